@@ -0,0 +1,424 @@
+"""
+Benchmark the throughput of the parsers and the QC modules.
+
+The corpora are generated from a fixed seed, so every run on every machine
+processes exactly the same data. This allows comparing Sequali versions on
+the same hardware. The corpora mimic the profiles of common data:
+
+  illumina_2x150    Paired end 2x150 reads with full range qualities, adapter
+                    read-through for short inserts and some duplicates.
+  novaseq_binned    Single end 151 bp reads with the four binned NovaSeq
+                    quality values.
+  ont_ultra_long    Ultra-long nanopore reads up to 1 Mbp with channel and
+                    start time metadata in the FASTQ header.
+  dorado_ubam       Unaligned BAM with dorado tags (ch, st, du) and nanopore
+                    read lengths.
+
+For each corpus the parsers and the add_record_array method of each module
+are timed separately. The best time of --repeats runs is reported as MB/s of
+FASTQ or BAM input and as reads/s. Use --json to store the results for
+comparison with later runs and --write-corpora to save the generated files
+so they can be used with the sequali command line as well.
+"""
+import argparse
+import io
+import json
+import math
+import os
+import platform
+import random
+import struct
+import sys
+import time
+from typing import Callable, Dict, Iterator, List, Optional, Tuple
+
+from sequali import __version__
+from sequali._qc import (AdapterCounter, BamParser, DedupEstimator,
+                         FastqParser, FastqRecordArrayView,
+                         InsertSizeMetrics, NanoStats, PerTileQuality,
+                         QCMetrics, QCPipeline, SequenceDuplication)
+from sequali.adapters import DEFAULT_ADAPTER_FILE, adapters_from_file
+
+SEED = 20240101
+NUCLEOTIDES = bytes.maketrans(bytes(range(256)), b"ACGT" * 64)
+COMPLEMENT = bytes.maketrans(b"ACGT", b"TGCA")
+ILLUMINA_ADAPTER_READ1 = b"AGATCGGAAGAGCACACGTCTGAACTCCAGTCA"
+ILLUMINA_ADAPTER_READ2 = b"AGATCGGAAGAGCGTCGTGTAGGGAAAGAGTGT"
+ILLUMINA_TILES = [surface * 1000 + swath * 100 + tile
+                  for surface in (1, 2) for swath in range(1, 7)
+                  for tile in range(1, 79)]
+
+
+def quality_table(weights: Dict[int, int]) -> bytes:
+    """
+    Return a translation table that maps random bytes to phred characters
+    with the given relative weights. The weights should sum to 256.
+    """
+    table = b"".join(bytes([phred + 33]) * weight
+                     for phred, weight in sorted(weights.items()))
+    assert len(table) == 256
+    return bytes.maketrans(bytes(range(256)), table)
+
+
+ILLUMINA_QUALITIES = quality_table(
+    {2: 4, 11: 4, 20: 8, 25: 12, 30: 20, 33: 28, 36: 52, 38: 64, 40: 64})
+NOVASEQ_QUALITIES = quality_table({2: 5, 12: 13, 23: 33, 37: 205})
+NANOPORE_QUALITIES = quality_table(
+    {3: 8, 6: 16, 9: 24, 12: 36, 15: 48, 18: 52, 21: 40, 25: 20, 30: 8,
+     40: 4})
+
+
+def random_bytes(rng: random.Random, length: int) -> bytes:
+    if length == 0:
+        return b""
+    return rng.getrandbits(length * 8).to_bytes(length, "little")
+
+
+def random_sequence(rng: random.Random, length: int) -> bytes:
+    return random_bytes(rng, length).translate(NUCLEOTIDES)
+
+
+def random_qualities(rng: random.Random, length: int, table: bytes) -> bytes:
+    return random_bytes(rng, length).translate(table)
+
+
+def reverse_complement(sequence: bytes) -> bytes:
+    return sequence.translate(COMPLEMENT)[::-1]
+
+
+def fastq_record(name: bytes, sequence: bytes, qualities: bytes) -> bytes:
+    return b"@" + name + b"\n" + sequence + b"\n+\n" + qualities + b"\n"
+
+
+def illumina_name(rng: random.Random, read_number: int, index: int) -> bytes:
+    tile = ILLUMINA_TILES[index % len(ILLUMINA_TILES)]
+    x = rng.randrange(1000, 32000)
+    y = rng.randrange(1000, 37000)
+    return (f"A00123:8:H7KKJDSXY:{index % 4 + 1}:{tile}:{x}:{y} "
+            f"{read_number}:N:0:ACGTACGT+TGCATGCA").encode("ascii")
+
+
+def illumina_2x150(rng: random.Random, scale: float) -> Tuple[bytes, bytes]:
+    number_of_pairs = int(200_000 * scale)
+    read_length = 150
+    fragments: List[bytes] = []
+    read1_records = []
+    read2_records = []
+    for i in range(number_of_pairs):
+        if fragments and rng.random() < 0.1:
+            fragment = rng.choice(fragments)
+        else:
+            insert_size = max(50, int(rng.gauss(250, 80)))
+            fragment = random_sequence(rng, insert_size)
+            if len(fragments) < 10_000:
+                fragments.append(fragment)
+        read1 = fragment + ILLUMINA_ADAPTER_READ1
+        read2 = reverse_complement(fragment) + ILLUMINA_ADAPTER_READ2
+        read1 = (read1 + random_sequence(rng, read_length))[:read_length]
+        read2 = (read2 + random_sequence(rng, read_length))[:read_length]
+        name1 = illumina_name(rng, 1, i)
+        name2 = name1[:-len(b"1:N:0:ACGTACGT+TGCATGCA")] + \
+            b"2:N:0:ACGTACGT+TGCATGCA"
+        read1_records.append(fastq_record(
+            name1, read1,
+            random_qualities(rng, read_length, ILLUMINA_QUALITIES)))
+        read2_records.append(fastq_record(
+            name2, read2,
+            random_qualities(rng, read_length, ILLUMINA_QUALITIES)))
+    return b"".join(read1_records), b"".join(read2_records)
+
+
+def novaseq_binned(rng: random.Random, scale: float) -> bytes:
+    number_of_reads = int(200_000 * scale)
+    read_length = 151
+    records = []
+    for i in range(number_of_reads):
+        records.append(fastq_record(
+            illumina_name(rng, 1, i),
+            random_sequence(rng, read_length),
+            random_qualities(rng, read_length, NOVASEQ_QUALITIES)))
+    return b"".join(records)
+
+
+def nanopore_lengths(rng: random.Random, total_bases: int, median: float,
+                     sigma: float, maximum: int) -> Iterator[int]:
+    bases = 0
+    while bases < total_bases:
+        length = min(maximum, max(1, int(rng.lognormvariate(math.log(median),
+                                                            sigma))))
+        bases += length
+        yield length
+
+
+def nanopore_start_time(rng: random.Random, read_index: int) -> str:
+    # Reads start over the course of a 72 hour run.
+    seconds = min(read_index * 7 + rng.randrange(7), 72 * 3600 - 1)
+    hours, remainder = divmod(seconds, 3600)
+    minutes, seconds = divmod(remainder, 60)
+    return f"2023-04-{24 + hours // 24:02}T{hours % 24:02}:{minutes:02}:" \
+           f"{seconds:02}"
+
+
+def ont_ultra_long(rng: random.Random, scale: float) -> bytes:
+    records = []
+    lengths = nanopore_lengths(rng, int(60_000_000 * scale), median=30_000,
+                               sigma=1.0, maximum=1_000_000)
+    for i, length in enumerate(lengths):
+        read_id = "%032x" % rng.getrandbits(128)
+        name = (f"{read_id[:8]}-{read_id[8:12]}-{read_id[12:16]}-"
+                f"{read_id[16:20]}-{read_id[20:]} "
+                f"runid=afee3a87585a5c58b78955ac2f01d681f6359a75 "
+                f"read={i} ch={rng.randrange(1, 3001)} "
+                f"start_time={nanopore_start_time(rng, i)}Z").encode("ascii")
+        records.append(fastq_record(
+            name, random_sequence(rng, length),
+            random_qualities(rng, length, NANOPORE_QUALITIES)))
+    return b"".join(records)
+
+
+BAM_HEADER_TEXT = (
+    b"@HD\tVN:1.6\tSO:unknown\n"
+    b"@PG\tID:basecaller\tPN:dorado\tVN:0.3.4+5f5cd02\n"
+    b"@RG\tID:afee3a87585a5c58b78955ac2f01d681f6359a75\tPL:ONT\n")
+BAM_NUCLEOTIDE_CODES = {ord(nuc): code for nuc, code in
+                        zip("ACGTN", (1, 2, 4, 8, 15))}
+
+
+def bam_encode_sequence(sequence: bytes) -> bytes:
+    if len(sequence) % 2:
+        sequence += b"N"
+    codes = BAM_NUCLEOTIDE_CODES
+    return bytes(codes[sequence[i]] << 4 | codes[sequence[i + 1]]
+                 for i in range(0, len(sequence), 2))
+
+
+def bam_record(name: bytes, sequence: bytes, qualities: bytes,
+               tags: bytes) -> bytes:
+    read_name = name + b"\0"
+    encoded_sequence = bam_encode_sequence(sequence)
+    phreds = bytes(quality - 33 for quality in qualities)
+    body = struct.pack(
+        "<iiBBHHHIiii", -1, -1, len(read_name), 255, 4680, 0, 4,
+        len(sequence), -1, -1, 0
+    ) + read_name + encoded_sequence + phreds + tags
+    return struct.pack("<I", len(body)) + body
+
+
+def dorado_ubam(rng: random.Random, scale: float) -> bytes:
+    parts = [b"BAM\1", struct.pack("<I", len(BAM_HEADER_TEXT)),
+             BAM_HEADER_TEXT, struct.pack("<I", 0)]
+    lengths = nanopore_lengths(rng, int(20_000_000 * scale), median=8_000,
+                               sigma=0.8, maximum=200_000)
+    for i, length in enumerate(lengths):
+        read_id = "%032x" % rng.getrandbits(128)
+        start_time = nanopore_start_time(rng, i) + ".308+00:00"
+        tags = (
+            b"qsi" + struct.pack("<i", rng.randrange(7, 25)) +
+            b"duf" + struct.pack("<f", length / 400) +
+            b"chi" + struct.pack("<i", rng.randrange(1, 3001)) +
+            b"stZ" + start_time.encode("ascii") + b"\0" +
+            b"RGZafee3a87585a5c58b78955ac2f01d681f6359a75\0"
+        )
+        parts.append(bam_record(
+            read_id.encode("ascii"), random_sequence(rng, length),
+            random_qualities(rng, length, NANOPORE_QUALITIES), tags))
+    return b"".join(parts)
+
+
+def best_time(function: Callable[[], None], repeats: int) -> float:
+    best = math.inf
+    for _ in range(repeats):
+        start = time.perf_counter()
+        function()
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def adapter_sequences(sequencing_technology: str) -> List[str]:
+    return [adapter.sequence for adapter in
+            adapters_from_file(DEFAULT_ADAPTER_FILE, sequencing_technology)]
+
+
+def single_end_modules(sequencing_technology: str
+                       ) -> Dict[str, Callable[[], object]]:
+    adapters = adapter_sequences(sequencing_technology)
+    return {
+        "QCMetrics": QCMetrics,
+        "PerTileQuality": PerTileQuality,
+        "SequenceDuplication": SequenceDuplication,
+        "NanoStats": NanoStats,
+        "AdapterCounter": lambda: AdapterCounter(adapters),
+        "DedupEstimator": DedupEstimator,
+    }
+
+
+def benchmark_modules(record_arrays: List[FastqRecordArrayView],
+                      sequencing_technology: str,
+                      repeats: int) -> Iterator[Tuple[str, float]]:
+    modules = single_end_modules(sequencing_technology)
+    for name, module_type in modules.items():
+        def run():
+            module = module_type()
+            for record_array in record_arrays:
+                module.add_record_array(record_array)  # type: ignore
+        yield f"{name}.add_record_array", best_time(run, repeats)
+
+    def run_pipeline():
+        pipeline = QCPipeline(
+            metrics=QCMetrics(),
+            per_tile_quality=PerTileQuality(),
+            sequence_duplication=SequenceDuplication(),
+            nanostats=NanoStats(),
+            adapter_counter=modules["AdapterCounter"](),
+            dedup_estimator=DedupEstimator(),
+        )
+        for record_array in record_arrays:
+            pipeline.add_record_array(record_array)
+    yield "QCPipeline.add_record_array", best_time(run_pipeline, repeats)
+
+
+def benchmark_pair_modules(record_arrays1: List[FastqRecordArrayView],
+                           record_arrays2: List[FastqRecordArrayView],
+                           repeats: int) -> Iterator[Tuple[str, float]]:
+    for module_type in (DedupEstimator, InsertSizeMetrics):
+        def run():
+            module = module_type()
+            for record_array1, record_array2 in zip(record_arrays1,
+                                                    record_arrays2):
+                module.add_record_array_pair(record_array1, record_array2)
+        yield (f"{module_type.__name__}.add_record_array_pair",
+               best_time(run, repeats))
+
+
+def parse_fastq(data: bytes) -> List[FastqRecordArrayView]:
+    return list(FastqParser(io.BytesIO(data)))
+
+
+def parse_bam(data: bytes) -> List[FastqRecordArrayView]:
+    return list(BamParser(io.BytesIO(data)))
+
+
+def result(corpus: str, benchmark: str, seconds: float, input_size: int,
+           number_of_reads: int) -> Dict[str, object]:
+    return dict(
+        corpus=corpus,
+        benchmark=benchmark,
+        seconds=seconds,
+        megabytes_per_second=input_size / seconds / 1_000_000,
+        reads_per_second=number_of_reads / seconds,
+    )
+
+
+def benchmark_corpus(corpus: str, data: bytes, repeats: int,
+                     data_reverse: Optional[bytes] = None,
+                     ) -> Iterator[Dict[str, object]]:
+    is_bam = data.startswith(b"BAM\1")
+    sequencing_technology = "nanopore" if corpus.startswith(
+        ("ont", "dorado")) else "illumina"
+    parser = parse_bam if is_bam else parse_fastq
+    record_arrays = parser(data)
+    number_of_reads = sum(len(record_array) for record_array in record_arrays)
+    if is_bam:
+        yield result(corpus, "BamParser", best_time(lambda: parse_bam(data),
+                                                    repeats),
+                     len(data), number_of_reads)
+    else:
+        yield result(corpus, "FastqParser",
+                     best_time(lambda: parse_fastq(data), repeats),
+                     len(data), number_of_reads)
+        # Uncompressed files are memory mapped by sequali.
+        yield result(corpus, "FastqParser (mapped)",
+                     best_time(lambda: list(FastqParser(data)), repeats),
+                     len(data), number_of_reads)
+    for benchmark, seconds in benchmark_modules(
+            record_arrays, sequencing_technology, repeats):
+        yield result(corpus, benchmark, seconds, len(data), number_of_reads)
+    if data_reverse is not None:
+        # Pair the record arrays the same way sequali does.
+        reverse_parser = FastqParser(io.BytesIO(data_reverse))
+        record_arrays2 = [reverse_parser.read(len(record_array))
+                          for record_array in record_arrays]
+        for benchmark, seconds in benchmark_pair_modules(
+                record_arrays, record_arrays2, repeats):
+            yield result(corpus, benchmark, seconds,
+                         len(data) + len(data_reverse), number_of_reads)
+
+
+CORPORA = {
+    "illumina_2x150": illumina_2x150,
+    "novaseq_binned": novaseq_binned,
+    "ont_ultra_long": ont_ultra_long,
+    "dorado_ubam": dorado_ubam,
+}
+
+
+def argument_parser() -> argparse.ArgumentParser:
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("corpora", nargs="*", metavar="CORPUS",
+                        help=f"Corpora to benchmark. Choose from "
+                             f"{', '.join(CORPORA)}. Default: all.")
+    parser.add_argument("--scale", type=float, default=1.0,
+                        help="Multiply the size of the corpora. The default "
+                             "corpora contain 20-60 million bases each.")
+    parser.add_argument("--repeats", type=int, default=3,
+                        help="Report the best time of this many runs. "
+                             "Default: 3.")
+    parser.add_argument("--json", metavar="JSON",
+                        help="Write the results to this JSON file.")
+    parser.add_argument("--write-corpora", metavar="DIR",
+                        help="Write the generated corpora to DIR.")
+    return parser
+
+
+def main():
+    parser = argument_parser()
+    args = parser.parse_args()
+    corpora = args.corpora or list(CORPORA)
+    for corpus in corpora:
+        if corpus not in CORPORA:
+            parser.error(f"Unknown corpus: {corpus}")
+    results = []
+    print(f"{'corpus':<16}{'benchmark':<42}{'MB/s':>10}{'reads/s':>14}",
+          file=sys.stderr)
+    for corpus in corpora:
+        # Each corpus gets its own seed so they do not depend on each other.
+        rng = random.Random(f"{SEED}-{corpus}")
+        data = CORPORA[corpus](rng, args.scale)
+        data_reverse = None
+        if isinstance(data, tuple):
+            data, data_reverse = data
+        if args.write_corpora:
+            os.makedirs(args.write_corpora, exist_ok=True)
+            paths = [(corpus + ("_R1" if data_reverse else ""), data),
+                     (corpus + "_R2", data_reverse)]
+            for name, contents in paths:
+                if contents is None:
+                    continue
+                suffix = ".bam" if contents.startswith(b"BAM\1") else ".fastq"
+                with open(os.path.join(args.write_corpora, name + suffix),
+                          "wb") as output:
+                    output.write(contents)
+        for entry in benchmark_corpus(corpus, data, args.repeats,
+                                      data_reverse):
+            results.append(entry)
+            print(f"{entry['corpus']:<16}{entry['benchmark']:<42}"
+                  f"{entry['megabytes_per_second']:>10.1f}"
+                  f"{entry['reads_per_second']:>14,.0f}", file=sys.stderr)
+    if args.json:
+        with open(args.json, "wt") as json_file:
+            json.dump(dict(
+                sequali_version=__version__,
+                python_version=platform.python_version(),
+                platform=platform.platform(),
+                processor=platform.processor() or platform.machine(),
+                cpu_count=os.cpu_count(),
+                scale=args.scale,
+                repeats=args.repeats,
+                results=results,
+            ), json_file, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -15,15 +15,19 @@
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
 import argparse
+import concurrent.futures
 import contextlib
+import functools
 import json
 import os
 import sys
+import time
+from typing import Dict, Iterable, Iterator, List, Optional, Union
 
 
 from ._qc import (
-    AdapterCounter,
     DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS,
+    DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS,
     DEFAULT_FINGERPRINT_BACK_SEQUENCE_LENGTH,
     DEFAULT_FINGERPRINT_BACK_SEQUENCE_OFFSET,
     DEFAULT_FINGERPRINT_FRONT_SEQUENCE_LENGTH,
@@ -31,23 +35,39 @@ from ._qc import (
     DEFAULT_FRAGMENT_LENGTH,
     DEFAULT_MAX_UNIQUE_FRAGMENTS,
     DEFAULT_UNIQUE_SAMPLE_EVERY,
-    DedupEstimator,
-    InsertSizeMetrics,
-    NanoStats,
-    PerTileQuality,
-    QCMetrics,
-    SequenceDuplication
 )
 from ._version import __version__
-from .adapters import DEFAULT_ADAPTER_FILE, adapters_from_file
+from .adapters import Adapter, DEFAULT_ADAPTER_FILE, adapters_from_file
+from .pipeline import (Collectors, ConvergenceMonitor, ThreadedPipeline,
+                       plan_memory, read_state_file, write_state_file)
 from .report_modules import (calculate_stats, dict_to_report_modules,
                              report_modules_to_dict, write_html_report)
-from .util import NGSFile, sequence_names_match
+from .sequence_identification import create_default_sequence_index
+from .util import NGSFile, PairedReader, StrideSampler
 
 DEFAULT_FINGERPRINT_BACK_SEQUENCE_PAIRED_OFFSET = 0
 DEFAULT_FINGERPRINT_FRONT_SEQUENCE_PAIRED_OFFSET = 0
 
 
+@functools.lru_cache
+def cached_adapters_from_file(adapter_file: str,
+                              sequencing_technology: Optional[str]
+                              ) -> List[Adapter]:
+    # Batch mode reads the adapter file only once for all samples.
+    return list(adapters_from_file(adapter_file, sequencing_technology))
+
+
+def memory_size(size: str) -> int:
+    """Parse a size in bytes with an optional K, M or G suffix."""
+    multipliers = {"K": 1024, "M": 1024 ** 2, "G": 1024 ** 3}
+    multiplier = multipliers.get(size[-1:].upper(), 1)
+    number = size[:-1] if multiplier != 1 else size
+    try:
+        return int(float(number) * multiplier)
+    except ValueError:
+        raise argparse.ArgumentTypeError(f"Invalid memory size: {size}")
+
+
 def argument_parser() -> argparse.ArgumentParser:
     parser = argparse.ArgumentParser(
         description="Create a quality metrics report for sequencing data.")
@@ -63,6 +83,13 @@ def argument_parser() -> argparse.ArgumentParser:
                         help="JSON output file. default: '<input>.json'.")
     parser.add_argument("--html",
                         help="HTML output file. default: '<input>.html'.")
+    parser.add_argument("--lazy-plots", action="store_true",
+                        help="Write plots larger than 64 KiB as SVG files "
+                             "to a directory next to the HTML report, named "
+                             "after it with a _plots suffix. The browser "
+                             "loads them when they are scrolled into view, "
+                             "so large reports open quickly. These plots "
+                             "have no tooltips.")
     parser.add_argument("--outdir", "--dir", metavar="OUTDIR",
                         help="Output directory for the report files. default: "
                              "current working directory.",
@@ -98,7 +125,6 @@ def argument_parser() -> argparse.ArgumentParser:
     parser.add_argument("--overrepresentation-max-unique-fragments",
                         type=int,
                         metavar="N",
-                        default=DEFAULT_MAX_UNIQUE_FRAGMENTS,
                         help=f"The maximum amount of unique fragments to "
                              f"store. Larger amounts increase the sensitivity "
                              f"of finding overrepresented sequences at the "
@@ -110,7 +136,6 @@ def argument_parser() -> argparse.ArgumentParser:
                         help=f"The length of the fragments to sample. The "
                              f"maximum is 31. Default: {DEFAULT_FRAGMENT_LENGTH}.")
     parser.add_argument("--overrepresentation-sample-every", type=int,
-                        default=DEFAULT_UNIQUE_SAMPLE_EVERY,
                         metavar="DIVISOR",
                         help=f"How often a read should be sampled. "
                              f"More samples leads to better precision, "
@@ -120,13 +145,20 @@ def argument_parser() -> argparse.ArgumentParser:
                              f"beginning. "
                              f"Default: 1 in {DEFAULT_UNIQUE_SAMPLE_EVERY}.")
     parser.add_argument("--duplication-max-stored-fingerprints", type=int,
-                        default=DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS,
                         metavar="N",
                         help=f"Determines how many fingerprints are maximally "
                              f"stored to estimate the duplication rate. "
                              f"More fingerprints leads to a more accurate "
                              f"estimate, but also more memory usage. "
-                             f"Default: {DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS:,}.")
+                             f"Default: {DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS:,}, "
+                             f"or {DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS:,} "
+                             f"with --duplication-sketch.")
+    parser.add_argument("--duplication-sketch", action="store_true",
+                        help="Estimate the duplication rate with a fixed "
+                             "memory sketch. The stored fingerprints are "
+                             "never subsampled again, which avoids pauses on "
+                             "very large datasets. The number of distinct "
+                             "fingerprints is estimated with HyperLogLog.")
     parser.add_argument("--fingerprint-front-length", type=int,
                         default=DEFAULT_FINGERPRINT_FRONT_SEQUENCE_LENGTH,
                         metavar="LENGTH",
@@ -162,8 +194,47 @@ def argument_parser() -> argparse.ArgumentParser:
                              f"for paired sequences.")
     parser.add_argument("-t", "--threads", type=int, default=2,
                         help="Number of threads to use. If greater than one "
-                             "an additional thread for gzip "
-                             "decompression will be used. Default: 2.")
+                             "an additional thread for gzip decompression "
+                             "and a thread that reads ahead in the input "
+                             "file will be used and the reads are processed "
+                             "by THREADS - 1 worker threads while the main "
+                             "thread parses the input. Memory usage of the "
+                             "overrepresented sequences and duplication "
+                             "modules scales with the number of "
+                             "worker threads. Default: 2.")
+    parser.add_argument("--max-memory", type=memory_size, metavar="SIZE",
+                        help="Limit the memory used by the overrepresented "
+                             "sequences and duplication tables of all "
+                             "worker threads, so that the total use stays "
+                             "within SIZE. A quarter, and at least 128M, is "
+                             "kept for the rest of the program. When the "
+                             "tables have to be smaller than the default, "
+                             "reads are sampled less often for "
+                             "overrepresented sequences. Options that set "
+                             "the table sizes explicitly take precedence. "
+                             "SIZE can have a K, M or G suffix. "
+                             "Default: no limit.")
+    parser.add_argument("--estimate", type=float, metavar="TOLERANCE",
+                        help="Stop reading once the GC content, quality and "
+                             "adapter distributions are known within "
+                             "TOLERANCE, for instance 0.01. Uncompressed "
+                             "FASTQ and BGZF compressed single-end files "
+                             "are sampled at offsets spread over the whole "
+                             "file, other input is read from the start. "
+                             "The report is marked as an estimate. The "
+                             "reads are processed by a single worker.")
+    parser.add_argument("--state", metavar="STATE_FILE",
+                        help="Also write the gathered data to STATE_FILE. "
+                             "State files of runs on parts of the data can "
+                             "be combined into one report with "
+                             "sequali-merge.")
+    parser.add_argument("--profile", action="store_true",
+                        help="Write performance counters of the parsers and "
+                             "the QC modules, such as the time spent and "
+                             "the hash table use, to a JSON file in OUTDIR "
+                             "named after INPUT with a .profile.json "
+                             "suffix. The module times are summed over "
+                             "the worker threads.")
     parser.add_argument("--version", action="version",
                         version=__version__)
     # Option to skip report creation and only run the module data gathering.
@@ -174,7 +245,14 @@ def argument_parser() -> argparse.ArgumentParser:
 
 
 def main() -> None:
-    args = argument_parser().parse_args()
+    run_sequali(argument_parser().parse_args())
+
+
+def run_sequali(args: argparse.Namespace, progress: bool = True) -> None:
+    """
+    Create the reports for the inputs in args, as parsed by the
+    argument_parser.
+    """
     threads = args.threads
     if threads < 1:
         raise ValueError(f"Threads must be greater than 1, got {threads}.")
@@ -185,14 +263,27 @@ def main() -> None:
     min_threshold = min(args.overrepresentation_min_threshold, max_threshold)
     paired = bool(args.input_reverse)
 
-    metrics1 = QCMetrics()
-    per_tile_quality1 = PerTileQuality()
-    nanostats1 = NanoStats()
-    sequence_duplication1 = SequenceDuplication(
-        max_unique_fragments=args.overrepresentation_max_unique_fragments,
-        fragment_length=args.overrepresentation_fragment_length,
-        sample_every=args.overrepresentation_sample_every
-    )
+    if args.max_memory is not None:
+        plan = plan_memory(args.max_memory, max(threads - 1, 1), paired,
+                           args.duplication_sketch)
+        if args.overrepresentation_max_unique_fragments is None:
+            args.overrepresentation_max_unique_fragments = (
+                plan.max_unique_fragments)
+            if args.overrepresentation_sample_every is None:
+                args.overrepresentation_sample_every = plan.sample_every
+        if args.duplication_max_stored_fingerprints is None:
+            args.duplication_max_stored_fingerprints = (
+                plan.max_stored_fingerprints)
+    if args.overrepresentation_max_unique_fragments is None:
+        args.overrepresentation_max_unique_fragments = (
+            DEFAULT_MAX_UNIQUE_FRAGMENTS)
+    if args.overrepresentation_sample_every is None:
+        args.overrepresentation_sample_every = DEFAULT_UNIQUE_SAMPLE_EVERY
+    if args.duplication_max_stored_fingerprints is None:
+        args.duplication_max_stored_fingerprints = (
+            DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS if args.duplication_sketch
+            else DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS)
+
     if paired:
         if args.fingerprint_front_offset is None:
             args.fingerprint_front_offset = (
@@ -207,35 +298,38 @@ def main() -> None:
         if args.fingerprint_back_offset is None:
             args.fingerprint_back_offset = (
                 DEFAULT_FINGERPRINT_BACK_SEQUENCE_PAIRED_OFFSET)
-    dedup_estimator = DedupEstimator(
-        max_stored_fingerprints=args.duplication_max_stored_fingerprints,
-        front_sequence_length=args.fingerprint_front_length,
-        front_sequence_offset=args.fingerprint_front_offset,
-        back_sequence_length=args.fingerprint_back_length,
-        back_sequence_offset=args.fingerprint_back_offset,
-    )
 
-    if paired:
-        insert_size_metrics = InsertSizeMetrics()
-        metrics2 = QCMetrics()
-        per_tile_quality2 = PerTileQuality()
-        sequence_duplication2 = SequenceDuplication(
-            max_unique_fragments=args.overrepresentation_max_unique_fragments,
-            fragment_length=args.overrepresentation_fragment_length,
-            sample_every=args.overrepresentation_sample_every
-        )
-    else:
-        metrics2 = None
-        per_tile_quality2 = None
-        sequence_duplication2 = None
-        insert_size_metrics = None
+    monitor: Optional[ConvergenceMonitor] = None
+    if args.estimate is not None:
+        try:
+            monitor = ConvergenceMonitor(args.estimate)
+        except ValueError as error:
+            raise SystemExit(f"--estimate: {error}")
+    processing_start = time.perf_counter()
     with contextlib.ExitStack() as exit_stack:
-        reader1 = NGSFile(args.input, threads - 1)
+        sampler: Optional[StrideSampler] = None
+        if monitor is not None and not paired:
+            try:
+                sampler = StrideSampler(args.input)
+            except ValueError:
+                # Not seekable, stop early while reading from the start.
+                pass
+        if sampler is not None:
+            exit_stack.enter_context(sampler)
+            # Only used for the sequencing technology.
+            reader1 = NGSFile(args.input, 0, read_ahead=False,
+                              progress=False)
+        else:
+            reader1 = NGSFile(args.input, threads - 1,
+                              read_ahead=threads > 1, progress=progress)
         exit_stack.enter_context(reader1)
+        reader1.reader.profiling = args.profile
         seqtech = reader1.sequencing_technology
         if paired:
-            reader2 = NGSFile(args.input_reverse, threads - 1)
+            reader2 = NGSFile(args.input_reverse, threads - 1,
+                              read_ahead=threads > 1, progress=progress)
             exit_stack.enter_context(reader2)
+            reader2.reader.profiling = args.profile
             if reader1.sequencing_technology != reader2.sequencing_technology:
                 raise RuntimeError(
                     f"Mismatching sequencing technologies:\n"
@@ -245,76 +339,270 @@ def main() -> None:
                 raise RuntimeError("Paired end mode is only supported for "
                                    "FASTQ files.")
             seqtech = "illumina"  # Paired end is always illumina
-            adapter_counter1 = None
-        adapters = list(adapters_from_file(args.adapter_file, seqtech))
-        if not paired:
-            adapter_counter1 = AdapterCounter(
-                adapter.sequence for adapter in adapters)
-        for record_array1 in reader1:
-            metrics1.add_record_array(record_array1)
-            per_tile_quality1.add_record_array(record_array1)
-            sequence_duplication1.add_record_array(record_array1)
-            nanostats1.add_record_array(record_array1)
-            if paired:
-                record_array2 = reader2.read(len(record_array1))
-                if len(record_array1) != len(record_array2):
-                    raise RuntimeError(
-                        f"FASTQ Files out of sync {args.input} has more "
-                        f"FASTQ records than {args.input_reverse}.")
-                if not (record_array1.is_mate(record_array2)):
-                    for r1, r2 in zip(iter(record_array1),
-                                      iter(record_array2)):
-                        if not sequence_names_match(r1.name(),
-                                                    r2.name()):
-                            raise RuntimeError(
-                                f"Mismatching names found! {r1.name()} "
-                                f"{r2.name()}")
-                    raise RuntimeError("Mismatching names found!")
-                dedup_estimator.add_record_array_pair(record_array1, record_array2)
-                insert_size_metrics.add_record_array_pair(record_array1, record_array2)  # type: ignore  # noqa: E501
-                metrics2.add_record_array(record_array2)  # type: ignore  # noqa: E501
-                per_tile_quality2.add_record_array(record_array2)  # type: ignore  # noqa: E501
-                sequence_duplication2.add_record_array(record_array2)  # type: ignore  # noqa: E501
-            else:
-                adapter_counter1.add_record_array(record_array1)   # type: ignore  # noqa: E501
-                dedup_estimator.add_record_array(record_array1)
-        if paired and len(reader2.read(1)) > 0:
-            raise RuntimeError(
-                f"FASTQ Files out of sync {args.input_reverse} has "
-                f"more FASTQ records than {args.input}.")
-    if args.no_report:
-        return
+        adapters = cached_adapters_from_file(args.adapter_file, seqtech)
+
+        def collectors_factory() -> Collectors:
+            return Collectors(
+                [adapter.sequence for adapter in adapters],
+                paired,
+                max_unique_fragments=(
+                    args.overrepresentation_max_unique_fragments),
+                fragment_length=args.overrepresentation_fragment_length,
+                sample_every=args.overrepresentation_sample_every,
+                max_stored_fingerprints=(
+                    args.duplication_max_stored_fingerprints),
+                duplication_sketch=args.duplication_sketch,
+                front_sequence_length=args.fingerprint_front_length,
+                front_sequence_offset=args.fingerprint_front_offset,
+                back_sequence_length=args.fingerprint_back_length,
+                back_sequence_offset=args.fingerprint_back_offset,
+                profiling=args.profile,
+            )
+
+        pipeline: Union[Collectors, ThreadedPipeline]
+        if threads > 1 and monitor is None:
+            pipeline = ThreadedPipeline(collectors_factory, threads - 1)
+            exit_stack.enter_context(pipeline)
+        else:
+            # The monitor inspects the metrics in between record arrays.
+            pipeline = collectors_factory()
+
+        def estimate_converged() -> bool:
+            return (monitor is not None and
+                    isinstance(pipeline, Collectors) and
+                    monitor.converged(pipeline))
+
+        stopped_early = False
+        if paired:
+            paired_reader = PairedReader(reader1, reader2,
+                                         threaded=threads > 1)
+            exit_stack.enter_context(paired_reader)
+            for record_array1, record_array2 in paired_reader:
+                pipeline.add_record_array_pair(record_array1, record_array2)
+                if estimate_converged():
+                    stopped_early = True
+                    break
+        else:
+            record_arrays: Iterable = reader1 if sampler is None else sampler
+            for record_array1 in record_arrays:
+                pipeline.add_record_array(record_array1)
+                if estimate_converged():
+                    stopped_early = True
+                    break
+        estimated = stopped_early or sampler is not None
+        sampled_fraction: Optional[float] = None
+        if sampler is not None:
+            sampled_fraction = min(
+                sampler.sampled_bytes / max(sampler.file_size, 1), 1.0)
+        elif stopped_early:
+            sampled_fraction = reader1.progress.fraction_read()
+        collectors = pipeline.finish()
+        # Gathered before the readers are closed, which releases the parsers.
+        parser_profiles = {"input": reader1.reader.profile()}
+        if paired:
+            parser_profiles["input_reverse"] = reader2.reader.profile()
+    processing_seconds = time.perf_counter() - processing_start
+    if args.state:
+        write_state_file(args.state, collectors, dict(
+            filename=args.input,
+            filename_reverse=args.input_reverse,
+            adapters=[list(adapter) for adapter in adapters],
+            fraction_threshold=fraction_threshold,
+            min_threshold=min_threshold,
+            max_threshold=max_threshold,
+        ))
+    report_seconds = None
+    if not args.no_report:
+        report_start = time.perf_counter()
+        write_reports(collectors, args.input, args.input_reverse, adapters,
+                      fraction_threshold, min_threshold, max_threshold,
+                      args.outdir, args.json, args.html, threads,
+                      estimated, sampled_fraction, args.lazy_plots)
+        report_seconds = time.perf_counter() - report_start
+    if args.profile:
+        profile = dict(
+            threads=threads,
+            processing_seconds=processing_seconds,
+            report_seconds=report_seconds,
+            parsers=parser_profiles,
+            modules=collectors.profile(),
+        )
+        os.makedirs(args.outdir, exist_ok=True)
+        profile_path = os.path.join(
+            args.outdir, os.path.basename(args.input) + ".profile.json")
+        with open(profile_path, "wt") as profile_file:
+            json.dump(profile, profile_file, indent=2)
+
+
+def write_reports(collectors: Collectors,
+                  filename: str,
+                  filename_reverse: Optional[str],
+                  adapters: List[Adapter],
+                  fraction_threshold: float,
+                  min_threshold: int,
+                  max_threshold: int,
+                  outdir: str,
+                  json_path: Optional[str] = None,
+                  html_path: Optional[str] = None,
+                  threads: int = 1,
+                  estimated: bool = False,
+                  sampled_fraction: Optional[float] = None,
+                  lazy_plots: bool = False):
     report_modules = calculate_stats(
-        filename=args.input,
-        metrics=metrics1,
-        adapter_counter=adapter_counter1,
-        per_tile_quality=per_tile_quality1,
-        sequence_duplication=sequence_duplication1,
-        dedup_estimator=dedup_estimator,
-        nanostats=nanostats1,
-        insert_size_metrics=insert_size_metrics,
-        filename_reverse=args.input_reverse,
-        metrics_reverse=metrics2,
-        per_tile_quality_reverse=per_tile_quality2,
-        sequence_duplication_reverse=sequence_duplication2,
+        filename=filename,
+        metrics=collectors.metrics,
+        adapter_counter=collectors.adapter_counter,
+        per_tile_quality=collectors.per_tile_quality,
+        sequence_duplication=collectors.sequence_duplication,
+        dedup_estimator=collectors.dedup_estimator,
+        nanostats=collectors.nanostats,
+        insert_size_metrics=collectors.insert_size_metrics,
+        filename_reverse=filename_reverse,
+        metrics_reverse=collectors.metrics_reverse,
+        per_tile_quality_reverse=collectors.per_tile_quality_reverse,
+        sequence_duplication_reverse=collectors.sequence_duplication_reverse,
         adapters=adapters,
         fraction_threshold=fraction_threshold,
         min_threshold=min_threshold,
-        max_threshold=max_threshold)
-    os.makedirs(args.outdir, exist_ok=True)
-    if args.json is None:
-        args.json = os.path.basename(args.input) + ".json"
-    if args.html is None:
-        args.html = os.path.basename(args.input) + ".html"
-    if not os.path.isabs(args.json):
-        args.json = os.path.join(args.outdir, args.json)
-    if not os.path.isabs(args.html):
-        args.html = os.path.join(args.outdir, args.html)
-    with open(args.json, "wt") as json_file:
+        max_threshold=max_threshold,
+        threads=threads,
+        estimated=estimated,
+        sampled_fraction=sampled_fraction)
+    os.makedirs(outdir, exist_ok=True)
+    if json_path is None:
+        json_path = os.path.basename(filename) + ".json"
+    if html_path is None:
+        html_path = os.path.basename(filename) + ".html"
+    if not os.path.isabs(json_path):
+        json_path = os.path.join(outdir, json_path)
+    if not os.path.isabs(html_path):
+        html_path = os.path.join(outdir, html_path)
+    with open(json_path, "wt") as json_file:
         json_dict = report_modules_to_dict(report_modules)
         # Indent=0 is ~40% smaller than indent=2 while still human-readable
         json.dump(json_dict, json_file, indent=0)
-    write_html_report(report_modules, args.html)
+    write_html_report(report_modules, html_path, threads,
+                      lazy_plots=lazy_plots)
+
+
+def merge_argument_parser() -> argparse.ArgumentParser:
+    parser = argparse.ArgumentParser(
+        description="Combine state files created with sequali --state on "
+                    "parts of the data into one report.")
+    parser.add_argument("states", metavar="STATE_FILE", nargs="+",
+                        help="State files created with sequali --state. "
+                             "These should be created with the same "
+                             "settings.")
+    parser.add_argument("--name",
+                        help="Name of the data used in the report and the "
+                             "default output names. Default: the input "
+                             "filename of the first state file.")
+    parser.add_argument("--json",
+                        help="JSON output file. default: '<name>.json'.")
+    parser.add_argument("--html",
+                        help="HTML output file. default: '<name>.html'.")
+    parser.add_argument("--outdir", "--dir", metavar="OUTDIR",
+                        help="Output directory for the report files. default: "
+                             "current working directory.",
+                        default=os.getcwd())
+    return parser
+
+
+def sequali_merge():
+    args = merge_argument_parser().parse_args()
+    collectors, metadata = read_state_file(args.states[0])
+    for state in args.states[1:]:
+        other, _ = read_state_file(state)
+        if other.paired != collectors.paired:
+            raise ValueError(f"Can not merge paired and single end state "
+                             f"files: {args.states[0]} and {state}.")
+        collectors.merge(other)
+    adapters = [Adapter(*adapter) for adapter in metadata["adapters"]]
+    write_reports(collectors,
+                  args.name or metadata["filename"],
+                  metadata["filename_reverse"],
+                  adapters,
+                  metadata["fraction_threshold"],
+                  metadata["min_threshold"],
+                  metadata["max_threshold"],
+                  args.outdir, args.json, args.html)
+
+
+def batch_argument_parser() -> argparse.ArgumentParser:
+    parser = argparse.ArgumentParser(
+        description="Create quality metrics reports for many samples in one "
+                    "process. The adapters and the contaminant index are "
+                    "loaded once and the samples are processed "
+                    "concurrently.")
+    parser.add_argument("sample_sheet", metavar="SAMPLE_SHEET",
+                        help="Tab-separated file with one sample per line: "
+                             "INPUT and optionally INPUT_REVERSE. Empty "
+                             "lines and lines starting with '#' are "
+                             "ignored. Use '-' to read the samples from "
+                             "stdin. Samples are started as soon as their "
+                             "line is read, so a long-running process can "
+                             "be fed through a pipe.")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1,
+                        help="Number of samples to process concurrently. "
+                             "Default: the number of CPUs.")
+    parser.add_argument("options", metavar="SEQUALI_OPTIONS",
+                        nargs=argparse.REMAINDER,
+                        help="Options for sequali that are applied to every "
+                             "sample, for instance --outdir. --json, --html "
+                             "and --state can not be used as every sample "
+                             "writes its own files. The samples use one "
+                             "thread each unless --threads is given.")
+    return parser
+
+
+def read_sample_sheet(sample_sheet: str) -> Iterator[List[str]]:
+    with contextlib.ExitStack() as exit_stack:
+        if sample_sheet == "-":
+            lines: Iterable[str] = sys.stdin
+        else:
+            lines = exit_stack.enter_context(open(sample_sheet, "rt"))
+        for line_number, line in enumerate(lines, start=1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            inputs = line.split("\t")
+            if len(inputs) > 2:
+                raise ValueError(
+                    f"Sample sheet {sample_sheet} line {line_number} has "
+                    f"{len(inputs)} columns, expected 1 or 2.")
+            yield inputs
+
+
+def sequali_batch():
+    parser = batch_argument_parser()
+    args = parser.parse_args()
+    if args.jobs < 1:
+        parser.error(f"jobs must be at least 1, got {args.jobs}.")
+    for option in args.options:
+        if option.split("=")[0] in ("--json", "--html", "--state"):
+            parser.error(f"{option} can not be used in batch mode.")
+    sample_options = ["--threads", "1"] + args.options
+    # Check the options before samples are started.
+    sample_parser = argument_parser()
+    sample_args = sample_parser.parse_args(sample_options + ["input"])
+    if not sample_args.no_report:
+        # Cached, so all samples share the same index.
+        create_default_sequence_index()
+    futures: Dict[concurrent.futures.Future, str] = {}
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as executor:
+        for inputs in read_sample_sheet(args.sample_sheet):
+            sample_args = sample_parser.parse_args(sample_options + inputs)
+            future = executor.submit(run_sequali, sample_args, progress=False)
+            futures[future] = inputs[0]
+        failed = 0
+        for future in concurrent.futures.as_completed(futures):
+            error = future.exception()
+            if error is not None:
+                failed += 1
+                print(f"{futures[future]}: {type(error).__name__}: {error}",
+                      file=sys.stderr)
+    if failed:
+        raise SystemExit(f"{failed} of {len(futures)} samples failed.")
 
 
 if __name__ == "__main__":  # pragma: no cover
@@ -326,6 +614,20 @@ def sequali_report():
     parser.add_argument("json", metavar="JSON", help="Sequali JSON file")
     parser.add_argument("-o", "--html", help="Output html file default: "
                                              "<input>.html")
+    parser.add_argument("-t", "--threads", type=int, default=1,
+                        help="Render the report modules on this many "
+                             "processes. Default: 1.")
+    parser.add_argument("--cache-dir", metavar="DIR",
+                        help="Store the rendered report modules in DIR. "
+                             "Modules with the same data are read from DIR "
+                             "instead of being rendered again.")
+    parser.add_argument("--lazy-plots", action="store_true",
+                        help="Write plots larger than 64 KiB as SVG files "
+                             "to a directory next to the HTML report, named "
+                             "after it with a _plots suffix. The browser "
+                             "loads them when they are scrolled into view, "
+                             "so large reports open quickly. These plots "
+                             "have no tooltips.")
     args = parser.parse_args()
     output = args.html
     in_json = args.json
@@ -334,4 +636,5 @@ def sequali_report():
         output = ".".join(in_json.split(".")[:-1]) + ".html"
     with open(in_json) as j:
         json_data = json.load(j)
-    write_html_report(dict_to_report_modules(json_data), output)
+    write_html_report(dict_to_report_modules(json_data), output,
+                      args.threads, args.cache_dir, args.lazy_plots)
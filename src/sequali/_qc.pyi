@@ -16,7 +16,8 @@
 
 import array
 import sys
-from typing import Dict, Iterable, Iterator, List, SupportsIndex, Optional, Tuple
+from typing import (Dict, Iterable, List, SupportsIndex, Optional, Sequence,
+                    Tuple, Union)
 
 TABLE_SIZE: int
 NUMBER_OF_PHREDS: int
@@ -28,10 +29,15 @@ G: int
 T: int 
 N: int 
 MAX_SEQUENCE_SIZE: int
+DEFAULT_EXACT_POSITIONS: int
 DEFAULT_MAX_UNIQUE_FRAGMENTS: int
 DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS: int
+DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS: int
 DEFAULT_FRAGMENT_LENGTH: int
 DEFAULT_UNIQUE_SAMPLE_EVERY: int
+FRAGMENT_BUCKET_SLOTS: int
+FRAGMENT_BUCKET_SIZE: int
+DEDUP_ESTIMATOR_ENTRY_SIZE: int
 DEFAULT_FINGERPRINT_FRONT_SEQUENCE_LENGTH: int
 DEFAULT_FINGERPRINT_BACK_SEQUENCE_LENGTH: int
 DEFAULT_FINGERPRINT_FRONT_SEQUENCE_OFFSET: int
@@ -40,68 +46,105 @@ INSERT_SIZE_MAX_ADAPTER_STORE_SIZE: int
 
 
 class FastqRecordView:
-    obj: bytes
+    obj: Union[bytes, bytearray]
     def __init__(self, __name, __sequence, __qualities) -> None: ...
     def name(self) -> str: ...
     def sequence(self) -> str: ...
     def qualities(self) -> str: ...
 
 class FastqRecordArrayView:
-    obj: bytes
+    obj: Union[bytes, bytearray, memoryview]
     def __init__(self, view_items: Iterable[FastqRecordView]) -> None: ...
     def __getitem__(self, index: SupportsIndex) -> FastqRecordView: ...
     def __len__(self) -> int: ...
     def is_mate(self, other: FastqRecordArrayView): ...
 
 class FastqParser:
+    profiling: bool
     def __init__(self, fileobj, initial_buffersize = 128 * 1024): ...
     def __iter__(self) -> FastqParser: ...
     def __next__(self) -> FastqRecordArrayView: ...
     def read(self, number_of_records: int) -> FastqRecordArrayView: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
 
 class BamParser:
     header: bytes
+    profiling: bool
     def __init__(self, fileobj, initial_buffersize = 96 * 1024): ...
     def __iter__(self) -> BamParser: ...
     def __next__(self) -> FastqRecordArrayView: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
 
 class QCMetrics:
     number_of_reads: int
     max_length: int
-    def __init__(self): ...
+    exact_positions: int
+    profiling: bool
+    def __init__(self, exact_positions: int = DEFAULT_EXACT_POSITIONS): ...
     def add_read(self, __read: FastqRecordView) -> None: ...
     def add_record_array(self, __record_array: FastqRecordArrayView) -> None: ...
-    def base_count_table(self) -> array.ArrayType: ...
-    def phred_count_table(self) -> array.ArrayType: ...
+    def base_count_table(
+        self, ranges: Optional[Sequence[Tuple[int, int]]] = None
+    ) -> array.ArrayType: ...
+    def phred_count_table(
+        self, ranges: Optional[Sequence[Tuple[int, int]]] = None
+    ) -> array.ArrayType: ...
+    def length_count_table(self) -> array.ArrayType: ...
+    def position_ranges(self) -> List[Tuple[int, int]]: ...
     def gc_content(self) -> array.ArrayType: ...
     def phred_scores(self) -> array.ArrayType: ...
+    def merge(self, __other: QCMetrics) -> None: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
+    def dump(self) -> bytes: ...
+    @classmethod
+    def load(cls, __data: bytes) -> QCMetrics: ...
 
 class AdapterCounter:
     number_of_sequences: int
     max_length: int
     adapters: Tuple[str, ...]
-    def __init__(self, __adapters: Iterable[str]): ...
+    prefilter: bool
+    profiling: bool
+    def __init__(self, __adapters: Iterable[str],
+                 prefilter: Optional[bool] = None): ...
     def add_read(self, __read: FastqRecordView) -> None: ...
     def add_record_array(self, __record_array: FastqRecordArrayView) -> None: ...
     def get_counts(self) -> List[Tuple[str, array.ArrayType]]: ...
+    def merge(self, __other: AdapterCounter) -> None: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
+    def dump(self) -> bytes: ...
+    @classmethod
+    def load(cls, __data: bytes) -> AdapterCounter: ...
 
 class PerTileQuality:
     max_length: int 
     number_of_reads: int 
+    exact_positions: int
     skipped_reason: Optional[str]
-    def __init__(self): ...
+    profiling: bool
+    def __init__(self, exact_positions: int = DEFAULT_EXACT_POSITIONS): ...
     def add_read(self, __read: FastqRecordView) -> None: ...
     def add_record_array(self, __record_array: FastqRecordArrayView) -> None: ...
-    def get_tile_counts(self) -> List[Tuple[int, List[float], List[int]]]: ...
+    def get_tile_counts(
+        self, ranges: Optional[Sequence[Tuple[int, int]]] = None
+    ) -> List[Tuple[int, List[float], List[int]]]: ...
+    def position_ranges(self) -> List[Tuple[int, int]]: ...
+    def merge(self, __other: PerTileQuality) -> None: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
+    def dump(self) -> bytes: ...
+    @classmethod
+    def load(cls, __data: bytes) -> PerTileQuality: ...
 
 class SequenceDuplication:
     number_of_sequences: int
     sampled_sequences: int
+    read_index: int
     collected_unique_fragments: int
     max_unique_fragments: int
     fragment_length: int
     sample_every: int
     total_fragments: int
+    profiling: bool
 
     def __init__(self,
                  max_unique_fragments: int = DEFAULT_MAX_UNIQUE_FRAGMENTS,
@@ -115,6 +158,11 @@ class SequenceDuplication:
                                   min_threshold: int = 1,
                                   max_threshold: int = sys.maxsize,
                                   ) -> List[Tuple[int, float, str]]: ...
+    def merge(self, __other: SequenceDuplication) -> None: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
+    def dump(self) -> bytes: ...
+    @classmethod
+    def load(cls, __data: bytes) -> SequenceDuplication: ...
 
 class DedupEstimator:
     _modulo_bits: int 
@@ -124,6 +172,8 @@ class DedupEstimator:
     back_sequence_length: int 
     front_sequence_offset: int 
     back_sequence_offset: int
+    sketch: bool
+    profiling: bool
 
     def __init__(
             self,
@@ -133,6 +183,7 @@ class DedupEstimator:
             back_sequence_length: int = DEFAULT_FINGERPRINT_BACK_SEQUENCE_LENGTH,
             front_sequence_offset: int = DEFAULT_FINGERPRINT_FRONT_SEQUENCE_OFFSET,
             back_sequence_offset: int = DEFAULT_FINGERPRINT_BACK_SEQUENCE_OFFSET,
+            sketch: bool = False,
     ): ...
     def add_sequence(self, __sequence: str) -> None: ...
     def add_sequence_pair(self, __sequence1: str, __sequence2: str) -> None: ...
@@ -142,28 +193,37 @@ class DedupEstimator:
                               __record_array2: FastqRecordArrayView,
                               ) -> None: ...
     def duplication_counts(self) -> array.ArrayType: ...
-
-class NanoporeReadInfo:
-    start_time: int
-    channel_id: int
-    length: int
-    cumulative_error_rate: float
-    duration: float
+    def estimated_distinct_fingerprints(self) -> int: ...
+    def merge(self, __other: DedupEstimator) -> None: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
+    def dump(self) -> bytes: ...
+    @classmethod
+    def load(cls, __data: bytes) -> DedupEstimator: ...
 
 class NanoStats:
     number_of_reads: int
     skipped_reason: Optional[str]
     minimum_time: int
     maximum_time: int
+    time_bucket_width: int
+    profiling: bool
     def add_read(self, __read: FastqRecordView) -> None: ...
     def add_record_array(self, __record_array: FastqRecordArrayView) -> None: ...
-    def nano_info_iterator(self) -> Iterator[NanoporeReadInfo]: ...
+    def time_buckets(self) -> List[Tuple[int, int, int, int, List[int]]]: ...
+    def channel_stats(self) -> List[Tuple[int, int, int, float]]: ...
+    def translocation_speeds(self) -> array.ArrayType: ...
+    def merge(self, __other: NanoStats) -> None: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
+    def dump(self) -> bytes: ...
+    @classmethod
+    def load(cls, __data: bytes) -> NanoStats: ...
 
 
 class InsertSizeMetrics:
     total_reads: int
     number_of_adapters_read1: int
     number_of_adapters_read2: int
+    profiling: bool
 
     def __init__(self): ...
     def add_sequence_pair(self, __sequence1: str, __sequence2: str) -> None: ...
@@ -174,3 +234,25 @@ class InsertSizeMetrics:
     def insert_sizes(self) -> array.ArrayType: ...
     def adapters_read1(self) -> List[Tuple[str, int]]: ...
     def adapters_read2(self) -> List[Tuple[str, int]]: ...
+    def merge(self, __other: InsertSizeMetrics) -> None: ...
+    def profile(self) -> Dict[str, Union[int, float]]: ...
+    def dump(self) -> bytes: ...
+    @classmethod
+    def load(cls, __data: bytes) -> InsertSizeMetrics: ...
+
+class QCPipeline:
+    metrics: Optional[QCMetrics]
+    per_tile_quality: Optional[PerTileQuality]
+    sequence_duplication: Optional[SequenceDuplication]
+    nanostats: Optional[NanoStats]
+    adapter_counter: Optional[AdapterCounter]
+    dedup_estimator: Optional[DedupEstimator]
+    def __init__(self,
+                 *,
+                 metrics: Optional[QCMetrics] = None,
+                 per_tile_quality: Optional[PerTileQuality] = None,
+                 sequence_duplication: Optional[SequenceDuplication] = None,
+                 nanostats: Optional[NanoStats] = None,
+                 adapter_counter: Optional[AdapterCounter] = None,
+                 dedup_estimator: Optional[DedupEstimator] = None): ...
+    def add_record_array(self, __record_array: FastqRecordArrayView) -> None: ...
@@ -28,6 +28,17 @@ along with Sequali.  If not, see <https://www.gnu.org/licenses/
 #include <math.h>
 #include <stdbool.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 #ifdef __SSE2__
 #include "emmintrin.h"
 #endif
@@ -55,6 +66,410 @@ non_temporal_write_prefetch(void *address)
 #endif
 }
 
+static inline void
+write_prefetch(void *address)
+{
+#if __GNUC__ || CLANG_COMPILER_HAS_BUILTIN(__builtin_prefetch)
+    __builtin_prefetch(address, 1, 3);
+#elif BUILD_IS_X86_64
+    _mm_prefetch(address, _MM_HINT_T0);
+#else
+/* No-op for MSVC and other compilers. MSVC builtin was not found. */
+#endif
+}
+
+/* The add_record_array methods release the GIL while the records are
+   processed, so the add_meta functions run without holding it. The same
+   add_meta functions are called with the GIL held by the add_read methods.
+   PyGILState_Ensure works in both situations, so errors that are raised from
+   within an add_meta function are raised using these helpers.
+
+   Memory that is (re)allocated from within add_meta is allocated with the
+   PyMem_Raw* functions as these do not require the GIL. */
+
+static void
+set_no_memory_error_gil_safe(void)
+{
+    PyGILState_STATE gil_state = PyGILState_Ensure();
+    PyErr_NoMemory();
+    PyGILState_Release(gil_state);
+}
+
+static void
+set_phred_error_gil_safe(uint8_t phred_character)
+{
+    PyGILState_STATE gil_state = PyGILState_Ensure();
+    PyErr_Format(PyExc_ValueError, "Not a valid phred character: %c",
+                 phred_character);
+    PyGILState_Release(gil_state);
+}
+
+/**
+ * @brief Return a "Can not parse header: " message for a FASTQ header.
+ *
+ * Can be called with or without holding the GIL.
+ *
+ * @return PyObject* a new reference to a str object or NULL on error.
+ */
+static PyObject *
+header_parse_failure_reason_gil_safe(const uint8_t *header, size_t header_length)
+{
+    PyGILState_STATE gil_state = PyGILState_Ensure();
+    PyObject *reason = NULL;
+    PyObject *header_obj =
+        PyUnicode_DecodeASCII((const char *)header, header_length, NULL);
+    if (header_obj != NULL) {
+        reason = PyUnicode_FromFormat("Can not parse header: %R", header_obj);
+        Py_DECREF(header_obj);
+    }
+    PyGILState_Release(gil_state);
+    return reason;
+}
+
+/**
+ * @brief Check whether other can be merged into self.
+ *
+ * @return int 0 if other is of the same type as self and not self. -1 with
+ *         an exception set otherwise.
+ */
+static int
+check_merge_compatibility(PyObject *self, PyObject *other)
+{
+    if (Py_TYPE(other) != Py_TYPE(self)) {
+        PyErr_Format(PyExc_TypeError, "other should be a %s object, got %s",
+                     Py_TYPE(self)->tp_name, Py_TYPE(other)->tp_name);
+        return -1;
+    }
+    if (other == self) {
+        PyErr_Format(PyExc_ValueError, "Can not merge a %s object with itself",
+                     Py_TYPE(self)->tp_name);
+        return -1;
+    }
+    return 0;
+}
+
+/* The dump() and load() methods use a compact binary format. It starts with
+   STATE_MAGIC, the format version and the type name of the object. This is
+   followed by the settings and the gathered data of the object. All integers
+   are stored as 64-bit little-endian integers and all floating point numbers
+   as 64-bit little-endian IEEE 754 doubles, so the format is the same on all
+   platforms. */
+
+#define STATE_MAGIC "SQLSTATE"
+#define STATE_MAGIC_SIZE 8
+#define STATE_FORMAT_VERSION 4
+
+struct StateWriter {
+    uint8_t *buffer;
+    size_t size;
+    size_t capacity;
+};
+
+static int
+StateWriter_write_u64(struct StateWriter *writer, uint64_t value)
+{
+    if (writer->size + 8 > writer->capacity) {
+        size_t new_capacity = (writer->capacity + 8) * 2;
+        uint8_t *tmp = PyMem_Realloc(writer->buffer, new_capacity);
+        if (tmp == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        writer->buffer = tmp;
+        writer->capacity = new_capacity;
+    }
+    uint8_t *target = writer->buffer + writer->size;
+    for (size_t i = 0; i < 8; i++) {
+        target[i] = (uint8_t)(value >> (i * 8));
+    }
+    writer->size += 8;
+    return 0;
+}
+
+static int
+StateWriter_write_double(struct StateWriter *writer, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return StateWriter_write_u64(writer, bits);
+}
+
+static int
+StateWriter_write_u64_array(struct StateWriter *writer, const uint64_t *values,
+                            size_t number_of_values)
+{
+    for (size_t i = 0; i < number_of_values; i++) {
+        if (StateWriter_write_u64(writer, values[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Write the length followed by the bytes, padded to a multiple of 8 bytes. */
+static int
+StateWriter_write_bytes(struct StateWriter *writer, const void *data,
+                        size_t length)
+{
+    if (StateWriter_write_u64(writer, length) != 0) {
+        return -1;
+    }
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; i += 8) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8 && i + j < length; j++) {
+            word |= ((uint64_t)bytes[i + j]) << (j * 8);
+        }
+        if (StateWriter_write_u64(writer, word) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Write a str object as UTF-8 encoded bytes. */
+static int
+StateWriter_write_str(struct StateWriter *writer, PyObject *string)
+{
+    Py_ssize_t length;
+    const char *utf8 = PyUnicode_AsUTF8AndSize(string, &length);
+    if (utf8 == NULL) {
+        return -1;
+    }
+    return StateWriter_write_bytes(writer, utf8, length);
+}
+
+static int
+StateWriter_init(struct StateWriter *writer, PyObject *obj)
+{
+    writer->buffer = NULL;
+    writer->size = 0;
+    writer->capacity = 0;
+    uint64_t magic = 0;
+    for (size_t i = 0; i < STATE_MAGIC_SIZE; i++) {
+        magic |= ((uint64_t)(uint8_t)STATE_MAGIC[i]) << (i * 8);
+    }
+    const char *type_name = Py_TYPE(obj)->tp_name;
+    if (StateWriter_write_u64(writer, magic) != 0 ||
+        StateWriter_write_u64(writer, STATE_FORMAT_VERSION) != 0 ||
+        StateWriter_write_bytes(writer, type_name, strlen(type_name)) != 0) {
+        PyMem_Free(writer->buffer);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Return the written state as a bytes object and free the writer.
+ *
+ * @param failed Whether an error occurred during writing. In that case the
+ *               writer is freed and NULL is returned.
+ */
+static PyObject *
+StateWriter_finish(struct StateWriter *writer, int failed)
+{
+    PyObject *result = NULL;
+    if (!failed) {
+        result = PyBytes_FromStringAndSize((char *)writer->buffer,
+                                           writer->size);
+    }
+    PyMem_Free(writer->buffer);
+    writer->buffer = NULL;
+    return result;
+}
+
+struct StateReader {
+    Py_buffer view;
+    const uint8_t *cursor;
+    const uint8_t *end;
+};
+
+static int
+StateReader_read_u64(struct StateReader *reader, uint64_t *value)
+{
+    if (reader->end - reader->cursor < 8) {
+        PyErr_SetString(PyExc_ValueError, "Truncated state data");
+        return -1;
+    }
+    uint64_t result = 0;
+    for (size_t i = 0; i < 8; i++) {
+        result |= ((uint64_t)reader->cursor[i]) << (i * 8);
+    }
+    reader->cursor += 8;
+    *value = result;
+    return 0;
+}
+
+static int
+StateReader_read_size(struct StateReader *reader, size_t *value)
+{
+    uint64_t result;
+    if (StateReader_read_u64(reader, &result) != 0) {
+        return -1;
+    }
+    if (result > PY_SSIZE_T_MAX) {
+        PyErr_Format(PyExc_ValueError, "Invalid size in state data: %llu",
+                     (unsigned long long)result);
+        return -1;
+    }
+    *value = result;
+    return 0;
+}
+
+static int
+StateReader_read_double(struct StateReader *reader, double *value)
+{
+    uint64_t bits;
+    if (StateReader_read_u64(reader, &bits) != 0) {
+        return -1;
+    }
+    memcpy(value, &bits, sizeof(bits));
+    return 0;
+}
+
+/**
+ * @brief Check if the reader has number_of_values 64-bit values left.
+ *
+ * Used before allocating memory for arrays, so corrupted sizes are not
+ * turned into huge allocations.
+ */
+static int
+StateReader_check_remaining(struct StateReader *reader,
+                            size_t number_of_values)
+{
+    if ((size_t)(reader->end - reader->cursor) / 8 < number_of_values) {
+        PyErr_SetString(PyExc_ValueError, "Truncated state data");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+StateReader_read_u64_array(struct StateReader *reader, uint64_t *values,
+                           size_t number_of_values)
+{
+    if (StateReader_check_remaining(reader, number_of_values) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < number_of_values; i++) {
+        StateReader_read_u64(reader, values + i);
+    }
+    return 0;
+}
+
+/**
+ * @brief Read bytes written by StateWriter_write_bytes into a new buffer.
+ *
+ * @param data Is set to a PyMem_Malloc'ed buffer that must be freed by the
+ *             caller.
+ */
+static int
+StateReader_read_bytes(struct StateReader *reader, uint8_t **data,
+                       size_t *length)
+{
+    size_t bytes_length;
+    if (StateReader_read_size(reader, &bytes_length) != 0) {
+        return -1;
+    }
+    size_t number_of_words = (bytes_length + 7) / 8;
+    if (StateReader_check_remaining(reader, number_of_words) != 0) {
+        return -1;
+    }
+    uint8_t *bytes = PyMem_Malloc(bytes_length + 1);
+    if (bytes == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(bytes, reader->cursor, bytes_length);
+    bytes[bytes_length] = 0;
+    reader->cursor += number_of_words * 8;
+    *data = bytes;
+    *length = bytes_length;
+    return 0;
+}
+
+/* Read bytes written by StateWriter_write_str and return a new str object */
+static PyObject *
+StateReader_read_str(struct StateReader *reader)
+{
+    uint8_t *data;
+    size_t length;
+    if (StateReader_read_bytes(reader, &data, &length) != 0) {
+        return NULL;
+    }
+    PyObject *result = PyUnicode_DecodeUTF8((char *)data, length, NULL);
+    PyMem_Free(data);
+    return result;
+}
+
+/**
+ * @brief Initialize a reader on a bytes-like object and check the header.
+ *
+ * @return int 0 on success. -1 with an exception set otherwise. When
+ *         successful the reader must be released with StateReader_release.
+ */
+static int
+StateReader_init(struct StateReader *reader, PyObject *data,
+                 PyTypeObject *type)
+{
+    if (PyObject_GetBuffer(data, &reader->view, PyBUF_SIMPLE) != 0) {
+        return -1;
+    }
+    reader->cursor = reader->view.buf;
+    reader->end = reader->cursor + reader->view.len;
+    if (reader->view.len < STATE_MAGIC_SIZE ||
+        memcmp(reader->cursor, STATE_MAGIC, STATE_MAGIC_SIZE) != 0) {
+        PyErr_SetString(PyExc_ValueError, "Data is not a sequali state");
+        goto error;
+    }
+    reader->cursor += STATE_MAGIC_SIZE;
+    uint64_t version;
+    if (StateReader_read_u64(reader, &version) != 0) {
+        goto error;
+    }
+    if (version != STATE_FORMAT_VERSION) {
+        PyErr_Format(PyExc_ValueError,
+                     "Unsupported state format version %llu, expected %d",
+                     (unsigned long long)version, STATE_FORMAT_VERSION);
+        goto error;
+    }
+    uint8_t *type_name;
+    size_t type_name_length;
+    if (StateReader_read_bytes(reader, &type_name, &type_name_length) != 0) {
+        goto error;
+    }
+    int names_equal = strcmp((char *)type_name, type->tp_name) == 0;
+    if (!names_equal) {
+        PyErr_Format(PyExc_ValueError, "Expected a %s state, got a %s state",
+                     type->tp_name, (char *)type_name);
+    }
+    PyMem_Free(type_name);
+    if (!names_equal) {
+        goto error;
+    }
+    return 0;
+error:
+    PyBuffer_Release(&reader->view);
+    return -1;
+}
+
+static void
+StateReader_release(struct StateReader *reader)
+{
+    PyBuffer_Release(&reader->view);
+}
+
+/* Check that all data is consumed. */
+static int
+StateReader_finish(struct StateReader *reader)
+{
+    if (reader->cursor != reader->end) {
+        PyErr_SetString(PyExc_ValueError, "Trailing data after state");
+        return -1;
+    }
+    return 0;
+}
+
 static PyObject *
 PythonArray_FromBuffer(char typecode, void *buffer, size_t buffersize)
 {
@@ -112,63 +527,8 @@ unsigned_decimal_integer_from_string(const uint8_t *string, size_t length)
     return result;
 }
 
-#define ASCII_MASK_8BYTE 0x8080808080808080ULL
 #define ASCII_MASK_1BYTE 0x80
 
-static inline int
-string_is_ascii_fallback(const char *string, size_t length)
-{
-    size_t all_chars = 0;
-    for (size_t i = 0; i < length; i++) {
-        all_chars |= string[i];
-    }
-    return !(all_chars & ASCII_MASK_1BYTE);
-}
-
-/**
- * @brief Check if a string of given length only contains ASCII characters.
- *
- * @param string A char pointer to the start of the string.
- * @param length The length of the string. This funtion does not check for
- *               terminating NULL bytes.
- * @returns 1 if the string is ASCII-only, 0 otherwise.
- */
-static int
-string_is_ascii(const char *string, size_t length)
-{
-    if (length < sizeof(size_t)) {
-        return string_is_ascii_fallback(string, length);
-    }
-    size_t number_of_chunks = length / sizeof(size_t);
-    size_t *chunks = (size_t *)string;
-    size_t number_of_unrolls = number_of_chunks / 4;
-    size_t remaining_chunks = number_of_chunks - (number_of_unrolls * 4);
-    size_t *chunk_ptr = chunks;
-    size_t all_chars0 = 0;
-    size_t all_chars1 = 0;
-    size_t all_chars2 = 0;
-    size_t all_chars3 = 0;
-    for (size_t i = 0; i < number_of_unrolls; i++) {
-        /* Performing indepedent OR calculations allows the compiler to use
-           vectors. It also allows out of order execution. */
-        all_chars0 |= chunk_ptr[0];
-        all_chars1 |= chunk_ptr[1];
-        all_chars2 |= chunk_ptr[2];
-        all_chars3 |= chunk_ptr[3];
-        chunk_ptr += 4;
-    }
-    size_t all_chars = all_chars0 | all_chars1 | all_chars2 | all_chars3;
-    for (size_t i = 0; i < remaining_chunks; i++) {
-        all_chars |= chunk_ptr[i];
-    }
-    /* Load the last few bytes left in a single integer for fast operations.
-       There is some overlap here with the work done before, but for a simple
-       ascii check this does not matter. */
-    size_t last_chunk = *(size_t *)(string + length - sizeof(size_t));
-    all_chars |= last_chunk;
-    return !(all_chars & ASCII_MASK_8BYTE);
-}
-
 /***
  * Seconds since epoch for years of 1970 and higher is defined in the POSIX
  * specification.:
@@ -644,6 +1004,28 @@ FastqRecordArrayView_CheckExact(void *obj)
     return Py_TYPE(obj) == &FastqRecordArrayView_Type;
 }
 
+static inline size_t
+count_trailing_zeros64(uint64_t x)
+{
+    /* x must not be 0 */
+#if defined(__GNUC__) || CLANG_COMPILER_HAS_BUILTIN(__builtin_ctzll)
+    return __builtin_ctzll(x);
+#else
+    size_t count = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        count += 1;
+    }
+    return count;
+#endif
+}
+
+static inline bool
+fastq_name_char_is_separator(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
 /**
  * @brief Compare two FASTQ record names to see if they are mates.
  *
@@ -651,34 +1033,62 @@ FastqRecordArrayView_CheckExact(void *obj)
  * first whitespace. If the last symbol of both IDs is a '1' or '2' it is
  * ignored to allow 'record/1' and 'record/2' to match.
  *
+ * The names are scanned once for the first position where they differ or
+ * where the first ID ends. With SSE2 this is done 16 bytes at a time.
+ *
  * @param name1 Pointer to the first name
+ * @param name1_length The length of the first name
  * @param name2 Pointer to the second name
  * @param name2_length The length of the second name
  */
 static inline bool
-fastq_names_are_mates(const char *name1, const char *name2, size_t name2_length)
+fastq_names_are_mates(const char *name1, size_t name1_length,
+                      const char *name2, size_t name2_length)
 {
-    /* strcspn will return the length of the string if none of the complement
-       characters is found, so name1_length is not necessary as a parameter.*/
-    size_t id_length = strcspn(name1, " \t\n");
-    if (name2_length < id_length) {
-        return false;
-    }
-    if (name2_length > id_length) {
-        char id2_sep = name2[id_length];
-        if (!(id2_sep == ' ' || id2_sep == '\t' || id2_sep == '\n')) {
-            return false;
+    size_t common_length = Py_MIN(name1_length, name2_length);
+    size_t pos = 0;
+#ifdef __SSE2__
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    while (pos + 16 <= common_length) {
+        __m128i chunk1 = _mm_loadu_si128((const __m128i *)(name1 + pos));
+        __m128i chunk2 = _mm_loadu_si128((const __m128i *)(name2 + pos));
+        __m128i separators = _mm_or_si128(_mm_cmpeq_epi8(chunk1, space),
+                                          _mm_cmpeq_epi8(chunk1, tab));
+        int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk1, chunk2));
+        int stop = (~equal & 0xFFFF) | _mm_movemask_epi8(separators);
+        if (stop) {
+            pos += count_trailing_zeros64(stop);
+            break;
         }
+        pos += 16;
     }
-    /* Make sure /1 and /2 endings are ignored. */
-    char id1_last_char = name1[id_length - 1];
-    if (id1_last_char == '1' || id1_last_char == '2') {
-        char id2_last_char = name2[id_length - 1];
-        if (id2_last_char == '1' || id2_last_char == '2') {
-            id_length -= 1;
-        }
+#endif
+    while (pos < common_length && name1[pos] == name2[pos] &&
+           !fastq_name_char_is_separator(name1[pos])) {
+        pos += 1;
+    }
+    bool id1_ends = pos == name1_length ||
+                    fastq_name_char_is_separator(name1[pos]);
+    bool id2_ends = pos == name2_length ||
+                    fastq_name_char_is_separator(name2[pos]);
+    if (id1_ends) {
+        /* The IDs are equal up to the end of the first ID. */
+        return id2_ends;
+    }
+    /* The IDs differ at pos. This is allowed only for the last symbol of
+       both IDs when these are '1' or '2'. */
+    if (pos == name2_length) {
+        return false;
+    }
+    char c1 = name1[pos];
+    char c2 = name2[pos];
+    if (!((c1 == '1' || c1 == '2') && (c2 == '1' || c2 == '2'))) {
+        return false;
     }
-    return memcmp(name1, name2, id_length) == 0;
+    pos += 1;
+    return (pos == name1_length || fastq_name_char_is_separator(name1[pos])) &&
+           (pos == name2_length || fastq_name_char_is_separator(name2[pos]));
 }
 
 PyDoc_STRVAR(
@@ -717,8 +1127,8 @@ FastqRecordArrayView_is_mate(FastqRecordArrayView *self, PyObject *other_obj)
         struct FastqMeta *record2 = other_records + i;
         char *name1 = (char *)record1->record_start + 1;
         char *name2 = (char *)record2->record_start + 1;
-        size_t name2_length = record2->name_length;
-        if (!fastq_names_are_mates(name1, name2, name2_length)) {
+        if (!fastq_names_are_mates(name1, record1->name_length, name2,
+                                   record2->name_length)) {
             Py_RETURN_FALSE;
         }
     }
@@ -753,27 +1163,220 @@ static PyTypeObject FastqRecordArrayView_Type = {
     .tp_methods = FastqRecordArrayView_methods,
 };
 
-/****************
- * FASTQ PARSER *
- ****************/
-
-typedef struct _FastqParserStruct {
-    PyObject_HEAD
-    uint8_t *record_start;
-    uint8_t *buffer_end;
-    size_t read_in_size;
-    PyObject *buffer_obj;
-    struct FastqMeta *meta_buffer;
-    size_t meta_buffer_size;
-    PyObject *file_obj;
-} FastqParser;
+/*************
+ * PROFILING *
+ *************/
+
+/* The modules keep counters that show where the time goes. The time spent
+   in add_record_array is only measured when the profiling attribute of a
+   module is set. The clock is read twice per record array, so the overhead
+   is negligible. The counters are not part of the state, merge adds them
+   together. */
+
+struct ModuleProfile {
+    uint64_t nanoseconds;
+    uint64_t record_arrays;
+    uint64_t records;
+    uint64_t bases;
+    uint64_t hash_table_lookups;
+    uint64_t hash_table_probes;
+};
 
-static void
-FastqParser_dealloc(FastqParser *self)
+static uint64_t
+monotonic_nanoseconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 /
+                      (double)frequency.QuadPart);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+#endif
+}
+
+static inline uint64_t
+ModuleProfile_start(char profiling)
+{
+    return profiling ? monotonic_nanoseconds() : 0;
+}
+
+static void
+ModuleProfile_add_bases(struct ModuleProfile *profile,
+                        const struct FastqMeta *records,
+                        Py_ssize_t number_of_records)
+{
+    for (Py_ssize_t i = 0; i < number_of_records; i++) {
+        profile->bases += records[i].sequence_length;
+    }
+}
+
+/* Add the time since start and the records to the profile. */
+static void
+ModuleProfile_stop(struct ModuleProfile *profile, uint64_t start,
+                   const struct FastqMeta *records,
+                   Py_ssize_t number_of_records)
+{
+    profile->nanoseconds += monotonic_nanoseconds() - start;
+    profile->record_arrays += 1;
+    profile->records += number_of_records;
+    ModuleProfile_add_bases(profile, records, number_of_records);
+}
+
+static void
+ModuleProfile_merge(struct ModuleProfile *profile,
+                    const struct ModuleProfile *other)
+{
+    profile->nanoseconds += other->nanoseconds;
+    profile->record_arrays += other->record_arrays;
+    profile->records += other->records;
+    profile->bases += other->bases;
+    profile->hash_table_lookups += other->hash_table_lookups;
+    profile->hash_table_probes += other->hash_table_probes;
+}
+
+static int
+dict_set_u64(PyObject *dict, const char *key, uint64_t value)
+{
+    PyObject *value_obj = PyLong_FromUnsignedLongLong(value);
+    if (value_obj == NULL) {
+        return -1;
+    }
+    int ret = PyDict_SetItemString(dict, key, value_obj);
+    Py_DECREF(value_obj);
+    return ret;
+}
+
+/* Return a new dict with the counters of the profile. Module specific
+   counters can be added to it with dict_set_u64. */
+static PyObject *
+ModuleProfile_to_dict(const struct ModuleProfile *profile)
+{
+    PyObject *dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    PyObject *seconds = PyFloat_FromDouble(profile->nanoseconds / 1e9);
+    if (seconds == NULL || PyDict_SetItemString(dict, "seconds", seconds) ||
+        dict_set_u64(dict, "record_arrays", profile->record_arrays) ||
+        dict_set_u64(dict, "records", profile->records) ||
+        dict_set_u64(dict, "bases", profile->bases)) {
+        Py_XDECREF(seconds);
+        Py_DECREF(dict);
+        return NULL;
+    }
+    Py_DECREF(seconds);
+    return dict;
+}
+
+/********************
+ * TABLE ALLOCATION *
+ ********************/
+
+/* The hash tables of the duplication modules are accessed at random
+   positions, so nearly every lookup needs a different page. Tables of at
+   least LARGE_TABLE_SIZE are mapped directly and marked for transparent
+   huge pages, so many fewer TLB entries are needed. The hint is ignored
+   when huge pages are disabled. Elsewhere the tables come from the raw
+   allocator. Both can be used without holding the GIL. */
+#define LARGE_TABLE_SIZE (2 * 1024 * 1024)
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+#define TABLE_ALLOCATION_USES_MMAP 1
+#else
+#define TABLE_ALLOCATION_USES_MMAP 0
+#endif
+
+/**
+ * @brief Allocate a zeroed table. Free it with table_free using the same
+ *        size.
+ *
+ * @returns A pointer to the table or NULL if there is not enough memory.
+ */
+static void *
+table_calloc(size_t number_of_entries, size_t entry_size)
+{
+    if (entry_size != 0 && number_of_entries > SIZE_MAX / entry_size) {
+        return NULL;
+    }
+#if TABLE_ALLOCATION_USES_MMAP
+    size_t size = number_of_entries * entry_size;
+    if (size >= LARGE_TABLE_SIZE) {
+        void *table = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (table == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(table, size, MADV_HUGEPAGE);
+        return table;
+    }
+#endif
+    return PyMem_RawCalloc(number_of_entries, entry_size);
+}
+
+static void
+table_free(void *table, size_t number_of_entries, size_t entry_size)
+{
+    if (table == NULL) {
+        return;
+    }
+#if TABLE_ALLOCATION_USES_MMAP
+    size_t size = number_of_entries * entry_size;
+    if (size >= LARGE_TABLE_SIZE) {
+        munmap(table, size);
+        return;
+    }
+#endif
+    PyMem_RawFree(table);
+}
+
+/****************
+ * FASTQ PARSER *
+ ****************/
+
+/* The read buffers are bytearrays that are kept in a pool. Once all record
+   arrays and views of a buffer are released, the pool holds the only
+   reference and the buffer is reused for a next batch. This avoids a new
+   allocation, and the page faults that come with it, for every batch. */
+#define FASTQ_PARSER_BUFFER_POOL_SIZE 16
+
+typedef struct _FastqParserStruct {
+    PyObject_HEAD
+    uint8_t *record_start;
+    uint8_t *buffer_end;
+    size_t read_in_size;
+    PyObject *buffer_obj;
+    PyObject *buffer_pool[FASTQ_PARSER_BUFFER_POOL_SIZE];
+    struct FastqMeta *meta_buffer;
+    size_t meta_buffer_size;
+    uint64_t *newline_bitmap;
+    size_t newline_bitmap_size;
+    PyObject *file_obj;
+    /* Set when fileobj supports the buffer protocol, for instance an mmap
+       object. The records then point directly into the buffer. */
+    PyObject *mapped_view;
+    size_t mapped_offset;
+    char profiling;
+    struct ModuleProfile profile;
+    uint64_t buffer_allocations;
+    uint64_t buffer_resizes;
+} FastqParser;
+
+static void
+FastqParser_dealloc(FastqParser *self)
 {
     Py_XDECREF(self->buffer_obj);
+    for (size_t i = 0; i < FASTQ_PARSER_BUFFER_POOL_SIZE; i++) {
+        Py_XDECREF(self->buffer_pool[i]);
+    }
     Py_XDECREF(self->file_obj);
     PyMem_Free(self->meta_buffer);
+    PyMem_Free(self->newline_bitmap);
+    Py_XDECREF(self->mapped_view);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
@@ -794,21 +1397,48 @@ FastqParser__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
                      read_in_size);
         return NULL;
     }
+    PyObject *mapped_view = NULL;
+    if (PyObject_CheckBuffer(file_obj)) {
+        mapped_view = PyMemoryView_FromObject(file_obj);
+        if (mapped_view == NULL) {
+            return NULL;
+        }
+        Py_buffer *view = PyMemoryView_GET_BUFFER(mapped_view);
+        if (view->itemsize != 1 || !PyBuffer_IsContiguous(view, 'C')) {
+            PyErr_Format(PyExc_TypeError,
+                         "fileobj buffer must be contiguous with an item "
+                         "size of 1, got %R",
+                         file_obj);
+            Py_DECREF(mapped_view);
+            return NULL;
+        }
+    }
     PyObject *buffer_obj = PyBytes_FromStringAndSize(NULL, 0);
     if (buffer_obj == NULL) {
+        Py_XDECREF(mapped_view);
         return NULL;
     }
     FastqParser *self = PyObject_New(FastqParser, type);
     if (self == NULL) {
         Py_DECREF(buffer_obj);
+        Py_XDECREF(mapped_view);
         return NULL;
     }
     self->record_start = (uint8_t *)PyBytes_AS_STRING(buffer_obj);
     self->buffer_end = self->record_start;
     self->buffer_obj = buffer_obj;
+    memset(self->buffer_pool, 0, sizeof(self->buffer_pool));
     self->read_in_size = read_in_size;
     self->meta_buffer = NULL;
     self->meta_buffer_size = 0;
+    self->newline_bitmap = NULL;
+    self->newline_bitmap_size = 0;
+    self->mapped_view = mapped_view;
+    self->mapped_offset = 0;
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
+    self->buffer_allocations = 0;
+    self->buffer_resizes = 0;
     Py_INCREF(file_obj);
     self->file_obj = file_obj;
     return (PyObject *)self;
@@ -821,6 +1451,100 @@ FastqParser__iter__(PyObject *self)
     return self;
 }
 
+/**
+ * @brief Build a bitmap of newline positions and check for ASCII in one
+ *        sweep over the buffer.
+ *
+ * @param buffer The buffer to scan.
+ * @param length The length of the buffer.
+ * @param bitmap Output bitmap of (length + 63) / 64 words. Bit i of word w is
+ *               set if buffer[w * 64 + i] is a newline. Bits beyond length
+ *               are zero.
+ * @returns true if the buffer is ASCII-only, false otherwise.
+ */
+static bool
+build_newline_bitmap(const uint8_t *buffer, size_t length, uint64_t *bitmap)
+{
+    size_t number_of_blocks = length / 64;
+    const uint8_t *block = buffer;
+    uint64_t all_chars = 0;
+#ifdef __SSE2__
+    __m128i newline = _mm_set1_epi8('\n');
+    __m128i all_chars_vec = _mm_setzero_si128();
+    for (size_t i = 0; i < number_of_blocks; i++) {
+        __m128i chunk0 = _mm_loadu_si128((const __m128i *)block);
+        __m128i chunk1 = _mm_loadu_si128((const __m128i *)(block + 16));
+        __m128i chunk2 = _mm_loadu_si128((const __m128i *)(block + 32));
+        __m128i chunk3 = _mm_loadu_si128((const __m128i *)(block + 48));
+        all_chars_vec = _mm_or_si128(
+            all_chars_vec, _mm_or_si128(_mm_or_si128(chunk0, chunk1),
+                                        _mm_or_si128(chunk2, chunk3)));
+        uint64_t mask0 = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk0, newline));
+        uint64_t mask1 = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk1, newline));
+        uint64_t mask2 = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk2, newline));
+        uint64_t mask3 = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk3, newline));
+        bitmap[i] = mask0 | (mask1 << 16) | (mask2 << 32) | (mask3 << 48);
+        block += 64;
+    }
+    all_chars = _mm_movemask_epi8(all_chars_vec);
+#else
+    for (size_t i = 0; i < number_of_blocks; i++) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 64; j++) {
+            uint8_t c = block[j];
+            all_chars |= c;
+            word |= (uint64_t)(c == '\n') << j;
+        }
+        bitmap[i] = word;
+        block += 64;
+    }
+    all_chars &= ASCII_MASK_1BYTE;
+#endif
+    size_t remainder = length - number_of_blocks * 64;
+    if (remainder) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < remainder; j++) {
+            uint8_t c = block[j];
+            all_chars |= c & ASCII_MASK_1BYTE;
+            word |= (uint64_t)(c == '\n') << j;
+        }
+        bitmap[number_of_blocks] = word;
+    }
+    return all_chars == 0;
+}
+
+/**
+ * @brief Find the next newline using a bitmap from build_newline_bitmap.
+ *
+ * @param bitmap The newline bitmap.
+ * @param bitmap_start The start of the buffer the bitmap was built on.
+ * @param pos The position to start searching at.
+ * @param end The end of the buffer the bitmap was built on.
+ * @returns A pointer to the newline or NULL if there is none.
+ */
+static inline uint8_t *
+newline_bitmap_find(const uint64_t *bitmap, uint8_t *bitmap_start,
+                    uint8_t *pos, uint8_t *end)
+{
+    if (pos >= end) {
+        return NULL;
+    }
+    size_t offset = pos - bitmap_start;
+    size_t word_index = offset / 64;
+    size_t number_of_words = ((end - bitmap_start) + 63) / 64;
+    uint64_t word = bitmap[word_index] >> (offset % 64);
+    if (word) {
+        return pos + count_trailing_zeros64(word);
+    }
+    for (word_index += 1; word_index < number_of_words; word_index++) {
+        word = bitmap[word_index];
+        if (word) {
+            return bitmap_start + word_index * 64 + count_trailing_zeros64(word);
+        }
+    }
+    return NULL;
+}
+
 static inline bool
 buffer_contains_fastq(const uint8_t *buffer, size_t buffer_size)
 {
@@ -838,14 +1562,261 @@ buffer_contains_fastq(const uint8_t *buffer, size_t buffer_size)
     return true;
 }
 
+/**
+ * @brief Parse FASTQ records into self->meta_buffer.
+ *
+ * @param record_start Start of the first record to parse.
+ * @param buffer_end End of the data.
+ * @param index_start Start of the data newline_bitmap was built on.
+ * @param newline_bitmap Bitmap from build_newline_bitmap.
+ * @param parsed_records_ptr Number of records in meta_buffer. Updated.
+ * @param max_records Stop when this many records are in meta_buffer.
+ * @returns The start of the first unparsed record, or NULL on error.
+ */
+static uint8_t *
+FastqParser_parse_records(FastqParser *self, uint8_t *record_start,
+                          uint8_t *buffer_end, uint8_t *index_start,
+                          const uint64_t *newline_bitmap,
+                          size_t *parsed_records_ptr, size_t max_records)
+{
+    size_t parsed_records = *parsed_records_ptr;
+    while (parsed_records < max_records) {
+        if (record_start + 2 >= buffer_end) {
+            break;
+        }
+        if (record_start[0] != '@') {
+            PyErr_Format(PyExc_ValueError,
+                         "Record does not start with @ but with %c",
+                         record_start[0]);
+            return NULL;
+        }
+        uint8_t *name_end = newline_bitmap_find(
+            newline_bitmap, index_start, record_start, buffer_end);
+        if (name_end == NULL) {
+            break;
+        }
+        size_t name_length = name_end - (record_start + 1);
+        uint8_t *sequence_start = name_end + 1;
+        uint8_t *sequence_end = newline_bitmap_find(
+            newline_bitmap, index_start, sequence_start, buffer_end);
+        if (sequence_end == NULL) {
+            break;
+        }
+        size_t sequence_length = sequence_end - sequence_start;
+        uint8_t *second_header_start = sequence_end + 1;
+        if ((second_header_start < buffer_end) &&
+            second_header_start[0] != '+') {
+            PyErr_Format(
+                PyExc_ValueError,
+                "Record second header does not start with + but with %c",
+                second_header_start[0]);
+            return NULL;
+        }
+        uint8_t *second_header_end = newline_bitmap_find(
+            newline_bitmap, index_start, second_header_start, buffer_end);
+        if (second_header_end == NULL) {
+            break;
+        }
+        uint8_t *qualities_start = second_header_end + 1;
+        uint8_t *qualities_end = newline_bitmap_find(
+            newline_bitmap, index_start, qualities_start, buffer_end);
+        if (qualities_end == NULL) {
+            break;
+        }
+        size_t qualities_length = qualities_end - qualities_start;
+        if (sequence_length != qualities_length) {
+            PyObject *record_name_obj = PyUnicode_DecodeASCII(
+                (char *)record_start + 1, name_length, NULL);
+            PyErr_Format(PyExc_ValueError,
+                         "Record sequence and qualities do not have equal "
+                         "length, %R",
+                         record_name_obj);
+            Py_DECREF(record_name_obj);
+            return NULL;
+        }
+        parsed_records += 1;
+        if (parsed_records > self->meta_buffer_size) {
+            struct FastqMeta *tmp = PyMem_Realloc(
+                self->meta_buffer, sizeof(struct FastqMeta) * parsed_records);
+            if (tmp == NULL) {
+                PyErr_NoMemory();
+                return NULL;
+            }
+            self->meta_buffer = tmp;
+            self->meta_buffer_size = parsed_records;
+        }
+        struct FastqMeta *meta = self->meta_buffer + (parsed_records - 1);
+        meta->record_start = record_start;
+        meta->name_length = name_length;
+        meta->sequence_offset = sequence_start - record_start;
+        meta->sequence_length = sequence_length;
+        meta->qualities_offset = qualities_start - record_start;
+        meta->accumulated_error_rate = 0.0;
+        meta->channel = -1;
+        meta->duration = 0.0;
+        meta->start_time = 0;
+        record_start = qualities_end + 1;
+    }
+    *parsed_records_ptr = parsed_records;
+    return record_start;
+}
+
+/**
+ * @brief Build the newline bitmap for a block of data in
+ *        self->newline_bitmap.
+ *
+ * @returns 0 on success, -1 with an exception set on error.
+ */
+static int
+FastqParser_index_newlines(FastqParser *self, uint8_t *index_start,
+                           size_t index_length)
+{
+    size_t bitmap_words = (index_length + 63) / 64;
+    if (bitmap_words > self->newline_bitmap_size) {
+        uint64_t *tmp = PyMem_Realloc(self->newline_bitmap,
+                                      bitmap_words * sizeof(uint64_t));
+        if (tmp == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->newline_bitmap = tmp;
+        self->newline_bitmap_size = bitmap_words;
+    }
+    bool is_ascii;
+    /* The data belongs to this parser only, so other threads, such as the
+       parser of the mate file, can run while it is indexed. */
+    Py_BEGIN_ALLOW_THREADS
+    is_ascii = build_newline_bitmap(index_start, index_length,
+                                    self->newline_bitmap);
+    Py_END_ALLOW_THREADS
+    if (!is_ascii) {
+        size_t pos;
+        for (pos = 0; pos < index_length; pos += 1) {
+            if (index_start[pos] & ASCII_MASK_1BYTE) {
+                break;
+            }
+        }
+        PyErr_Format(PyExc_ValueError, "Found non-ASCII character in file: %c",
+                     index_start[pos]);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Create a record array from a fileobj that supports the buffer
+ *        protocol.
+ *
+ * No data is copied. The records point directly into the buffer and the
+ * record array holds a memoryview of the parsed part. The data is indexed
+ * in windows of read_in_size that grow geometrically until min_records are
+ * found.
+ */
 static PyObject *
-FastqParser_create_record_array(FastqParser *self, size_t min_records,
-                                size_t max_records)
+FastqParser_create_record_array_from_buffer(FastqParser *self,
+                                            size_t min_records,
+                                            size_t max_records)
+{
+    Py_buffer *view = PyMemoryView_GET_BUFFER(self->mapped_view);
+    uint8_t *data = view->buf;
+    size_t data_size = view->len;
+    size_t batch_offset = self->mapped_offset;
+    uint8_t *record_start = data + batch_offset;
+    uint8_t *data_end = data + data_size;
+    uint8_t *indexed_end = record_start;
+    size_t parsed_records = 0;
+    while (parsed_records < min_records && indexed_end < data_end) {
+        /* The window at least doubles the part that is not parsed yet, so
+           records much larger than read_in_size are indexed a number of
+           times that is logarithmic rather than linear in their size. */
+        size_t window_size =
+            Py_MAX(self->read_in_size, (size_t)(indexed_end - record_start));
+        uint8_t *window_end = indexed_end + window_size;
+        if (window_end > data_end || window_end < indexed_end) {
+            window_end = data_end;
+        }
+        /* Only the records that did not fit in the previous window need to
+           be indexed again. */
+        if (FastqParser_index_newlines(self, record_start,
+                                       window_end - record_start) != 0) {
+            return NULL;
+        }
+        record_start = FastqParser_parse_records(
+            self, record_start, window_end, record_start,
+            self->newline_bitmap, &parsed_records, max_records);
+        if (record_start == NULL) {
+            return NULL;
+        }
+        indexed_end = window_end;
+    }
+    if (parsed_records == 0 && record_start < data_end) {
+        PyObject *remaining_obj = PyUnicode_DecodeASCII(
+            (char *)record_start, data_end - record_start, NULL);
+        if (remaining_obj == NULL) {
+            return NULL;
+        }
+        PyErr_Format(PyExc_EOFError, "Incomplete record at the end of file %U",
+                     remaining_obj);
+        Py_DECREF(remaining_obj);
+        return NULL;
+    }
+    size_t batch_end = record_start - data;
+    PyObject *batch_view =
+        PySequence_GetSlice(self->mapped_view, batch_offset, batch_end);
+    if (batch_view == NULL) {
+        return NULL;
+    }
+    self->mapped_offset = batch_end;
+    PyObject *record_array = FastqRecordArrayView_FromPointerSizeAndObject(
+        self->meta_buffer, parsed_records, batch_view);
+    Py_DECREF(batch_view);
+    return record_array;
+}
+
+/**
+ * @brief Return a new reference to a bytearray of size bytes. A buffer from
+ *        the pool is used when no other object refers to it.
+ */
+static PyObject *
+FastqParser_acquire_buffer(FastqParser *self, Py_ssize_t size)
+{
+    for (size_t i = 0; i < FASTQ_PARSER_BUFFER_POOL_SIZE; i++) {
+        PyObject *buffer = self->buffer_pool[i];
+        if (buffer == NULL) {
+            buffer = PyByteArray_FromStringAndSize(NULL, size);
+            if (buffer == NULL) {
+                return NULL;
+            }
+            self->buffer_allocations += 1;
+            self->buffer_pool[i] = buffer;
+            Py_INCREF(buffer);
+            return buffer;
+        }
+        if (Py_REFCNT(buffer) == 1) {
+            if (PyByteArray_Resize(buffer, size) != 0) {
+                return NULL;
+            }
+            Py_INCREF(buffer);
+            return buffer;
+        }
+    }
+    /* All pooled buffers are in use. */
+    self->buffer_allocations += 1;
+    return PyByteArray_FromStringAndSize(NULL, size);
+}
+
+static PyObject *
+FastqParser_create_record_array_from_file(FastqParser *self,
+                                          size_t min_records,
+                                          size_t max_records)
 {
     uint8_t *record_start = self->record_start;
     uint8_t *buffer_end = self->buffer_end;
     size_t parsed_records = 0;
     PyObject *new_buffer_obj = NULL;
+    /* The buffer the record_start pointers of the parsed records point
+       into. */
+    uint8_t *parsed_buffer = NULL;
     while (parsed_records < min_records) {
         size_t leftover_size = buffer_end - record_start;
         size_t read_in_size;
@@ -855,38 +1826,35 @@ FastqParser_create_record_array(FastqParser *self, size_t min_records,
         if (new_buffer_obj == NULL) {
             /* On the first loop create a new buffer and initialize it with
                the leftover from the last run of the function. */
-            new_buffer_size = self->read_in_size;
-            new_buffer_obj = PyBytes_FromStringAndSize(NULL, new_buffer_size);
+            new_buffer_size = Py_MAX(self->read_in_size, leftover_size * 2);
+            new_buffer_obj = FastqParser_acquire_buffer(self, new_buffer_size);
             if (new_buffer_obj == NULL) {
                 return NULL;
             }
-            memcpy(PyBytes_AS_STRING(new_buffer_obj), record_start, leftover_size);
+            memcpy(PyByteArray_AS_STRING(new_buffer_obj), record_start,
+                   leftover_size);
             read_in_size = new_buffer_size - leftover_size;
             read_in_offset = leftover_size;
             record_start_offset = 0;
         }
         else {
             /* On subsequent loops, enlarge the buffer until the minimum
-               amount of records fits. */
-            uint8_t *old_start = (uint8_t *)PyBytes_AS_STRING(new_buffer_obj);
+               amount of records fits. The buffer grows geometrically, so
+               long records need only a few resizes. */
+            uint8_t *old_start =
+                (uint8_t *)PyByteArray_AS_STRING(new_buffer_obj);
             record_start_offset = record_start - old_start;
             size_t old_size = buffer_end - old_start;
-            new_buffer_size = old_size + self->read_in_size;
-            if (_PyBytes_Resize(&new_buffer_obj, new_buffer_size) == -1) {
+            read_in_size = Py_MAX(self->read_in_size, old_size);
+            new_buffer_size = old_size + read_in_size;
+            if (PyByteArray_Resize(new_buffer_obj, new_buffer_size) != 0) {
+                Py_DECREF(new_buffer_obj);
                 return NULL;
             }
-            /* Change the already parsed records to point to the new buffer. */
-            uint8_t *new_start = (uint8_t *)PyBytes_AS_STRING(new_buffer_obj);
-            struct FastqMeta *meta_buffer = self->meta_buffer;
-            for (size_t i = 0; i < parsed_records; i++) {
-                struct FastqMeta *record = meta_buffer + i;
-                intptr_t record_offset = record->record_start - old_start;
-                record->record_start = new_start + record_offset;
-            }
-            read_in_size = self->read_in_size;
+            self->buffer_resizes += 1;
             read_in_offset = old_size;
         }
-        uint8_t *new_buffer = (uint8_t *)PyBytes_AS_STRING(new_buffer_obj);
+        uint8_t *new_buffer = (uint8_t *)PyByteArray_AS_STRING(new_buffer_obj);
 
         PyObject *remaining_space_view = PyMemoryView_FromMemory(
             (char *)new_buffer + read_in_offset, read_in_size, PyBUF_WRITE);
@@ -908,22 +1876,33 @@ FastqParser_create_record_array(FastqParser *self, size_t min_records,
         Py_DECREF(read_bytes_obj);
         Py_ssize_t actual_buffer_size = read_in_offset + read_bytes;
         if (actual_buffer_size < new_buffer_size) {
-            if (_PyBytes_Resize(&new_buffer_obj, actual_buffer_size) == -1) {
+            if (PyByteArray_Resize(new_buffer_obj, actual_buffer_size) != 0) {
+                Py_DECREF(new_buffer_obj);
                 return NULL;
             }
         }
-        new_buffer = (uint8_t *)PyBytes_AS_STRING(new_buffer_obj);
+        new_buffer = (uint8_t *)PyByteArray_AS_STRING(new_buffer_obj);
         new_buffer_size = actual_buffer_size;
-        if (!string_is_ascii((char *)new_buffer + read_in_offset, read_bytes)) {
-            Py_ssize_t pos;
-            for (pos = read_in_offset; pos < new_buffer_size; pos += 1) {
-                if (new_buffer[pos] & ASCII_MASK_1BYTE) {
-                    break;
-                }
+        /* Both the enlarging and the shrinking resize may have moved the
+           buffer. Change the already parsed records to point to the new
+           buffer if so. */
+        if (parsed_buffer != new_buffer) {
+            struct FastqMeta *meta_buffer = self->meta_buffer;
+            for (size_t i = 0; i < parsed_records; i++) {
+                struct FastqMeta *record = meta_buffer + i;
+                intptr_t record_offset = record->record_start - parsed_buffer;
+                record->record_start = new_buffer + record_offset;
             }
-            PyErr_Format(PyExc_ValueError,
-                         "Found non-ASCII character in file: %c",
-                         new_buffer[pos]);
+            parsed_buffer = new_buffer;
+        }
+        record_start = new_buffer + record_start_offset;
+        buffer_end = new_buffer + new_buffer_size;
+        /* Index all newlines of the unparsed part of the buffer in one
+           sweep, so the records can be split without repeated memchr calls.
+           The ASCII check is done in the same sweep. */
+        uint8_t *index_start = new_buffer + record_start_offset;
+        size_t index_length = new_buffer_size - record_start_offset;
+        if (FastqParser_index_newlines(self, index_start, index_length) != 0) {
             Py_DECREF(new_buffer_obj);
             return NULL;
         }
@@ -949,87 +1928,12 @@ FastqParser_create_record_array(FastqParser *self, size_t min_records,
             /* At this point, there are still valid FASTQ records in the buffer
                but these have not been parsed yet.*/
         }
-        record_start = new_buffer + record_start_offset;
-        buffer_end = new_buffer + new_buffer_size;
-
-        while (parsed_records < max_records) {
-            if (record_start + 2 >= buffer_end) {
-                break;
-            }
-            if (record_start[0] != '@') {
-                PyErr_Format(PyExc_ValueError,
-                             "Record does not start with @ but with %c",
-                             record_start[0]);
-                Py_DECREF(new_buffer_obj);
-                return NULL;
-            }
-            uint8_t *name_end =
-                memchr(record_start, '\n', buffer_end - record_start);
-            if (name_end == NULL) {
-                break;
-            }
-            size_t name_length = name_end - (record_start + 1);
-            uint8_t *sequence_start = name_end + 1;
-            uint8_t *sequence_end =
-                memchr(sequence_start, '\n', buffer_end - sequence_start);
-            if (sequence_end == NULL) {
-                break;
-            }
-            size_t sequence_length = sequence_end - sequence_start;
-            uint8_t *second_header_start = sequence_end + 1;
-            if ((second_header_start < buffer_end) &&
-                second_header_start[0] != '+') {
-                PyErr_Format(
-                    PyExc_ValueError,
-                    "Record second header does not start with + but with %c",
-                    second_header_start[0]);
-                Py_DECREF(new_buffer_obj);
-                return NULL;
-            }
-            uint8_t *second_header_end = memchr(
-                second_header_start, '\n', buffer_end - second_header_start);
-            if (second_header_end == NULL) {
-                break;
-            }
-            uint8_t *qualities_start = second_header_end + 1;
-            uint8_t *qualities_end =
-                memchr(qualities_start, '\n', buffer_end - qualities_start);
-            if (qualities_end == NULL) {
-                break;
-            }
-            size_t qualities_length = qualities_end - qualities_start;
-            if (sequence_length != qualities_length) {
-                PyObject *record_name_obj = PyUnicode_DecodeASCII(
-                    (char *)record_start + 1, name_length, NULL);
-                PyErr_Format(PyExc_ValueError,
-                             "Record sequence and qualities do not have equal "
-                             "length, %R",
-                             record_name_obj);
-                Py_DECREF(new_buffer_obj);
-                Py_DECREF(record_name_obj);
-                return NULL;
-            }
-            parsed_records += 1;
-            if (parsed_records > self->meta_buffer_size) {
-                struct FastqMeta *tmp = PyMem_Realloc(
-                    self->meta_buffer, sizeof(struct FastqMeta) * parsed_records);
-                if (tmp == NULL) {
-                    return PyErr_NoMemory();
-                }
-                self->meta_buffer = tmp;
-                self->meta_buffer_size = parsed_records;
-            }
-            struct FastqMeta *meta = self->meta_buffer + (parsed_records - 1);
-            meta->record_start = record_start;
-            meta->name_length = name_length;
-            meta->sequence_offset = sequence_start - record_start;
-            meta->sequence_length = sequence_length;
-            meta->qualities_offset = qualities_start - record_start;
-            meta->accumulated_error_rate = 0.0;
-            meta->channel = -1;
-            meta->duration = 0.0;
-            meta->start_time = 0;
-            record_start = qualities_end + 1;
+        record_start = FastqParser_parse_records(
+            self, record_start, buffer_end, index_start, self->newline_bitmap,
+            &parsed_records, max_records);
+        if (record_start == NULL) {
+            Py_DECREF(new_buffer_obj);
+            return NULL;
         }
     }
     /* Save the current buffer object so any leftovers can be reused at the
@@ -1044,6 +1948,28 @@ FastqParser_create_record_array(FastqParser *self, size_t min_records,
         self->meta_buffer, parsed_records, new_buffer_obj);
 }
 
+static PyObject *
+FastqParser_create_record_array(FastqParser *self, size_t min_records,
+                                size_t max_records)
+{
+    uint64_t start = ModuleProfile_start(self->profiling);
+    PyObject *record_array;
+    if (self->mapped_view != NULL) {
+        record_array = FastqParser_create_record_array_from_buffer(
+            self, min_records, max_records);
+    }
+    else {
+        record_array = FastqParser_create_record_array_from_file(
+            self, min_records, max_records);
+    }
+    if (record_array != NULL && self->profiling) {
+        ModuleProfile_stop(&self->profile, start,
+                           ((FastqRecordArrayView *)record_array)->records,
+                           Py_SIZE(record_array));
+    }
+    return record_array;
+}
+
 static PyObject *
 FastqParser__next__(FastqParser *self)
 {
@@ -1081,9 +2007,41 @@ FastqParser_read(FastqParser *self, PyObject *number_of_records_obj)
                                            number_of_records);
 }
 
+PyDoc_STRVAR(FastqParser_profile__doc__,
+             "profile($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a dictionary with the performance counters of the "
+             "parser.\n"
+             "The time is only measured when profiling is set.\n");
+
+#define FastqParser_profile_method METH_NOARGS
+
+static PyObject *
+FastqParser_profile(FastqParser *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *profile = ModuleProfile_to_dict(&self->profile);
+    if (profile == NULL ||
+        dict_set_u64(profile, "buffer_allocations",
+                     self->buffer_allocations) != 0 ||
+        dict_set_u64(profile, "buffer_resizes", self->buffer_resizes) != 0) {
+        Py_XDECREF(profile);
+        return NULL;
+    }
+    return profile;
+}
+
 static PyMethodDef FastqParser_methods[] = {
     {"read", (PyCFunction)FastqParser_read, FastqParser_read_method,
      FastqParser_read__doc__},
+    {"profile", (PyCFunction)FastqParser_profile,
+     FastqParser_profile_method, FastqParser_profile__doc__},
+    {NULL},
+};
+
+static PyMemberDef FastqParser_members[] = {
+    {"profiling", T_BOOL, offsetof(FastqParser, profiling), 0,
+     "Measure the time spent parsing record arrays."},
     {NULL},
 };
 
@@ -1095,6 +2053,7 @@ PyTypeObject FastqParser_Type = {
     .tp_iter = (iternextfunc)FastqParser__iter__,
     .tp_iternext = (iternextfunc)FastqParser__next__,
     .tp_methods = FastqParser_methods,
+    .tp_members = FastqParser_members,
 };
 
 /**************
@@ -1112,6 +2071,9 @@ typedef struct _BamParserStruct {
     size_t meta_buffer_size;
     PyObject *file_obj;
     PyObject *header;  // The BAM header
+    char profiling;
+    struct ModuleProfile profile;
+    uint64_t buffer_resizes;
 } BamParser;
 
 static void
@@ -1223,6 +2185,9 @@ BamParser__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     self->read_in_size = read_in_size;
     self->meta_buffer = NULL;
     self->meta_buffer_size = 0;
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
+    self->buffer_resizes = 0;
     Py_INCREF(file_obj);
     self->file_obj = file_obj;
     self->header = header;
@@ -1347,7 +2312,7 @@ bam_tags_to_fastq_meta(const uint8_t *tags, size_t tags_length,
 }
 
 static PyObject *
-BamParser__next__(BamParser *self)
+BamParser_create_record_array(BamParser *self)
 {
     uint8_t *record_start = self->record_start;
     uint8_t *buffer_end = self->buffer_end;
@@ -1381,6 +2346,7 @@ BamParser__next__(BamParser *self)
             }
             self->read_in_buffer = tmp_read_in_buffer;
             self->read_in_buffer_size = minimum_space_required;
+            self->buffer_resizes += 1;
         }
         PyObject *buffer_view =
             PyMemoryView_FromMemory((char *)self->read_in_buffer + leftover_size,
@@ -1470,7 +2436,11 @@ BamParser__next__(BamParser *self)
             }
             /* The + and newlines are unncessary, but also do not require much
                space and compute time. So keep the in-memory presentation as
-               a FASTQ record for homogeneity with FASTQ input. */
+               a FASTQ record for homogeneity with FASTQ input. Decoding the
+               4-bit sequence with pshufb costs a small fraction of the time
+               the modules spend on a base, and the record is still in the
+               cache when the modules read it. So the modules do not need a
+               separate variant for the BAM encoding. */
             fastq_buffer_cursor += name_length;
             fastq_buffer_cursor[0] = '\n';
             fastq_buffer_cursor += 1;
@@ -1527,9 +2497,52 @@ BamParser__next__(BamParser *self)
     return record_array;
 }
 
+static PyObject *
+BamParser__next__(BamParser *self)
+{
+    uint64_t start = ModuleProfile_start(self->profiling);
+    PyObject *record_array = BamParser_create_record_array(self);
+    if (record_array != NULL && self->profiling) {
+        ModuleProfile_stop(&self->profile, start,
+                           ((FastqRecordArrayView *)record_array)->records,
+                           Py_SIZE(record_array));
+    }
+    return record_array;
+}
+
+PyDoc_STRVAR(BamParser_profile__doc__,
+             "profile($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a dictionary with the performance counters of the "
+             "parser.\n"
+             "The time is only measured when profiling is set.\n");
+
+#define BamParser_profile_method METH_NOARGS
+
+static PyObject *
+BamParser_profile(BamParser *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *profile = ModuleProfile_to_dict(&self->profile);
+    if (profile == NULL ||
+        dict_set_u64(profile, "buffer_resizes", self->buffer_resizes) != 0) {
+        Py_XDECREF(profile);
+        return NULL;
+    }
+    return profile;
+}
+
+static PyMethodDef BamParser_methods[] = {
+    {"profile", (PyCFunction)BamParser_profile,
+     BamParser_profile_method, BamParser_profile__doc__},
+    {NULL},
+};
+
 static PyMemberDef BamParser_members[] = {
     {"header", T_OBJECT_EX, offsetof(BamParser, header), READONLY,
      "The BAM header"},
+    {"profiling", T_BOOL, offsetof(BamParser, profiling), 0,
+     "Measure the time spent parsing record arrays."},
     {NULL}};
 
 PyTypeObject BamParser_Type = {
@@ -1539,9 +2552,208 @@ PyTypeObject BamParser_Type = {
     .tp_new = BamParser__new__,
     .tp_iter = (iternextfunc)BamParser__iter__,
     .tp_iternext = (iternextfunc)BamParser__next__,
+    .tp_methods = BamParser_methods,
     .tp_members = BamParser_members,
 };
 
+/********************
+ * POSITION BINNING *
+ ********************/
+
+/* QCMetrics and PerTileQuality store a table row for each position. A single
+   ultra-long read would make these tables huge and slow to flush, so only the
+   first exact_positions positions get a row of their own. The positions after
+   that are counted in bins which double in width every
+   POSITION_BINS_PER_OCTAVE rows. Because exact_positions is a power of two,
+   the bins start at a width of exact_positions / POSITION_BINS_PER_OCTAVE and
+   always align to the octaves. The number of rows grows with the logarithm of
+   the read length. The report collapses the positions into logarithmic
+   ranges, so the bins are invisible there. */
+
+#define POSITION_BINS_PER_OCTAVE 64
+#define DEFAULT_EXACT_POSITIONS 4096
+
+static int
+check_exact_positions(Py_ssize_t exact_positions)
+{
+    if (exact_positions < POSITION_BINS_PER_OCTAVE ||
+        (exact_positions & (exact_positions - 1)) != 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "exact_positions must be a power of 2 and at least %d, "
+                     "got %zd",
+                     POSITION_BINS_PER_OCTAVE, exact_positions);
+        return -1;
+    }
+    return 0;
+}
+
+/* Return the number of rows that are needed to store length positions. */
+static size_t
+position_bins_rows(size_t exact_positions, size_t length)
+{
+    if (length <= exact_positions) {
+        return length;
+    }
+    size_t rows = exact_positions;
+    size_t octave_start = exact_positions;
+    /* Written as a subtraction so the doubling can not overflow. */
+    while (length - octave_start > octave_start) {
+        rows += POSITION_BINS_PER_OCTAVE;
+        octave_start *= 2;
+    }
+    size_t bin_width = octave_start / POSITION_BINS_PER_OCTAVE;
+    return rows + (length - octave_start + bin_width - 1) / bin_width;
+}
+
+/* Return the row in which a position is stored. */
+static inline size_t
+position_bins_row(size_t exact_positions, size_t position)
+{
+    if (position < exact_positions) {
+        return position;
+    }
+    return position_bins_rows(exact_positions, position + 1) - 1;
+}
+
+/* Return a list of (start, stop) tuples with the positions of each row. */
+static PyObject *
+position_bins_ranges(size_t exact_positions, size_t length)
+{
+    size_t number_of_rows = position_bins_rows(exact_positions, length);
+    PyObject *ranges = PyList_New(number_of_rows);
+    if (ranges == NULL) {
+        return NULL;
+    }
+    size_t bin_start = 0;
+    size_t bin_width = 1;
+    for (size_t row = 0; row < number_of_rows; row++) {
+        if (bin_start == exact_positions) {
+            bin_width = exact_positions / POSITION_BINS_PER_OCTAVE;
+        }
+        else if (bin_start > exact_positions &&
+                 bin_start == bin_width * POSITION_BINS_PER_OCTAVE * 2) {
+            bin_width *= 2;
+        }
+        size_t bin_stop = Py_MIN(bin_start + bin_width, length);
+        PyObject *entry = Py_BuildValue("(nn)", (Py_ssize_t)bin_start,
+                                        (Py_ssize_t)bin_stop);
+        if (entry == NULL) {
+            Py_DECREF(ranges);
+            return NULL;
+        }
+        PyList_SET_ITEM(ranges, row, entry);
+        bin_start += bin_width;
+    }
+    return ranges;
+}
+
+struct RowRange {
+    size_t start;
+    size_t stop;
+};
+
+/* Convert a sequence of (start, stop) tuples with row indices into an array
+   of RowRange structs. The array must be freed with PyMem_Free. On error
+   NULL is returned with an exception set. */
+static struct RowRange *
+row_ranges_from_sequence(PyObject *ranges, size_t number_of_rows,
+                         Py_ssize_t *number_of_ranges)
+{
+    PyObject *ranges_fast =
+        PySequence_Fast(ranges, "ranges must be a sequence");
+    if (ranges_fast == NULL) {
+        return NULL;
+    }
+    Py_ssize_t length = PySequence_Fast_GET_SIZE(ranges_fast);
+    struct RowRange *row_ranges =
+        PyMem_Malloc(Py_MAX(length, 1) * sizeof(struct RowRange));
+    if (row_ranges == NULL) {
+        Py_DECREF(ranges_fast);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    PyObject **items = PySequence_Fast_ITEMS(ranges_fast);
+    for (Py_ssize_t i = 0; i < length; i++) {
+        Py_ssize_t start;
+        Py_ssize_t stop;
+        if (!PyTuple_Check(items[i])) {
+            PyErr_Format(PyExc_TypeError,
+                         "ranges must contain (start, stop) tuples, got %R",
+                         items[i]);
+            goto error;
+        }
+        if (!PyArg_ParseTuple(items[i], "nn", &start, &stop)) {
+            goto error;
+        }
+        if (start < 0 || stop < start || (size_t)stop > number_of_rows) {
+            PyErr_Format(PyExc_ValueError,
+                         "Range (%zd, %zd) is not within the %zu rows of the "
+                         "table.", start, stop, number_of_rows);
+            goto error;
+        }
+        row_ranges[i].start = start;
+        row_ranges[i].stop = stop;
+    }
+    Py_DECREF(ranges_fast);
+    *number_of_ranges = length;
+    return row_ranges;
+error:
+    Py_DECREF(ranges_fast);
+    PyMem_Free(row_ranges);
+    return NULL;
+}
+
+/* Sum the rows of a count table with table_width columns for each range and
+   return the result as an array.array with one row per range. */
+static PyObject *
+aggregate_count_table(const uint64_t *table, size_t table_width,
+                      size_t number_of_rows, PyObject *ranges)
+{
+    Py_ssize_t number_of_ranges = 0;
+    struct RowRange *row_ranges =
+        row_ranges_from_sequence(ranges, number_of_rows, &number_of_ranges);
+    if (row_ranges == NULL) {
+        return NULL;
+    }
+    size_t aggregated_size =
+        number_of_ranges * table_width * sizeof(uint64_t);
+    uint64_t *aggregated = PyMem_Calloc(Py_MAX(aggregated_size, 1), 1);
+    if (aggregated == NULL) {
+        PyMem_Free(row_ranges);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < number_of_ranges; i++) {
+        uint64_t *aggregated_row = aggregated + i * table_width;
+        for (size_t row = row_ranges[i].start; row < row_ranges[i].stop;
+             row++) {
+            const uint64_t *table_row = table + row * table_width;
+            for (size_t j = 0; j < table_width; j++) {
+                aggregated_row[j] += table_row[j];
+            }
+        }
+    }
+    PyObject *result =
+        PythonArray_FromBuffer('Q', aggregated, aggregated_size);
+    PyMem_Free(aggregated);
+    PyMem_Free(row_ranges);
+    return result;
+}
+
+/* Like PyMem_RawRealloc, but the new part of the memory is zeroed. On
+   failure NULL is returned and the original memory is left intact. */
+static void *
+realloc_zeroed(void *memory, size_t old_size, size_t new_size)
+{
+    uint8_t *new_memory = PyMem_RawRealloc(memory, new_size);
+    if (new_memory == NULL) {
+        return NULL;
+    }
+    if (new_size > old_size) {
+        memset(new_memory + old_size, 0, new_size - old_size);
+    }
+    return new_memory;
+}
+
 /**************
  * QC METRICS *
  **************/
@@ -1599,88 +2811,297 @@ phred_to_index(uint8_t phred)
     return phred >> 2;
 }
 
+/* Illumina NovaSeq and NovaSeq X instruments bin their qualities into three
+   or four distinct values. The first QUALITY_BINS_DETECTION_READS reads are
+   scanned for the values that occur. When there are at most
+   QUALITY_BINS_MAX of them, the vectorized kernels classify the phreds
+   with a few comparisons and look up the error rates with a permute rather
+   than a gather. The error rates are still added position by position, so
+   the results are identical to those of the generic kernels. A chunk with
+   any other value disables the quality bins for the rest of the run and is
+   left to the generic code. Unused bins repeat the last bin, which keeps
+   every bin index mapping to a valid phred. */
+#define QUALITY_BINS_MAX 4
+#define QUALITY_BINS_DETECTION_READS 1000
+
+enum QualityBinsState {
+    QUALITY_BINS_DETECTING,
+    QUALITY_BINS_ACTIVE,
+    QUALITY_BINS_DISABLED,
+};
+
+struct QualityBins {
+    uint8_t state;
+    uint8_t number_of_bins;
+    uint8_t phreds[QUALITY_BINS_MAX];
+    double error_rates[QUALITY_BINS_MAX];
+    uint64_t seen_phreds[2];
+    size_t detection_reads;
+};
+
+static void
+QualityBins_init(struct QualityBins *bins, int supported)
+{
+    memset(bins, 0, sizeof(struct QualityBins));
+    bins->state = supported ? QUALITY_BINS_DETECTING : QUALITY_BINS_DISABLED;
+}
+
+static void
+QualityBins_detect(struct QualityBins *bins, const uint8_t *qualities,
+                   size_t length, uint8_t phred_offset)
+{
+    for (size_t i = 0; i < length; i++) {
+        uint8_t q = qualities[i] - phred_offset;
+        if (q > PHRED_MAX) {
+            /* The counting code raises the error. */
+            bins->state = QUALITY_BINS_DISABLED;
+            return;
+        }
+        bins->seen_phreds[q >> 6] |= 1ULL << (q & 63);
+    }
+    bins->detection_reads += 1;
+    if (bins->detection_reads < QUALITY_BINS_DETECTION_READS) {
+        return;
+    }
+    bins->state = QUALITY_BINS_DISABLED;
+    size_t number_of_bins = 0;
+    uint8_t phreds[PHRED_MAX + 1];
+    for (uint8_t q = 0; q <= PHRED_MAX; q++) {
+        if (bins->seen_phreds[q >> 6] & (1ULL << (q & 63))) {
+            phreds[number_of_bins] = q;
+            number_of_bins += 1;
+        }
+    }
+    if (number_of_bins == 0 || number_of_bins > QUALITY_BINS_MAX) {
+        return;
+    }
+    for (size_t i = 0; i < QUALITY_BINS_MAX; i++) {
+        uint8_t q = phreds[Py_MIN(i, number_of_bins - 1)];
+        bins->phreds[i] = q;
+        bins->error_rates[i] = SCORE_TO_ERROR_RATE[q];
+    }
+    bins->number_of_bins = number_of_bins;
+    bins->state = QUALITY_BINS_ACTIVE;
+}
+
+/* Add the active quality bins to a profile dictionary, or None when the
+   quality bins are not in use. */
+static int
+dict_set_quality_bins(PyObject *dict, const struct QualityBins *bins)
+{
+    PyObject *value_obj;
+    if (bins->state == QUALITY_BINS_ACTIVE) {
+        value_obj = PyList_New(bins->number_of_bins);
+        if (value_obj == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < bins->number_of_bins; i++) {
+            PyObject *phred = PyLong_FromLong(bins->phreds[i]);
+            if (phred == NULL) {
+                Py_DECREF(value_obj);
+                return -1;
+            }
+            PyList_SET_ITEM(value_obj, i, phred);
+        }
+    }
+    else {
+        Py_INCREF(Py_None);
+        value_obj = Py_None;
+    }
+    int ret = PyDict_SetItemString(dict, "quality_bins", value_obj);
+    Py_DECREF(value_obj);
+    return ret;
+}
+
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+/* Store the bin index of each of the 32 phreds in bin_indices. Returns 0
+   when one of the phreds does not belong to a bin. */
+__attribute__((__target__("avx2"))) static inline int
+QualityBins_classify_avx2(const __m256i bin_phreds[QUALITY_BINS_MAX],
+                          __m256i phreds, __m256i *bin_indices)
+{
+    __m256i is_bin0 = _mm256_cmpeq_epi8(phreds, bin_phreds[0]);
+    __m256i is_bin1 = _mm256_cmpeq_epi8(phreds, bin_phreds[1]);
+    __m256i is_bin2 = _mm256_cmpeq_epi8(phreds, bin_phreds[2]);
+    __m256i is_bin3 = _mm256_cmpeq_epi8(phreds, bin_phreds[3]);
+    __m256i in_bin = _mm256_or_si256(_mm256_or_si256(is_bin0, is_bin1),
+                                     _mm256_or_si256(is_bin2, is_bin3));
+    if (_mm256_movemask_epi8(in_bin) != -1) {
+        return 0;
+    }
+    /* Repeated bins match more than once, the highest index wins. */
+    *bin_indices = _mm256_max_epu8(
+        _mm256_max_epu8(_mm256_and_si256(is_bin1, _mm256_set1_epi8(1)),
+                        _mm256_and_si256(is_bin2, _mm256_set1_epi8(2))),
+        _mm256_and_si256(is_bin3, _mm256_set1_epi8(3)));
+    return 1;
+}
+
+/* Return the error rates of the four positions whose bin indices are in the
+   low four bytes of bin_indices. error_rates holds the four doubles of
+   QualityBins.error_rates, which are selected as pairs of 32-bit halves. */
+__attribute__((__target__("avx2"))) static inline __m256d
+QualityBins_error_rates_avx2(__m256i error_rates, __m128i bin_indices)
+{
+    __m128i low_halves = _mm_add_epi8(bin_indices, bin_indices);
+    __m128i high_halves = _mm_add_epi8(low_halves, _mm_set1_epi8(1));
+    __m256i permute =
+        _mm256_cvtepu8_epi32(_mm_unpacklo_epi8(low_halves, high_halves));
+    return _mm256_castsi256_pd(
+        _mm256_permutevar8x32_epi32(error_rates, permute));
+}
+#endif
+
+typedef uint16_t staging_quality_bin_table[QUALITY_BINS_MAX];
+
+/* The staging tables only cover the exact positions. The positions in the
+   bins are counted directly in the base and phred tables, as a bin can
+   receive more than UINT16_MAX counts from a single read. staging_length
+   tracks the highest position written since the last flush, so a flush only
+   touches the part of the staging tables that is in use. Phreds counted
+   by the quality bin kernel go into staging_quality_bin_counts and are
+   added to the phred table rows of their bins on a flush. */
 typedef struct _QCMetricsStruct {
     PyObject_HEAD
     uint8_t phred_offset;
     uint16_t staging_count;
     size_t max_length;
+    size_t exact_positions;
+    size_t number_of_rows;
+    size_t staging_length;
     staging_base_table *staging_base_counts;
     staging_phred_table *staging_phred_counts;
+    staging_quality_bin_table *staging_quality_bin_counts;
     base_table *base_counts;
     phred_table *phred_counts;
+    uint64_t *length_counts;
     size_t number_of_reads;
     uint64_t gc_content[101];
     uint64_t phred_scores[PHRED_MAX + 1];
+    uint64_t staging_flushes;
+    struct QualityBins quality_bins;
+    char profiling;
+    struct ModuleProfile profile;
 } QCMetrics;
 
+/* Only set when a vectorized quality bin kernel is available. */
+static int (*QCMetrics_count_quality_bins)(
+    QCMetrics *self, const uint8_t *qualities, size_t sequence_length,
+    double *accumulated_error_rate) = NULL;
+
 static void
 QCMetrics_dealloc(QCMetrics *self)
 {
-    PyMem_Free(self->staging_base_counts);
-    PyMem_Free(self->staging_phred_counts);
-    PyMem_Free(self->base_counts);
-    PyMem_Free(self->phred_counts);
+    PyMem_RawFree(self->staging_base_counts);
+    PyMem_RawFree(self->staging_phred_counts);
+    PyMem_RawFree(self->staging_quality_bin_counts);
+    PyMem_RawFree(self->base_counts);
+    PyMem_RawFree(self->phred_counts);
+    PyMem_RawFree(self->length_counts);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 static PyObject *
 QCMetrics__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
-    static char *kwargnames[] = {NULL};
-    static char *format = ":QCMetrics";
+    Py_ssize_t exact_positions = DEFAULT_EXACT_POSITIONS;
+    static char *kwargnames[] = {"exact_positions", NULL};
+    static char *format = "|n:QCMetrics";
     uint8_t phred_offset = 33;
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames,
+                                     &exact_positions)) {
+        return NULL;
+    }
+    if (check_exact_positions(exact_positions) != 0) {
         return NULL;
     }
     QCMetrics *self = PyObject_New(QCMetrics, type);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
     self->max_length = 0;
+    self->exact_positions = exact_positions;
+    self->number_of_rows = 0;
+    self->staging_length = 0;
     self->phred_offset = phred_offset;
     self->staging_base_counts = NULL;
     self->staging_phred_counts = NULL;
+    self->staging_quality_bin_counts = NULL;
     self->base_counts = NULL;
     self->phred_counts = NULL;
+    self->length_counts = NULL;
     self->number_of_reads = 0;
+    self->staging_count = 0;
     memset(self->gc_content, 0, 101 * sizeof(uint64_t));
     memset(self->phred_scores, 0, (PHRED_MAX + 1) * sizeof(uint64_t));
+    self->staging_flushes = 0;
+    QualityBins_init(&self->quality_bins,
+                     QCMetrics_count_quality_bins != NULL);
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
     return (PyObject *)self;
 }
 
 static int
-QCMetrics_resize(QCMetrics *self, Py_ssize_t new_size)
+QCMetrics_resize(QCMetrics *self, size_t new_length)
 {
-    staging_base_table *staging_base_tmp = PyMem_Realloc(
-        self->staging_base_counts, new_size * sizeof(staging_base_table));
-    staging_phred_table *staging_phred_tmp = PyMem_Realloc(
-        self->staging_phred_counts, new_size * sizeof(staging_phred_table));
-    base_table *base_table_tmp =
-        PyMem_Realloc(self->base_counts, new_size * sizeof(base_table));
-    phred_table *phred_table_tmp =
-        PyMem_Realloc(self->phred_counts, new_size * sizeof(phred_table));
-
-    if (staging_base_tmp == NULL || staging_phred_tmp == NULL ||
-        base_table_tmp == NULL || phred_table_tmp == NULL) {
-        PyErr_NoMemory();
-        PyMem_Free(staging_base_tmp);
-        PyMem_Free(staging_phred_tmp);
-        PyMem_Free(base_table_tmp);
-        PyMem_Free(phred_table_tmp);
-        return -1;
+    size_t exact_positions = self->exact_positions;
+    size_t old_staging = Py_MIN(self->max_length, exact_positions);
+    size_t new_staging = Py_MIN(new_length, exact_positions);
+    size_t old_rows = self->number_of_rows;
+    size_t new_rows = position_bins_rows(exact_positions, new_length);
+
+    /* Each table is stored as soon as it is reallocated, so no memory is
+       lost or freed twice when a later allocation fails. */
+    staging_base_table *staging_base_tmp = realloc_zeroed(
+        self->staging_base_counts, old_staging * sizeof(staging_base_table),
+        new_staging * sizeof(staging_base_table));
+    if (staging_base_tmp == NULL) {
+        goto error;
     }
-
-    size_t old_size = self->max_length;
-    size_t new_slots = new_size - old_size;
-    memset(staging_base_tmp + old_size, 0, new_slots * sizeof(staging_base_table));
-    memset(staging_phred_tmp + old_size, 0,
-           new_slots * sizeof(staging_phred_table));
-    memset(base_table_tmp + old_size, 0, new_slots * sizeof(base_table));
-    memset(phred_table_tmp + old_size, 0, new_slots * sizeof(phred_table));
-
     self->staging_base_counts = staging_base_tmp;
+    staging_phred_table *staging_phred_tmp = realloc_zeroed(
+        self->staging_phred_counts, old_staging * sizeof(staging_phred_table),
+        new_staging * sizeof(staging_phred_table));
+    if (staging_phred_tmp == NULL) {
+        goto error;
+    }
     self->staging_phred_counts = staging_phred_tmp;
+    staging_quality_bin_table *staging_quality_bin_tmp = realloc_zeroed(
+        self->staging_quality_bin_counts,
+        old_staging * sizeof(staging_quality_bin_table),
+        new_staging * sizeof(staging_quality_bin_table));
+    if (staging_quality_bin_tmp == NULL) {
+        goto error;
+    }
+    self->staging_quality_bin_counts = staging_quality_bin_tmp;
+    base_table *base_table_tmp =
+        realloc_zeroed(self->base_counts, old_rows * sizeof(base_table),
+                       new_rows * sizeof(base_table));
+    if (base_table_tmp == NULL) {
+        goto error;
+    }
     self->base_counts = base_table_tmp;
+    phred_table *phred_table_tmp =
+        realloc_zeroed(self->phred_counts, old_rows * sizeof(phred_table),
+                       new_rows * sizeof(phred_table));
+    if (phred_table_tmp == NULL) {
+        goto error;
+    }
     self->phred_counts = phred_table_tmp;
-    self->max_length = new_size;
+    uint64_t *length_counts_tmp =
+        realloc_zeroed(self->length_counts, old_rows * sizeof(uint64_t),
+                       new_rows * sizeof(uint64_t));
+    if (length_counts_tmp == NULL) {
+        goto error;
+    }
+    self->length_counts = length_counts_tmp;
+    self->max_length = new_length;
+    self->number_of_rows = new_rows;
     return 0;
+error:
+    set_no_memory_error_gil_safe();
+    return -1;
 }
 
 static void
@@ -1689,9 +3110,10 @@ QCMetrics_flush_staging(QCMetrics *self)
     if (self->staging_count == 0) {
         return;
     }
+    self->staging_flushes += 1;
     uint64_t *base_counts = (uint64_t *)self->base_counts;
     uint16_t *staging_base_counts = (uint16_t *)self->staging_base_counts;
-    size_t number_of_base_slots = self->max_length * NUC_TABLE_SIZE;
+    size_t number_of_base_slots = self->staging_length * NUC_TABLE_SIZE;
     /* base counts is only updated once every 65535 times. So make sure it
        does not pollute the cache and use non temporal prefetching. The
        same goes for phred counts.
@@ -1706,45 +3128,43 @@ QCMetrics_flush_staging(QCMetrics *self)
 
     uint64_t *phred_counts = (uint64_t *)self->phred_counts;
     uint16_t *staging_phred_counts = (uint16_t *)self->staging_phred_counts;
-    size_t number_of_phred_slots = self->max_length * PHRED_TABLE_SIZE;
+    size_t number_of_phred_slots = self->staging_length * PHRED_TABLE_SIZE;
     non_temporal_write_prefetch(phred_counts);
     for (size_t i = 0; i < number_of_phred_slots; i++) {
         phred_counts[i] += staging_phred_counts[i];
         non_temporal_write_prefetch(phred_counts + i + 8);
     }
-    memset(staging_phred_counts, 0, number_of_phred_slots * sizeof(uint16_t));
-
-    self->staging_count = 0;
-}
-
-static inline int
-QCMetrics_add_meta(QCMetrics *self, struct FastqMeta *meta)
-{
-    const uint8_t *record_start = meta->record_start;
-    size_t sequence_length = meta->sequence_length;
-    const uint8_t *sequence = record_start + meta->sequence_offset;
-    const uint8_t *qualities = record_start + meta->qualities_offset;
-
-    if (sequence_length > self->max_length) {
-        if (QCMetrics_resize(self, sequence_length) != 0) {
-            return -1;
-        }
-    }
+    memset(staging_phred_counts, 0, number_of_phred_slots * sizeof(uint16_t));
 
-    self->number_of_reads += 1;
-    if (self->staging_count >= UINT16_MAX) {
-        QCMetrics_flush_staging(self);
+    /* Counts are only present once the quality bins have been active. */
+    struct QualityBins *bins = &self->quality_bins;
+    if (bins->number_of_bins != 0) {
+        for (size_t i = 0; i < self->staging_length; i++) {
+            uint16_t *bin_counts = self->staging_quality_bin_counts[i];
+            for (size_t j = 0; j < QUALITY_BINS_MAX; j++) {
+                self->phred_counts[i][phred_to_index(bins->phreds[j])] +=
+                    bin_counts[j];
+            }
+        }
+        memset(self->staging_quality_bin_counts, 0,
+               self->staging_length * sizeof(staging_quality_bin_table));
     }
-    self->staging_count += 1;
 
-    staging_base_table *staging_base_counts_ptr = self->staging_base_counts;
+    self->staging_count = 0;
+    self->staging_length = 0;
+}
+
+/* A 64-bit integer can be used as 2 consecutive 32 bit integers. Using
+   a bit of shifting, this means no memory access is needed to count
+   the nucleotide counts for the GC content calculation.
+   We can also count at_counts and gc_counts together.  */
+static uint64_t
+QCMetrics_count_bases_default(staging_base_table *staging_base_counts_ptr,
+                              const uint8_t *sequence, size_t sequence_length)
+{
     const uint8_t *sequence_ptr = sequence;
     const uint8_t *end_ptr = sequence + sequence_length;
     const uint8_t *unroll_end_ptr = end_ptr - 3;
-    /* A 64-bit integer can be used as 2 consecutive 32 bit integers. Using
-       a bit of shifting, this means no memory access is needed to count
-       the nucleotide counts for the GC content calculation.
-       We can also count at_counts and gc_counts together.  */
     static const uint64_t count_integers[5] = {
         /*  A   , C            , G            , T   , N */
         1ULL, 1ULL << 32ULL, 1ULL << 32ULL, 1ULL, 0};
@@ -1780,26 +3200,27 @@ QCMetrics_add_meta(QCMetrics *self, struct FastqMeta *meta)
         sequence_ptr += 1;
         staging_base_counts_ptr += 1;
     }
-    uint64_t base_counts =
-        base_counts0 + base_counts1 + base_counts2 + base_counts3;
-    uint64_t at_counts = base_counts & 0xFFFFFFFF;
-    uint64_t gc_counts = (base_counts >> 32) & 0xFFFFFFFF;
-    double gc_content_percentage =
-        (double)gc_counts * (double)100.0 / (double)(at_counts + gc_counts);
-    uint64_t gc_content_index = (uint64_t)round(gc_content_percentage);
-    assert(gc_content_index >= 0);
-    assert(gc_content_index <= 100);
-    self->gc_content[gc_content_index] += 1;
+    return base_counts0 + base_counts1 + base_counts2 + base_counts3;
+}
 
-    staging_phred_table *staging_phred_counts_ptr = self->staging_phred_counts;
+/* Counts the phred scores starting with the given four accumulators. The
+   accumulators map to positions 0, 1, 2 and 3 modulo 4. Vectorized versions
+   use the same lane layout, so the summation order and therefore the
+   resulting double is identical regardless of the code path taken. */
+static int
+QCMetrics_count_qualities_scalar(staging_phred_table *staging_phred_counts_ptr,
+                                 const uint8_t *qualities,
+                                 size_t sequence_length, uint8_t phred_offset,
+                                 double accumulators[4],
+                                 double *accumulated_error_rate)
+{
     const uint8_t *qualities_ptr = qualities;
     const uint8_t *qualities_end_ptr = qualities + sequence_length;
     const uint8_t *qualities_unroll_end_ptr = qualities_end_ptr - 4;
-    uint8_t phred_offset = self->phred_offset;
-    double accumulator0 = 0.0;
-    double accumulator1 = 0.0;
-    double accumulator2 = 0.0;
-    double accumulator3 = 0.0;
+    double accumulator0 = accumulators[0];
+    double accumulator1 = accumulators[1];
+    double accumulator2 = accumulators[2];
+    double accumulator3 = accumulators[3];
     while (qualities_ptr < qualities_unroll_end_ptr) {
         uint8_t q0 = qualities_ptr[0] - phred_offset;
         uint8_t q1 = qualities_ptr[1] - phred_offset;
@@ -1830,21 +3251,465 @@ QCMetrics_add_meta(QCMetrics *self, struct FastqMeta *meta)
         staging_phred_counts_ptr += 4;
         qualities_ptr += 4;
     }
-    double accumulated_error_rate =
+    double error_rate_sum =
         accumulator0 + accumulator1 + accumulator2 + accumulator3;
     while (qualities_ptr < qualities_end_ptr) {
         uint8_t q = *qualities_ptr - phred_offset;
         if (q > PHRED_MAX) {
-            PyErr_Format(PyExc_ValueError, "Not a valid phred character: %c",
-                         *qualities_ptr);
+            set_phred_error_gil_safe(*qualities_ptr);
             return -1;
         }
         uint8_t q_index = phred_to_index(q);
         staging_phred_counts_ptr[0][q_index] += 1;
-        accumulated_error_rate += SCORE_TO_ERROR_RATE[q];
+        error_rate_sum += SCORE_TO_ERROR_RATE[q];
         staging_phred_counts_ptr += 1;
         qualities_ptr += 1;
     }
+    *accumulated_error_rate = error_rate_sum;
+    return 0;
+}
+
+static int
+QCMetrics_count_qualities_default(staging_phred_table *staging_phred_counts_ptr,
+                                  const uint8_t *qualities,
+                                  size_t sequence_length, uint8_t phred_offset,
+                                  double *accumulated_error_rate)
+{
+    double accumulators[4] = {0.0, 0.0, 0.0, 0.0};
+    return QCMetrics_count_qualities_scalar(
+        staging_phred_counts_ptr, qualities, sequence_length, phred_offset,
+        accumulators, accumulated_error_rate);
+}
+
+static uint64_t (*QCMetrics_count_bases)(
+    staging_base_table *staging_base_counts_ptr, const uint8_t *sequence,
+    size_t sequence_length) = QCMetrics_count_bases_default;
+
+static int (*QCMetrics_count_qualities)(
+    staging_phred_table *staging_phred_counts_ptr, const uint8_t *qualities,
+    size_t sequence_length, uint8_t phred_offset,
+    double *accumulated_error_rate) = QCMetrics_count_qualities_default;
+
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+/* Shuffle masks and nucleotide patterns to expand 16 nucleotide indices
+   into the 80 uint16_t counters that 16 consecutive staging_base_table
+   entries occupy. Counter k belongs to position k / 5 and nucleotide
+   index k % 5. */
+// clang-format off
+static const int8_t BASE_TABLE_EXPAND_SHUFFLE[NUC_TABLE_SIZE][32] = {
+    {0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1,
+     1, -1, 1, -1, 2, -1, 2, -1, 2, -1, 2, -1, 2, -1, 3, -1},
+    {3, -1, 3, -1, 3, -1, 3, -1, 4, -1, 4, -1, 4, -1, 4, -1,
+     4, -1, 5, -1, 5, -1, 5, -1, 5, -1, 5, -1, 6, -1, 6, -1},
+    {6, -1, 6, -1, 6, -1, 7, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+     8, -1, 8, -1, 8, -1, 8, -1, 8, -1, 9, -1, 9, -1, 9, -1},
+    {9, -1, 9, -1, 10, -1, 10, -1, 10, -1, 10, -1, 10, -1, 11, -1,
+     11, -1, 11, -1, 11, -1, 11, -1, 12, -1, 12, -1, 12, -1, 12, -1},
+    {12, -1, 13, -1, 13, -1, 13, -1, 13, -1, 13, -1, 14, -1, 14, -1,
+     14, -1, 14, -1, 14, -1, 15, -1, 15, -1, 15, -1, 15, -1, 15, -1},
+};
+static const int16_t BASE_TABLE_EXPAND_NUCLEOTIDE[NUC_TABLE_SIZE][16] = {
+    {0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0},
+    {1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1},
+    {2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2},
+    {3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3},
+    {4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4},
+};
+// clang-format on
+
+/* Same as above, for the PHRED_TABLE_SIZE counters per position of
+   staging_phred_table. */
+// clang-format off
+static const int8_t PHRED_TABLE_EXPAND_SHUFFLE[PHRED_TABLE_SIZE][32] = {
+    {0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1,
+     0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1, -1},
+    {1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1,
+     2, -1, 2, -1, 2, -1, 2, -1, 2, -1, 2, -1, 2, -1, 2, -1},
+    {2, -1, 2, -1, 2, -1, 2, -1, 3, -1, 3, -1, 3, -1, 3, -1,
+     3, -1, 3, -1, 3, -1, 3, -1, 3, -1, 3, -1, 3, -1, 3, -1},
+    {4, -1, 4, -1, 4, -1, 4, -1, 4, -1, 4, -1, 4, -1, 4, -1,
+     4, -1, 4, -1, 4, -1, 4, -1, 5, -1, 5, -1, 5, -1, 5, -1},
+    {5, -1, 5, -1, 5, -1, 5, -1, 5, -1, 5, -1, 5, -1, 5, -1,
+     6, -1, 6, -1, 6, -1, 6, -1, 6, -1, 6, -1, 6, -1, 6, -1},
+    {6, -1, 6, -1, 6, -1, 6, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+     7, -1, 7, -1, 7, -1, 7, -1, 7, -1, 7, -1, 7, -1, 7, -1},
+    {8, -1, 8, -1, 8, -1, 8, -1, 8, -1, 8, -1, 8, -1, 8, -1,
+     8, -1, 8, -1, 8, -1, 8, -1, 9, -1, 9, -1, 9, -1, 9, -1},
+    {9, -1, 9, -1, 9, -1, 9, -1, 9, -1, 9, -1, 9, -1, 9, -1,
+     10, -1, 10, -1, 10, -1, 10, -1, 10, -1, 10, -1, 10, -1, 10, -1},
+    {10, -1, 10, -1, 10, -1, 10, -1, 11, -1, 11, -1, 11, -1, 11, -1,
+     11, -1, 11, -1, 11, -1, 11, -1, 11, -1, 11, -1, 11, -1, 11, -1},
+    {12, -1, 12, -1, 12, -1, 12, -1, 12, -1, 12, -1, 12, -1, 12, -1,
+     12, -1, 12, -1, 12, -1, 12, -1, 13, -1, 13, -1, 13, -1, 13, -1},
+    {13, -1, 13, -1, 13, -1, 13, -1, 13, -1, 13, -1, 13, -1, 13, -1,
+     14, -1, 14, -1, 14, -1, 14, -1, 14, -1, 14, -1, 14, -1, 14, -1},
+    {14, -1, 14, -1, 14, -1, 14, -1, 15, -1, 15, -1, 15, -1, 15, -1,
+     15, -1, 15, -1, 15, -1, 15, -1, 15, -1, 15, -1, 15, -1, 15, -1},
+};
+static const int16_t PHRED_TABLE_EXPAND_INDEX[PHRED_TABLE_SIZE][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3},
+    {4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7},
+    {8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3},
+    {4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7},
+    {8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3},
+    {4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7},
+    {8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3},
+    {4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7},
+    {8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+};
+// clang-format on
+
+/* Add 16 one-hot encoded table entries to the number_of_vectors * 16
+   uint16_t counters at counters. */
+__attribute__((__target__("avx2"))) static inline void
+staging_table_add_16_avx2(uint16_t *counters, __m128i table_indices,
+                          const int8_t (*expand_shuffle)[32],
+                          const int16_t (*expand_index)[16],
+                          size_t number_of_vectors)
+{
+    __m256i indices = _mm256_broadcastsi128_si256(table_indices);
+    for (size_t i = 0; i < number_of_vectors; i++) {
+        __m256i shuffle =
+            _mm256_loadu_si256((const __m256i *)expand_shuffle[i]);
+        __m256i expected =
+            _mm256_loadu_si256((const __m256i *)expand_index[i]);
+        __m256i one_hot = _mm256_and_si256(
+            _mm256_cmpeq_epi16(_mm256_shuffle_epi8(indices, shuffle),
+                               expected),
+            _mm256_set1_epi16(1));
+        __m256i *counter_ptr = (__m256i *)(counters + i * 16);
+        _mm256_storeu_si256(
+            counter_ptr,
+            _mm256_add_epi16(_mm256_loadu_si256(counter_ptr), one_hot));
+    }
+}
+
+__attribute__((__target__("avx2,popcnt"))) static uint64_t
+QCMetrics_count_bases_avx2(staging_base_table *staging_base_counts_ptr,
+                           const uint8_t *sequence, size_t sequence_length)
+{
+    /* Classify 32 nucleotides at once. Clearing the lowercase bit (32) maps
+       a, c, g and t onto their uppercase counterparts, and no other
+       character below 128 onto A, C, G or T, so this matches
+       NUCLEOTIDE_TO_INDEX. The AT and GC counts follow from the movemasks.
+       Rather than incrementing 32 counters one by one, the indices are
+       expanded to one-hot vectors that are added to the staging table. */
+    size_t at_counts = 0;
+    size_t gc_counts = 0;
+    size_t i = 0;
+    __m256i lowercase_bit = _mm256_set1_epi8(32);
+    while (i + 32 <= sequence_length) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(sequence + i));
+        __m256i upper = _mm256_andnot_si256(lowercase_bit, chunk);
+        __m256i is_a = _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('A'));
+        __m256i is_c = _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('C'));
+        __m256i is_g = _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('G'));
+        __m256i is_t = _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('T'));
+        __m256i is_at = _mm256_or_si256(is_a, is_t);
+        __m256i is_gc = _mm256_or_si256(is_c, is_g);
+        __m256i index_vec = _mm256_or_si256(
+            _mm256_andnot_si256(_mm256_or_si256(is_at, is_gc),
+                                _mm256_set1_epi8(N)),
+            _mm256_or_si256(
+                _mm256_and_si256(is_c, _mm256_set1_epi8(C)),
+                _mm256_or_si256(_mm256_and_si256(is_g, _mm256_set1_epi8(G)),
+                                _mm256_and_si256(is_t, _mm256_set1_epi8(T)))));
+        at_counts += __builtin_popcount(_mm256_movemask_epi8(is_at));
+        gc_counts += __builtin_popcount(_mm256_movemask_epi8(is_gc));
+        staging_table_add_16_avx2(
+            (uint16_t *)staging_base_counts_ptr,
+            _mm256_castsi256_si128(index_vec), BASE_TABLE_EXPAND_SHUFFLE,
+            BASE_TABLE_EXPAND_NUCLEOTIDE, NUC_TABLE_SIZE);
+        staging_table_add_16_avx2(
+            (uint16_t *)(staging_base_counts_ptr + 16),
+            _mm256_extracti128_si256(index_vec, 1), BASE_TABLE_EXPAND_SHUFFLE,
+            BASE_TABLE_EXPAND_NUCLEOTIDE, NUC_TABLE_SIZE);
+        staging_base_counts_ptr += 32;
+        i += 32;
+    }
+    /* Avoid AVX-SSE transition penalties in the scalar remainder. */
+    _mm256_zeroupper();
+    return ((uint64_t)gc_counts << 32) + (uint64_t)at_counts +
+           QCMetrics_count_bases_default(staging_base_counts_ptr, sequence + i,
+                                         sequence_length - i);
+}
+
+__attribute__((__target__("avx2"))) static int
+QCMetrics_count_qualities_avx2(staging_phred_table *staging_phred_counts_ptr,
+                               const uint8_t *qualities,
+                               size_t sequence_length, uint8_t phred_offset,
+                               double *accumulated_error_rate)
+{
+    /* Validate and index 32 phreds at once. The error rates are gathered
+       four at a time so accumulator lane k, just like accumulatork in the
+       scalar code, holds every position that is k modulo 4. A chunk
+       containing an invalid phred is left to the scalar code which
+       produces the error. The loop bound replicates the scalar unroll
+       bound so the same positions end up in the same lanes. */
+    uint8_t scores[32];
+    __m256d accumulator = _mm256_setzero_pd();
+    __m256i offset_vec = _mm256_set1_epi8(phred_offset);
+    __m256i phred_max_vec = _mm256_set1_epi8(PHRED_MAX);
+    size_t i = 0;
+    while (i + 32 < sequence_length) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(qualities + i));
+        __m256i phreds = _mm256_sub_epi8(chunk, offset_vec);
+        __m256i valid = _mm256_cmpeq_epi8(
+            _mm256_max_epu8(phreds, phred_max_vec), phred_max_vec);
+        if (_mm256_movemask_epi8(valid) != -1) {
+            break;
+        }
+        __m256i index_vec = _mm256_and_si256(
+            _mm256_srli_epi16(
+                _mm256_min_epu8(phreds, _mm256_set1_epi8(PHRED_LIMIT)), 2),
+            _mm256_set1_epi8(0x3F));
+        staging_table_add_16_avx2(
+            (uint16_t *)staging_phred_counts_ptr,
+            _mm256_castsi256_si128(index_vec), PHRED_TABLE_EXPAND_SHUFFLE,
+            PHRED_TABLE_EXPAND_INDEX, PHRED_TABLE_SIZE);
+        staging_table_add_16_avx2(
+            (uint16_t *)(staging_phred_counts_ptr + 16),
+            _mm256_extracti128_si256(index_vec, 1), PHRED_TABLE_EXPAND_SHUFFLE,
+            PHRED_TABLE_EXPAND_INDEX, PHRED_TABLE_SIZE);
+        _mm256_storeu_si256((__m256i *)scores, phreds);
+        for (size_t j = 0; j < 32; j += 4) {
+            int32_t four_scores;
+            memcpy(&four_scores, scores + j, sizeof(int32_t));
+            __m128i score_indices =
+                _mm_cvtepu8_epi32(_mm_cvtsi32_si128(four_scores));
+            accumulator = _mm256_add_pd(
+                accumulator,
+                _mm256_i32gather_pd(SCORE_TO_ERROR_RATE, score_indices, 8));
+        }
+        staging_phred_counts_ptr += 32;
+        i += 32;
+    }
+    double accumulators[4];
+    _mm256_storeu_pd(accumulators, accumulator);
+    _mm256_zeroupper();
+    return QCMetrics_count_qualities_scalar(
+        staging_phred_counts_ptr, qualities + i, sequence_length - i,
+        phred_offset, accumulators, accumulated_error_rate);
+}
+
+/* Same as above, for the QUALITY_BINS_MAX counters per position of
+   staging_quality_bin_table. */
+// clang-format off
+static const int8_t QUALITY_BIN_TABLE_EXPAND_SHUFFLE[QUALITY_BINS_MAX][32] = {
+    {0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1, -1,
+     2, -1, 2, -1, 2, -1, 2, -1, 3, -1, 3, -1, 3, -1, 3, -1},
+    {4, -1, 4, -1, 4, -1, 4, -1, 5, -1, 5, -1, 5, -1, 5, -1,
+     6, -1, 6, -1, 6, -1, 6, -1, 7, -1, 7, -1, 7, -1, 7, -1},
+    {8, -1, 8, -1, 8, -1, 8, -1, 9, -1, 9, -1, 9, -1, 9, -1,
+     10, -1, 10, -1, 10, -1, 10, -1, 11, -1, 11, -1, 11, -1, 11, -1},
+    {12, -1, 12, -1, 12, -1, 12, -1, 13, -1, 13, -1, 13, -1, 13, -1,
+     14, -1, 14, -1, 14, -1, 14, -1, 15, -1, 15, -1, 15, -1, 15, -1},
+};
+static const int16_t QUALITY_BIN_TABLE_EXPAND_INDEX[QUALITY_BINS_MAX][16] = {
+    {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+    {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+    {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+    {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+};
+// clang-format on
+
+__attribute__((__target__("avx2"))) static int
+QCMetrics_count_quality_bins_avx2(QCMetrics *self, const uint8_t *qualities,
+                                  size_t sequence_length,
+                                  double *accumulated_error_rate)
+{
+    /* Follows QCMetrics_count_qualities_avx2, with the same lane layout
+       and loop bound. Only four counters per position are updated instead
+       of PHRED_TABLE_SIZE and the error rates are permuted from a single
+       register. */
+    struct QualityBins *bins = &self->quality_bins;
+    staging_quality_bin_table *staging_quality_bin_counts_ptr =
+        self->staging_quality_bin_counts;
+    __m256i bin_phreds[QUALITY_BINS_MAX];
+    for (size_t i = 0; i < QUALITY_BINS_MAX; i++) {
+        bin_phreds[i] = _mm256_set1_epi8(bins->phreds[i]);
+    }
+    __m256i error_rates =
+        _mm256_loadu_si256((const __m256i *)bins->error_rates);
+    __m256d accumulator = _mm256_setzero_pd();
+    __m256i offset_vec = _mm256_set1_epi8(self->phred_offset);
+    size_t i = 0;
+    while (i + 32 < sequence_length) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(qualities + i));
+        __m256i phreds = _mm256_sub_epi8(chunk, offset_vec);
+        __m256i bin_indices;
+        if (!QualityBins_classify_avx2(bin_phreds, phreds, &bin_indices)) {
+            bins->state = QUALITY_BINS_DISABLED;
+            break;
+        }
+        __m128i low_indices = _mm256_castsi256_si128(bin_indices);
+        __m128i high_indices = _mm256_extracti128_si256(bin_indices, 1);
+        staging_table_add_16_avx2(
+            (uint16_t *)staging_quality_bin_counts_ptr, low_indices,
+            QUALITY_BIN_TABLE_EXPAND_SHUFFLE, QUALITY_BIN_TABLE_EXPAND_INDEX,
+            QUALITY_BINS_MAX);
+        staging_table_add_16_avx2(
+            (uint16_t *)(staging_quality_bin_counts_ptr + 16), high_indices,
+            QUALITY_BIN_TABLE_EXPAND_SHUFFLE, QUALITY_BIN_TABLE_EXPAND_INDEX,
+            QUALITY_BINS_MAX);
+        __m128i indices[2] = {low_indices, high_indices};
+        for (size_t j = 0; j < 2; j++) {
+            accumulator = _mm256_add_pd(
+                accumulator, QualityBins_error_rates_avx2(error_rates,
+                                                          indices[j]));
+            accumulator = _mm256_add_pd(
+                accumulator,
+                QualityBins_error_rates_avx2(error_rates,
+                                             _mm_srli_si128(indices[j], 4)));
+            accumulator = _mm256_add_pd(
+                accumulator,
+                QualityBins_error_rates_avx2(error_rates,
+                                             _mm_srli_si128(indices[j], 8)));
+            accumulator = _mm256_add_pd(
+                accumulator,
+                QualityBins_error_rates_avx2(error_rates,
+                                             _mm_srli_si128(indices[j], 12)));
+        }
+        staging_quality_bin_counts_ptr += 32;
+        i += 32;
+    }
+    double accumulators[4];
+    _mm256_storeu_pd(accumulators, accumulator);
+    _mm256_zeroupper();
+    return QCMetrics_count_qualities_scalar(
+        self->staging_phred_counts + i, qualities + i, sequence_length - i,
+        self->phred_offset, accumulators, accumulated_error_rate);
+}
+
+/* Constructor runs at dynamic load time */
+__attribute__((constructor)) static void
+QCMetrics_count_init_func_ptr(void)
+{
+    if (__builtin_cpu_supports("avx2")) {
+        QCMetrics_count_bases = QCMetrics_count_bases_avx2;
+        QCMetrics_count_qualities = QCMetrics_count_qualities_avx2;
+        QCMetrics_count_quality_bins = QCMetrics_count_quality_bins_avx2;
+    }
+    else {
+        QCMetrics_count_bases = QCMetrics_count_bases_default;
+        QCMetrics_count_qualities = QCMetrics_count_qualities_default;
+    }
+}
+#endif
+
+/* Count the positions of a read beyond exact_positions directly in the
+   binned rows of the base and phred tables. The packed AT and GC counts and
+   the error rates are added to base_counts_ptr and accumulated_error_rate. */
+static int
+QCMetrics_count_binned(QCMetrics *self, const uint8_t *sequence,
+                       const uint8_t *qualities, size_t sequence_length,
+                       uint64_t *base_counts_ptr,
+                       double *accumulated_error_rate)
+{
+    static const uint64_t count_integers[5] = {
+        /*  A   , C            , G            , T   , N */
+        1ULL, 1ULL << 32ULL, 1ULL << 32ULL, 1ULL, 0};
+    size_t exact_positions = self->exact_positions;
+    uint8_t phred_offset = self->phred_offset;
+    uint64_t base_counts = 0;
+    double error_rate = 0.0;
+    size_t row = exact_positions;
+    size_t bin_start = exact_positions;
+    size_t bin_width = exact_positions / POSITION_BINS_PER_OCTAVE;
+    while (bin_start < sequence_length) {
+        size_t bin_end = Py_MIN(bin_start + bin_width, sequence_length);
+        uint64_t *bin_bases = self->base_counts[row];
+        uint64_t *bin_phreds = self->phred_counts[row];
+        for (size_t i = bin_start; i < bin_end; i++) {
+            uint8_t c_index = NUCLEOTIDE_TO_INDEX[sequence[i]];
+            bin_bases[c_index] += 1;
+            base_counts += count_integers[c_index];
+            uint8_t q = qualities[i] - phred_offset;
+            if (q > PHRED_MAX) {
+                set_phred_error_gil_safe(qualities[i]);
+                return -1;
+            }
+            bin_phreds[phred_to_index(q)] += 1;
+            error_rate += SCORE_TO_ERROR_RATE[q];
+        }
+        row += 1;
+        bin_start += bin_width;
+        if (bin_start == bin_width * POSITION_BINS_PER_OCTAVE * 2) {
+            bin_width *= 2;
+        }
+    }
+    *base_counts_ptr += base_counts;
+    *accumulated_error_rate += error_rate;
+    return 0;
+}
+
+static inline int
+QCMetrics_add_meta(QCMetrics *self, struct FastqMeta *meta)
+{
+    const uint8_t *record_start = meta->record_start;
+    size_t sequence_length = meta->sequence_length;
+    const uint8_t *sequence = record_start + meta->sequence_offset;
+    const uint8_t *qualities = record_start + meta->qualities_offset;
+
+    if (sequence_length > self->max_length) {
+        if (QCMetrics_resize(self, sequence_length) != 0) {
+            return -1;
+        }
+    }
+
+    self->number_of_reads += 1;
+    if (self->staging_count >= UINT16_MAX) {
+        QCMetrics_flush_staging(self);
+    }
+    self->staging_count += 1;
+    if (sequence_length > 0) {
+        size_t last_row =
+            position_bins_row(self->exact_positions, sequence_length - 1);
+        self->length_counts[last_row] += 1;
+    }
+    size_t exact_length = Py_MIN(sequence_length, self->exact_positions);
+    if (exact_length > self->staging_length) {
+        self->staging_length = exact_length;
+    }
+
+    uint64_t base_counts = QCMetrics_count_bases(self->staging_base_counts,
+                                                 sequence, exact_length);
+    double accumulated_error_rate;
+    int ret;
+    struct QualityBins *bins = &self->quality_bins;
+    if (bins->state == QUALITY_BINS_ACTIVE) {
+        ret = QCMetrics_count_quality_bins(self, qualities, exact_length,
+                                           &accumulated_error_rate);
+    }
+    else {
+        if (bins->state == QUALITY_BINS_DETECTING) {
+            QualityBins_detect(bins, qualities, exact_length,
+                               self->phred_offset);
+        }
+        ret = QCMetrics_count_qualities(self->staging_phred_counts, qualities,
+                                        exact_length, self->phred_offset,
+                                        &accumulated_error_rate);
+    }
+    if (ret != 0) {
+        return -1;
+    }
+    if (sequence_length > exact_length &&
+        QCMetrics_count_binned(self, sequence, qualities, sequence_length,
+                               &base_counts, &accumulated_error_rate) != 0) {
+        return -1;
+    }
+
+    uint64_t at_counts = base_counts & 0xFFFFFFFF;
+    uint64_t gc_counts = (base_counts >> 32) & 0xFFFFFFFF;
+    double gc_content_percentage =
+        (double)gc_counts * (double)100.0 / (double)(at_counts + gc_counts);
+    uint64_t gc_content_index = (uint64_t)round(gc_content_percentage);
+    assert(gc_content_index >= 0);
+    assert(gc_content_index <= 100);
+    self->gc_content[gc_content_index] += 1;
 
     meta->accumulated_error_rate = accumulated_error_rate;
     double average_error_rate = accumulated_error_rate / (double)sequence_length;
@@ -1907,76 +3772,329 @@ QCMetrics_add_record_array(QCMetrics *self, FastqRecordArrayView *record_array)
     }
     Py_ssize_t number_of_records = Py_SIZE(record_array);
     struct FastqMeta *records = record_array->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
     for (Py_ssize_t i = 0; i < number_of_records; i++) {
-        if (QCMetrics_add_meta(self, records + i) != 0) {
-            return NULL;
+        ret = QCMetrics_add_meta(self, records + i);
+        if (ret != 0) {
+            break;
         }
     }
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
 PyDoc_STRVAR(QCMetrics_base_count_table__doc__,
-             "base_count_table($self, /)\n"
+             "base_count_table($self, /, ranges=None)\n"
              "--\n"
              "\n"
-             "Return a array.array on the produced base count table. \n");
+             "Return a array.array on the produced base count table. \n"
+             "\n"
+             "  ranges\n"
+             "    Optional sequence of (start, stop) row ranges. When given, "
+             "the rows\n"
+             "    within each range are summed and the table has one row "
+             "per range.\n");
 
-#define QCMetrics_base_count_table_method METH_NOARGS
+#define QCMetrics_base_count_table_method METH_VARARGS | METH_KEYWORDS
 
 static PyObject *
-QCMetrics_base_count_table(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+QCMetrics_base_count_table(QCMetrics *self, PyObject *args, PyObject *kwargs)
 {
+    PyObject *ranges = Py_None;
+    static char *kwargnames[] = {"ranges", NULL};
+    static char *format = "|O:QCMetrics.base_count_table";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames,
+                                     &ranges)) {
+        return NULL;
+    }
     QCMetrics_flush_staging(self);
+    if (ranges != Py_None) {
+        return aggregate_count_table((uint64_t *)self->base_counts,
+                                     NUC_TABLE_SIZE, self->number_of_rows,
+                                     ranges);
+    }
     return PythonArray_FromBuffer('Q', self->base_counts,
-                                  self->max_length * sizeof(base_table));
+                                  self->number_of_rows * sizeof(base_table));
 }
 
 PyDoc_STRVAR(QCMetrics_phred_count_table__doc__,
-             "phred_table($self, /)\n"
+             "phred_table($self, /, ranges=None)\n"
              "--\n"
              "\n"
-             "Return a array.array on the produced phred count table. \n");
+             "Return a array.array on the produced phred count table. \n"
+             "\n"
+             "  ranges\n"
+             "    Optional sequence of (start, stop) row ranges. When given, "
+             "the rows\n"
+             "    within each range are summed and the table has one row "
+             "per range.\n");
 
-#define QCMetrics_phred_count_table_method METH_NOARGS
+#define QCMetrics_phred_count_table_method METH_VARARGS | METH_KEYWORDS
 
 static PyObject *
-QCMetrics_phred_count_table(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+QCMetrics_phred_count_table(QCMetrics *self, PyObject *args, PyObject *kwargs)
 {
+    PyObject *ranges = Py_None;
+    static char *kwargnames[] = {"ranges", NULL};
+    static char *format = "|O:QCMetrics.phred_count_table";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames,
+                                     &ranges)) {
+        return NULL;
+    }
     QCMetrics_flush_staging(self);
+    if (ranges != Py_None) {
+        return aggregate_count_table((uint64_t *)self->phred_counts,
+                                     PHRED_TABLE_SIZE, self->number_of_rows,
+                                     ranges);
+    }
     return PythonArray_FromBuffer('Q', self->phred_counts,
-                                  self->max_length * sizeof(phred_table));
+                                  self->number_of_rows * sizeof(phred_table));
+}
+
+PyDoc_STRVAR(QCMetrics_length_count_table__doc__,
+             "length_count_table($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a array.array with for each row the number of reads \n"
+             "whose last base is in that row. Reads of length 0 are not \n"
+             "counted.\n");
+
+#define QCMetrics_length_count_table_method METH_NOARGS
+
+static PyObject *
+QCMetrics_length_count_table(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+{
+    return PythonArray_FromBuffer('Q', self->length_counts,
+                                  self->number_of_rows * sizeof(uint64_t));
+}
+
+PyDoc_STRVAR(QCMetrics_position_ranges__doc__,
+             "position_ranges($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a list of (start, stop) tuples with the positions that \n"
+             "each row of the count tables covers. The first exact_positions \n"
+             "rows cover a single position.\n");
+
+#define QCMetrics_position_ranges_method METH_NOARGS
+
+static PyObject *
+QCMetrics_position_ranges(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+{
+    return position_bins_ranges(self->exact_positions, self->max_length);
+}
+
+PyDoc_STRVAR(QCMetrics_gc_content__doc__,
+             "gc_content($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a array.array on the produced gc content counts. \n");
+
+#define QCMetrics_gc_content_method METH_NOARGS
+
+static PyObject *
+QCMetrics_gc_content(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+{
+    QCMetrics_flush_staging(self);
+    return PythonArray_FromBuffer('Q', self->gc_content, sizeof(self->gc_content));
+}
+
+PyDoc_STRVAR(
+    QCMetrics_phred_scores__doc__,
+    "phred_scores($self, /)\n"
+    "--\n"
+    "\n"
+    "Return a array.array on the produced average phred score counts. \n");
+
+#define QCMetrics_phred_scores_method METH_NOARGS
+
+static PyObject *
+QCMetrics_phred_scores(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+{
+    QCMetrics_flush_staging(self);
+    return PythonArray_FromBuffer('Q', self->phred_scores,
+                                  sizeof(self->phred_scores));
+}
+
+PyDoc_STRVAR(QCMetrics_merge__doc__,
+             "merge($self, other, /)\n"
+             "--\n"
+             "\n"
+             "Add the counts of another QCMetrics object to this one. \n"
+             "\n"
+             "  other\n"
+             "    A QCMetrics object.\n");
+
+#define QCMetrics_merge_method METH_O
+
+static PyObject *
+QCMetrics_merge(QCMetrics *self, QCMetrics *other)
+{
+    if (check_merge_compatibility((PyObject *)self, (PyObject *)other) != 0) {
+        return NULL;
+    }
+    if (self->exact_positions != other->exact_positions) {
+        PyErr_Format(PyExc_ValueError,
+                     "exact_positions should be the same, got %zu and %zu",
+                     self->exact_positions, other->exact_positions);
+        return NULL;
+    }
+    if (other->max_length > self->max_length) {
+        if (QCMetrics_resize(self, other->max_length) != 0) {
+            return NULL;
+        }
+    }
+    QCMetrics_flush_staging(self);
+    QCMetrics_flush_staging(other);
+    uint64_t *base_counts = (uint64_t *)self->base_counts;
+    uint64_t *other_base_counts = (uint64_t *)other->base_counts;
+    size_t number_of_base_slots = other->number_of_rows * NUC_TABLE_SIZE;
+    for (size_t i = 0; i < number_of_base_slots; i++) {
+        base_counts[i] += other_base_counts[i];
+    }
+    uint64_t *phred_counts = (uint64_t *)self->phred_counts;
+    uint64_t *other_phred_counts = (uint64_t *)other->phred_counts;
+    size_t number_of_phred_slots = other->number_of_rows * PHRED_TABLE_SIZE;
+    for (size_t i = 0; i < number_of_phred_slots; i++) {
+        phred_counts[i] += other_phred_counts[i];
+    }
+    for (size_t i = 0; i < other->number_of_rows; i++) {
+        self->length_counts[i] += other->length_counts[i];
+    }
+    for (size_t i = 0; i < 101; i++) {
+        self->gc_content[i] += other->gc_content[i];
+    }
+    for (size_t i = 0; i < PHRED_MAX + 1; i++) {
+        self->phred_scores[i] += other->phred_scores[i];
+    }
+    self->number_of_reads += other->number_of_reads;
+    self->staging_flushes += other->staging_flushes;
+    ModuleProfile_merge(&self->profile, &other->profile);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(QCMetrics_dump__doc__,
+             "dump($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the state of the object as a bytes object that can be \n"
+             "restored with QCMetrics.load.\n");
+
+#define QCMetrics_dump_method METH_NOARGS
+
+static PyObject *
+QCMetrics_dump(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+{
+    QCMetrics_flush_staging(self);
+    struct StateWriter writer;
+    if (StateWriter_init(&writer, (PyObject *)self) != 0) {
+        return NULL;
+    }
+    size_t number_of_rows = self->number_of_rows;
+    int failed =
+        StateWriter_write_u64(&writer, self->exact_positions) ||
+        StateWriter_write_u64(&writer, self->max_length) ||
+        StateWriter_write_u64(&writer, self->number_of_reads) ||
+        StateWriter_write_u64_array(&writer, (uint64_t *)self->base_counts,
+                                    number_of_rows * NUC_TABLE_SIZE) ||
+        StateWriter_write_u64_array(&writer, (uint64_t *)self->phred_counts,
+                                    number_of_rows * PHRED_TABLE_SIZE) ||
+        StateWriter_write_u64_array(&writer, self->length_counts,
+                                    number_of_rows) ||
+        StateWriter_write_u64_array(&writer, self->gc_content, 101) ||
+        StateWriter_write_u64_array(&writer, self->phred_scores,
+                                    PHRED_MAX + 1);
+    return StateWriter_finish(&writer, failed);
+}
+
+PyDoc_STRVAR(QCMetrics_load__doc__,
+             "load($type, data, /)\n"
+             "--\n"
+             "\n"
+             "Create a QCMetrics object from the output of dump(). \n"
+             "\n"
+             "  data\n"
+             "    A bytes-like object.\n");
+
+#define QCMetrics_load_method (METH_O | METH_CLASS)
+
+static PyObject *
+QCMetrics_load(PyTypeObject *type, PyObject *data)
+{
+    struct StateReader reader;
+    if (StateReader_init(&reader, data, type) != 0) {
+        return NULL;
+    }
+    size_t exact_positions;
+    size_t max_length;
+    uint64_t number_of_reads;
+    QCMetrics *self = NULL;
+    if (StateReader_read_size(&reader, &exact_positions) != 0) {
+        goto error;
+    }
+    self = (QCMetrics *)PyObject_CallFunction((PyObject *)type, "n",
+                                              (Py_ssize_t)exact_positions);
+    if (self == NULL || StateReader_read_size(&reader, &max_length) != 0 ||
+        StateReader_read_u64(&reader, &number_of_reads) != 0) {
+        goto error;
+    }
+    size_t number_of_rows = position_bins_rows(exact_positions, max_length);
+    if (StateReader_check_remaining(&reader, number_of_rows) != 0) {
+        goto error;
+    }
+    if (max_length > 0 && QCMetrics_resize(self, max_length) != 0) {
+        goto error;
+    }
+    self->number_of_reads = number_of_reads;
+    if (StateReader_read_u64_array(&reader, (uint64_t *)self->base_counts,
+                                   number_of_rows * NUC_TABLE_SIZE) != 0 ||
+        StateReader_read_u64_array(&reader, (uint64_t *)self->phred_counts,
+                                   number_of_rows * PHRED_TABLE_SIZE) != 0 ||
+        StateReader_read_u64_array(&reader, self->length_counts,
+                                   number_of_rows) != 0 ||
+        StateReader_read_u64_array(&reader, self->gc_content, 101) != 0 ||
+        StateReader_read_u64_array(&reader, self->phred_scores,
+                                   PHRED_MAX + 1) != 0 ||
+        StateReader_finish(&reader) != 0) {
+        goto error;
+    }
+    StateReader_release(&reader);
+    return (PyObject *)self;
+error:
+    Py_XDECREF(self);
+    StateReader_release(&reader);
+    return NULL;
 }
 
-PyDoc_STRVAR(QCMetrics_gc_content__doc__,
-             "gc_content($self, /)\n"
+PyDoc_STRVAR(QCMetrics_profile__doc__,
+             "profile($self, /)\n"
              "--\n"
              "\n"
-             "Return a array.array on the produced gc content counts. \n");
-
-#define QCMetrics_gc_content_method METH_NOARGS
-
-static PyObject *
-QCMetrics_gc_content(QCMetrics *self, PyObject *Py_UNUSED(ignore))
-{
-    QCMetrics_flush_staging(self);
-    return PythonArray_FromBuffer('Q', self->gc_content, sizeof(self->gc_content));
-}
-
-PyDoc_STRVAR(
-    QCMetrics_phred_scores__doc__,
-    "phred_scores($self, /)\n"
-    "--\n"
-    "\n"
-    "Return a array.array on the produced average phred score counts. \n");
+             "Return a dictionary with the performance counters of the "
+             "module.\n"
+             "The time is only measured when profiling is set.\n");
 
-#define QCMetrics_phred_scores_method METH_NOARGS
+#define QCMetrics_profile_method METH_NOARGS
 
 static PyObject *
-QCMetrics_phred_scores(QCMetrics *self, PyObject *Py_UNUSED(ignore))
+QCMetrics_profile(QCMetrics *self, PyObject *Py_UNUSED(ignore))
 {
-    QCMetrics_flush_staging(self);
-    return PythonArray_FromBuffer('Q', self->phred_scores,
-                                  sizeof(self->phred_scores));
+    PyObject *profile = ModuleProfile_to_dict(&self->profile);
+    if (profile == NULL ||
+        dict_set_u64(profile, "staging_flushes", self->staging_flushes) != 0 ||
+        dict_set_quality_bins(profile, &self->quality_bins) != 0) {
+        Py_XDECREF(profile);
+        return NULL;
+    }
+    return profile;
 }
 
 static PyMethodDef QCMetrics_methods[] = {
@@ -1984,22 +4102,40 @@ static PyMethodDef QCMetrics_methods[] = {
      QCMetrics_add_read__doc__},
     {"add_record_array", (PyCFunction)QCMetrics_add_record_array,
      QCMetrics_add_record_array_method, QCMetrics_add_record_array__doc__},
-    {"base_count_table", (PyCFunction)QCMetrics_base_count_table,
+    {"base_count_table",
+     (PyCFunction)(void (*)(void))QCMetrics_base_count_table,
      QCMetrics_base_count_table_method, QCMetrics_base_count_table__doc__},
-    {"phred_count_table", (PyCFunction)QCMetrics_phred_count_table,
+    {"phred_count_table",
+     (PyCFunction)(void (*)(void))QCMetrics_phred_count_table,
      QCMetrics_phred_count_table_method, QCMetrics_phred_count_table__doc__},
+    {"length_count_table", (PyCFunction)QCMetrics_length_count_table,
+     QCMetrics_length_count_table_method, QCMetrics_length_count_table__doc__},
+    {"position_ranges", (PyCFunction)QCMetrics_position_ranges,
+     QCMetrics_position_ranges_method, QCMetrics_position_ranges__doc__},
     {"gc_content", (PyCFunction)QCMetrics_gc_content,
      QCMetrics_gc_content_method, QCMetrics_gc_content__doc__},
     {"phred_scores", (PyCFunction)QCMetrics_phred_scores,
      QCMetrics_phred_scores_method, QCMetrics_phred_scores__doc__},
+    {"merge", (PyCFunction)QCMetrics_merge, QCMetrics_merge_method,
+     QCMetrics_merge__doc__},
+    {"dump", (PyCFunction)QCMetrics_dump, QCMetrics_dump_method,
+     QCMetrics_dump__doc__},
+    {"load", (PyCFunction)QCMetrics_load, QCMetrics_load_method,
+     QCMetrics_load__doc__},
+    {"profile", (PyCFunction)QCMetrics_profile,
+     QCMetrics_profile_method, QCMetrics_profile__doc__},
     {NULL},
 };
 
 static PyMemberDef QCMetrics_members[] = {
     {"max_length", T_PYSSIZET, offsetof(QCMetrics, max_length), READONLY,
      "The length of the longest read"},
+    {"exact_positions", T_PYSSIZET, offsetof(QCMetrics, exact_positions),
+     READONLY, "The number of positions that are counted individually"},
     {"number_of_reads", T_ULONGLONG, offsetof(QCMetrics, number_of_reads),
      READONLY, "The total amount of reads counted"},
+    {"profiling", T_BOOL, offsetof(QCMetrics, profiling), 0,
+     "Measure the time spent in add_record_array."},
     {NULL},
 };
 
@@ -2069,6 +4205,54 @@ MachineWordPatternMatcherSSE2_destroy(MachineWordPatternMatcherSSE2 *matcher)
 }
 #endif
 
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+#define ADAPTER_COUNTER_HAS_AVX2 1
+#define AVX2_MATCHER_WORDS 4
+/* The masks are stored as plain 64-bit words rather than __m256i. The
+   module is not compiled with AVX2 enabled and PyMem_Malloc only guarantees
+   16-byte alignment, so unaligned loads are used in the AVX2 functions. */
+typedef struct AdapterSequenceAVX2Struct {
+    size_t adapter_index;
+    size_t adapter_length;
+    bitmask_t found_mask[AVX2_MATCHER_WORDS];
+} AdapterSequenceAVX2;
+
+typedef struct MachineWordPatternMatcherAVX2Struct {
+    bitmask_t init_mask[AVX2_MATCHER_WORDS];
+    bitmask_t found_mask[AVX2_MATCHER_WORDS];
+    bitmask_t bitmasks[NUC_TABLE_SIZE][AVX2_MATCHER_WORDS];
+    size_t number_of_sequences;
+    AdapterSequenceAVX2 *sequences;
+} MachineWordPatternMatcherAVX2;
+
+static void
+MachineWordPatternMatcherAVX2_destroy(MachineWordPatternMatcherAVX2 *matcher)
+{
+    PyMem_Free(matcher->sequences);
+}
+#else
+#define ADAPTER_COUNTER_HAS_AVX2 0
+#endif
+
+/* With many adapters the matchers need many passes over each sequence. The
+   prefilter is a bitset of all k-mers that adapters start with. A sequence is
+   scanned once for these k-mers and the matchers only run over the windows
+   where an adapter may start. Since the shift-and state is reset at the start
+   of each window, and every adapter occurrence is fully contained in a
+   window, the results are exactly the same as without the prefilter. With 8
+   bases the bitset uses 8 KiB, which fits in the L1 cache. */
+#define ADAPTER_PREFILTER_K 8
+#define ADAPTER_PREFILTER_KMER_MASK ((1ULL << (2 * ADAPTER_PREFILTER_K)) - 1)
+#define ADAPTER_PREFILTER_WORDS ((ADAPTER_PREFILTER_KMER_MASK + 1) / 64)
+/* Scanning for k-mers costs about as much as one AVX2 matcher of four words,
+   so the prefilter is used automatically when more words are needed. */
+#define ADAPTER_PREFILTER_MIN_MATCHER_WORDS 5
+
+struct AdapterWindow {
+    size_t start;
+    size_t end;
+};
+
 typedef struct AdapterCounterStruct {
     PyObject_HEAD
     size_t number_of_adapters;
@@ -2082,6 +4266,17 @@ typedef struct AdapterCounterStruct {
 #ifdef __SSE2__
     MachineWordPatternMatcherSSE2 *sse2_matchers;
 #endif
+    size_t number_of_avx2_matchers;
+#if ADAPTER_COUNTER_HAS_AVX2
+    MachineWordPatternMatcherAVX2 *avx2_matchers;
+#endif
+    char uses_prefilter;
+    uint64_t *prefilter;
+    size_t max_adapter_length;
+    struct AdapterWindow *windows;
+    size_t windows_size;
+    char profiling;
+    struct ModuleProfile profile;
 } AdapterCounter;
 
 static void
@@ -2090,7 +4285,7 @@ AdapterCounter_dealloc(AdapterCounter *self)
     Py_XDECREF(self->adapters);
     if (self->adapter_counter != NULL) {
         for (size_t i = 0; i < self->number_of_adapters; i++) {
-            PyMem_Free(self->adapter_counter[i]);
+            PyMem_RawFree(self->adapter_counter[i]);
         }
     }
     PyMem_Free(self->adapter_counter);
@@ -2105,6 +4300,14 @@ AdapterCounter_dealloc(AdapterCounter *self)
     }
     PyMem_Free(self->sse2_matchers);
 #endif
+#if ADAPTER_COUNTER_HAS_AVX2
+    for (size_t i = 0; i < self->number_of_avx2_matchers; i++) {
+        MachineWordPatternMatcherAVX2_destroy(self->avx2_matchers + i);
+    }
+    PyMem_Free(self->avx2_matchers);
+#endif
+    PyMem_Free(self->prefilter);
+    PyMem_RawFree(self->windows);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
@@ -2191,6 +4394,81 @@ AdapterCounter_SSE2_convert(AdapterCounter *self)
 }
 #endif
 
+#if ADAPTER_COUNTER_HAS_AVX2
+/* Pack groups of four matchers into one AVX2 matcher. The remaining
+   matchers are left in self->matchers to be handled by the SSE2 and scalar
+   code. */
+static int
+AdapterCounter_AVX2_convert(AdapterCounter *self)
+{
+    self->number_of_avx2_matchers =
+        self->number_of_matchers / AVX2_MATCHER_WORDS;
+    if (self->number_of_avx2_matchers == 0) {
+        return 0;
+    }
+    MachineWordPatternMatcherAVX2 *tmp =
+        PyMem_Malloc(self->number_of_avx2_matchers *
+                     sizeof(MachineWordPatternMatcherAVX2));
+    if (tmp == NULL) {
+        self->number_of_avx2_matchers = 0;
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->avx2_matchers = tmp;
+    memset(self->avx2_matchers, 0,
+           self->number_of_avx2_matchers *
+               sizeof(MachineWordPatternMatcherAVX2));
+    for (size_t i = 0; i < self->number_of_avx2_matchers; i++) {
+        MachineWordPatternMatcherAVX2 *avx2_matcher = self->avx2_matchers + i;
+        MachineWordPatternMatcher *normal_matchers =
+            self->matchers + (i * AVX2_MATCHER_WORDS);
+        size_t number_of_sequences = 0;
+        for (size_t word = 0; word < AVX2_MATCHER_WORDS; word++) {
+            MachineWordPatternMatcher *normal_matcher = normal_matchers + word;
+            avx2_matcher->init_mask[word] = normal_matcher->init_mask;
+            avx2_matcher->found_mask[word] = normal_matcher->found_mask;
+            for (size_t j = 0; j < NUC_TABLE_SIZE; j++) {
+                avx2_matcher->bitmasks[j][word] = normal_matcher->bitmasks[j];
+            }
+            number_of_sequences += normal_matcher->number_of_sequences;
+        }
+        AdapterSequenceAVX2 *seq_tmp =
+            PyMem_Malloc(number_of_sequences * sizeof(AdapterSequenceAVX2));
+        if (seq_tmp == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        memset(seq_tmp, 0, number_of_sequences * sizeof(AdapterSequenceAVX2));
+        avx2_matcher->sequences = seq_tmp;
+        avx2_matcher->number_of_sequences = number_of_sequences;
+        AdapterSequenceAVX2 *avx2_adapter = avx2_matcher->sequences;
+        for (size_t word = 0; word < AVX2_MATCHER_WORDS; word++) {
+            MachineWordPatternMatcher *normal_matcher = normal_matchers + word;
+            for (size_t j = 0; j < normal_matcher->number_of_sequences; j++) {
+                AdapterSequence *normal_adapter = normal_matcher->sequences + j;
+                avx2_adapter->adapter_index = normal_adapter->adapter_index;
+                avx2_adapter->adapter_length = normal_adapter->adapter_length;
+                avx2_adapter->found_mask[word] = normal_adapter->found_mask;
+                avx2_adapter += 1;
+            }
+        }
+    }
+
+    size_t number_of_converted_matchers =
+        self->number_of_avx2_matchers * AVX2_MATCHER_WORDS;
+    for (size_t i = 0; i < number_of_converted_matchers; i++) {
+        MachineWordPatternMatcher_destroy(self->matchers + i);
+    }
+    size_t number_of_remaining_matchers =
+        self->number_of_matchers - number_of_converted_matchers;
+    /* Move the remaining matchers to the front, the array is not shrunk. */
+    memmove(self->matchers, self->matchers + number_of_converted_matchers,
+            number_of_remaining_matchers * sizeof(MachineWordPatternMatcher));
+    self->number_of_matchers = number_of_remaining_matchers;
+    return 0;
+}
+#endif
+
 static void
 populate_bitmask(bitmask_t *bitmask, char *word, size_t word_length)
 {
@@ -2205,19 +4483,122 @@ populate_bitmask(bitmask_t *bitmask, char *word, size_t word_length)
     }
 }
 
+/**
+ * @brief Build the prefilter from the first k-mers of all adapters.
+ *
+ * @return 1 if the prefilter was built, 0 if one of the adapters is too short
+ *         or does not start with a k-mer of ACGT, -1 on a memory error.
+ */
+static int
+AdapterCounter_build_prefilter(AdapterCounter *self)
+{
+    uint64_t *prefilter = PyMem_Calloc(ADAPTER_PREFILTER_WORDS,
+                                       sizeof(uint64_t));
+    if (prefilter == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    size_t max_adapter_length = 0;
+    for (size_t i = 0; i < self->number_of_adapters; i++) {
+        PyObject *adapter = PyTuple_GET_ITEM(self->adapters, i);
+        size_t adapter_length = PyUnicode_GET_LENGTH(adapter);
+        const uint8_t *adapter_sequence = PyUnicode_DATA(adapter);
+        if (adapter_length < ADAPTER_PREFILTER_K) {
+            PyMem_Free(prefilter);
+            return 0;
+        }
+        uint64_t kmer = 0;
+        for (size_t j = 0; j < ADAPTER_PREFILTER_K; j++) {
+            uint8_t index = NUCLEOTIDE_TO_INDEX[adapter_sequence[j]];
+            if (index == N) {
+                PyMem_Free(prefilter);
+                return 0;
+            }
+            kmer = (kmer << 2) | index;
+        }
+        prefilter[kmer / 64] |= 1ULL << (kmer % 64);
+        max_adapter_length = Py_MAX(max_adapter_length, adapter_length);
+    }
+    self->uses_prefilter = 1;
+    self->prefilter = prefilter;
+    self->max_adapter_length = max_adapter_length;
+    return 1;
+}
+
+/**
+ * @brief Find the windows where an adapter may occur in the sequence. Windows
+ *        start at a k-mer that is in the prefilter and are long enough to
+ *        contain the longest adapter. Overlapping windows are merged.
+ *
+ * @return The number of windows in self->windows or -1 on a memory error.
+ */
+static Py_ssize_t
+AdapterCounter_find_windows(AdapterCounter *self, const uint8_t *sequence,
+                            size_t sequence_length)
+{
+    const uint64_t *prefilter = self->prefilter;
+    size_t max_adapter_length = self->max_adapter_length;
+    struct AdapterWindow *windows = self->windows;
+    size_t number_of_windows = 0;
+    uint64_t kmer = 0;
+    size_t valid_bases = 0;
+    for (size_t i = 0; i < sequence_length; i++) {
+        uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[i]];
+        if (index == N) {
+            valid_bases = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | index) & ADAPTER_PREFILTER_KMER_MASK;
+        valid_bases += 1;
+        if (valid_bases < ADAPTER_PREFILTER_K ||
+            !(prefilter[kmer / 64] & (1ULL << (kmer % 64)))) {
+            continue;
+        }
+        size_t start = i + 1 - ADAPTER_PREFILTER_K;
+        size_t end = Py_MIN(start + max_adapter_length, sequence_length);
+        if (number_of_windows && windows[number_of_windows - 1].end >= start) {
+            windows[number_of_windows - 1].end = end;
+            continue;
+        }
+        if (number_of_windows == self->windows_size) {
+            size_t new_size = Py_MAX(16, self->windows_size * 2);
+            windows = PyMem_RawRealloc(windows,
+                                       new_size * sizeof(struct AdapterWindow));
+            if (windows == NULL) {
+                set_no_memory_error_gil_safe();
+                return -1;
+            }
+            self->windows = windows;
+            self->windows_size = new_size;
+        }
+        windows[number_of_windows].start = start;
+        windows[number_of_windows].end = end;
+        number_of_windows += 1;
+    }
+    return number_of_windows;
+}
+
 static PyObject *
 AdapterCounter__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
-    static char *kwargnames[] = {"", NULL};
-    static char *format = "O:AdapterCounter";
+    static char *kwargnames[] = {"", "prefilter", NULL};
+    static char *format = "O|O:AdapterCounter";
     PyObject *adapter_iterable = NULL;
+    PyObject *prefilter_obj = Py_None;
     PyObject *adapters = NULL;
     AdapterCounter *self = NULL;
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames,
-                                     &adapter_iterable)) {
+                                     &adapter_iterable, &prefilter_obj)) {
         return NULL;
     }
+    int use_prefilter = -1;
+    if (prefilter_obj != Py_None) {
+        use_prefilter = PyObject_IsTrue(prefilter_obj);
+        if (use_prefilter == -1) {
+            return NULL;
+        }
+    }
     adapters = PySequence_Tuple(adapter_iterable);
     if (adapters == NULL) {
         return NULL;
@@ -2268,6 +4649,15 @@ AdapterCounter__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 #ifdef __SSE2__
     self->sse2_matchers = NULL;
 #endif
+    self->number_of_avx2_matchers = 0;
+#if ADAPTER_COUNTER_HAS_AVX2
+    self->avx2_matchers = NULL;
+#endif
+    self->uses_prefilter = 0;
+    self->prefilter = NULL;
+    self->max_adapter_length = 0;
+    self->windows = NULL;
+    self->windows_size = 0;
     size_t adapter_index = 0;
     size_t matcher_index = 0;
     PyObject *adapter;
@@ -2327,11 +4717,41 @@ AdapterCounter__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
         matcher_index += 1;
     }
     self->adapters = adapters;
+    if (use_prefilter == -1) {
+        use_prefilter =
+            self->number_of_matchers >= ADAPTER_PREFILTER_MIN_MATCHER_WORDS;
+    }
+    if (use_prefilter) {
+        int ret = AdapterCounter_build_prefilter(self);
+        if (ret == -1) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        if (ret == 0 && prefilter_obj != Py_None) {
+            PyErr_Format(PyExc_ValueError,
+                         "A prefilter requires all adapters to start with at "
+                         "least %d A, C, G or T bases.",
+                         ADAPTER_PREFILTER_K);
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+#if ADAPTER_COUNTER_HAS_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        if (AdapterCounter_AVX2_convert(self) != 0) {
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+#endif
 #ifdef __SSE2__
     if (AdapterCounter_SSE2_convert(self) != 0) {
+        Py_DECREF(self);
         return NULL;
     }
 #endif
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
     return (PyObject *)self;
 
 error:
@@ -2348,10 +4768,10 @@ AdapterCounter_resize(AdapterCounter *self, size_t new_size)
     }
     size_t old_size = self->max_length;
     for (size_t i = 0; i < self->number_of_adapters; i++) {
-        uint64_t *tmp =
-            PyMem_Realloc(self->adapter_counter[i], new_size * sizeof(uint64_t));
+        uint64_t *tmp = PyMem_RawRealloc(self->adapter_counter[i],
+                                         new_size * sizeof(uint64_t));
         if (tmp == NULL) {
-            PyErr_NoMemory();
+            set_no_memory_error_gil_safe();
             return -1;
         }
         self->adapter_counter[i] = tmp;
@@ -2431,6 +4851,120 @@ update_adapter_count_array(size_t position, uint64_t R, uint64_t already_found,
     return already_found;
 }
 
+#if ADAPTER_COUNTER_HAS_AVX2
+__attribute__((__target__("avx2"))) static inline __m256i
+update_adapter_count_array_avx2(size_t position, __m256i R,
+                                __m256i already_found,
+                                MachineWordPatternMatcherAVX2 *matcher,
+                                uint64_t **adapter_counter)
+{
+    size_t number_of_adapters = matcher->number_of_sequences;
+    for (size_t i = 0; i < number_of_adapters; i++) {
+        AdapterSequenceAVX2 *adapter = matcher->sequences + i;
+        __m256i adapter_found_mask =
+            _mm256_loadu_si256((__m256i *)adapter->found_mask);
+        if (!_mm256_testz_si256(adapter_found_mask, already_found)) {
+            continue;
+        }
+        if (!_mm256_testz_si256(R, adapter_found_mask)) {
+            size_t found_position = position - adapter->adapter_length + 1;
+            adapter_counter[adapter->adapter_index][found_position] += 1;
+            // Make sure we only find the adapter once at the earliest position;
+            already_found = _mm256_or_si256(already_found, adapter_found_mask);
+        }
+    }
+    return already_found;
+}
+
+/* Runs all AVX2 matchers over the sequence. Like in AdapterCounter_add_meta
+   two matchers are run at the same time when possible to take advantage of
+   out of order execution. */
+__attribute__((__target__("avx2"))) static void
+AdapterCounter_run_avx2_matchers(AdapterCounter *self, const uint8_t *sequence,
+                                 const struct AdapterWindow *windows,
+                                 size_t number_of_windows)
+{
+    size_t matcher_index = 0;
+    size_t number_of_matchers = self->number_of_avx2_matchers;
+    while (matcher_index < number_of_matchers) {
+        if (number_of_matchers - matcher_index == 1) {
+            MachineWordPatternMatcherAVX2 *matcher =
+                self->avx2_matchers + matcher_index;
+            __m256i found_mask =
+                _mm256_loadu_si256((__m256i *)matcher->found_mask);
+            __m256i init_mask =
+                _mm256_loadu_si256((__m256i *)matcher->init_mask);
+            __m256i already_found = _mm256_setzero_si256();
+            matcher_index += 1;
+            for (size_t w = 0; w < number_of_windows; w++) {
+                __m256i R = _mm256_setzero_si256();
+                size_t window_end = windows[w].end;
+                for (size_t pos = windows[w].start; pos < window_end; pos++) {
+                    R = _mm256_slli_epi64(R, 1);
+                    R = _mm256_or_si256(R, init_mask);
+                    uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
+                    __m256i mask =
+                        _mm256_loadu_si256((__m256i *)matcher->bitmasks[index]);
+                    R = _mm256_and_si256(R, mask);
+                    if (!_mm256_testz_si256(R, found_mask)) {
+                        already_found = update_adapter_count_array_avx2(
+                            pos, R, already_found, matcher,
+                            self->adapter_counter);
+                    }
+                }
+            }
+        }
+        else {
+            MachineWordPatternMatcherAVX2 *matcher1 =
+                self->avx2_matchers + matcher_index;
+            MachineWordPatternMatcherAVX2 *matcher2 =
+                self->avx2_matchers + matcher_index + 1;
+            __m256i found_mask1 =
+                _mm256_loadu_si256((__m256i *)matcher1->found_mask);
+            __m256i found_mask2 =
+                _mm256_loadu_si256((__m256i *)matcher2->found_mask);
+            __m256i init_mask1 =
+                _mm256_loadu_si256((__m256i *)matcher1->init_mask);
+            __m256i init_mask2 =
+                _mm256_loadu_si256((__m256i *)matcher2->init_mask);
+            __m256i already_found1 = _mm256_setzero_si256();
+            __m256i already_found2 = _mm256_setzero_si256();
+            matcher_index += 2;
+            for (size_t w = 0; w < number_of_windows; w++) {
+                __m256i R1 = _mm256_setzero_si256();
+                __m256i R2 = _mm256_setzero_si256();
+                size_t window_end = windows[w].end;
+                for (size_t pos = windows[w].start; pos < window_end; pos++) {
+                    R1 = _mm256_slli_epi64(R1, 1);
+                    R2 = _mm256_slli_epi64(R2, 1);
+                    R1 = _mm256_or_si256(R1, init_mask1);
+                    R2 = _mm256_or_si256(R2, init_mask2);
+                    uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
+                    __m256i mask1 = _mm256_loadu_si256(
+                        (__m256i *)matcher1->bitmasks[index]);
+                    __m256i mask2 = _mm256_loadu_si256(
+                        (__m256i *)matcher2->bitmasks[index]);
+                    R1 = _mm256_and_si256(R1, mask1);
+                    R2 = _mm256_and_si256(R2, mask2);
+                    if (!_mm256_testz_si256(R1, found_mask1)) {
+                        already_found1 = update_adapter_count_array_avx2(
+                            pos, R1, already_found1, matcher1,
+                            self->adapter_counter);
+                    }
+                    if (!_mm256_testz_si256(R2, found_mask2)) {
+                        already_found2 = update_adapter_count_array_avx2(
+                            pos, R2, already_found2, matcher2,
+                            self->adapter_counter);
+                    }
+                }
+            }
+        }
+    }
+    /* Avoid AVX-SSE transition penalties in the SSE2 code that follows. */
+    _mm256_zeroupper();
+}
+#endif
+
 static int
 AdapterCounter_add_meta(AdapterCounter *self, struct FastqMeta *meta)
 {
@@ -2444,6 +4978,24 @@ AdapterCounter_add_meta(AdapterCounter *self, struct FastqMeta *meta)
             return -1;
         }
     }
+    struct AdapterWindow whole_sequence = {0, sequence_length};
+    const struct AdapterWindow *windows = &whole_sequence;
+    size_t number_of_windows = 1;
+    if (self->prefilter != NULL) {
+        Py_ssize_t found_windows =
+            AdapterCounter_find_windows(self, sequence, sequence_length);
+        if (found_windows < 0) {
+            return -1;
+        }
+        windows = self->windows;
+        number_of_windows = found_windows;
+    }
+#if ADAPTER_COUNTER_HAS_AVX2
+    if (self->number_of_avx2_matchers) {
+        AdapterCounter_run_avx2_matchers(self, sequence, windows,
+                                         number_of_windows);
+    }
+#endif
     size_t scalar_matcher_index = 0;
     size_t vector_matcher_index = 0;
     size_t number_of_scalar_matchers = self->number_of_matchers;
@@ -2460,18 +5012,22 @@ AdapterCounter_add_meta(AdapterCounter *self, struct FastqMeta *meta)
                 self->matchers + scalar_matcher_index;
             bitmask_t found_mask = matcher->found_mask;
             bitmask_t init_mask = matcher->init_mask;
-            bitmask_t R = 0;
             bitmask_t *bitmask = matcher->bitmasks;
             bitmask_t already_found = 0;
             scalar_matcher_index += 1;
-            for (size_t pos = 0; pos < sequence_length; pos++) {
-                R <<= 1;
-                R |= init_mask;
-                uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
-                R &= bitmask[index];
-                if (R & found_mask) {
-                    already_found = update_adapter_count_array(
-                        pos, R, already_found, matcher, self->adapter_counter);
+            for (size_t w = 0; w < number_of_windows; w++) {
+                bitmask_t R = 0;
+                size_t window_end = windows[w].end;
+                for (size_t pos = windows[w].start; pos < window_end; pos++) {
+                    R <<= 1;
+                    R |= init_mask;
+                    uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
+                    R &= bitmask[index];
+                    if (R & found_mask) {
+                        already_found = update_adapter_count_array(
+                            pos, R, already_found, matcher,
+                            self->adapter_counter);
+                    }
                 }
             }
         }
@@ -2481,19 +5037,23 @@ AdapterCounter_add_meta(AdapterCounter *self, struct FastqMeta *meta)
                 self->sse2_matchers + vector_matcher_index;
             __m128i found_mask = matcher->found_mask;
             __m128i init_mask = matcher->init_mask;
-            __m128i R = _mm_setzero_si128();
             __m128i *bitmask = matcher->bitmasks;
             __m128i already_found = _mm_setzero_si128();
             vector_matcher_index += 1;
-            for (size_t pos = 0; pos < sequence_length; pos++) {
-                R = _mm_slli_epi64(R, 1);
-                R = _mm_or_si128(R, init_mask);
-                uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
-                __m128i mask = bitmask[index];
-                R = _mm_and_si128(R, mask);
-                if (bitwise_and_nonzero_si128(R, found_mask)) {
-                    already_found = update_adapter_count_array_sse2(
-                        pos, R, already_found, matcher, self->adapter_counter);
+            for (size_t w = 0; w < number_of_windows; w++) {
+                __m128i R = _mm_setzero_si128();
+                size_t window_end = windows[w].end;
+                for (size_t pos = windows[w].start; pos < window_end; pos++) {
+                    R = _mm_slli_epi64(R, 1);
+                    R = _mm_or_si128(R, init_mask);
+                    uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
+                    __m128i mask = bitmask[index];
+                    R = _mm_and_si128(R, mask);
+                    if (bitwise_and_nonzero_si128(R, found_mask)) {
+                        already_found = update_adapter_count_array_sse2(
+                            pos, R, already_found, matcher,
+                            self->adapter_counter);
+                    }
                 }
             }
             /* In the cases below we take advantage of out of order execution
@@ -2514,32 +5074,36 @@ AdapterCounter_add_meta(AdapterCounter *self, struct FastqMeta *meta)
             bitmask_t scalar_found_mask = scalar_matcher->found_mask;
             __m128i vector_init_mask = vector_matcher->init_mask;
             bitmask_t scalar_init_mask = scalar_matcher->init_mask;
-            __m128i vector_R = _mm_setzero_si128();
-            bitmask_t scalar_R = 0;
             __m128i *vector_bitmasks = vector_matcher->bitmasks;
             bitmask_t *scalar_bitmasks = scalar_matcher->bitmasks;
             __m128i vector_already_found = _mm_setzero_si128();
             bitmask_t scalar_already_found = 0;
             vector_matcher_index += 1;
             scalar_matcher_index += 1;
-            for (size_t pos = 0; pos < sequence_length; pos++) {
-                vector_R = _mm_slli_epi64(vector_R, 1);
-                scalar_R <<= 1;
-                vector_R = _mm_or_si128(vector_R, vector_init_mask);
-                scalar_R |= scalar_init_mask;
-                uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
-                scalar_R &= scalar_bitmasks[index];
-                __m128i vector_mask = vector_bitmasks[index];
-                vector_R = _mm_and_si128(vector_R, vector_mask);
-                if (bitwise_and_nonzero_si128(vector_R, vector_found_mask)) {
-                    vector_already_found = update_adapter_count_array_sse2(
-                        pos, vector_R, vector_already_found, vector_matcher,
-                        self->adapter_counter);
-                }
-                if (scalar_R & scalar_found_mask) {
-                    scalar_already_found = update_adapter_count_array(
-                        pos, scalar_R, scalar_already_found, scalar_matcher,
-                        self->adapter_counter);
+            for (size_t w = 0; w < number_of_windows; w++) {
+                __m128i vector_R = _mm_setzero_si128();
+                bitmask_t scalar_R = 0;
+                size_t window_end = windows[w].end;
+                for (size_t pos = windows[w].start; pos < window_end; pos++) {
+                    vector_R = _mm_slli_epi64(vector_R, 1);
+                    scalar_R <<= 1;
+                    vector_R = _mm_or_si128(vector_R, vector_init_mask);
+                    scalar_R |= scalar_init_mask;
+                    uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
+                    scalar_R &= scalar_bitmasks[index];
+                    __m128i vector_mask = vector_bitmasks[index];
+                    vector_R = _mm_and_si128(vector_R, vector_mask);
+                    if (bitwise_and_nonzero_si128(vector_R,
+                                                  vector_found_mask)) {
+                        vector_already_found = update_adapter_count_array_sse2(
+                            pos, vector_R, vector_already_found, vector_matcher,
+                            self->adapter_counter);
+                    }
+                    if (scalar_R & scalar_found_mask) {
+                        scalar_already_found = update_adapter_count_array(
+                            pos, scalar_R, scalar_already_found, scalar_matcher,
+                            self->adapter_counter);
+                    }
                 }
             }
         }
@@ -2552,30 +5116,35 @@ AdapterCounter_add_meta(AdapterCounter *self, struct FastqMeta *meta)
             __m128i found_mask2 = matcher2->found_mask;
             __m128i init_mask1 = matcher1->init_mask;
             __m128i init_mask2 = matcher2->init_mask;
-            __m128i R1 = _mm_setzero_si128();
-            __m128i R2 = _mm_setzero_si128();
             __m128i *bitmasks1 = matcher1->bitmasks;
             __m128i *bitmasks2 = matcher2->bitmasks;
             __m128i already_found1 = _mm_setzero_si128();
             __m128i already_found2 = _mm_setzero_si128();
             vector_matcher_index += 2;
-            for (size_t pos = 0; pos < sequence_length; pos++) {
-                R1 = _mm_slli_epi64(R1, 1);
-                R2 = _mm_slli_epi64(R2, 1);
-                R1 = _mm_or_si128(R1, init_mask1);
-                R2 = _mm_or_si128(R2, init_mask2);
-                uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
-                __m128i mask1 = bitmasks1[index];
-                __m128i mask2 = bitmasks2[index];
-                R1 = _mm_and_si128(R1, mask1);
-                R2 = _mm_and_si128(R2, mask2);
-                if (bitwise_and_nonzero_si128(R1, found_mask1)) {
-                    already_found1 = update_adapter_count_array_sse2(
-                        pos, R1, already_found1, matcher1, self->adapter_counter);
-                }
-                if (bitwise_and_nonzero_si128(R2, found_mask2)) {
-                    already_found2 = update_adapter_count_array_sse2(
-                        pos, R2, already_found2, matcher2, self->adapter_counter);
+            for (size_t w = 0; w < number_of_windows; w++) {
+                __m128i R1 = _mm_setzero_si128();
+                __m128i R2 = _mm_setzero_si128();
+                size_t window_end = windows[w].end;
+                for (size_t pos = windows[w].start; pos < window_end; pos++) {
+                    R1 = _mm_slli_epi64(R1, 1);
+                    R2 = _mm_slli_epi64(R2, 1);
+                    R1 = _mm_or_si128(R1, init_mask1);
+                    R2 = _mm_or_si128(R2, init_mask2);
+                    uint8_t index = NUCLEOTIDE_TO_INDEX[sequence[pos]];
+                    __m128i mask1 = bitmasks1[index];
+                    __m128i mask2 = bitmasks2[index];
+                    R1 = _mm_and_si128(R1, mask1);
+                    R2 = _mm_and_si128(R2, mask2);
+                    if (bitwise_and_nonzero_si128(R1, found_mask1)) {
+                        already_found1 = update_adapter_count_array_sse2(
+                            pos, R1, already_found1, matcher1,
+                            self->adapter_counter);
+                    }
+                    if (bitwise_and_nonzero_si128(R2, found_mask2)) {
+                        already_found2 = update_adapter_count_array_sse2(
+                            pos, R2, already_found2, matcher2,
+                            self->adapter_counter);
+                    }
                 }
             }
         }
@@ -2632,48 +5201,215 @@ AdapterCounter_add_record_array(AdapterCounter *self,
             Py_TYPE(record_array)->tp_name);
         return NULL;
     }
-    Py_ssize_t number_of_records = Py_SIZE(record_array);
-    struct FastqMeta *records = record_array->records;
-    for (Py_ssize_t i = 0; i < number_of_records; i++) {
-        if (AdapterCounter_add_meta(self, records + i) != 0) {
-            return NULL;
+    Py_ssize_t number_of_records = Py_SIZE(record_array);
+    struct FastqMeta *records = record_array->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
+    for (Py_ssize_t i = 0; i < number_of_records; i++) {
+        ret = AdapterCounter_add_meta(self, records + i);
+        if (ret != 0) {
+            break;
+        }
+    }
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(AdapterCounter_get_counts__doc__,
+             "get_counts($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the counts as a list of tuples. Each tuple contains the "
+             "adapter, \n"
+             "and an array.array counts per position. \n");
+
+#define AdapterCounter_get_counts_method METH_NOARGS
+
+static PyObject *
+AdapterCounter_get_counts(AdapterCounter *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *counts_list = PyList_New(self->number_of_adapters);
+    if (counts_list == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (size_t i = 0; i < self->number_of_adapters; i++) {
+        PyObject *tup = PyTuple_New(2);
+        PyObject *counts = PythonArray_FromBuffer(
+            'Q', self->adapter_counter[i], self->max_length * sizeof(uint64_t));
+        if (counts == NULL) {
+            return NULL;
+        }
+        PyObject *adapter = PyTuple_GET_ITEM(self->adapters, i);
+        Py_INCREF(adapter);
+        PyTuple_SET_ITEM(tup, 0, adapter);
+        PyTuple_SET_ITEM(tup, 1, counts);
+        PyList_SET_ITEM(counts_list, i, tup);
+    }
+    return counts_list;
+}
+
+PyDoc_STRVAR(AdapterCounter_merge__doc__,
+             "merge($self, other, /)\n"
+             "--\n"
+             "\n"
+             "Add the counts of another AdapterCounter object to this one. \n"
+             "Both objects must search for the same adapters.\n"
+             "\n"
+             "  other\n"
+             "    An AdapterCounter object.\n");
+
+#define AdapterCounter_merge_method METH_O
+
+static PyObject *
+AdapterCounter_merge(AdapterCounter *self, AdapterCounter *other)
+{
+    if (check_merge_compatibility((PyObject *)self, (PyObject *)other) != 0) {
+        return NULL;
+    }
+    int adapters_equal =
+        PyObject_RichCompareBool(self->adapters, other->adapters, Py_EQ);
+    if (adapters_equal == -1) {
+        return NULL;
+    }
+    if (!adapters_equal) {
+        PyErr_Format(PyExc_ValueError,
+                     "Adapters should be the same, got %R and %R",
+                     self->adapters, other->adapters);
+        return NULL;
+    }
+    if (AdapterCounter_resize(self, other->max_length) != 0) {
+        return NULL;
+    }
+    size_t other_max_length = other->max_length;
+    for (size_t i = 0; i < self->number_of_adapters; i++) {
+        uint64_t *counts = self->adapter_counter[i];
+        uint64_t *other_counts = other->adapter_counter[i];
+        for (size_t j = 0; j < other_max_length; j++) {
+            counts[j] += other_counts[j];
+        }
+    }
+    self->number_of_sequences += other->number_of_sequences;
+    ModuleProfile_merge(&self->profile, &other->profile);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(AdapterCounter_dump__doc__,
+             "dump($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the state of the object as a bytes object that can be \n"
+             "restored with AdapterCounter.load.\n");
+
+#define AdapterCounter_dump_method METH_NOARGS
+
+static PyObject *
+AdapterCounter_dump(AdapterCounter *self, PyObject *Py_UNUSED(ignore))
+{
+    struct StateWriter writer;
+    if (StateWriter_init(&writer, (PyObject *)self) != 0) {
+        return NULL;
+    }
+    int failed = StateWriter_write_u64(&writer, self->number_of_adapters);
+    for (size_t i = 0; i < self->number_of_adapters && !failed; i++) {
+        PyObject *adapter = PyTuple_GET_ITEM(self->adapters, i);
+        failed = StateWriter_write_str(&writer, adapter);
+    }
+    failed = failed || StateWriter_write_u64(&writer, self->max_length) ||
+             StateWriter_write_u64(&writer, self->number_of_sequences);
+    for (size_t i = 0; i < self->number_of_adapters && !failed; i++) {
+        failed = StateWriter_write_u64_array(
+            &writer, self->adapter_counter[i], self->max_length);
+    }
+    return StateWriter_finish(&writer, failed);
+}
+
+PyDoc_STRVAR(AdapterCounter_load__doc__,
+             "load($type, data, /)\n"
+             "--\n"
+             "\n"
+             "Create an AdapterCounter object from the output of dump(). \n"
+             "\n"
+             "  data\n"
+             "    A bytes-like object.\n");
+
+#define AdapterCounter_load_method (METH_O | METH_CLASS)
+
+static PyObject *
+AdapterCounter_load(PyTypeObject *type, PyObject *data)
+{
+    struct StateReader reader;
+    if (StateReader_init(&reader, data, type) != 0) {
+        return NULL;
+    }
+    AdapterCounter *self = NULL;
+    PyObject *adapters = NULL;
+    size_t number_of_adapters;
+    size_t max_length;
+    uint64_t number_of_sequences;
+    if (StateReader_read_size(&reader, &number_of_adapters) != 0 ||
+        StateReader_check_remaining(&reader, number_of_adapters) != 0) {
+        goto error;
+    }
+    adapters = PyTuple_New(number_of_adapters);
+    if (adapters == NULL) {
+        goto error;
+    }
+    for (size_t i = 0; i < number_of_adapters; i++) {
+        PyObject *adapter = StateReader_read_str(&reader);
+        if (adapter == NULL) {
+            goto error;
+        }
+        PyTuple_SET_ITEM(adapters, i, adapter);
+    }
+    self = (AdapterCounter *)PyObject_CallOneArg((PyObject *)type, adapters);
+    if (self == NULL || StateReader_read_size(&reader, &max_length) != 0 ||
+        StateReader_read_u64(&reader, &number_of_sequences) != 0 ||
+        StateReader_check_remaining(&reader, max_length) != 0 ||
+        AdapterCounter_resize(self, max_length) != 0) {
+        goto error;
+    }
+    self->number_of_sequences = number_of_sequences;
+    for (size_t i = 0; i < number_of_adapters; i++) {
+        if (StateReader_read_u64_array(&reader, self->adapter_counter[i],
+                                       max_length) != 0) {
+            goto error;
         }
     }
-    Py_RETURN_NONE;
+    if (StateReader_finish(&reader) != 0) {
+        goto error;
+    }
+    Py_DECREF(adapters);
+    StateReader_release(&reader);
+    return (PyObject *)self;
+error:
+    Py_XDECREF(adapters);
+    Py_XDECREF(self);
+    StateReader_release(&reader);
+    return NULL;
 }
 
-PyDoc_STRVAR(AdapterCounter_get_counts__doc__,
-             "get_counts($self, /)\n"
+PyDoc_STRVAR(AdapterCounter_profile__doc__,
+             "profile($self, /)\n"
              "--\n"
              "\n"
-             "Return the counts as a list of tuples. Each tuple contains the "
-             "adapter, \n"
-             "and an array.array counts per position. \n");
+             "Return a dictionary with the performance counters of the "
+             "module.\n"
+             "The time is only measured when profiling is set.\n");
 
-#define AdapterCounter_get_counts_method METH_NOARGS
+#define AdapterCounter_profile_method METH_NOARGS
 
 static PyObject *
-AdapterCounter_get_counts(AdapterCounter *self, PyObject *Py_UNUSED(ignore))
+AdapterCounter_profile(AdapterCounter *self, PyObject *Py_UNUSED(ignore))
 {
-    PyObject *counts_list = PyList_New(self->number_of_adapters);
-    if (counts_list == NULL) {
-        PyErr_NoMemory();
-        return NULL;
-    }
-    for (size_t i = 0; i < self->number_of_adapters; i++) {
-        PyObject *tup = PyTuple_New(2);
-        PyObject *counts = PythonArray_FromBuffer(
-            'Q', self->adapter_counter[i], self->max_length * sizeof(uint64_t));
-        if (counts == NULL) {
-            return NULL;
-        }
-        PyObject *adapter = PyTuple_GET_ITEM(self->adapters, i);
-        Py_INCREF(adapter);
-        PyTuple_SET_ITEM(tup, 0, adapter);
-        PyTuple_SET_ITEM(tup, 1, counts);
-        PyList_SET_ITEM(counts_list, i, tup);
-    }
-    return counts_list;
+    return ModuleProfile_to_dict(&self->profile);
 }
 
 static PyMethodDef AdapterCounter_methods[] = {
@@ -2684,6 +5420,14 @@ static PyMethodDef AdapterCounter_methods[] = {
      AdapterCounter_add_record_array__doc__},
     {"get_counts", (PyCFunction)AdapterCounter_get_counts,
      AdapterCounter_get_counts_method, AdapterCounter_get_counts__doc__},
+    {"merge", (PyCFunction)AdapterCounter_merge, AdapterCounter_merge_method,
+     AdapterCounter_merge__doc__},
+    {"dump", (PyCFunction)AdapterCounter_dump, AdapterCounter_dump_method,
+     AdapterCounter_dump__doc__},
+    {"load", (PyCFunction)AdapterCounter_load, AdapterCounter_load_method,
+     AdapterCounter_load__doc__},
+    {"profile", (PyCFunction)AdapterCounter_profile,
+     AdapterCounter_profile_method, AdapterCounter_profile__doc__},
     {NULL},
 };
 
@@ -2695,6 +5439,11 @@ static PyMemberDef AdapterCounter_members[] = {
      "The total counted number of sequences"},
     {"adapters", T_OBJECT_EX, offsetof(AdapterCounter, adapters), READONLY,
      "The adapters that are searched for"},
+    {"prefilter", T_BOOL, offsetof(AdapterCounter, uses_prefilter), READONLY,
+     "Whether the adapter search is limited to windows found by the k-mer "
+     "prefilter"},
+    {"profiling", T_BOOL, offsetof(AdapterCounter, profiling), 0,
+     "Measure the time spent in add_record_array."},
     {NULL},
 };
 
@@ -2711,11 +5460,20 @@ static PyTypeObject AdapterCounter_type = {
  * Per Tile Quality *
  ********************/
 
+/* For the exact positions, length_counts holds the number of reads that end
+   at each position. Reads that are longer than exact_positions are counted at
+   the last exact position. For the binned rows, length_counts holds the
+   number of bases in the bin directly. */
 typedef struct _TileQualityStruct {
     uint64_t *length_counts;
     double *total_errors;
 } TileQuality;
 
+/* Consecutive reads usually come from the same tile. The header up to and
+   including the colon after the tile ID is stored, so the next header only
+   needs a memcmp to find its tile ID. */
+#define TILE_PREFIX_MAX_LENGTH 128
+
 typedef struct _PerTileQualityStruct {
     PyObject_HEAD
     uint8_t phred_offset;
@@ -2723,40 +5481,128 @@ typedef struct _PerTileQualityStruct {
     TileQuality *tile_qualities;
     size_t number_of_tiles;
     size_t max_length;
+    size_t exact_positions;
+    size_t number_of_rows;
     size_t number_of_reads;
+    size_t tile_prefix_length;
+    Py_ssize_t tile_prefix_id;
+    uint8_t tile_prefix[TILE_PREFIX_MAX_LENGTH];
     PyObject *skipped_reason;
+    struct QualityBins quality_bins;
+    char profiling;
+    struct ModuleProfile profile;
 } PerTileQuality;
 
+/* Add the error rates of the longest run of 32 byte chunks at the start of
+   qualities to total_errors and return its length. Only set when a
+   vectorized quality bin kernel is available. */
+static size_t (*PerTileQuality_add_quality_bins)(
+    struct QualityBins *bins, double *total_errors, const uint8_t *qualities,
+    size_t length, uint8_t phred_offset) = NULL;
+
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+__attribute__((__target__("avx2"))) static size_t
+PerTileQuality_add_quality_bins_avx2(struct QualityBins *bins,
+                                     double *total_errors,
+                                     const uint8_t *qualities, size_t length,
+                                     uint8_t phred_offset)
+{
+    __m256i bin_phreds[QUALITY_BINS_MAX];
+    for (size_t i = 0; i < QUALITY_BINS_MAX; i++) {
+        bin_phreds[i] = _mm256_set1_epi8(bins->phreds[i]);
+    }
+    __m256i error_rates =
+        _mm256_loadu_si256((const __m256i *)bins->error_rates);
+    __m256i offset_vec = _mm256_set1_epi8(phred_offset);
+    size_t i = 0;
+    while (i + 32 <= length) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(qualities + i));
+        __m256i phreds = _mm256_sub_epi8(chunk, offset_vec);
+        __m256i bin_indices;
+        if (!QualityBins_classify_avx2(bin_phreds, phreds, &bin_indices)) {
+            bins->state = QUALITY_BINS_DISABLED;
+            break;
+        }
+        __m128i indices[2] = {_mm256_castsi256_si128(bin_indices),
+                              _mm256_extracti128_si256(bin_indices, 1)};
+        for (size_t j = 0; j < 2; j++) {
+            __m256d rates[4] = {
+                QualityBins_error_rates_avx2(error_rates, indices[j]),
+                QualityBins_error_rates_avx2(error_rates,
+                                             _mm_srli_si128(indices[j], 4)),
+                QualityBins_error_rates_avx2(error_rates,
+                                             _mm_srli_si128(indices[j], 8)),
+                QualityBins_error_rates_avx2(error_rates,
+                                             _mm_srli_si128(indices[j], 12)),
+            };
+            for (size_t k = 0; k < 4; k++) {
+                double *cursor = total_errors + i + j * 16 + k * 4;
+                _mm256_storeu_pd(
+                    cursor, _mm256_add_pd(_mm256_loadu_pd(cursor), rates[k]));
+            }
+        }
+        i += 32;
+    }
+    _mm256_zeroupper();
+    return i;
+}
+
+/* Constructor runs at dynamic load time */
+__attribute__((constructor)) static void
+PerTileQuality_init_func_ptr(void)
+{
+    if (__builtin_cpu_supports("avx2")) {
+        PerTileQuality_add_quality_bins = PerTileQuality_add_quality_bins_avx2;
+    }
+}
+#endif
+
 static void
 PerTileQuality_dealloc(PerTileQuality *self)
 {
     Py_XDECREF(self->skipped_reason);
     for (size_t i = 0; i < self->number_of_tiles; i++) {
         TileQuality tile_qual = self->tile_qualities[i];
-        PyMem_Free(tile_qual.length_counts);
-        PyMem_Free(tile_qual.total_errors);
+        PyMem_RawFree(tile_qual.length_counts);
+        PyMem_RawFree(tile_qual.total_errors);
     }
-    PyMem_Free(self->tile_qualities);
+    PyMem_RawFree(self->tile_qualities);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 static PyObject *
 PerTileQuality__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
-    static char *kwargnames[] = {NULL};
-    static char *format = ":PerTileQuality";
+    Py_ssize_t exact_positions = DEFAULT_EXACT_POSITIONS;
+    static char *kwargnames[] = {"exact_positions", NULL};
+    static char *format = "|n:PerTileQuality";
     uint8_t phred_offset = 33;
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames,
+                                     &exact_positions)) {
+        return NULL;
+    }
+    if (check_exact_positions(exact_positions) != 0) {
         return NULL;
     }
     PerTileQuality *self = PyObject_New(PerTileQuality, type);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
     self->max_length = 0;
+    self->exact_positions = exact_positions;
+    self->number_of_rows = 0;
     self->phred_offset = phred_offset;
     self->tile_qualities = NULL;
     self->number_of_reads = 0;
     self->number_of_tiles = 0;
+    self->tile_prefix_length = 0;
+    self->tile_prefix_id = -1;
     self->skipped = 0;
     self->skipped_reason = NULL;
+    QualityBins_init(&self->quality_bins,
+                     PerTileQuality_add_quality_bins != NULL);
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
     return (PyObject *)self;
 }
 
@@ -2766,10 +5612,10 @@ PerTileQuality_resize_tile_array(PerTileQuality *self, size_t highest_tile)
     if (highest_tile < self->number_of_tiles) {
         return 0;
     }
-    TileQuality *new_qualities =
-        PyMem_Realloc(self->tile_qualities, highest_tile * sizeof(TileQuality));
+    TileQuality *new_qualities = PyMem_RawRealloc(
+        self->tile_qualities, highest_tile * sizeof(TileQuality));
     if (new_qualities == NULL) {
-        PyErr_NoMemory();
+        set_no_memory_error_gil_safe();
         return -1;
     }
     size_t previous_number_of_tiles = self->number_of_tiles;
@@ -2788,30 +5634,33 @@ PerTileQuality_resize_tiles(PerTileQuality *self, size_t new_length)
     }
     TileQuality *tile_qualities = self->tile_qualities;
     size_t number_of_tiles = self->number_of_tiles;
-    size_t old_length = self->max_length;
+    size_t old_rows = self->number_of_rows;
+    size_t new_rows = position_bins_rows(self->exact_positions, new_length);
     for (size_t i = 0; i < number_of_tiles; i++) {
         TileQuality *tile_quality = tile_qualities + i;
         if (tile_quality->length_counts == NULL &&
             tile_quality->total_errors == NULL) {
             continue;
         }
-        uint64_t *length_counts = PyMem_Realloc(tile_quality->length_counts,
-                                                new_length * sizeof(uint64_t));
-        double *total_errors = PyMem_Realloc(tile_quality->total_errors,
-                                             new_length * sizeof(double));
-
-        if (length_counts == NULL || total_errors == NULL) {
-            PyErr_NoMemory();
+        uint64_t *length_counts = realloc_zeroed(
+            tile_quality->length_counts, old_rows * sizeof(uint64_t),
+            new_rows * sizeof(uint64_t));
+        if (length_counts == NULL) {
+            set_no_memory_error_gil_safe();
             return -1;
         }
-        memset(length_counts + old_length, 0,
-               (new_length - old_length) * sizeof(uint64_t));
-        memset(total_errors + old_length, 0,
-               (new_length - old_length) * sizeof(double));
         tile_quality->length_counts = length_counts;
+        double *total_errors = realloc_zeroed(tile_quality->total_errors,
+                                              old_rows * sizeof(double),
+                                              new_rows * sizeof(double));
+        if (total_errors == NULL) {
+            set_no_memory_error_gil_safe();
+            return -1;
+        }
         tile_quality->total_errors = total_errors;
     }
     self->max_length = new_length;
+    self->number_of_rows = new_rows;
     return 0;
 }
 
@@ -2820,10 +5669,13 @@ PerTileQuality_resize_tiles(PerTileQuality *self, size_t new_length)
  *
  * @param header A string pointing to the header
  * @param header_length length of the header string
+ * @param prefix_length Set to the length of the header up to and including
+ *                      the colon after the tile ID.
  * @return long the tile_id or -1 if there was a parse error.
  */
 static Py_ssize_t
-illumina_header_to_tile_id(const uint8_t *header, size_t header_length)
+illumina_header_to_tile_id(const uint8_t *header, size_t header_length,
+                           size_t *prefix_length)
 {
     /* The following link contains the header format:
        https://support.illumina.com/help/BaseSpace_OLH_009008/Content/Source/Informatics/BS/FileFormat_FASTQ-files_swBS.htm
@@ -2850,6 +5702,7 @@ illumina_header_to_tile_id(const uint8_t *header, size_t header_length)
         if (*cursor == ':') {
             const uint8_t *tile_end = cursor;
             size_t tile_length = tile_end - tile_start;
+            *prefix_length = tile_end + 1 - header;
             return unsigned_decimal_integer_from_string(tile_start, tile_length);
         }
         cursor += 1;
@@ -2870,18 +5723,32 @@ PerTileQuality_add_meta(PerTileQuality *self, struct FastqMeta *meta)
     size_t sequence_length = meta->sequence_length;
     uint8_t phred_offset = self->phred_offset;
 
-    Py_ssize_t tile_id = illumina_header_to_tile_id(header, header_length);
-    if (tile_id == -1) {
-        PyObject *header_obj =
-            PyUnicode_DecodeASCII((const char *)header, header_length, NULL);
-        if (header_obj == NULL) {
-            return -1;
+    Py_ssize_t tile_id;
+    size_t prefix_length = self->tile_prefix_length;
+    if (prefix_length != 0 && header_length > prefix_length &&
+        memcmp(header, self->tile_prefix, prefix_length) == 0) {
+        tile_id = self->tile_prefix_id;
+    }
+    else {
+        tile_id =
+            illumina_header_to_tile_id(header, header_length, &prefix_length);
+        if (tile_id == -1) {
+            self->skipped_reason =
+                header_parse_failure_reason_gil_safe(header, header_length);
+            if (self->skipped_reason == NULL) {
+                return -1;
+            }
+            self->skipped = 1;
+            return 0;
+        }
+        if (prefix_length <= TILE_PREFIX_MAX_LENGTH) {
+            memcpy(self->tile_prefix, header, prefix_length);
+            self->tile_prefix_length = prefix_length;
+            self->tile_prefix_id = tile_id;
+        }
+        else {
+            self->tile_prefix_length = 0;
         }
-        self->skipped_reason =
-            PyUnicode_FromFormat("Can not parse header: %R", header_obj);
-        Py_DECREF(header_obj);
-        self->skipped = 1;
-        return 0;
     }
 
     if (sequence_length > self->max_length) {
@@ -2901,14 +5768,17 @@ PerTileQuality_add_meta(PerTileQuality *self, struct FastqMeta *meta)
     TileQuality *tile_quality = self->tile_qualities + tile_id;
     if (tile_quality->length_counts == NULL && tile_quality->total_errors == NULL) {
         uint64_t *length_counts =
-            PyMem_Malloc(self->max_length * sizeof(uint64_t));
-        double *total_errors = PyMem_Malloc(self->max_length * sizeof(double));
+            PyMem_RawMalloc(self->number_of_rows * sizeof(uint64_t));
+        double *total_errors =
+            PyMem_RawMalloc(self->number_of_rows * sizeof(double));
         if (length_counts == NULL || total_errors == NULL) {
-            PyErr_NoMemory();
+            PyMem_RawFree(length_counts);
+            PyMem_RawFree(total_errors);
+            set_no_memory_error_gil_safe();
             return -1;
         }
-        memset(length_counts, 0, self->max_length * sizeof(uint64_t));
-        memset(total_errors, 0, self->max_length * sizeof(double));
+        memset(length_counts, 0, self->number_of_rows * sizeof(uint64_t));
+        memset(total_errors, 0, self->number_of_rows * sizeof(double));
         tile_quality->length_counts = length_counts;
         tile_quality->total_errors = total_errors;
     }
@@ -2917,12 +5787,23 @@ PerTileQuality_add_meta(PerTileQuality *self, struct FastqMeta *meta)
     if (sequence_length == 0) {
         return 0;
     }
-    tile_quality->length_counts[sequence_length - 1] += 1;
+    size_t exact_positions = self->exact_positions;
+    size_t exact_length = Py_MIN(sequence_length, exact_positions);
+    tile_quality->length_counts[exact_length - 1] += 1;
     double *restrict total_errors = tile_quality->total_errors;
-    double *restrict error_cursor = total_errors;
-    const uint8_t *qualities_end = qualities + sequence_length;
-    const uint8_t *restrict qualities_ptr = qualities;
-    const uint8_t *qualities_unroll_end = qualities_end - 1;
+    struct QualityBins *bins = &self->quality_bins;
+    size_t quality_bins_length = 0;
+    if (bins->state == QUALITY_BINS_ACTIVE) {
+        quality_bins_length = PerTileQuality_add_quality_bins(
+            bins, total_errors, qualities, exact_length, phred_offset);
+    }
+    else if (bins->state == QUALITY_BINS_DETECTING) {
+        QualityBins_detect(bins, qualities, exact_length, phred_offset);
+    }
+    double *restrict error_cursor = total_errors + quality_bins_length;
+    const uint8_t *qualities_end = qualities + exact_length;
+    const uint8_t *restrict qualities_ptr = qualities + quality_bins_length;
+    const uint8_t *qualities_unroll_end = qualities_end - 3;
     while (qualities_ptr < qualities_unroll_end) {
         uint8_t phred0 = qualities_ptr[0] - phred_offset;
         uint8_t phred1 = qualities_ptr[1] - phred_offset;
@@ -2947,14 +5828,36 @@ PerTileQuality_add_meta(PerTileQuality *self, struct FastqMeta *meta)
     while (qualities_ptr < qualities_end) {
         uint8_t q = *qualities_ptr - phred_offset;
         if (q > PHRED_MAX) {
-            PyErr_Format(PyExc_ValueError, "Not a valid phred character: %c",
-                         *qualities_ptr);
+            set_phred_error_gil_safe(*qualities_ptr);
             return -1;
         }
         *error_cursor += SCORE_TO_ERROR_RATE[q];
         qualities_ptr += 1;
         error_cursor += 1;
     }
+
+    size_t row = exact_positions;
+    size_t bin_start = exact_positions;
+    size_t bin_width = exact_positions / POSITION_BINS_PER_OCTAVE;
+    while (bin_start < sequence_length) {
+        size_t bin_end = Py_MIN(bin_start + bin_width, sequence_length);
+        double bin_errors = 0.0;
+        for (size_t i = bin_start; i < bin_end; i++) {
+            uint8_t q = qualities[i] - phred_offset;
+            if (q > PHRED_MAX) {
+                set_phred_error_gil_safe(qualities[i]);
+                return -1;
+            }
+            bin_errors += SCORE_TO_ERROR_RATE[q];
+        }
+        total_errors[row] += bin_errors;
+        tile_quality->length_counts[row] += bin_end - bin_start;
+        row += 1;
+        bin_start += bin_width;
+        if (bin_start == bin_width * POSITION_BINS_PER_OCTAVE * 2) {
+            bin_width *= 2;
+        }
+    }
     return 0;
 }
 
@@ -3012,79 +5915,412 @@ PerTileQuality_add_record_array(PerTileQuality *self,
             Py_TYPE(record_array)->tp_name);
         return NULL;
     }
-    Py_ssize_t number_of_records = Py_SIZE(record_array);
-    struct FastqMeta *records = record_array->records;
-    for (Py_ssize_t i = 0; i < number_of_records; i++) {
-        if (PerTileQuality_add_meta(self, records + i) != 0) {
-            return NULL;
+    Py_ssize_t number_of_records = Py_SIZE(record_array);
+    struct FastqMeta *records = record_array->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
+    for (Py_ssize_t i = 0; i < number_of_records; i++) {
+        ret = PerTileQuality_add_meta(self, records + i);
+        if (ret != 0) {
+            break;
+        }
+    }
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(PerTileQuality_get_tile_counts__doc__,
+             "get_tile_counts($self, /, ranges=None)\n"
+             "--\n"
+             "\n"
+             "Get a list of tuples with the tile IDs and a list of their "
+             "summed errors and\n"
+             "a list of their counts. The lists have an entry for each row "
+             "in position_ranges().\n"
+             "\n"
+             "  ranges\n"
+             "    Optional sequence of (start, stop) row ranges. When given, "
+             "the lists\n"
+             "    have an entry for each range with the sums of its rows.\n");
+
+#define PerTileQuality_get_tile_counts_method METH_VARARGS | METH_KEYWORDS
+
+static PyObject *
+PerTileQuality_get_tile_counts(PerTileQuality *self, PyObject *args,
+                               PyObject *kwargs)
+{
+    PyObject *ranges = Py_None;
+    static char *kwargnames[] = {"ranges", NULL};
+    static char *format = "|O:PerTileQuality.get_tile_counts";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames,
+                                     &ranges)) {
+        return NULL;
+    }
+    TileQuality *tile_qualities = self->tile_qualities;
+    size_t maximum_tile = self->number_of_tiles;
+    size_t tile_length = self->number_of_rows;
+    size_t exact_positions = self->exact_positions;
+    Py_ssize_t number_of_ranges = tile_length;
+    struct RowRange *row_ranges = NULL;
+    if (ranges != Py_None) {
+        row_ranges = row_ranges_from_sequence(ranges, tile_length,
+                                              &number_of_ranges);
+        if (row_ranges == NULL) {
+            return NULL;
+        }
+    }
+    uint64_t *row_bases = PyMem_Malloc(Py_MAX(tile_length, 1) *
+                                       sizeof(uint64_t));
+    PyObject *result = PyList_New(0);
+    if (row_bases == NULL || result == NULL) {
+        PyMem_Free(row_ranges);
+        PyMem_Free(row_bases);
+        Py_XDECREF(result);
+        return PyErr_NoMemory();
+    }
+
+    for (size_t i = 0; i < maximum_tile; i++) {
+        TileQuality *tile_quality = tile_qualities + i;
+        double *total_errors = tile_quality->total_errors;
+        uint64_t *length_counts = tile_quality->length_counts;
+        if (length_counts == NULL && total_errors == NULL) {
+            continue;
+        }
+        /* Work back from the lenght counts. If we have 200 reads total and a
+           100 are length 150 and a 100 are length 120. This means we have
+           a 100 bases at each position 120-150 and 200 bases at 0-120.
+           The binned rows store their number of bases directly. */
+        uint64_t total_bases = 0;
+        for (Py_ssize_t j = tile_length - 1; j >= 0; j -= 1) {
+            if ((size_t)j >= exact_positions) {
+                row_bases[j] = length_counts[j];
+            }
+            else {
+                total_bases += length_counts[j];
+                row_bases[j] = total_bases;
+            }
+        }
+        PyObject *entry = PyTuple_New(3);
+        PyObject *tile_id = PyLong_FromSize_t(i);
+        PyObject *summed_error_list = PyList_New(number_of_ranges);
+        PyObject *count_list = PyList_New(number_of_ranges);
+        if (entry == NULL || tile_id == NULL || summed_error_list == NULL ||
+            count_list == NULL) {
+            Py_XDECREF(entry);
+            Py_XDECREF(tile_id);
+            Py_XDECREF(summed_error_list);
+            Py_XDECREF(count_list);
+            goto error;
+        }
+        PyTuple_SET_ITEM(entry, 0, tile_id);
+        PyTuple_SET_ITEM(entry, 1, summed_error_list);
+        PyTuple_SET_ITEM(entry, 2, count_list);
+        for (Py_ssize_t j = 0; j < number_of_ranges; j++) {
+            double summed_errors = 0.0;
+            uint64_t bases = 0;
+            if (row_ranges == NULL) {
+                summed_errors = total_errors[j];
+                bases = row_bases[j];
+            }
+            else {
+                for (size_t row = row_ranges[j].start;
+                     row < row_ranges[j].stop; row++) {
+                    summed_errors += total_errors[row];
+                    bases += row_bases[row];
+                }
+            }
+            PyObject *summed_error_obj = PyFloat_FromDouble(summed_errors);
+            PyObject *count_obj = PyLong_FromUnsignedLongLong(bases);
+            if (summed_error_obj == NULL || count_obj == NULL) {
+                Py_XDECREF(summed_error_obj);
+                Py_XDECREF(count_obj);
+                Py_DECREF(entry);
+                goto error;
+            }
+            PyList_SET_ITEM(summed_error_list, j, summed_error_obj);
+            PyList_SET_ITEM(count_list, j, count_obj);
+        }
+        int ret = PyList_Append(result, entry);
+        Py_DECREF(entry);
+        if (ret != 0) {
+            goto error;
+        }
+    }
+    PyMem_Free(row_ranges);
+    PyMem_Free(row_bases);
+    return result;
+error:
+    PyMem_Free(row_ranges);
+    PyMem_Free(row_bases);
+    Py_DECREF(result);
+    return NULL;
+}
+
+PyDoc_STRVAR(PerTileQuality_position_ranges__doc__,
+             "position_ranges($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a list of (start, stop) tuples with the positions that \n"
+             "each entry of the tile count lists covers.\n");
+
+#define PerTileQuality_position_ranges_method METH_NOARGS
+
+static PyObject *
+PerTileQuality_position_ranges(PerTileQuality *self,
+                               PyObject *Py_UNUSED(ignore))
+{
+    return position_bins_ranges(self->exact_positions, self->max_length);
+}
+
+PyDoc_STRVAR(PerTileQuality_merge__doc__,
+             "merge($self, other, /)\n"
+             "--\n"
+             "\n"
+             "Add the per tile errors and counts of another PerTileQuality \n"
+             "object to this one. If either object was skipped, the result \n"
+             "is skipped as well.\n"
+             "\n"
+             "  other\n"
+             "    A PerTileQuality object.\n");
+
+#define PerTileQuality_merge_method METH_O
+
+static PyObject *
+PerTileQuality_merge(PerTileQuality *self, PerTileQuality *other)
+{
+    if (check_merge_compatibility((PyObject *)self, (PyObject *)other) != 0) {
+        return NULL;
+    }
+    if (self->exact_positions != other->exact_positions) {
+        PyErr_Format(PyExc_ValueError,
+                     "exact_positions should be the same, got %zu and %zu",
+                     self->exact_positions, other->exact_positions);
+        return NULL;
+    }
+    ModuleProfile_merge(&self->profile, &other->profile);
+    if (self->skipped) {
+        Py_RETURN_NONE;
+    }
+    if (other->skipped) {
+        Py_XINCREF(other->skipped_reason);
+        self->skipped_reason = other->skipped_reason;
+        self->skipped = 1;
+        Py_RETURN_NONE;
+    }
+    if (other->max_length > self->max_length) {
+        if (PerTileQuality_resize_tiles(self, other->max_length) != 0) {
+            return NULL;
+        }
+    }
+    if (other->number_of_tiles > self->number_of_tiles) {
+        if (PerTileQuality_resize_tile_array(self, other->number_of_tiles) !=
+            0) {
+            return NULL;
+        }
+    }
+    size_t number_of_rows = self->number_of_rows;
+    size_t other_number_of_rows = other->number_of_rows;
+    for (size_t i = 0; i < other->number_of_tiles; i++) {
+        TileQuality *other_tile_quality = other->tile_qualities + i;
+        if (other_tile_quality->length_counts == NULL &&
+            other_tile_quality->total_errors == NULL) {
+            continue;
+        }
+        TileQuality *tile_quality = self->tile_qualities + i;
+        if (tile_quality->length_counts == NULL &&
+            tile_quality->total_errors == NULL) {
+            uint64_t *length_counts =
+                PyMem_RawCalloc(number_of_rows, sizeof(uint64_t));
+            double *total_errors =
+                PyMem_RawCalloc(number_of_rows, sizeof(double));
+            if (length_counts == NULL || total_errors == NULL) {
+                PyMem_RawFree(length_counts);
+                PyMem_RawFree(total_errors);
+                return PyErr_NoMemory();
+            }
+            tile_quality->length_counts = length_counts;
+            tile_quality->total_errors = total_errors;
+        }
+        uint64_t *length_counts = tile_quality->length_counts;
+        double *total_errors = tile_quality->total_errors;
+        uint64_t *other_length_counts = other_tile_quality->length_counts;
+        double *other_total_errors = other_tile_quality->total_errors;
+        for (size_t j = 0; j < other_number_of_rows; j++) {
+            length_counts[j] += other_length_counts[j];
+            total_errors[j] += other_total_errors[j];
+        }
+    }
+    self->number_of_reads += other->number_of_reads;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(PerTileQuality_dump__doc__,
+             "dump($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the state of the object as a bytes object that can be \n"
+             "restored with PerTileQuality.load.\n");
+
+#define PerTileQuality_dump_method METH_NOARGS
+
+static PyObject *
+PerTileQuality_dump(PerTileQuality *self, PyObject *Py_UNUSED(ignore))
+{
+    struct StateWriter writer;
+    if (StateWriter_init(&writer, (PyObject *)self) != 0) {
+        return NULL;
+    }
+    int failed = StateWriter_write_u64(&writer, self->exact_positions) ||
+                 StateWriter_write_u64(&writer, self->skipped);
+    if (self->skipped) {
+        if (self->skipped_reason != NULL) {
+            failed = failed ||
+                     StateWriter_write_str(&writer, self->skipped_reason);
+        }
+        else {
+            failed = failed || StateWriter_write_bytes(&writer, "", 0);
+        }
+        return StateWriter_finish(&writer, failed);
+    }
+    size_t number_of_rows = self->number_of_rows;
+    failed = failed || StateWriter_write_u64(&writer, self->max_length) ||
+             StateWriter_write_u64(&writer, self->number_of_reads) ||
+             StateWriter_write_u64(&writer, self->number_of_tiles);
+    for (size_t i = 0; i < self->number_of_tiles && !failed; i++) {
+        TileQuality *tile_quality = self->tile_qualities + i;
+        if (tile_quality->length_counts == NULL &&
+            tile_quality->total_errors == NULL) {
+            failed = StateWriter_write_u64(&writer, 0);
+            continue;
+        }
+        failed = StateWriter_write_u64(&writer, 1) ||
+                 StateWriter_write_u64_array(
+                     &writer, tile_quality->length_counts, number_of_rows);
+        for (size_t j = 0; j < number_of_rows && !failed; j++) {
+            failed = StateWriter_write_double(&writer,
+                                              tile_quality->total_errors[j]);
+        }
+    }
+    return StateWriter_finish(&writer, failed);
+}
+
+PyDoc_STRVAR(PerTileQuality_load__doc__,
+             "load($type, data, /)\n"
+             "--\n"
+             "\n"
+             "Create a PerTileQuality object from the output of dump(). \n"
+             "\n"
+             "  data\n"
+             "    A bytes-like object.\n");
+
+#define PerTileQuality_load_method (METH_O | METH_CLASS)
+
+static PyObject *
+PerTileQuality_load(PyTypeObject *type, PyObject *data)
+{
+    struct StateReader reader;
+    if (StateReader_init(&reader, data, type) != 0) {
+        return NULL;
+    }
+    size_t exact_positions;
+    uint64_t skipped;
+    size_t max_length;
+    uint64_t number_of_reads;
+    size_t number_of_tiles;
+    PerTileQuality *self = NULL;
+    if (StateReader_read_size(&reader, &exact_positions) != 0) {
+        goto error;
+    }
+    self = (PerTileQuality *)PyObject_CallFunction(
+        (PyObject *)type, "n", (Py_ssize_t)exact_positions);
+    if (self == NULL || StateReader_read_u64(&reader, &skipped) != 0) {
+        goto error;
+    }
+    if (skipped) {
+        self->skipped_reason = StateReader_read_str(&reader);
+        if (self->skipped_reason == NULL) {
+            goto error;
+        }
+        self->skipped = 1;
+        goto finish;
+    }
+    if (StateReader_read_size(&reader, &max_length) != 0 ||
+        StateReader_read_u64(&reader, &number_of_reads) != 0 ||
+        StateReader_read_size(&reader, &number_of_tiles) != 0 ||
+        StateReader_check_remaining(&reader, number_of_tiles) != 0 ||
+        PerTileQuality_resize_tile_array(self, number_of_tiles) != 0) {
+        goto error;
+    }
+    size_t number_of_rows = position_bins_rows(exact_positions, max_length);
+    self->max_length = max_length;
+    self->number_of_rows = number_of_rows;
+    self->number_of_reads = number_of_reads;
+    for (size_t i = 0; i < number_of_tiles; i++) {
+        uint64_t present;
+        if (StateReader_read_u64(&reader, &present) != 0) {
+            goto error;
+        }
+        if (!present) {
+            continue;
+        }
+        if (StateReader_check_remaining(&reader, number_of_rows * 2) != 0) {
+            goto error;
+        }
+        TileQuality *tile_quality = self->tile_qualities + i;
+        tile_quality->length_counts =
+            PyMem_RawCalloc(number_of_rows, sizeof(uint64_t));
+        tile_quality->total_errors =
+            PyMem_RawCalloc(number_of_rows, sizeof(double));
+        if (tile_quality->length_counts == NULL ||
+            tile_quality->total_errors == NULL) {
+            PyErr_NoMemory();
+            goto error;
+        }
+        StateReader_read_u64_array(&reader, tile_quality->length_counts,
+                                   number_of_rows);
+        for (size_t j = 0; j < number_of_rows; j++) {
+            StateReader_read_double(&reader, tile_quality->total_errors + j);
         }
     }
-    Py_RETURN_NONE;
+finish:
+    if (StateReader_finish(&reader) != 0) {
+        goto error;
+    }
+    StateReader_release(&reader);
+    return (PyObject *)self;
+error:
+    Py_XDECREF(self);
+    StateReader_release(&reader);
+    return NULL;
 }
 
-PyDoc_STRVAR(PerTileQuality_get_tile_counts__doc__,
-             "get_tile_counts($self, /)\n"
+PyDoc_STRVAR(PerTileQuality_profile__doc__,
+             "profile($self, /)\n"
              "--\n"
              "\n"
-             "Get a list of tuples with the tile IDs and a list of their "
-             "summed errors and\n"
-             "a list of their counts. \n");
+             "Return a dictionary with the performance counters of the "
+             "module.\n"
+             "The time is only measured when profiling is set.\n");
 
-#define PerTileQuality_get_tile_counts_method METH_NOARGS
+#define PerTileQuality_profile_method METH_NOARGS
 
 static PyObject *
-PerTileQuality_get_tile_counts(PerTileQuality *self, PyObject *Py_UNUSED(ignore))
+PerTileQuality_profile(PerTileQuality *self, PyObject *Py_UNUSED(ignore))
 {
-    TileQuality *tile_qualities = self->tile_qualities;
-    size_t maximum_tile = self->number_of_tiles;
-    size_t tile_length = self->max_length;
-    PyObject *result = PyList_New(0);
-    if (result == NULL) {
-        return PyErr_NoMemory();
-    }
-
-    for (size_t i = 0; i < maximum_tile; i++) {
-        TileQuality *tile_quality = tile_qualities + i;
-        double *total_errors = tile_quality->total_errors;
-        uint64_t *length_counts = tile_quality->length_counts;
-        if (length_counts == NULL && total_errors == NULL) {
-            continue;
-        }
-        PyObject *entry = PyTuple_New(3);
-        PyObject *tile_id = PyLong_FromSize_t(i);
-        PyObject *summed_error_list = PyList_New(tile_length);
-        PyObject *count_list = PyList_New(tile_length);
-        if (entry == NULL || tile_id == NULL || summed_error_list == NULL ||
-            count_list == NULL) {
-            Py_DECREF(result);
-            return PyErr_NoMemory();
-        }
-        /* Work back from the lenght counts. If we have 200 reads total and a
-           100 are length 150 and a 100 are length 120. This means we have
-           a 100 bases at each position 120-150 and 200 bases at 0-120. */
-        uint64_t total_bases = 0;
-        for (Py_ssize_t j = tile_length - 1; j >= 0; j -= 1) {
-            total_bases += length_counts[j];
-            PyObject *summed_error_obj = PyFloat_FromDouble(total_errors[j]);
-            PyObject *count_obj = PyLong_FromUnsignedLongLong(total_bases);
-            if (summed_error_obj == NULL || count_obj == NULL) {
-                Py_DECREF(result);
-                return PyErr_NoMemory();
-            }
-            PyList_SET_ITEM(summed_error_list, j, summed_error_obj);
-            PyList_SET_ITEM(count_list, j, count_obj);
-        }
-        PyTuple_SET_ITEM(entry, 0, tile_id);
-        PyTuple_SET_ITEM(entry, 1, summed_error_list);
-        PyTuple_SET_ITEM(entry, 2, count_list);
-        int ret = PyList_Append(result, entry);
-        if (ret != 0) {
-            Py_DECREF(result);
-            return NULL;
-        }
-        Py_DECREF(entry);
+    PyObject *profile = ModuleProfile_to_dict(&self->profile);
+    if (profile == NULL ||
+        dict_set_quality_bins(profile, &self->quality_bins) != 0) {
+        Py_XDECREF(profile);
+        return NULL;
     }
-    return result;
+    return profile;
 }
 
 static PyMethodDef PerTileQuality_methods[] = {
@@ -3093,19 +6329,35 @@ static PyMethodDef PerTileQuality_methods[] = {
     {"add_record_array", (PyCFunction)PerTileQuality_add_record_array,
      PerTileQuality_add_record_array_method,
      PerTileQuality_add_record_array__doc__},
-    {"get_tile_counts", (PyCFunction)PerTileQuality_get_tile_counts,
+    {"get_tile_counts",
+     (PyCFunction)(void (*)(void))PerTileQuality_get_tile_counts,
      PerTileQuality_get_tile_counts_method, PerTileQuality_get_tile_counts__doc__},
+    {"position_ranges", (PyCFunction)PerTileQuality_position_ranges,
+     PerTileQuality_position_ranges_method,
+     PerTileQuality_position_ranges__doc__},
+    {"merge", (PyCFunction)PerTileQuality_merge, PerTileQuality_merge_method,
+     PerTileQuality_merge__doc__},
+    {"dump", (PyCFunction)PerTileQuality_dump, PerTileQuality_dump_method,
+     PerTileQuality_dump__doc__},
+    {"load", (PyCFunction)PerTileQuality_load, PerTileQuality_load_method,
+     PerTileQuality_load__doc__},
+    {"profile", (PyCFunction)PerTileQuality_profile,
+     PerTileQuality_profile_method, PerTileQuality_profile__doc__},
     {NULL},
 };
 
 static PyMemberDef PerTileQuality_members[] = {
     {"max_length", T_PYSSIZET, offsetof(PerTileQuality, max_length), READONLY,
      "The length of the longest read"},
+    {"exact_positions", T_PYSSIZET, offsetof(PerTileQuality, exact_positions),
+     READONLY, "The number of positions that are counted individually"},
     {"number_of_reads", T_ULONGLONG, offsetof(PerTileQuality, number_of_reads),
      READONLY, "The total amount of reads counted"},
     {"skipped_reason", T_OBJECT, offsetof(PerTileQuality, skipped_reason), READONLY,
      "What the reason is for skipping the module if skipped."
      "Set to None if not skipped."},
+    {"profiling", T_BOOL, offsetof(PerTileQuality, profiling), 0,
+     "Measure the time spent in add_record_array."},
     {NULL},
 };
 
@@ -3152,28 +6404,192 @@ kmer_to_sequence(uint64_t kmer, size_t k, uint8_t *sequence)
 #define DEFAULT_FRAGMENT_LENGTH 21
 #define DEFAULT_UNIQUE_SAMPLE_EVERY 8
 
+/* The hash table is an array of buckets that are exactly one cache line.
+   Each bucket stores the hashes and their counts together, so an insert
+   touches only one cache line unless the bucket is full. When a bucket is
+   full, the next bucket is probed. The slots in a bucket are filled in order
+   and entries are never removed, so a bucket that is not full ends the probe
+   sequence. */
+#define FRAGMENT_BUCKET_SLOTS 5
+#define FRAGMENT_BUCKET_ALIGNMENT 64
+
+struct FragmentBucket {
+    uint64_t hashes[FRAGMENT_BUCKET_SLOTS];
+    uint32_t counts[FRAGMENT_BUCKET_SLOTS];
+    uint32_t occupied;
+};
+
+/* New fragment hashes are gathered in a batch and inserted together. The
+   bucket for a hash a few positions ahead is prefetched, so the cache misses
+   in the big table overlap rather than being waited on one by one. */
+#define FRAGMENT_BATCH_SIZE 4096
+#define FRAGMENT_PREFETCH_DISTANCE 8
+
+typedef void (*fragment_kernel)(const uint8_t *sequence,
+                                size_t sequence_length, size_t fragment_length,
+                                size_t mid_point, uint64_t *staging_hash_table,
+                                uint64_t staging_hash_size);
+
 typedef struct _SequenceDuplicationStruct {
     PyObject_HEAD
     size_t fragment_length;
     uint64_t number_of_sequences;
     uint64_t sampled_sequences;
+    /* The position of the next read in the input. Sampling is based on it
+       rather than on number_of_sequences, so a pipeline that divides the
+       input over multiple objects can set it and sample the same reads as
+       a single object would. */
+    uint64_t read_index;
     uint64_t staging_hash_table_size;
     uint64_t *staging_hash_table;
-    uint64_t hash_table_size;
-    uint64_t *hashes;
-    uint32_t *counts;
+    uint64_t number_of_buckets;
+    struct FragmentBucket *buckets;
+    void *buckets_allocation;
+    uint64_t *batch;
+    size_t batch_size;
     uint64_t max_unique_fragments;
     uint64_t number_of_unique_fragments;
     uint64_t total_fragments;
     size_t sample_every;
+    fragment_kernel fragment_kernel;
+    const char *fragment_kernel_name;
+    char profiling;
+    struct ModuleProfile profile;
 } SequenceDuplication;
 
+static inline void
+add_to_staging(uint64_t *staging_hash_table, uint64_t staging_hash_table_size,
+               uint64_t hash)
+{
+    /* Works because size is a power of 2 */
+    uint64_t hash_to_index_int = staging_hash_table_size - 1;
+    uint64_t index = hash & hash_to_index_int;
+    while (true) {
+        uint64_t current_entry = staging_hash_table[index];
+        if (current_entry == 0) {
+            staging_hash_table[index] = hash;
+            break;
+        }
+        else if (current_entry == hash) {
+            break;
+        }
+        index += 1;
+        index &= hash_to_index_int;
+    }
+    return;
+}
+
+/* Fragment kernels hash all the fragments of a sequence that consists of A,
+   C, G and T only into the staging hash table. The fragments are taken from
+   the front up to mid_point and from mid_point to the end. Nucleotides are
+   converted in groups of 8 from their ASCII codes. This loads up to 7 bytes
+   beyond the sequence, which is safe because it is followed by at least
+   "\n+\n" and the qualities.
+
+   The kernels are generated for the common fragment lengths, so the
+   conversion is fully unrolled, and for gathering the nucleotide bits with
+   BMI2. The generic kernels take the fragment length at runtime. */
+#define DEFINE_FRAGMENT_KERNEL(name, k, gather_nucleotide_bits, attributes) \
+    attributes static void name(                                           \
+        const uint8_t *sequence, size_t sequence_length,                   \
+        size_t fragment_length, size_t mid_point,                          \
+        uint64_t *staging_hash_table, uint64_t staging_hash_size)          \
+    {                                                                      \
+        (void)fragment_length;                                             \
+        size_t i = 0;                                                      \
+        while (i < sequence_length) {                                      \
+            const uint8_t *fragment = sequence + i;                        \
+            uint64_t kmer = 0;                                             \
+            size_t j = 0;                                                  \
+            for (; j + 8 <= (k); j += 8) {                                 \
+                kmer = (kmer << 16) | gather_nucleotide_bits(              \
+                                          load_big_endian_uint64(          \
+                                              fragment + j));              \
+            }                                                              \
+            if (j < (k)) {                                                 \
+                uint64_t tail = gather_nucleotide_bits(                    \
+                    load_big_endian_uint64(fragment + j));                 \
+                kmer = (kmer << (2 * ((k) - j))) |                         \
+                       (tail >> (2 * (8 - ((k) - j))));                    \
+            }                                                              \
+            kmer = nucleotide_bits_to_twobit(kmer);                        \
+            uint64_t revcomp_kmer = reverse_complement_kmer(kmer, (k));    \
+            if (revcomp_kmer < kmer) {                                     \
+                kmer = revcomp_kmer;                                       \
+            }                                                              \
+            add_to_staging(staging_hash_table, staging_hash_size,          \
+                           wanghash64(kmer));                              \
+            size_t next = i + (k);                                         \
+            i = (i < mid_point && next > mid_point) ? mid_point : next;    \
+        }                                                                  \
+    }
+
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_generic, fragment_length,
+                       gather_nucleotide_bits_default, )
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_15, 15, gather_nucleotide_bits_default, )
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_21, 21, gather_nucleotide_bits_default, )
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_31, 31, gather_nucleotide_bits_default, )
+
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+#define BMI2_TARGET __attribute__((__target__("bmi2")))
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_generic_bmi2, fragment_length,
+                       gather_nucleotide_bits_bmi2, BMI2_TARGET)
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_15_bmi2, 15,
+                       gather_nucleotide_bits_bmi2, BMI2_TARGET)
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_21_bmi2, 21,
+                       gather_nucleotide_bits_bmi2, BMI2_TARGET)
+DEFINE_FRAGMENT_KERNEL(fragment_kernel_31_bmi2, 31,
+                       gather_nucleotide_bits_bmi2, BMI2_TARGET)
+#undef BMI2_TARGET
+#endif
+
+static fragment_kernel
+select_fragment_kernel(size_t fragment_length, const char **name)
+{
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+    /* PEXT is microcoded and very slow on AMD processors before Zen 3. */
+    if (__builtin_cpu_supports("bmi2") && !__builtin_cpu_is("amd")) {
+        switch (fragment_length) {
+            case 15:
+                *name = "15_bmi2";
+                return fragment_kernel_15_bmi2;
+            case 21:
+                *name = "21_bmi2";
+                return fragment_kernel_21_bmi2;
+            case 31:
+                *name = "31_bmi2";
+                return fragment_kernel_31_bmi2;
+            default:
+                *name = "generic_bmi2";
+                return fragment_kernel_generic_bmi2;
+        }
+    }
+#endif
+    switch (fragment_length) {
+        case 15:
+            *name = "15";
+            return fragment_kernel_15;
+        case 21:
+            *name = "21";
+            return fragment_kernel_21;
+        case 31:
+            *name = "31";
+            return fragment_kernel_31;
+        default:
+            *name = "generic";
+            return fragment_kernel_generic;
+    }
+}
+
 static void
 SequenceDuplication_dealloc(SequenceDuplication *self)
 {
-    PyMem_Free(self->staging_hash_table);
-    PyMem_Free(self->hashes);
-    PyMem_Free(self->counts);
+    PyMem_RawFree(self->staging_hash_table);
+    table_free(self->buckets_allocation,
+               self->number_of_buckets * sizeof(struct FragmentBucket) +
+                   FRAGMENT_BUCKET_ALIGNMENT,
+               1);
+    PyMem_Free(self->batch);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
@@ -3209,65 +6625,138 @@ SequenceDuplication__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
                      "sample_every must be 1 or greater. Got %zd", sample_every);
         return NULL;
     }
-    /* If size is a power of 2, the modulo HASH_TABLE_SIZE can be optimised to
-       a bitwise AND. Using 1.5 times as a base we ensure that the hashtable is
-       utilized for at most 2/3. (Increased business degrades performance.) */
-    uint64_t hash_table_bits = (uint64_t)(log2(max_unique_fragments * 1.5) + 1);
-    uint64_t hash_table_size = 1 << hash_table_bits;
-    uint64_t *hashes = PyMem_Calloc(hash_table_size, sizeof(uint64_t));
-    uint32_t *counts = PyMem_Calloc(hash_table_size, sizeof(uint32_t));
-    if ((hashes == NULL) || (counts == NULL)) {
-        PyMem_Free(hashes);
-        PyMem_Free(counts);
+    /* If size is a power of 2, the modulo NUMBER_OF_BUCKETS can be optimised
+       to a bitwise AND. Using 1.5 times as a base we ensure that the hashtable
+       is utilized for at most 2/3. (Increased business degrades performance.)
+     */
+    uint64_t number_of_buckets = 1;
+    while (number_of_buckets * FRAGMENT_BUCKET_SLOTS <
+           (uint64_t)max_unique_fragments + max_unique_fragments / 2) {
+        number_of_buckets <<= 1;
+    }
+    /* The raw allocator does not guarantee cache line alignment. */
+    size_t buckets_allocation_size =
+        number_of_buckets * sizeof(struct FragmentBucket) +
+        FRAGMENT_BUCKET_ALIGNMENT;
+    void *buckets_allocation = table_calloc(buckets_allocation_size, 1);
+    uint64_t *batch = PyMem_Malloc(FRAGMENT_BATCH_SIZE * sizeof(uint64_t));
+    if ((buckets_allocation == NULL) || (batch == NULL)) {
+        table_free(buckets_allocation, buckets_allocation_size, 1);
+        PyMem_Free(batch);
         return PyErr_NoMemory();
     }
     SequenceDuplication *self = PyObject_New(SequenceDuplication, type);
     if (self == NULL) {
-        PyMem_Free(hashes);
-        PyMem_Free(counts);
+        table_free(buckets_allocation, buckets_allocation_size, 1);
+        PyMem_Free(batch);
         return PyErr_NoMemory();
     }
+    uintptr_t buckets_address = (uintptr_t)buckets_allocation;
+    buckets_address += FRAGMENT_BUCKET_ALIGNMENT -
+                       (buckets_address % FRAGMENT_BUCKET_ALIGNMENT);
     self->number_of_sequences = 0;
     self->sampled_sequences = 0;
+    self->read_index = 0;
     self->number_of_unique_fragments = 0;
     self->max_unique_fragments = max_unique_fragments;
-    self->hash_table_size = hash_table_size;
+    self->number_of_buckets = number_of_buckets;
     self->total_fragments = 0;
     self->fragment_length = fragment_length;
     self->staging_hash_table_size = 0;
     self->staging_hash_table = NULL;
-    self->hashes = hashes;
-    self->counts = counts;
+    self->buckets = (struct FragmentBucket *)buckets_address;
+    self->buckets_allocation = buckets_allocation;
+    self->batch = batch;
+    self->batch_size = 0;
     self->sample_every = sample_every;
+    self->fragment_kernel = select_fragment_kernel(
+        fragment_length, &self->fragment_kernel_name);
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
     return (PyObject *)self;
 }
 
+/* Return a bitmask of the slots in the bucket that hold the hash. */
+static inline uint32_t
+FragmentBucket_match(const struct FragmentBucket *bucket, uint64_t hash)
+{
+    uint32_t match = 0;
+#ifdef __SSE2__
+    /* SSE2 has no 64-bit compare. Compare 32-bit halves and require both
+       halves to be equal. */
+    __m128i needle = _mm_set1_epi64x(hash);
+    for (size_t i = 0; i < 4; i += 2) {
+        __m128i entries = _mm_load_si128((__m128i *)(bucket->hashes + i));
+        __m128i half_equal = _mm_cmpeq_epi32(entries, needle);
+        __m128i equal = _mm_and_si128(
+            half_equal, _mm_shuffle_epi32(half_equal, _MM_SHUFFLE(2, 3, 0, 1)));
+        match |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(equal)) << i;
+    }
+    match |= (uint32_t)(bucket->hashes[4] == hash) << 4;
+#else
+    for (size_t i = 0; i < FRAGMENT_BUCKET_SLOTS; i++) {
+        match |= (uint32_t)(bucket->hashes[i] == hash) << i;
+    }
+#endif
+    return match & ((1U << bucket->occupied) - 1);
+}
+
+static inline struct FragmentBucket *
+SequenceDuplication_home_bucket(SequenceDuplication *self, uint64_t hash)
+{
+    return self->buckets + (hash & (self->number_of_buckets - 1));
+}
+
 static void
-Sequence_duplication_insert_hash(SequenceDuplication *self, uint64_t hash)
+Sequence_duplication_insert_hash(SequenceDuplication *self, uint64_t hash,
+                                 uint32_t count)
 {
-    uint64_t hash_to_index_int = self->hash_table_size - 1;
-    uint64_t *hashes = self->hashes;
-    uint32_t *counts = self->counts;
-    size_t index = hash & hash_to_index_int;
+    uint64_t bucket_index_mask = self->number_of_buckets - 1;
+    size_t index = hash & bucket_index_mask;
+    self->profile.hash_table_lookups += 1;
 
     while (1) {
-        uint64_t hash_entry = hashes[index];
-        if (hash_entry == 0) {
+        struct FragmentBucket *bucket = self->buckets + index;
+        uint32_t match = FragmentBucket_match(bucket, hash);
+        if (match) {
+            bucket->counts[count_trailing_zeros64(match)] += count;
+            break;
+        }
+        uint32_t occupied = bucket->occupied;
+        if (occupied < FRAGMENT_BUCKET_SLOTS) {
             if (self->number_of_unique_fragments < self->max_unique_fragments) {
-                hashes[index] = hash;
-                counts[index] = 1;
+                bucket->hashes[occupied] = hash;
+                bucket->counts[occupied] = count;
+                bucket->occupied = occupied + 1;
                 self->number_of_unique_fragments += 1;
             }
             break;
         }
-        else if (hash_entry == hash) {
-            counts[index] += 1;
-            break;
-        }
         index += 1;
-        /* Make sure the index round trips when it reaches hash_table_size.*/
-        index &= hash_to_index_int;
+        self->profile.hash_table_probes += 1;
+        /* Make sure the index round trips when it reaches number_of_buckets.*/
+        index &= bucket_index_mask;
+    }
+}
+
+/* Insert all hashes of the batch with a count of one. */
+static void
+SequenceDuplication_flush_batch(SequenceDuplication *self)
+{
+    uint64_t *batch = self->batch;
+    size_t batch_size = self->batch_size;
+    size_t prefetched = Py_MIN(batch_size, FRAGMENT_PREFETCH_DISTANCE);
+    for (size_t i = 0; i < prefetched; i++) {
+        write_prefetch(SequenceDuplication_home_bucket(self, batch[i]));
+    }
+    for (size_t i = 0; i < batch_size; i++) {
+        if (i + FRAGMENT_PREFETCH_DISTANCE < batch_size) {
+            write_prefetch(SequenceDuplication_home_bucket(
+                self, batch[i + FRAGMENT_PREFETCH_DISTANCE]));
+        }
+        Sequence_duplication_insert_hash(self, batch[i], 1);
     }
+    self->batch_size = 0;
 }
 
 static int
@@ -3277,9 +6766,9 @@ SequenceDuplication_resize_staging(SequenceDuplication *self, uint64_t new_size)
         return 0;
     }
     uint64_t *tmp =
-        PyMem_Realloc(self->staging_hash_table, new_size * sizeof(uint64_t));
+        PyMem_RawRealloc(self->staging_hash_table, new_size * sizeof(uint64_t));
     if (tmp == NULL) {
-        PyErr_NoMemory();
+        set_no_memory_error_gil_safe();
         return -1;
     }
     self->staging_hash_table = tmp;
@@ -3287,37 +6776,16 @@ SequenceDuplication_resize_staging(SequenceDuplication *self, uint64_t new_size)
     return 0;
 }
 
-static inline void
-add_to_staging(uint64_t *staging_hash_table, uint64_t staging_hash_table_size,
-               uint64_t hash)
-{
-    /* Works because size is a power of 2 */
-    uint64_t hash_to_index_int = staging_hash_table_size - 1;
-    uint64_t index = hash & hash_to_index_int;
-    while (true) {
-        uint64_t current_entry = staging_hash_table[index];
-        if (current_entry == 0) {
-            staging_hash_table[index] = hash;
-            break;
-        }
-        else if (current_entry == hash) {
-            break;
-        }
-        index += 1;
-        index &= hash_to_index_int;
-    }
-    return;
-}
-
 static int
 SequenceDuplication_add_meta(SequenceDuplication *self, struct FastqMeta *meta)
 {
-    if (self->number_of_sequences % self->sample_every != 0) {
-        self->number_of_sequences += 1;
+    uint64_t read_index = self->read_index;
+    self->read_index += 1;
+    self->number_of_sequences += 1;
+    if (read_index % self->sample_every != 0) {
         return 0;
     }
     self->sampled_sequences += 1;
-    self->number_of_sequences += 1;
     Py_ssize_t sequence_length = meta->sequence_length;
     Py_ssize_t fragment_length = self->fragment_length;
     size_t fragments = 0;
@@ -3358,40 +6826,57 @@ SequenceDuplication_add_meta(SequenceDuplication *self, struct FastqMeta *meta)
     Py_ssize_t mid_point =
         sequence_length - (from_mid_point_fragments * fragment_length);
     bool warn_unknown = false;
-    // Sample front sequences
-    for (Py_ssize_t i = 0; i < mid_point; i += fragment_length) {
-        int64_t kmer = sequence_to_canonical_kmer(sequence + i, fragment_length);
-        if (kmer < 0) {
-            if (kmer == TWOBIT_UNKNOWN_CHAR) {
-                warn_unknown = true;
+    if (sequence_is_acgt(sequence, sequence_length)) {
+        self->fragment_kernel(sequence, sequence_length, fragment_length,
+                              mid_point, staging_hash_table,
+                              staging_hash_size);
+        fragments = total_fragments;
+    }
+    else {
+        // Sample front sequences
+        for (Py_ssize_t i = 0; i < mid_point; i += fragment_length) {
+            int64_t kmer =
+                sequence_to_canonical_kmer(sequence + i, fragment_length);
+            if (kmer < 0) {
+                if (kmer == TWOBIT_UNKNOWN_CHAR) {
+                    warn_unknown = true;
+                }
+                continue;
             }
-            continue;
+            fragments += 1;
+            uint64_t hash = wanghash64(kmer);
+            add_to_staging(staging_hash_table, staging_hash_size, hash);
         }
-        fragments += 1;
-        uint64_t hash = wanghash64(kmer);
-        add_to_staging(staging_hash_table, staging_hash_size, hash);
-    }
 
-    // Sample back sequences
-    for (Py_ssize_t i = mid_point; i < sequence_length; i += fragment_length) {
-        int64_t kmer = sequence_to_canonical_kmer(sequence + i, fragment_length);
-        if (kmer < 0) {
-            if (kmer == TWOBIT_UNKNOWN_CHAR) {
-                warn_unknown = true;
+        // Sample back sequences
+        for (Py_ssize_t i = mid_point; i < sequence_length;
+             i += fragment_length) {
+            int64_t kmer =
+                sequence_to_canonical_kmer(sequence + i, fragment_length);
+            if (kmer < 0) {
+                if (kmer == TWOBIT_UNKNOWN_CHAR) {
+                    warn_unknown = true;
+                }
+                continue;
             }
-            continue;
+            fragments += 1;
+            uint64_t hash = wanghash64(kmer);
+            add_to_staging(staging_hash_table, staging_hash_size, hash);
         }
-        fragments += 1;
-        uint64_t hash = wanghash64(kmer);
-        add_to_staging(staging_hash_table, staging_hash_size, hash);
     }
+    uint64_t *batch = self->batch;
     for (size_t i = 0; i < staging_hash_size; i++) {
         uint64_t hash = staging_hash_table[i];
         if (hash != 0) {
-            Sequence_duplication_insert_hash(self, hash);
+            if (self->batch_size == FRAGMENT_BATCH_SIZE) {
+                SequenceDuplication_flush_batch(self);
+            }
+            batch[self->batch_size] = hash;
+            self->batch_size += 1;
         }
     }
     if (warn_unknown) {
+        PyGILState_STATE gil_state = PyGILState_Ensure();
         PyObject *culprit =
             PyUnicode_DecodeASCII((char *)sequence, sequence_length, NULL);
         PyErr_WarnFormat(
@@ -3399,6 +6884,7 @@ SequenceDuplication_add_meta(SequenceDuplication *self, struct FastqMeta *meta)
             "Sequence contains a chacter that is not A, C, G, T or N: %R",
             culprit);
         Py_DECREF(culprit);
+        PyGILState_Release(gil_state);
     }
     self->total_fragments += fragments;
     return 0;
@@ -3424,7 +6910,9 @@ SequenceDuplication_add_read(SequenceDuplication *self, FastqRecordView *read)
                      Py_TYPE(read)->tp_name);
         return NULL;
     }
-    if (SequenceDuplication_add_meta(self, &read->meta) != 0) {
+    int ret = SequenceDuplication_add_meta(self, &read->meta);
+    SequenceDuplication_flush_batch(self);
+    if (ret != 0) {
         return NULL;
     }
     Py_RETURN_NONE;
@@ -3454,11 +6942,23 @@ SequenceDuplication_add_record_array(SequenceDuplication *self,
     }
     Py_ssize_t number_of_records = Py_SIZE(record_array);
     struct FastqMeta *records = record_array->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
     for (Py_ssize_t i = 0; i < number_of_records; i++) {
-        if (SequenceDuplication_add_meta(self, records + i) != 0) {
-            return NULL;
+        ret = SequenceDuplication_add_meta(self, records + i);
+        if (ret != 0) {
+            break;
         }
     }
+    SequenceDuplication_flush_batch(self);
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -3478,30 +6978,28 @@ SequenceDuplication_sequence_counts(SequenceDuplication *self,
     if (count_dict == NULL) {
         return PyErr_NoMemory();
     }
-    uint64_t *hashes = self->hashes;
-    uint32_t *counts = self->counts;
-    uint64_t hash_table_size = self->hash_table_size;
+    struct FragmentBucket *buckets = self->buckets;
+    uint64_t number_of_buckets = self->number_of_buckets;
     Py_ssize_t fragment_length = self->fragment_length;
-    for (size_t i = 0; i < hash_table_size; i += 1) {
-        uint64_t entry_hash = hashes[i];
-        if (entry_hash == 0) {
-            continue;
-        }
-        PyObject *count_obj = PyLong_FromUnsignedLong(counts[i]);
-        if (count_obj == NULL) {
-            goto error;
-        }
-        PyObject *key = PyUnicode_New(fragment_length, 127);
-        if (key == NULL) {
-            goto error;
-        }
-        uint64_t kmer = wanghash64_inverse(entry_hash);
-        kmer_to_sequence(kmer, fragment_length, PyUnicode_DATA(key));
-        if (PyDict_SetItem(count_dict, key, count_obj) != 0) {
-            goto error;
+    for (size_t i = 0; i < number_of_buckets; i += 1) {
+        struct FragmentBucket *bucket = buckets + i;
+        for (size_t j = 0; j < bucket->occupied; j++) {
+            PyObject *count_obj = PyLong_FromUnsignedLong(bucket->counts[j]);
+            if (count_obj == NULL) {
+                goto error;
+            }
+            PyObject *key = PyUnicode_New(fragment_length, 127);
+            if (key == NULL) {
+                goto error;
+            }
+            uint64_t kmer = wanghash64_inverse(bucket->hashes[j]);
+            kmer_to_sequence(kmer, fragment_length, PyUnicode_DATA(key));
+            if (PyDict_SetItem(count_dict, key, count_obj) != 0) {
+                goto error;
+            }
+            Py_DECREF(count_obj);
+            Py_DECREF(key);
         }
-        Py_DECREF(count_obj);
-        Py_DECREF(key);
     }
     return count_dict;
 
@@ -3587,20 +7085,23 @@ SequenceDuplication_overrepresented_sequences(SequenceDuplication *self,
     hit_theshold = Py_MAX(min_threshold, hit_theshold);
     hit_theshold = Py_MIN(max_threshold, hit_theshold);
     uint64_t minimum_hits = hit_theshold;
-    uint64_t *hashes = self->hashes;
-    uint32_t *counts = self->counts;
-    size_t hash_table_size = self->hash_table_size;
+    struct FragmentBucket *buckets = self->buckets;
+    uint64_t number_of_buckets = self->number_of_buckets;
     Py_ssize_t fragment_length = self->fragment_length;
-    for (size_t i = 0; i < hash_table_size; i += 1) {
-        uint32_t count = counts[i];
-        if (count >= minimum_hits) {
-            uint64_t entry_hash = hashes[i];
-            uint64_t kmer = wanghash64_inverse(entry_hash);
+    for (size_t i = 0; i < number_of_buckets; i += 1) {
+        struct FragmentBucket *bucket = buckets + i;
+        for (size_t j = 0; j < bucket->occupied; j++) {
+            uint32_t count = bucket->counts[j];
+            if (count < minimum_hits) {
+                continue;
+            }
+            uint64_t kmer = wanghash64_inverse(bucket->hashes[j]);
             PyObject *sequence_obj = PyUnicode_New(fragment_length, 127);
             if (sequence_obj == NULL) {
                 goto error;
             }
-            kmer_to_sequence(kmer, fragment_length, PyUnicode_DATA(sequence_obj));
+            kmer_to_sequence(kmer, fragment_length,
+                             PyUnicode_DATA(sequence_obj));
             PyObject *entry_tuple = Py_BuildValue(
                 "(KdN)", count,
                 (double)((double)count / (double)sampled_sequences),
@@ -3627,6 +7128,195 @@ error:
     return NULL;
 }
 
+PyDoc_STRVAR(SequenceDuplication_merge__doc__,
+             "merge($self, other, /)\n"
+             "--\n"
+             "\n"
+             "Add the fragment counts of another SequenceDuplication object \n"
+             "to this one. Fragments that are not yet stored in this object \n"
+             "are only added when max_unique_fragments is not yet reached.\n"
+             "\n"
+             "  other\n"
+             "    A SequenceDuplication object with the same "
+             "fragment_length.\n");
+
+#define SequenceDuplication_merge_method METH_O
+
+static PyObject *
+SequenceDuplication_merge(SequenceDuplication *self, SequenceDuplication *other)
+{
+    if (check_merge_compatibility((PyObject *)self, (PyObject *)other) != 0) {
+        return NULL;
+    }
+    if (self->fragment_length != other->fragment_length) {
+        PyErr_Format(PyExc_ValueError,
+                     "fragment_length should be the same, got %zu and %zu",
+                     self->fragment_length, other->fragment_length);
+        return NULL;
+    }
+    for (size_t i = 0; i < other->number_of_buckets; i++) {
+        struct FragmentBucket *bucket = other->buckets + i;
+        for (size_t j = 0; j < bucket->occupied; j++) {
+            Sequence_duplication_insert_hash(self, bucket->hashes[j],
+                                             bucket->counts[j]);
+        }
+    }
+    self->number_of_sequences += other->number_of_sequences;
+    self->sampled_sequences += other->sampled_sequences;
+    self->total_fragments += other->total_fragments;
+    ModuleProfile_merge(&self->profile, &other->profile);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(SequenceDuplication_dump__doc__,
+             "dump($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the state of the object as a bytes object that can be \n"
+             "restored with SequenceDuplication.load.\n");
+
+#define SequenceDuplication_dump_method METH_NOARGS
+
+static PyObject *
+SequenceDuplication_dump(SequenceDuplication *self,
+                         PyObject *Py_UNUSED(ignore))
+{
+    struct StateWriter writer;
+    if (StateWriter_init(&writer, (PyObject *)self) != 0) {
+        return NULL;
+    }
+    int failed =
+        StateWriter_write_u64(&writer, self->max_unique_fragments) ||
+        StateWriter_write_u64(&writer, self->fragment_length) ||
+        StateWriter_write_u64(&writer, self->sample_every) ||
+        StateWriter_write_u64(&writer, self->number_of_sequences) ||
+        StateWriter_write_u64(&writer, self->sampled_sequences) ||
+        StateWriter_write_u64(&writer, self->total_fragments) ||
+        StateWriter_write_u64(&writer, self->number_of_unique_fragments);
+    for (size_t i = 0; i < self->number_of_buckets && !failed; i++) {
+        struct FragmentBucket *bucket = self->buckets + i;
+        for (size_t j = 0; j < bucket->occupied && !failed; j++) {
+            failed = StateWriter_write_u64(&writer, bucket->hashes[j]) ||
+                     StateWriter_write_u64(&writer, bucket->counts[j]);
+        }
+    }
+    return StateWriter_finish(&writer, failed);
+}
+
+PyDoc_STRVAR(SequenceDuplication_load__doc__,
+             "load($type, data, /)\n"
+             "--\n"
+             "\n"
+             "Create a SequenceDuplication object from the output of \n"
+             "dump(). \n"
+             "\n"
+             "  data\n"
+             "    A bytes-like object.\n");
+
+#define SequenceDuplication_load_method (METH_O | METH_CLASS)
+
+static PyObject *
+SequenceDuplication_load(PyTypeObject *type, PyObject *data)
+{
+    struct StateReader reader;
+    if (StateReader_init(&reader, data, type) != 0) {
+        return NULL;
+    }
+    SequenceDuplication *self = NULL;
+    size_t max_unique_fragments;
+    size_t fragment_length;
+    size_t sample_every;
+    uint64_t number_of_sequences;
+    uint64_t sampled_sequences;
+    uint64_t total_fragments;
+    size_t number_of_unique_fragments;
+    if (StateReader_read_size(&reader, &max_unique_fragments) != 0 ||
+        StateReader_read_size(&reader, &fragment_length) != 0 ||
+        StateReader_read_size(&reader, &sample_every) != 0 ||
+        StateReader_read_u64(&reader, &number_of_sequences) != 0 ||
+        StateReader_read_u64(&reader, &sampled_sequences) != 0 ||
+        StateReader_read_u64(&reader, &total_fragments) != 0 ||
+        StateReader_read_size(&reader, &number_of_unique_fragments) != 0) {
+        goto error;
+    }
+    if (number_of_unique_fragments > max_unique_fragments) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid number of unique fragments in state data");
+        goto error;
+    }
+    self = (SequenceDuplication *)PyObject_CallFunction(
+        (PyObject *)type, "nnn", (Py_ssize_t)max_unique_fragments,
+        (Py_ssize_t)fragment_length, (Py_ssize_t)sample_every);
+    if (self == NULL ||
+        StateReader_check_remaining(&reader, number_of_unique_fragments * 2) !=
+            0) {
+        goto error;
+    }
+    for (size_t i = 0; i < number_of_unique_fragments; i++) {
+        uint64_t hash;
+        uint64_t count;
+        StateReader_read_u64(&reader, &hash);
+        StateReader_read_u64(&reader, &count);
+        if (hash == 0 || count > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Invalid fragment entry in state data");
+            goto error;
+        }
+        Sequence_duplication_insert_hash(self, hash, count);
+    }
+    if (StateReader_finish(&reader) != 0) {
+        goto error;
+    }
+    self->number_of_sequences = number_of_sequences;
+    self->sampled_sequences = sampled_sequences;
+    self->read_index = number_of_sequences;
+    self->total_fragments = total_fragments;
+    StateReader_release(&reader);
+    return (PyObject *)self;
+error:
+    Py_XDECREF(self);
+    StateReader_release(&reader);
+    return NULL;
+}
+
+PyDoc_STRVAR(SequenceDuplication_profile__doc__,
+             "profile($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a dictionary with the performance counters of the "
+             "module.\n"
+             "The time is only measured when profiling is set.\n");
+
+#define SequenceDuplication_profile_method METH_NOARGS
+
+static PyObject *
+SequenceDuplication_profile(SequenceDuplication *self,
+                            PyObject *Py_UNUSED(ignore))
+{
+    PyObject *profile = ModuleProfile_to_dict(&self->profile);
+    if (profile == NULL ||
+        dict_set_u64(profile, "hash_table_entries",
+                     self->number_of_unique_fragments) != 0 ||
+        dict_set_u64(profile, "hash_table_slots",
+                     self->number_of_buckets * FRAGMENT_BUCKET_SLOTS) != 0 ||
+        dict_set_u64(profile, "hash_table_lookups",
+                     self->profile.hash_table_lookups) != 0 ||
+        dict_set_u64(profile, "hash_table_probes",
+                     self->profile.hash_table_probes) != 0) {
+        Py_XDECREF(profile);
+        return NULL;
+    }
+    PyObject *kernel_name = PyUnicode_FromString(self->fragment_kernel_name);
+    if (kernel_name == NULL ||
+        PyDict_SetItemString(profile, "fragment_kernel", kernel_name) != 0) {
+        Py_XDECREF(kernel_name);
+        Py_DECREF(profile);
+        return NULL;
+    }
+    Py_DECREF(kernel_name);
+    return profile;
+}
+
 static PyMethodDef SequenceDuplication_methods[] = {
     {"add_read", (PyCFunction)SequenceDuplication_add_read,
      SequenceDuplication_add_read_method, SequenceDuplication_add_read__doc__},
@@ -3640,6 +7330,14 @@ static PyMethodDef SequenceDuplication_methods[] = {
      (PyCFunction)(void (*)(void))SequenceDuplication_overrepresented_sequences,
      SequenceDuplication_overrepresented_sequences_method,
      SequenceDuplication_overrepresented_sequences__doc__},
+    {"merge", (PyCFunction)SequenceDuplication_merge,
+     SequenceDuplication_merge_method, SequenceDuplication_merge__doc__},
+    {"dump", (PyCFunction)SequenceDuplication_dump,
+     SequenceDuplication_dump_method, SequenceDuplication_dump__doc__},
+    {"load", (PyCFunction)SequenceDuplication_load,
+     SequenceDuplication_load_method, SequenceDuplication_load__doc__},
+    {"profile", (PyCFunction)SequenceDuplication_profile,
+     SequenceDuplication_profile_method, SequenceDuplication_profile__doc__},
     {NULL},
 };
 
@@ -3650,6 +7348,9 @@ static PyMemberDef SequenceDuplication_members[] = {
     {"sampled_sequences", T_ULONGLONG,
      offsetof(SequenceDuplication, sampled_sequences), READONLY,
      "The total number of sequences that were analysed."},
+    {"read_index", T_ULONGLONG, offsetof(SequenceDuplication, read_index), 0,
+     "The position in the input of the next read. One in sample_every "
+     "positions is sampled."},
     {"collected_unique_fragments", T_ULONGLONG,
      offsetof(SequenceDuplication, number_of_unique_fragments), READONLY,
      "The number of unique fragments collected."},
@@ -3662,6 +7363,8 @@ static PyMemberDef SequenceDuplication_members[] = {
      READONLY, "One in this many reads is sampled"},
     {"total_fragments", T_ULONGLONG, offsetof(SequenceDuplication, total_fragments),
      READONLY, "Total number of fragments."},
+    {"profiling", T_BOOL, offsetof(SequenceDuplication, profiling), 0,
+     "Measure the time spent in add_record_array."},
     {NULL},
 };
 
@@ -3704,6 +7407,19 @@ fingerprints.
 #define DEFAULT_FINGERPRINT_FRONT_SEQUENCE_OFFSET 64
 #define DEFAULT_FINGERPRINT_BACK_SEQUENCE_OFFSET 64
 
+/*
+In sketch mode the hash table is never rehashed. Instead it keeps the
+max_stored_fingerprints smallest hashes (a bottom-k or KMV sketch). A hash
+that is retained at the end was retained from its first occurrence onwards,
+so the counts of the retained hashes are exact and form a uniform sample of
+the distinct fingerprints. A HyperLogLog sketch estimates the number of
+distinct fingerprints. 65536 stored fingerprints and 16384 HyperLogLog
+registers require about 2MB.
+*/
+#define DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS 65536
+#define HLL_PRECISION 14
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
 // Use packing at the 4-byte boundary to save 4 bytes of storage.
 #pragma pack(4)
 struct EstimatorEntry {
@@ -3724,12 +7440,21 @@ typedef struct _DedupEstimatorStruct {
     size_t back_sequence_offset;
     uint8_t *fingerprint_store;
     struct EstimatorEntry *hash_table;
+    char sketch;
+    // Max heap with the stored hashes, so the largest can be evicted.
+    uint64_t *sketch_heap;
+    uint8_t *hll_registers;
+    char profiling;
+    struct ModuleProfile profile;
 } DedupEstimator;
 
 static void
 DedupEstimator_dealloc(DedupEstimator *self)
 {
-    PyMem_Free(self->hash_table);
+    table_free(self->hash_table, self->hash_table_size,
+               sizeof(struct EstimatorEntry));
+    PyMem_RawFree(self->sketch_heap);
+    PyMem_RawFree(self->hll_registers);
     PyMem_Free(self->fingerprint_store);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
@@ -3742,15 +7467,17 @@ DedupEstimator__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     Py_ssize_t front_sequence_offset = DEFAULT_FINGERPRINT_FRONT_SEQUENCE_OFFSET;
     Py_ssize_t back_sequence_length = DEFAULT_FINGERPRINT_BACK_SEQUENCE_LENGTH;
     Py_ssize_t back_sequence_offset = DEFAULT_FINGERPRINT_BACK_SEQUENCE_OFFSET;
+    int sketch = 0;
     static char *kwargnames[] = {
         "max_stored_fingerprints", "front_sequence_length",
         "back_sequence_length",    "front_sequence_offset",
-        "back_sequence_offset",    NULL};
-    static char *format = "|n$nnnn:DedupEstimator";
+        "back_sequence_offset",    "sketch",
+        NULL};
+    static char *format = "|n$nnnnp:DedupEstimator";
     if (!PyArg_ParseTupleAndKeywords(
             args, kwargs, format, kwargnames, &max_stored_fingerprints,
             &front_sequence_length, &back_sequence_length,
-            &front_sequence_offset, &back_sequence_offset)) {
+            &front_sequence_offset, &back_sequence_offset, &sketch)) {
         return NULL;
     }
 
@@ -3790,15 +7517,32 @@ DedupEstimator__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
         return PyErr_NoMemory();
     }
     struct EstimatorEntry *hash_table =
-        PyMem_Calloc(hash_table_size, sizeof(struct EstimatorEntry));
+        table_calloc(hash_table_size, sizeof(struct EstimatorEntry));
     if (hash_table == NULL) {
         PyMem_Free(fingerprint_store);
         return PyErr_NoMemory();
     }
+    uint64_t *sketch_heap = NULL;
+    uint8_t *hll_registers = NULL;
+    if (sketch) {
+        sketch_heap =
+            PyMem_RawMalloc(max_stored_fingerprints * sizeof(uint64_t));
+        hll_registers = PyMem_RawCalloc(HLL_REGISTERS, 1);
+        if (sketch_heap == NULL || hll_registers == NULL) {
+            PyMem_Free(fingerprint_store);
+            table_free(hash_table, hash_table_size,
+                       sizeof(struct EstimatorEntry));
+            PyMem_RawFree(sketch_heap);
+            PyMem_RawFree(hll_registers);
+            return PyErr_NoMemory();
+        }
+    }
     DedupEstimator *self = PyObject_New(DedupEstimator, type);
     if (self == NULL) {
         PyMem_Free(fingerprint_store);
-        PyMem_Free(hash_table);
+        table_free(hash_table, hash_table_size, sizeof(struct EstimatorEntry));
+        PyMem_RawFree(sketch_heap);
+        PyMem_RawFree(hll_registers);
         return PyErr_NoMemory();
     }
     self->front_sequence_length = front_sequence_length;
@@ -3812,6 +7556,11 @@ DedupEstimator__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     self->hash_table = hash_table;
     self->modulo_bits = 0;
     self->stored_entries = 0;
+    self->sketch = sketch;
+    self->sketch_heap = sketch_heap;
+    self->hll_registers = hll_registers;
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
     return (PyObject *)self;
 }
 
@@ -3825,9 +7574,9 @@ DedupEstimator_increment_modulo(DedupEstimator *self)
     size_t index_mask = hash_table_size - 1;
     size_t new_stored_entries = 0;
     struct EstimatorEntry *new_hash_table =
-        PyMem_Calloc(hash_table_size, sizeof(struct EstimatorEntry));
+        table_calloc(hash_table_size, sizeof(struct EstimatorEntry));
     if (new_hash_table == NULL) {
-        PyErr_NoMemory();
+        set_no_memory_error_gil_safe();
         return -1;
     }
 
@@ -3854,15 +7603,13 @@ DedupEstimator_increment_modulo(DedupEstimator *self)
     self->hash_table = new_hash_table;
     self->modulo_bits = next_modulo_bits;
     self->stored_entries = new_stored_entries;
-    PyMem_Free(tmp);
+    table_free(tmp, hash_table_size, sizeof(struct EstimatorEntry));
     return 0;
 }
 
 static int
-DedupEstimator_add_fingerprint(DedupEstimator *self, uint8_t *fingerprint,
-                               size_t fingerprint_length, uint64_t seed)
+DedupEstimator_add_hash(DedupEstimator *self, uint64_t hash, uint32_t count)
 {
-    uint64_t hash = MurmurHash3_x64_64(fingerprint, fingerprint_length, seed);
     size_t modulo_bits = self->modulo_bits;
     size_t ignore_mask = (1ULL << modulo_bits) - 1;
     if (hash & ignore_mask) {
@@ -3877,24 +7624,168 @@ DedupEstimator_add_fingerprint(DedupEstimator *self, uint8_t *fingerprint,
     size_t index_mask = hash_table_size - 1;
     size_t index = (hash >> modulo_bits) & index_mask;
     struct EstimatorEntry *hash_table = self->hash_table;
+    self->profile.hash_table_lookups += 1;
     while (true) {
         struct EstimatorEntry *current_entry = hash_table + index;
         if (current_entry->count == 0) {
             current_entry->hash = hash;
-            current_entry->count = 1;
+            current_entry->count = count;
             self->stored_entries += 1;
             break;
         }
         else if (current_entry->hash == hash) {
-            current_entry->count += 1;
+            current_entry->count += count;
             break;
         }
         index += 1;
         index &= index_mask;
+        self->profile.hash_table_probes += 1;
+    }
+    return 0;
+}
+
+static void
+DedupEstimator_sketch_heap_sift_down(DedupEstimator *self)
+{
+    uint64_t *heap = self->sketch_heap;
+    size_t heap_size = self->stored_entries;
+    size_t index = 0;
+    uint64_t value = heap[0];
+    while (true) {
+        size_t child = index * 2 + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (child + 1 < heap_size && heap[child + 1] > heap[child]) {
+            child += 1;
+        }
+        if (heap[child] <= value) {
+            break;
+        }
+        heap[index] = heap[child];
+        index = child;
+    }
+    heap[index] = value;
+}
+
+static void
+DedupEstimator_sketch_heap_sift_up(DedupEstimator *self, size_t index)
+{
+    uint64_t *heap = self->sketch_heap;
+    uint64_t value = heap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (heap[parent] >= value) {
+            break;
+        }
+        heap[index] = heap[parent];
+        index = parent;
+    }
+    heap[index] = value;
+}
+
+/* Remove a stored hash from the hash table. Linear probing allows moving the
+   following entries back rather than leaving a tombstone. */
+static void
+DedupEstimator_sketch_remove_hash(DedupEstimator *self, uint64_t hash)
+{
+    struct EstimatorEntry *hash_table = self->hash_table;
+    size_t index_mask = self->hash_table_size - 1;
+    size_t index = hash & index_mask;
+    while (hash_table[index].hash != hash || hash_table[index].count == 0) {
+        index = (index + 1) & index_mask;
+    }
+    size_t next_index = index;
+    while (true) {
+        next_index = (next_index + 1) & index_mask;
+        struct EstimatorEntry *next_entry = hash_table + next_index;
+        if (next_entry->count == 0) {
+            break;
+        }
+        // Distance of the entry to its home slot, and to the free slot.
+        size_t home_distance =
+            (next_index - (next_entry->hash & index_mask)) & index_mask;
+        size_t free_distance = (next_index - index) & index_mask;
+        if (home_distance >= free_distance) {
+            hash_table[index] = *next_entry;
+            index = next_index;
+        }
+    }
+    hash_table[index].count = 0;
+}
+
+static int
+DedupEstimator_sketch_add_hash(DedupEstimator *self, uint64_t hash,
+                               uint32_t count)
+{
+    size_t max_stored_entries = self->max_stored_entries;
+    uint64_t *heap = self->sketch_heap;
+    if (self->stored_entries == max_stored_entries && hash > heap[0]) {
+        return 0;
+    }
+    struct EstimatorEntry *hash_table = self->hash_table;
+    size_t index_mask = self->hash_table_size - 1;
+    size_t index = hash & index_mask;
+    self->profile.hash_table_lookups += 1;
+    while (true) {
+        struct EstimatorEntry *current_entry = hash_table + index;
+        if (current_entry->count == 0) {
+            break;
+        }
+        if (current_entry->hash == hash) {
+            current_entry->count += count;
+            return 0;
+        }
+        index = (index + 1) & index_mask;
+        self->profile.hash_table_probes += 1;
+    }
+    if (self->stored_entries == max_stored_entries) {
+        DedupEstimator_sketch_remove_hash(self, heap[0]);
+        heap[0] = hash;
+        DedupEstimator_sketch_heap_sift_down(self);
+        // The removal may have moved entries into the found free slot.
+        index = hash & index_mask;
+        while (hash_table[index].count != 0) {
+            index = (index + 1) & index_mask;
+        }
+    }
+    else {
+        heap[self->stored_entries] = hash;
+        DedupEstimator_sketch_heap_sift_up(self, self->stored_entries);
+        self->stored_entries += 1;
     }
+    hash_table[index].hash = hash;
+    hash_table[index].count = count;
     return 0;
 }
 
+static inline void
+DedupEstimator_hll_add_hash(DedupEstimator *self, uint64_t hash)
+{
+    size_t register_index = hash >> (64 - HLL_PRECISION);
+    uint64_t remaining_bits = hash << HLL_PRECISION;
+    uint8_t rank = 1;
+    while (rank <= 64 - HLL_PRECISION && !(remaining_bits >> 63)) {
+        remaining_bits <<= 1;
+        rank += 1;
+    }
+    if (rank > self->hll_registers[register_index]) {
+        self->hll_registers[register_index] = rank;
+    }
+}
+
+static inline int
+DedupEstimator_add_fingerprint(DedupEstimator *self, uint8_t *fingerprint,
+                               size_t fingerprint_length, uint64_t seed)
+{
+    uint64_t hash = MurmurHash3_x64_64(fingerprint, fingerprint_length, seed);
+    if (self->sketch) {
+        DedupEstimator_hll_add_hash(self, hash);
+        return DedupEstimator_sketch_add_hash(self, hash, 1);
+    }
+    return DedupEstimator_add_hash(self, hash, 1);
+}
+
 static int
 DedupEstimator_add_sequence_ptr(DedupEstimator *self, uint8_t *sequence,
                                 size_t sequence_length)
@@ -3975,14 +7866,25 @@ DedupEstimator_add_record_array(DedupEstimator *self,
     }
     Py_ssize_t number_of_records = Py_SIZE(record_array);
     struct FastqMeta *records = record_array->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
     for (Py_ssize_t i = 0; i < number_of_records; i++) {
         struct FastqMeta *meta = records + i;
         uint8_t *sequence = meta->record_start + meta->sequence_offset;
         size_t sequence_length = meta->sequence_length;
-        if (DedupEstimator_add_sequence_ptr(self, sequence, sequence_length) != 0) {
-            return NULL;
+        ret = DedupEstimator_add_sequence_ptr(self, sequence, sequence_length);
+        if (ret != 0) {
+            break;
         }
     }
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -4008,6 +7910,7 @@ DedupEstimator_add_record_array_pair(DedupEstimator *self,
                      "Dedupestimatorr.add_record_array_pair() "
                      "takes exactly two arguments (%zd given)",
                      nargs);
+        return NULL;
     }
     FastqRecordArrayView *record_array1 = (FastqRecordArrayView *)args[0];
     FastqRecordArrayView *record_array2 = (FastqRecordArrayView *)args[1];
@@ -4032,9 +7935,13 @@ DedupEstimator_add_record_array_pair(DedupEstimator *self,
             "record_array1 and record_array2 must be of the same size. "
             "Got %zd and %zd respectively.",
             number_of_records, Py_SIZE(record_array2));
+        return NULL;
     }
     struct FastqMeta *records1 = record_array1->records;
     struct FastqMeta *records2 = record_array2->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
     for (Py_ssize_t i = 0; i < number_of_records; i++) {
         struct FastqMeta *meta1 = records1 + i;
         struct FastqMeta *meta2 = records2 + i;
@@ -4042,12 +7949,21 @@ DedupEstimator_add_record_array_pair(DedupEstimator *self,
         uint8_t *sequence2 = meta2->record_start + meta2->sequence_offset;
         size_t sequence_length1 = meta1->sequence_length;
         size_t sequence_length2 = meta2->sequence_length;
-        int ret = DedupEstimator_add_sequence_pair_ptr(
+        ret = DedupEstimator_add_sequence_pair_ptr(
             self, sequence1, sequence_length1, sequence2, sequence_length2);
         if (ret != 0) {
-            return NULL;
+            break;
         }
     }
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records1,
+                           number_of_records);
+        ModuleProfile_add_bases(&self->profile, records2, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -4160,6 +8076,284 @@ DedupEstimator_duplication_counts(DedupEstimator *self,
     return result;
 }
 
+PyDoc_STRVAR(DedupEstimator_estimated_distinct_fingerprints__doc__,
+             "estimated_distinct_fingerprints($self)\n"
+             "--\n"
+             "\n"
+             "Return an estimate of the number of distinct fingerprints. In \n"
+             "sketch mode this uses HyperLogLog, otherwise the number of \n"
+             "tracked fingerprints is scaled by the subsampling rate.\n");
+
+#define DedupEstimator_estimated_distinct_fingerprints_method METH_NOARGS
+
+static PyObject *
+DedupEstimator_estimated_distinct_fingerprints(DedupEstimator *self,
+                                               PyObject *Py_UNUSED(ignore))
+{
+    if (!self->sketch) {
+        return PyLong_FromUnsignedLongLong((uint64_t)self->stored_entries
+                                           << self->modulo_bits);
+    }
+    double m = HLL_REGISTERS;
+    double inverse_sum = 0.0;
+    size_t empty_registers = 0;
+    for (size_t i = 0; i < HLL_REGISTERS; i++) {
+        uint8_t rank = self->hll_registers[i];
+        inverse_sum += ldexp(1.0, -rank);
+        empty_registers += (rank == 0);
+    }
+    double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double estimate = alpha * m * m / inverse_sum;
+    // Use linear counting for small cardinalities.
+    if (estimate <= 2.5 * m && empty_registers != 0) {
+        estimate = m * log(m / (double)empty_registers);
+    }
+    return PyLong_FromUnsignedLongLong((uint64_t)round(estimate));
+}
+
+PyDoc_STRVAR(DedupEstimator_merge__doc__,
+             "merge($self, other, /)\n"
+             "--\n"
+             "\n"
+             "Add the fingerprints of another DedupEstimator object to this \n"
+             "one. The fingerprint settings, max_stored_fingerprints and \n"
+             "sketch mode must be the same. The fingerprints are subsampled \n"
+             "at the highest sampling rate of both objects. In sketch mode \n"
+             "the smallest hashes of both objects are retained. For \n"
+             "fingerprints that are retained the counts are exact.\n"
+             "\n"
+             "  other\n"
+             "    A DedupEstimator object.\n");
+
+#define DedupEstimator_merge_method METH_O
+
+static PyObject *
+DedupEstimator_merge(DedupEstimator *self, DedupEstimator *other)
+{
+    if (check_merge_compatibility((PyObject *)self, (PyObject *)other) != 0) {
+        return NULL;
+    }
+    if (self->front_sequence_length != other->front_sequence_length ||
+        self->back_sequence_length != other->back_sequence_length ||
+        self->front_sequence_offset != other->front_sequence_offset ||
+        self->back_sequence_offset != other->back_sequence_offset ||
+        self->max_stored_entries != other->max_stored_entries ||
+        self->sketch != other->sketch) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Can only merge DedupEstimator objects with the same "
+                        "fingerprint, max_stored_fingerprints and sketch "
+                        "settings.");
+        return NULL;
+    }
+    ModuleProfile_merge(&self->profile, &other->profile);
+    if (self->sketch) {
+        for (size_t i = 0; i < HLL_REGISTERS; i++) {
+            self->hll_registers[i] =
+                Py_MAX(self->hll_registers[i], other->hll_registers[i]);
+        }
+        struct EstimatorEntry *other_hash_table = other->hash_table;
+        for (size_t i = 0; i < other->hash_table_size; i++) {
+            struct EstimatorEntry entry = other_hash_table[i];
+            if (entry.count != 0) {
+                DedupEstimator_sketch_add_hash(self, entry.hash, entry.count);
+            }
+        }
+        Py_RETURN_NONE;
+    }
+    while (self->modulo_bits < other->modulo_bits) {
+        if (DedupEstimator_increment_modulo(self) != 0) {
+            return NULL;
+        }
+    }
+    struct EstimatorEntry *other_hash_table = other->hash_table;
+    for (size_t i = 0; i < other->hash_table_size; i++) {
+        struct EstimatorEntry entry = other_hash_table[i];
+        if (entry.count == 0) {
+            continue;
+        }
+        if (DedupEstimator_add_hash(self, entry.hash, entry.count) != 0) {
+            return NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(DedupEstimator_dump__doc__,
+             "dump($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the state of the object as a bytes object that can be \n"
+             "restored with DedupEstimator.load.\n");
+
+#define DedupEstimator_dump_method METH_NOARGS
+
+static PyObject *
+DedupEstimator_dump(DedupEstimator *self, PyObject *Py_UNUSED(ignore))
+{
+    struct StateWriter writer;
+    if (StateWriter_init(&writer, (PyObject *)self) != 0) {
+        return NULL;
+    }
+    int failed = StateWriter_write_u64(&writer, self->max_stored_entries) ||
+                 StateWriter_write_u64(&writer, self->front_sequence_length) ||
+                 StateWriter_write_u64(&writer, self->back_sequence_length) ||
+                 StateWriter_write_u64(&writer, self->front_sequence_offset) ||
+                 StateWriter_write_u64(&writer, self->back_sequence_offset) ||
+                 StateWriter_write_u64(&writer, self->sketch) ||
+                 StateWriter_write_u64(&writer, self->modulo_bits) ||
+                 StateWriter_write_u64(&writer, self->stored_entries);
+    if (self->sketch && !failed) {
+        failed = StateWriter_write_bytes(&writer, self->hll_registers,
+                                         HLL_REGISTERS);
+    }
+    struct EstimatorEntry *hash_table = self->hash_table;
+    for (size_t i = 0; i < self->hash_table_size && !failed; i++) {
+        struct EstimatorEntry entry = hash_table[i];
+        if (entry.count != 0) {
+            failed = StateWriter_write_u64(&writer, entry.hash) ||
+                     StateWriter_write_u64(&writer, entry.count);
+        }
+    }
+    return StateWriter_finish(&writer, failed);
+}
+
+PyDoc_STRVAR(DedupEstimator_load__doc__,
+             "load($type, data, /)\n"
+             "--\n"
+             "\n"
+             "Create a DedupEstimator object from the output of dump(). \n"
+             "\n"
+             "  data\n"
+             "    A bytes-like object.\n");
+
+#define DedupEstimator_load_method (METH_O | METH_CLASS)
+
+static PyObject *
+DedupEstimator_load(PyTypeObject *type, PyObject *data)
+{
+    struct StateReader reader;
+    if (StateReader_init(&reader, data, type) != 0) {
+        return NULL;
+    }
+    DedupEstimator *self = NULL;
+    PyObject *args = NULL;
+    PyObject *kwargs = NULL;
+    uint8_t *hll_registers = NULL;
+    size_t settings[6];
+    size_t modulo_bits;
+    size_t stored_entries;
+    for (size_t i = 0; i < 6; i++) {
+        if (StateReader_read_size(&reader, settings + i) != 0) {
+            goto error;
+        }
+    }
+    if (StateReader_read_size(&reader, &modulo_bits) != 0 ||
+        StateReader_read_size(&reader, &stored_entries) != 0) {
+        goto error;
+    }
+    if (settings[5] > 1 || modulo_bits > 63 || stored_entries > settings[0] ||
+        (settings[5] && modulo_bits != 0)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid fingerprint table in state data");
+        goto error;
+    }
+    args = Py_BuildValue("(n)", (Py_ssize_t)settings[0]);
+    kwargs = Py_BuildValue(
+        "{snsnsnsnsO}", "front_sequence_length", (Py_ssize_t)settings[1],
+        "back_sequence_length", (Py_ssize_t)settings[2],
+        "front_sequence_offset", (Py_ssize_t)settings[3],
+        "back_sequence_offset", (Py_ssize_t)settings[4], "sketch",
+        settings[5] ? Py_True : Py_False);
+    if (args == NULL || kwargs == NULL) {
+        goto error;
+    }
+    self = (DedupEstimator *)PyObject_Call((PyObject *)type, args, kwargs);
+    if (self == NULL) {
+        goto error;
+    }
+    if (self->sketch) {
+        size_t registers_length;
+        if (StateReader_read_bytes(&reader, &hll_registers,
+                                   &registers_length) != 0) {
+            goto error;
+        }
+        if (registers_length != HLL_REGISTERS) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Invalid HyperLogLog registers in state data");
+            goto error;
+        }
+        memcpy(self->hll_registers, hll_registers, HLL_REGISTERS);
+    }
+    if (StateReader_check_remaining(&reader, stored_entries * 2) != 0) {
+        goto error;
+    }
+    while (self->modulo_bits < modulo_bits) {
+        if (DedupEstimator_increment_modulo(self) != 0) {
+            goto error;
+        }
+    }
+    for (size_t i = 0; i < stored_entries; i++) {
+        uint64_t hash;
+        uint64_t count;
+        StateReader_read_u64(&reader, &hash);
+        StateReader_read_u64(&reader, &count);
+        if (count == 0 || count > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Invalid fingerprint entry in state data");
+            goto error;
+        }
+        if (self->sketch) {
+            DedupEstimator_sketch_add_hash(self, hash, count);
+        }
+        else if (DedupEstimator_add_hash(self, hash, count) != 0) {
+            goto error;
+        }
+    }
+    if (StateReader_finish(&reader) != 0) {
+        goto error;
+    }
+    PyMem_Free(hll_registers);
+    Py_DECREF(args);
+    Py_DECREF(kwargs);
+    StateReader_release(&reader);
+    return (PyObject *)self;
+error:
+    PyMem_Free(hll_registers);
+    Py_XDECREF(args);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(self);
+    StateReader_release(&reader);
+    return NULL;
+}
+
+PyDoc_STRVAR(DedupEstimator_profile__doc__,
+             "profile($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a dictionary with the performance counters of the "
+             "module.\n"
+             "The time is only measured when profiling is set.\n");
+
+#define DedupEstimator_profile_method METH_NOARGS
+
+static PyObject *
+DedupEstimator_profile(DedupEstimator *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *profile = ModuleProfile_to_dict(&self->profile);
+    if (profile == NULL ||
+        dict_set_u64(profile, "hash_table_entries",
+                     self->stored_entries) != 0 ||
+        dict_set_u64(profile, "hash_table_slots", self->hash_table_size) != 0 ||
+        dict_set_u64(profile, "hash_table_lookups",
+                     self->profile.hash_table_lookups) != 0 ||
+        dict_set_u64(profile, "hash_table_probes",
+                     self->profile.hash_table_probes) != 0) {
+        Py_XDECREF(profile);
+        return NULL;
+    }
+    return profile;
+}
+
 static PyMethodDef DedupEstimator_methods[] = {
     {"add_record_array", (PyCFunction)DedupEstimator_add_record_array,
      DedupEstimator_add_record_array_method,
@@ -4175,6 +8369,18 @@ static PyMethodDef DedupEstimator_methods[] = {
     {"duplication_counts", (PyCFunction)DedupEstimator_duplication_counts,
      DedupEstimator_duplication_counts_method,
      DedupEstimator_duplication_counts__doc__},
+    {"estimated_distinct_fingerprints",
+     (PyCFunction)DedupEstimator_estimated_distinct_fingerprints,
+     DedupEstimator_estimated_distinct_fingerprints_method,
+     DedupEstimator_estimated_distinct_fingerprints__doc__},
+    {"merge", (PyCFunction)DedupEstimator_merge, DedupEstimator_merge_method,
+     DedupEstimator_merge__doc__},
+    {"dump", (PyCFunction)DedupEstimator_dump, DedupEstimator_dump_method,
+     DedupEstimator_dump__doc__},
+    {"load", (PyCFunction)DedupEstimator_load, DedupEstimator_load_method,
+     DedupEstimator_load__doc__},
+    {"profile", (PyCFunction)DedupEstimator_profile,
+     DedupEstimator_profile_method, DedupEstimator_profile__doc__},
     {NULL},
 };
 
@@ -4193,6 +8399,9 @@ static PyMemberDef DedupEstimator_members[] = {
      offsetof(DedupEstimator, front_sequence_offset), READONLY, NULL},
     {"back_sequence_offset", T_ULONGLONG,
      offsetof(DedupEstimator, back_sequence_offset), READONLY, NULL},
+    {"sketch", T_BOOL, offsetof(DedupEstimator, sketch), READONLY, NULL},
+    {"profiling", T_BOOL, offsetof(DedupEstimator, profiling), 0,
+     "Measure the time spent in add_record_array."},
     {NULL},
 };
 
@@ -4217,143 +8426,65 @@ struct NanoInfo {
     double cumulative_error_rate;
 };
 
-typedef struct {
-    PyObject_HEAD
-    struct NanoInfo info;
-} NanoporeReadInfo;
-
-static PyObject *
-NanoporeReadInfo_get_start_time(NanoporeReadInfo *self, void *closure)
-{
-    return PyLong_FromLong(self->info.start_time);
-}
-static PyObject *
-NanoporeReadInfo_get_channel_id(NanoporeReadInfo *self, void *closure)
-{
-    return PyLong_FromLong(self->info.channel_id);
-}
-static PyObject *
-NanoporeReadInfo_get_length(NanoporeReadInfo *self, void *closure)
-{
-    return PyLong_FromUnsignedLong(self->info.length);
-}
-static PyObject *
-NanoporeReadInfo_get_cumulative_error_rate(NanoporeReadInfo *self, void *closure)
-{
-    return PyFloat_FromDouble(self->info.cumulative_error_rate);
-}
-static PyObject *
-NanoporeReadInfo_get_duration(NanoporeReadInfo *self, void *closure)
-{
-    return PyFloat_FromDouble((double)self->info.duration);
-}
-
-static PyGetSetDef NanoporeReadInfo_properties[] = {
-    {"start_time", (getter)NanoporeReadInfo_get_start_time, NULL,
-     "unix UTC timestamp for start time", NULL},
-    {"channel_id", (getter)NanoporeReadInfo_get_channel_id, NULL,
-     "channel number", NULL},
-    {"length", (getter)NanoporeReadInfo_get_length, NULL, NULL, NULL},
-    {"cumulative_error_rate", (getter)NanoporeReadInfo_get_cumulative_error_rate,
-     NULL, "sum off all the bases' error rates.", NULL},
-    {"duration", (getter)NanoporeReadInfo_get_duration, NULL, NULL, NULL},
-    {NULL},
+/*
+The read information is aggregated while the reads stream in, so memory usage
+and report generation time do not depend on the number of reads. The time
+series is kept in NANOSTATS_TIME_BUCKETS buckets that start with a width of
+one minute. When the reads span more time than the buckets cover, the bucket
+width is doubled and neighbouring buckets are combined. Buckets are aligned to
+multiples of their width since the epoch, so the buckets of different
+NanoStats objects can always be combined.
+*/
+#define NANOSTATS_TIME_BUCKETS 256
+#define NANOSTATS_MIN_BUCKET_WIDTH 60
+#define NANOSTATS_QUALITY_BINS 12
+#define NANOSTATS_TRANSLOCATION_BINS 81
+#define NANOSTATS_MAX_CHANNEL_ID 65535
+
+struct NanoTimeBucket {
+    uint64_t reads;
+    uint64_t bases;
+    uint64_t qualities[NANOSTATS_QUALITY_BINS];
 };
 
-static PyTypeObject NanoporeReadInfo_Type = {
-    .tp_name = "_qc.NanoporeReadInfo",
-    .tp_basicsize = sizeof(NanoporeReadInfo),
-    .tp_dealloc = (destructor)PyObject_Del,
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_getset = NanoporeReadInfo_properties,
+struct NanoChannelStats {
+    uint64_t reads;
+    uint64_t bases;
+    double cumulative_error_rate;
 };
 
 typedef struct _NanoStatsStruct {
     PyObject_HEAD
     bool skipped;
     size_t number_of_reads;
-    size_t nano_infos_size;
-    struct NanoInfo *nano_infos;
     time_t min_time;
     time_t max_time;
+    int64_t bucket_width;
+    // The start time of time_buckets[0] divided by bucket_width.
+    int64_t first_bucket;
+    struct NanoTimeBucket *time_buckets;
+    // A bitmap of the channels that were active in each time bucket.
+    uint64_t *channel_bitmaps;
+    size_t channel_bitmap_words;
+    // Has channel_bitmap_words * 64 entries.
+    struct NanoChannelStats *channel_stats;
+    size_t number_of_channels;
+    uint64_t translocation_speeds[NANOSTATS_TRANSLOCATION_BINS];
     PyObject *skipped_reason;
+    char profiling;
+    struct ModuleProfile profile;
 } NanoStats;
 
 static void
-NanoStats_dealloc(NanoStats *self)
-{
-    PyMem_Free(self->nano_infos);
-    Py_XDECREF(self->skipped_reason);
-    Py_TYPE(self)->tp_free((PyObject *)self);
-}
-
-typedef struct {
-    PyObject_HEAD
-    size_t number_of_reads;
-    struct NanoInfo *nano_infos;
-    size_t current_pos;
-    PyObject *nano_stats;
-} NanoStatsIterator;
-
-static void
-NanoStatsIterator_dealloc(NanoStatsIterator *self)
-{
-    Py_DECREF(self->nano_stats);
-    Py_TYPE(self)->tp_free(self);
-}
-
-static PyTypeObject NanoStatsIterator_Type;
-
-static PyObject *
-NanoStatsIterator_FromNanoStats(NanoStats *nano_stats)
-{
-    NanoStatsIterator *self =
-        PyObject_New(NanoStatsIterator, &NanoStatsIterator_Type);
-    if (self == NULL) {
-        return PyErr_NoMemory();
-    }
-    self->nano_infos = nano_stats->nano_infos;
-    self->number_of_reads = nano_stats->number_of_reads;
-    self->current_pos = 0;
-    Py_INCREF(nano_stats);
-    self->nano_stats = (PyObject *)nano_stats;
-    return (PyObject *)self;
-}
-
-static PyObject *
-NanoStatsIterator__iter__(NanoStatsIterator *self)
-{
-    Py_INCREF(self);
-    return (PyObject *)self;
-}
-
-static PyObject *
-NanoStatsIterator__next__(NanoStatsIterator *self)
-{
-    size_t current_pos = self->current_pos;
-    if (current_pos == self->number_of_reads) {
-        PyErr_SetNone(PyExc_StopIteration);
-        return NULL;
-    }
-    NanoporeReadInfo *info =
-        PyObject_New(NanoporeReadInfo, &NanoporeReadInfo_Type);
-    if (info == NULL) {
-        return PyErr_NoMemory();
-    }
-    memcpy(&info->info, self->nano_infos + current_pos, sizeof(struct NanoInfo));
-    self->current_pos = current_pos + 1;
-    return (PyObject *)info;
+NanoStats_dealloc(NanoStats *self)
+{
+    PyMem_RawFree(self->time_buckets);
+    PyMem_RawFree(self->channel_bitmaps);
+    PyMem_RawFree(self->channel_stats);
+    Py_XDECREF(self->skipped_reason);
+    Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
-static PyTypeObject NanoStatsIterator_Type = {
-    .tp_name = "_qc.NanoStatsIterator",
-    .tp_basicsize = sizeof(NanoStatsIterator),
-    .tp_dealloc = (destructor)NanoStatsIterator_dealloc,
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_iter = (iternextfunc)NanoStatsIterator__iter__,
-    .tp_iternext = (iternextfunc)NanoStatsIterator__next__,
-};
-
 static PyObject *
 NanoStats__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
@@ -4362,20 +8493,181 @@ NanoStats__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwarg_names)) {
         return NULL;
     }
-    NanoStats *self = PyObject_New(NanoStats, type);
-    if (self == NULL) {
+    struct NanoTimeBucket *time_buckets =
+        PyMem_RawCalloc(NANOSTATS_TIME_BUCKETS, sizeof(struct NanoTimeBucket));
+    uint64_t *channel_bitmaps =
+        PyMem_RawCalloc(NANOSTATS_TIME_BUCKETS, sizeof(uint64_t));
+    struct NanoChannelStats *channel_stats =
+        PyMem_RawCalloc(64, sizeof(struct NanoChannelStats));
+    NanoStats *self = NULL;
+    if (time_buckets == NULL || channel_bitmaps == NULL ||
+        channel_stats == NULL ||
+        (self = PyObject_New(NanoStats, type)) == NULL) {
+        PyMem_RawFree(time_buckets);
+        PyMem_RawFree(channel_bitmaps);
+        PyMem_RawFree(channel_stats);
         return PyErr_NoMemory();
     }
-    self->nano_infos = NULL;
-    self->nano_infos_size = 0;
     self->number_of_reads = 0;
     self->skipped = false;
     self->skipped_reason = NULL;
     self->min_time = 0;
     self->max_time = 0;
+    self->bucket_width = NANOSTATS_MIN_BUCKET_WIDTH;
+    self->first_bucket = 0;
+    self->time_buckets = time_buckets;
+    self->channel_bitmaps = channel_bitmaps;
+    self->channel_bitmap_words = 1;
+    self->channel_stats = channel_stats;
+    self->number_of_channels = 64;
+    memset(self->translocation_speeds, 0, sizeof(self->translocation_speeds));
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
     return (PyObject *)self;
 }
 
+static inline int64_t
+floor_divide(int64_t dividend, int64_t divisor)
+{
+    int64_t quotient = dividend / divisor;
+    if (dividend % divisor < 0) {
+        quotient -= 1;
+    }
+    return quotient;
+}
+
+static inline size_t
+popcount64(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+/* Make room for channel IDs up to and including channel_id. */
+static int
+NanoStats_resize_channels(NanoStats *self, size_t channel_id)
+{
+    size_t old_words = self->channel_bitmap_words;
+    size_t new_words = Py_MAX(old_words * 2, channel_id / 64 + 1);
+    struct NanoChannelStats *channel_stats = realloc_zeroed(
+        self->channel_stats, old_words * 64 * sizeof(struct NanoChannelStats),
+        new_words * 64 * sizeof(struct NanoChannelStats));
+    if (channel_stats == NULL) {
+        set_no_memory_error_gil_safe();
+        return -1;
+    }
+    self->channel_stats = channel_stats;
+    uint64_t *channel_bitmaps =
+        PyMem_RawCalloc(NANOSTATS_TIME_BUCKETS * new_words, sizeof(uint64_t));
+    if (channel_bitmaps == NULL) {
+        set_no_memory_error_gil_safe();
+        return -1;
+    }
+    for (size_t i = 0; i < NANOSTATS_TIME_BUCKETS; i++) {
+        memcpy(channel_bitmaps + i * new_words,
+               self->channel_bitmaps + i * old_words,
+               old_words * sizeof(uint64_t));
+    }
+    PyMem_RawFree(self->channel_bitmaps);
+    self->channel_bitmaps = channel_bitmaps;
+    self->channel_bitmap_words = new_words;
+    self->number_of_channels = new_words * 64;
+    return 0;
+}
+
+static int
+NanoStats_double_bucket_width(NanoStats *self)
+{
+    size_t words = self->channel_bitmap_words;
+    struct NanoTimeBucket *time_buckets =
+        PyMem_RawCalloc(NANOSTATS_TIME_BUCKETS, sizeof(struct NanoTimeBucket));
+    uint64_t *channel_bitmaps =
+        PyMem_RawCalloc(NANOSTATS_TIME_BUCKETS * words, sizeof(uint64_t));
+    if (time_buckets == NULL || channel_bitmaps == NULL) {
+        PyMem_RawFree(time_buckets);
+        PyMem_RawFree(channel_bitmaps);
+        set_no_memory_error_gil_safe();
+        return -1;
+    }
+    int64_t first_bucket = self->first_bucket;
+    int64_t new_first_bucket = floor_divide(first_bucket, 2);
+    for (size_t i = 0; i < NANOSTATS_TIME_BUCKETS; i++) {
+        size_t j = floor_divide(first_bucket + i, 2) - new_first_bucket;
+        struct NanoTimeBucket *source = self->time_buckets + i;
+        struct NanoTimeBucket *target = time_buckets + j;
+        target->reads += source->reads;
+        target->bases += source->bases;
+        for (size_t k = 0; k < NANOSTATS_QUALITY_BINS; k++) {
+            target->qualities[k] += source->qualities[k];
+        }
+        uint64_t *source_bitmap = self->channel_bitmaps + i * words;
+        uint64_t *target_bitmap = channel_bitmaps + j * words;
+        for (size_t k = 0; k < words; k++) {
+            target_bitmap[k] |= source_bitmap[k];
+        }
+    }
+    PyMem_RawFree(self->time_buckets);
+    PyMem_RawFree(self->channel_bitmaps);
+    self->time_buckets = time_buckets;
+    self->channel_bitmaps = channel_bitmaps;
+    self->first_bucket = new_first_bucket;
+    self->bucket_width *= 2;
+    return 0;
+}
+
+/**
+ * @brief Return the index of the time bucket for timestamp. The buckets are
+ *        shifted or widened when the timestamp is outside their range.
+ *
+ * @return Py_ssize_t The index, or -1 on a memory error.
+ */
+static Py_ssize_t
+NanoStats_time_bucket_index(NanoStats *self, time_t timestamp)
+{
+    if (self->number_of_reads == 0) {
+        self->min_time = timestamp;
+        self->max_time = timestamp;
+        self->first_bucket = floor_divide(timestamp, self->bucket_width);
+    }
+    while (true) {
+        int64_t bucket_width = self->bucket_width;
+        int64_t bucket = floor_divide(timestamp, bucket_width);
+        int64_t first_bucket = Py_MIN(bucket, self->first_bucket);
+        int64_t last_bucket =
+            Py_MAX(bucket, floor_divide(self->max_time, bucket_width));
+        if (last_bucket - first_bucket >= NANOSTATS_TIME_BUCKETS) {
+            if (NanoStats_double_bucket_width(self) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        size_t shift = self->first_bucket - first_bucket;
+        if (shift) {
+            size_t words = self->channel_bitmap_words;
+            memmove(self->time_buckets + shift, self->time_buckets,
+                    (NANOSTATS_TIME_BUCKETS - shift) *
+                        sizeof(struct NanoTimeBucket));
+            memset(self->time_buckets, 0,
+                   shift * sizeof(struct NanoTimeBucket));
+            memmove(self->channel_bitmaps + shift * words,
+                    self->channel_bitmaps,
+                    (NANOSTATS_TIME_BUCKETS - shift) * words *
+                        sizeof(uint64_t));
+            memset(self->channel_bitmaps, 0, shift * words * sizeof(uint64_t));
+            self->first_bucket = first_bucket;
+        }
+        if (timestamp < self->min_time) {
+            self->min_time = timestamp;
+        }
+        if (timestamp > self->max_time) {
+            self->max_time = timestamp;
+        }
+        return bucket - first_bucket;
+    }
+}
+
 /**
  * @brief Parse read, channel_id and start_time fields from a nanopore FASTQ
  *        header. Other fields are untouched.
@@ -4434,6 +8726,7 @@ NanoInfo_from_header(const uint8_t *header, size_t header_length,
     return 0;
 }
 
+
 /**
  * @brief Add a FASTQ record to the NanoStats module
  *
@@ -4447,49 +8740,72 @@ NanoStats_add_meta(NanoStats *self, struct FastqMeta *meta)
     if (self->skipped) {
         return 0;
     }
-    if (self->number_of_reads == self->nano_infos_size) {
-        size_t old_size = self->nano_infos_size;
-        size_t new_size = Py_MAX(old_size * 2, 16 * 1024);
-        struct NanoInfo *tmp =
-            PyMem_Realloc(self->nano_infos, new_size * sizeof(struct NanoInfo));
-        if (tmp == NULL) {
-            PyErr_NoMemory();
-            return -1;
-        }
-        memset(tmp + old_size, 0, (new_size - old_size) * sizeof(struct NanoInfo));
-        self->nano_infos = tmp;
-        self->nano_infos_size = new_size;
-    };
-    struct NanoInfo *info = self->nano_infos + self->number_of_reads;
-    size_t sequence_length = meta->sequence_length;
-    info->length = sequence_length;
+    struct NanoInfo info;
+    info.length = meta->sequence_length;
+    info.duration = 0.0;
 
     if (meta->channel != -1) {
         /* Already parsed from BAM */
-        info->channel_id = meta->channel;
-        info->duration = meta->duration;
-        info->start_time = meta->start_time;
+        info.channel_id = meta->channel;
+        info.duration = meta->duration;
+        info.start_time = meta->start_time;
     }
     else if (NanoInfo_from_header(meta->record_start + 1, meta->name_length,
-                                  info) != 0) {
-        PyObject *header_obj = PyUnicode_DecodeASCII(
-            (const char *)meta->record_start + 1, meta->name_length, NULL);
-        if (header_obj == NULL) {
+                                  &info) != 0) {
+        self->skipped_reason = header_parse_failure_reason_gil_safe(
+            meta->record_start + 1, meta->name_length);
+        if (self->skipped_reason == NULL) {
             return -1;
         }
         self->skipped = true;
-        self->skipped_reason =
-            PyUnicode_FromFormat("Can not parse header: %R", header_obj);
-        Py_DECREF(header_obj);
         return 0;
     }
-    info->cumulative_error_rate = meta->accumulated_error_rate;
-    time_t timestamp = info->start_time;
-    if (timestamp > self->max_time) {
-        self->max_time = timestamp;
+    if (info.channel_id < 0 || info.channel_id > NANOSTATS_MAX_CHANNEL_ID) {
+        PyGILState_STATE gil_state = PyGILState_Ensure();
+        self->skipped_reason = PyUnicode_FromFormat(
+            "Channel ID %d is outside of the supported range 0-%d",
+            (int)info.channel_id, NANOSTATS_MAX_CHANNEL_ID);
+        PyGILState_Release(gil_state);
+        if (self->skipped_reason == NULL) {
+            return -1;
+        }
+        self->skipped = true;
+        return 0;
     }
-    if (self->min_time == 0 || timestamp < self->min_time) {
-        self->min_time = timestamp;
+    info.cumulative_error_rate = meta->accumulated_error_rate;
+
+    Py_ssize_t bucket_index =
+        NanoStats_time_bucket_index(self, info.start_time);
+    if (bucket_index == -1) {
+        return -1;
+    }
+    size_t channel_id = info.channel_id;
+    if (channel_id >= self->number_of_channels) {
+        if (NanoStats_resize_channels(self, channel_id) != 0) {
+            return -1;
+        }
+    }
+    size_t length = info.length;
+    double phred = 0.0;
+    if (length) {
+        // nearbyint rounds half to even, like Python's round.
+        phred = nearbyint(-10 * log10(info.cumulative_error_rate / length));
+    }
+    size_t phred_index = (size_t)Py_MIN(Py_MAX(phred, 0.0), 47.0) >> 2;
+    struct NanoTimeBucket *bucket = self->time_buckets + bucket_index;
+    bucket->reads += 1;
+    bucket->bases += length;
+    bucket->qualities[phred_index] += 1;
+    self->channel_bitmaps[bucket_index * self->channel_bitmap_words +
+                          channel_id / 64] |= 1ULL << (channel_id % 64);
+    struct NanoChannelStats *channel_stats = self->channel_stats + channel_id;
+    channel_stats->reads += 1;
+    channel_stats->bases += length;
+    channel_stats->cumulative_error_rate += info.cumulative_error_rate;
+    if (info.duration != 0.0) {
+        double speed = nearbyint(length / (double)info.duration);
+        size_t speed_index = (size_t)Py_MIN(Py_MAX(speed, 0.0), 800.0) / 10;
+        self->translocation_speeds[speed_index] += 1;
     }
     self->number_of_reads += 1;
     return 0;
@@ -4547,26 +8863,410 @@ NanoStats_add_record_array(NanoStats *self, FastqRecordArrayView *record_array)
     }
     Py_ssize_t number_of_records = Py_SIZE(record_array);
     struct FastqMeta *records = record_array->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
     for (Py_ssize_t i = 0; i < number_of_records; i++) {
-        if (NanoStats_add_meta(self, records + i) != 0) {
+        ret = NanoStats_add_meta(self, records + i);
+        if (ret != 0) {
+            break;
+        }
+    }
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(NanoStats_time_buckets__doc__,
+             "time_buckets($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a list of (start_time, reads, bases, active_channels, \n"
+             "quality_counts) tuples for the time buckets from minimum_time \n"
+             "up to and including maximum_time. quality_counts has the number "
+             "\n"
+             "of reads for each of 12 bins of 4 phred scores, based on the \n"
+             "average read quality. Each bucket is time_bucket_width seconds "
+             "long.\n");
+
+#define NanoStats_time_buckets_method METH_NOARGS
+
+static PyObject *
+NanoStats_time_buckets(NanoStats *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *result = PyList_New(0);
+    if (result == NULL || self->number_of_reads == 0) {
+        return result;
+    }
+    int64_t bucket_width = self->bucket_width;
+    size_t number_of_buckets =
+        floor_divide(self->max_time, bucket_width) - self->first_bucket + 1;
+    size_t words = self->channel_bitmap_words;
+    for (size_t i = 0; i < number_of_buckets; i++) {
+        struct NanoTimeBucket *bucket = self->time_buckets + i;
+        uint64_t *bitmap = self->channel_bitmaps + i * words;
+        size_t active_channels = 0;
+        for (size_t j = 0; j < words; j++) {
+            active_channels += popcount64(bitmap[j]);
+        }
+        PyObject *qualities = PyList_New(NANOSTATS_QUALITY_BINS);
+        if (qualities == NULL) {
+            goto error;
+        }
+        for (size_t j = 0; j < NANOSTATS_QUALITY_BINS; j++) {
+            PyObject *count = PyLong_FromUnsignedLongLong(bucket->qualities[j]);
+            if (count == NULL) {
+                Py_DECREF(qualities);
+                goto error;
+            }
+            PyList_SET_ITEM(qualities, j, count);
+        }
+        PyObject *entry = Py_BuildValue(
+            "(LKKnN)", (long long)((self->first_bucket + i) * bucket_width),
+            (unsigned long long)bucket->reads,
+            (unsigned long long)bucket->bases, (Py_ssize_t)active_channels,
+            qualities);
+        if (entry == NULL) {
+            goto error;
+        }
+        int ret = PyList_Append(result, entry);
+        Py_DECREF(entry);
+        if (ret != 0) {
+            goto error;
+        }
+    }
+    return result;
+error:
+    Py_DECREF(result);
+    return NULL;
+}
+
+PyDoc_STRVAR(NanoStats_channel_stats__doc__,
+             "channel_stats($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a list of (channel_id, reads, bases, "
+             "cumulative_error_rate) \n"
+             "tuples for all channels that have reads.\n");
+
+#define NanoStats_channel_stats_method METH_NOARGS
+
+static PyObject *
+NanoStats_channel_stats(NanoStats *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *result = PyList_New(0);
+    if (result == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < self->number_of_channels; i++) {
+        struct NanoChannelStats *channel_stats = self->channel_stats + i;
+        if (channel_stats->reads == 0) {
+            continue;
+        }
+        PyObject *entry = Py_BuildValue(
+            "(nKKd)", (Py_ssize_t)i, (unsigned long long)channel_stats->reads,
+            (unsigned long long)channel_stats->bases,
+            channel_stats->cumulative_error_rate);
+        if (entry == NULL) {
+            Py_DECREF(result);
             return NULL;
         }
+        int ret = PyList_Append(result, entry);
+        Py_DECREF(entry);
+        if (ret != 0) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+PyDoc_STRVAR(NanoStats_translocation_speeds__doc__,
+             "translocation_speeds($self, /)\n"
+             "--\n"
+             "\n"
+             "Return an array.array with the number of reads for each \n"
+             "translocation speed in bins of 10 bases per second. The last \n"
+             "bin contains all reads of 800 bases per second and more. Reads \n"
+             "without duration information are not counted.\n");
+
+#define NanoStats_translocation_speeds_method METH_NOARGS
+
+static PyObject *
+NanoStats_translocation_speeds(NanoStats *self, PyObject *Py_UNUSED(ignore))
+{
+    return PythonArray_FromBuffer('Q', self->translocation_speeds,
+                                  sizeof(self->translocation_speeds));
+}
+
+PyDoc_STRVAR(NanoStats_merge__doc__,
+             "merge($self, other, /)\n"
+             "--\n"
+             "\n"
+             "Add the read information of another NanoStats object to this "
+             "one. \n"
+             "If either object was skipped, the result is skipped as well.\n"
+             "\n"
+             "  other\n"
+             "    A NanoStats object.\n");
+
+#define NanoStats_merge_method METH_O
+
+static PyObject *
+NanoStats_merge(NanoStats *self, NanoStats *other)
+{
+    if (check_merge_compatibility((PyObject *)self, (PyObject *)other) != 0) {
+        return NULL;
+    }
+    ModuleProfile_merge(&self->profile, &other->profile);
+    if (self->skipped) {
+        Py_RETURN_NONE;
+    }
+    if (other->skipped) {
+        Py_XINCREF(other->skipped_reason);
+        self->skipped_reason = other->skipped_reason;
+        self->skipped = true;
+        Py_RETURN_NONE;
+    }
+    if (other->number_of_reads == 0) {
+        Py_RETURN_NONE;
+    }
+    if (other->number_of_channels > self->number_of_channels) {
+        if (NanoStats_resize_channels(self, other->number_of_channels - 1) !=
+            0) {
+            return NULL;
+        }
+    }
+    while (self->bucket_width < other->bucket_width) {
+        if (NanoStats_double_bucket_width(self) != 0) {
+            return NULL;
+        }
+    }
+    // Make sure the range of other is covered.
+    if (NanoStats_time_bucket_index(self, other->min_time) == -1) {
+        return NULL;
+    }
+    self->number_of_reads += 1;
+    if (NanoStats_time_bucket_index(self, other->max_time) == -1) {
+        return NULL;
+    }
+    self->number_of_reads += other->number_of_reads - 1;
+
+    int64_t bucket_width = self->bucket_width;
+    int64_t other_bucket_width = other->bucket_width;
+    size_t words = self->channel_bitmap_words;
+    size_t other_words = other->channel_bitmap_words;
+    size_t other_buckets =
+        floor_divide(other->max_time, other_bucket_width) -
+        other->first_bucket + 1;
+    for (size_t i = 0; i < other_buckets; i++) {
+        int64_t start_time = (other->first_bucket + i) * other_bucket_width;
+        size_t j = floor_divide(start_time, bucket_width) - self->first_bucket;
+        struct NanoTimeBucket *source = other->time_buckets + i;
+        struct NanoTimeBucket *target = self->time_buckets + j;
+        target->reads += source->reads;
+        target->bases += source->bases;
+        for (size_t k = 0; k < NANOSTATS_QUALITY_BINS; k++) {
+            target->qualities[k] += source->qualities[k];
+        }
+        uint64_t *source_bitmap = other->channel_bitmaps + i * other_words;
+        uint64_t *target_bitmap = self->channel_bitmaps + j * words;
+        for (size_t k = 0; k < other_words; k++) {
+            target_bitmap[k] |= source_bitmap[k];
+        }
+    }
+    for (size_t i = 0; i < other->number_of_channels; i++) {
+        struct NanoChannelStats *source = other->channel_stats + i;
+        struct NanoChannelStats *target = self->channel_stats + i;
+        target->reads += source->reads;
+        target->bases += source->bases;
+        target->cumulative_error_rate += source->cumulative_error_rate;
+    }
+    for (size_t i = 0; i < NANOSTATS_TRANSLOCATION_BINS; i++) {
+        self->translocation_speeds[i] += other->translocation_speeds[i];
     }
     Py_RETURN_NONE;
 }
 
-PyDoc_STRVAR(NanoStats_nano_info_iterator__doc__,
-             "nano_info_iterator($self, /)\n"
+PyDoc_STRVAR(NanoStats_dump__doc__,
+             "dump($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the state of the object as a bytes object that can be \n"
+             "restored with NanoStats.load.\n");
+
+#define NanoStats_dump_method METH_NOARGS
+
+static PyObject *
+NanoStats_dump(NanoStats *self, PyObject *Py_UNUSED(ignore))
+{
+    struct StateWriter writer;
+    if (StateWriter_init(&writer, (PyObject *)self) != 0) {
+        return NULL;
+    }
+    int failed = StateWriter_write_u64(&writer, self->skipped);
+    if (self->skipped) {
+        if (self->skipped_reason != NULL) {
+            failed = failed ||
+                     StateWriter_write_str(&writer, self->skipped_reason);
+        }
+        else {
+            failed = failed || StateWriter_write_bytes(&writer, "", 0);
+        }
+        return StateWriter_finish(&writer, failed);
+    }
+    size_t words = self->channel_bitmap_words;
+    failed = failed ||
+             StateWriter_write_u64(&writer, (int64_t)self->min_time) ||
+             StateWriter_write_u64(&writer, (int64_t)self->max_time) ||
+             StateWriter_write_u64(&writer, self->number_of_reads) ||
+             StateWriter_write_u64(&writer, self->bucket_width) ||
+             StateWriter_write_u64(&writer, self->first_bucket) ||
+             StateWriter_write_u64(&writer, words) ||
+             StateWriter_write_u64_array(&writer, self->translocation_speeds,
+                                         NANOSTATS_TRANSLOCATION_BINS);
+    for (size_t i = 0; i < NANOSTATS_TIME_BUCKETS && !failed; i++) {
+        struct NanoTimeBucket *bucket = self->time_buckets + i;
+        failed = StateWriter_write_u64(&writer, bucket->reads) ||
+                 StateWriter_write_u64(&writer, bucket->bases) ||
+                 StateWriter_write_u64_array(&writer, bucket->qualities,
+                                             NANOSTATS_QUALITY_BINS);
+    }
+    failed = failed ||
+             StateWriter_write_u64_array(&writer, self->channel_bitmaps,
+                                         NANOSTATS_TIME_BUCKETS * words);
+    for (size_t i = 0; i < self->number_of_channels && !failed; i++) {
+        struct NanoChannelStats *channel_stats = self->channel_stats + i;
+        failed = StateWriter_write_u64(&writer, channel_stats->reads) ||
+                 StateWriter_write_u64(&writer, channel_stats->bases) ||
+                 StateWriter_write_double(&writer,
+                                          channel_stats->cumulative_error_rate);
+    }
+    return StateWriter_finish(&writer, failed);
+}
+
+PyDoc_STRVAR(NanoStats_load__doc__,
+             "load($type, data, /)\n"
              "--\n"
              "\n"
-             "Return an iterator of NanoporeReadInfo objects. \n");
+             "Create a NanoStats object from the output of dump(). \n"
+             "\n"
+             "  data\n"
+             "    A bytes-like object.\n");
+
+#define NanoStats_load_method (METH_O | METH_CLASS)
+
+static PyObject *
+NanoStats_load(PyTypeObject *type, PyObject *data)
+{
+    struct StateReader reader;
+    if (StateReader_init(&reader, data, type) != 0) {
+        return NULL;
+    }
+    uint64_t skipped;
+    uint64_t min_time;
+    uint64_t max_time;
+    size_t number_of_reads;
+    uint64_t bucket_width;
+    uint64_t first_bucket;
+    size_t words;
+    NanoStats *self = (NanoStats *)PyObject_CallObject((PyObject *)type, NULL);
+    if (self == NULL || StateReader_read_u64(&reader, &skipped) != 0) {
+        goto error;
+    }
+    if (skipped) {
+        self->skipped_reason = StateReader_read_str(&reader);
+        if (self->skipped_reason == NULL) {
+            goto error;
+        }
+        self->skipped = true;
+        goto finish;
+    }
+    if (StateReader_read_u64(&reader, &min_time) != 0 ||
+        StateReader_read_u64(&reader, &max_time) != 0 ||
+        StateReader_read_size(&reader, &number_of_reads) != 0 ||
+        StateReader_read_u64(&reader, &bucket_width) != 0 ||
+        StateReader_read_u64(&reader, &first_bucket) != 0 ||
+        StateReader_read_size(&reader, &words) != 0) {
+        goto error;
+    }
+    // The bucket width must be a power of 2 times the minimum width.
+    uint64_t width_factor = bucket_width / NANOSTATS_MIN_BUCKET_WIDTH;
+    if (bucket_width % NANOSTATS_MIN_BUCKET_WIDTH != 0 || width_factor == 0 ||
+        width_factor > (1ULL << 40) || (width_factor & (width_factor - 1)) ||
+        words == 0 || words > (NANOSTATS_MAX_CHANNEL_ID / 64 + 1) ||
+        (int64_t)max_time < (int64_t)min_time ||
+        floor_divide((int64_t)min_time, bucket_width) !=
+            (int64_t)first_bucket ||
+        floor_divide((int64_t)max_time, bucket_width) - (int64_t)first_bucket >=
+            NANOSTATS_TIME_BUCKETS) {
+        PyErr_SetString(PyExc_ValueError, "Invalid NanoStats state data");
+        goto error;
+    }
+    if (words > self->channel_bitmap_words &&
+        NanoStats_resize_channels(self, words * 64 - 1) != 0) {
+        goto error;
+    }
+    if (StateReader_check_remaining(
+            &reader, NANOSTATS_TRANSLOCATION_BINS +
+                         NANOSTATS_TIME_BUCKETS * (2 + NANOSTATS_QUALITY_BINS) +
+                         NANOSTATS_TIME_BUCKETS * words + words * 64 * 3) !=
+        0) {
+        goto error;
+    }
+    self->min_time = (int64_t)min_time;
+    self->max_time = (int64_t)max_time;
+    self->number_of_reads = number_of_reads;
+    self->bucket_width = bucket_width;
+    self->first_bucket = (int64_t)first_bucket;
+    StateReader_read_u64_array(&reader, self->translocation_speeds,
+                               NANOSTATS_TRANSLOCATION_BINS);
+    for (size_t i = 0; i < NANOSTATS_TIME_BUCKETS; i++) {
+        struct NanoTimeBucket *bucket = self->time_buckets + i;
+        StateReader_read_u64(&reader, &bucket->reads);
+        StateReader_read_u64(&reader, &bucket->bases);
+        StateReader_read_u64_array(&reader, bucket->qualities,
+                                   NANOSTATS_QUALITY_BINS);
+    }
+    StateReader_read_u64_array(&reader, self->channel_bitmaps,
+                               NANOSTATS_TIME_BUCKETS * words);
+    for (size_t i = 0; i < words * 64; i++) {
+        struct NanoChannelStats *channel_stats = self->channel_stats + i;
+        StateReader_read_u64(&reader, &channel_stats->reads);
+        StateReader_read_u64(&reader, &channel_stats->bases);
+        StateReader_read_double(&reader, &channel_stats->cumulative_error_rate);
+    }
+finish:
+    if (StateReader_finish(&reader) != 0) {
+        goto error;
+    }
+    StateReader_release(&reader);
+    return (PyObject *)self;
+error:
+    Py_XDECREF(self);
+    StateReader_release(&reader);
+    return NULL;
+}
 
-#define NanoStats_nano_info_iterator_method METH_NOARGS
+PyDoc_STRVAR(NanoStats_profile__doc__,
+             "profile($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a dictionary with the performance counters of the "
+             "module.\n"
+             "The time is only measured when profiling is set.\n");
+
+#define NanoStats_profile_method METH_NOARGS
 
 static PyObject *
-NanoStats_nano_info_iterator(NanoStats *self, PyObject *Py_UNUSED(ignore))
+NanoStats_profile(NanoStats *self, PyObject *Py_UNUSED(ignore))
 {
-    return NanoStatsIterator_FromNanoStats(self);
+    return ModuleProfile_to_dict(&self->profile);
 }
 
 static PyMethodDef NanoStats_methods[] = {
@@ -4574,8 +9274,21 @@ static PyMethodDef NanoStats_methods[] = {
      NanoStats_add_read__doc__},
     {"add_record_array", (PyCFunction)NanoStats_add_record_array,
      NanoStats_add_record_array_method, NanoStats_add_record_array__doc__},
-    {"nano_info_iterator", (PyCFunction)NanoStats_nano_info_iterator,
-     NanoStats_nano_info_iterator_method, NanoStats_nano_info_iterator__doc__},
+    {"time_buckets", (PyCFunction)NanoStats_time_buckets,
+     NanoStats_time_buckets_method, NanoStats_time_buckets__doc__},
+    {"channel_stats", (PyCFunction)NanoStats_channel_stats,
+     NanoStats_channel_stats_method, NanoStats_channel_stats__doc__},
+    {"translocation_speeds", (PyCFunction)NanoStats_translocation_speeds,
+     NanoStats_translocation_speeds_method,
+     NanoStats_translocation_speeds__doc__},
+    {"merge", (PyCFunction)NanoStats_merge, NanoStats_merge_method,
+     NanoStats_merge__doc__},
+    {"dump", (PyCFunction)NanoStats_dump, NanoStats_dump_method,
+     NanoStats_dump__doc__},
+    {"load", (PyCFunction)NanoStats_load, NanoStats_load_method,
+     NanoStats_load__doc__},
+    {"profile", (PyCFunction)NanoStats_profile,
+     NanoStats_profile_method, NanoStats_profile__doc__},
     {NULL},
 };
 
@@ -4594,6 +9307,10 @@ static PyMemberDef NanoStats_members[] = {
     },
     {"maximum_time", T_LONG, offsetof(NanoStats, max_time), READONLY,
      "The latest timepoint found in the headers"},
+    {"time_bucket_width", T_LONGLONG, offsetof(NanoStats, bucket_width),
+     READONLY, "The width of the time buckets in seconds"},
+    {"profiling", T_BOOL, offsetof(NanoStats, profiling), 0,
+     "Measure the time spent in add_record_array."},
     {NULL},
 };
 
@@ -4633,6 +9350,8 @@ typedef struct _InsertSizeMetricsStruct {
     size_t hash_table_read1_entries;
     size_t hash_table_read2_entries;
     size_t max_insert_size;
+    char profiling;
+    struct ModuleProfile profile;
 } InsertSizeMetrics;
 
 static void
@@ -4640,7 +9359,7 @@ InsertSizeMetrics_dealloc(InsertSizeMetrics *self)
 {
     PyMem_Free(self->hash_table_read1);
     PyMem_Free(self->hash_table_read2);
-    PyMem_Free(self->insert_sizes);
+    PyMem_RawFree(self->insert_sizes);
     Py_TYPE(self)->tp_free(self);
 }
 
@@ -4653,6 +9372,8 @@ static PyMemberDef InsertSizeMetrics_members[] = {
     {"number_of_adapters_read2", T_ULONGLONG,
      offsetof(InsertSizeMetrics, number_of_adapters_read2), READONLY,
      "The number off reads in read 2 with an adapter."},
+    {"profiling", T_BOOL, offsetof(InsertSizeMetrics, profiling), 0,
+     "Measure the time spent in add_record_array."},
     {NULL},
 };
 
@@ -4689,7 +9410,7 @@ InsertSizeMetrics__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     self->hash_table_read2 =
         PyMem_Calloc(self->hash_table_size, sizeof(struct AdapterTableEntry));
     self->insert_sizes =
-        PyMem_Calloc(self->max_insert_size + 1, sizeof(uint64_t));
+        PyMem_RawCalloc(self->max_insert_size + 1, sizeof(uint64_t));
     self->total_reads = 0;
     self->number_of_adapters_read1 = 0;
     self->number_of_adapters_read2 = 0;
@@ -4700,6 +9421,8 @@ InsertSizeMetrics__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
         Py_DECREF(self);
         return PyErr_NoMemory();
     }
+    self->profiling = 0;
+    memset(&self->profile, 0, sizeof(struct ModuleProfile));
     return (PyObject *)self;
 }
 
@@ -4711,9 +9434,9 @@ InsertSizeMetrics_resize(InsertSizeMetrics *self, size_t new_size)
     }
     size_t old_size = self->max_insert_size;
     size_t new_raw_size = sizeof(uint64_t) * (new_size + 1);
-    uint64_t *tmp = PyMem_Realloc(self->insert_sizes, new_raw_size);
+    uint64_t *tmp = PyMem_RawRealloc(self->insert_sizes, new_raw_size);
     if (tmp == NULL) {
-        PyErr_NoMemory();
+        set_no_memory_error_gil_safe();
         return -1;
     }
     memset(tmp + old_size + 1, 0, (new_size - old_size) * sizeof(uint64_t));
@@ -4724,7 +9447,7 @@ InsertSizeMetrics_resize(InsertSizeMetrics *self, size_t new_size)
 
 static inline void
 InsertSizeMetrics_add_adapter(InsertSizeMetrics *self, const uint8_t *adapter,
-                              size_t adapter_length, bool read2)
+                              size_t adapter_length, uint64_t count, bool read2)
 {
     assert(adapter_length <= INSERT_SIZE_MAX_ADAPTER_STORE_SIZE);
     uint64_t hash = MurmurHash3_x64_64(adapter, adapter_length, 0);
@@ -4740,13 +9463,14 @@ InsertSizeMetrics_add_adapter(InsertSizeMetrics *self, const uint8_t *adapter,
     size_t hash_to_index_int =
         hash_table_size - 1;  // Works because size is a power of 2.
     size_t index = hash & hash_to_index_int;
+    self->profile.hash_table_lookups += 1;
     while (true) {
         struct AdapterTableEntry *entry = hash_table + index;
         uint64_t current_hash = entry->hash;
         if (current_hash == hash) {
             if (adapter_length == entry->adapter_length &&
                 memcmp(adapter, entry->adapter, adapter_length) == 0) {
-                entry->adapter_count += 1;
+                entry->adapter_count += count;
                 return;
             }
         }
@@ -4755,13 +9479,14 @@ InsertSizeMetrics_add_adapter(InsertSizeMetrics *self, const uint8_t *adapter,
                 entry->hash = hash;
                 entry->adapter_length = adapter_length;
                 memcpy(entry->adapter, adapter, adapter_length);
-                entry->adapter_count = 1;
+                entry->adapter_count = count;
                 current_entries[0] += 1;
             }
             return;
         }
         index += 1;
         index &= hash_to_index_int;
+        self->profile.hash_table_probes += 1;
     }
 }
 
@@ -4796,15 +9521,25 @@ reverse_complement(uint8_t *restrict dest, const uint8_t *restrict src,
     }
 }
 
+/* Count the bytes that differ between two 16-byte sequences. For each byte
+   of the XOR that is not zero, the high bit is set by adding 0x7F to the
+   lower seven bits and ORing with the byte itself. */
 static inline size_t
-hamming_distance(const uint8_t *restrict sequence1,
-                 const uint8_t *restrict sequence2, size_t length)
+hamming_distance16(const uint8_t *restrict sequence1,
+                   const uint8_t *restrict sequence2)
 {
+    uint64_t words1[2];
+    uint64_t words2[2];
+    memcpy(words1, sequence1, 16);
+    memcpy(words2, sequence2, 16);
     size_t distance = 0;
-    for (size_t i = 0; i < length; i++) {
-        if (sequence1[i] != sequence2[i]) {
-            distance += 1;
-        }
+    for (size_t i = 0; i < 2; i++) {
+        uint64_t difference = words1[i] ^ words2[i];
+        uint64_t high_bits = (((difference & 0x7F7F7F7F7F7F7F7FULL) +
+                               0x7F7F7F7F7F7F7F7FULL) |
+                              difference) &
+                             0x8080808080808080ULL;
+        distance += ((high_bits >> 7) * 0x0101010101010101ULL) >> 56;
     }
     return distance;
 }
@@ -4814,14 +9549,46 @@ hamming_distance(const uint8_t *restrict sequence1,
 
 #define UPPER_MASK 0xDFDFDFDFDFDFDFDFULL
 
+/**
+ * @brief Check whether the reverse complemented start or end of sequence2
+ *        matches sequence1 at offset i with at most one error.
+ *
+ * @return size_t The insert size or 0 when there is no match.
+ */
+static inline size_t
+insert_size_at_offset(const uint8_t *restrict sequence1, size_t i,
+                      const uint8_t *start_seq, const uint8_t *end_seq,
+                      size_t sequence2_length)
+{
+    uint64_t start1 = ((uint64_t *)start_seq)[0];
+    uint64_t start2 = ((uint64_t *)start_seq)[1];
+    uint64_t end1 = ((uint64_t *)end_seq)[0];
+    uint64_t end2 = ((uint64_t *)end_seq)[1];
+    uint64_t word1 = ((uint64_t *)(sequence1 + i))[0] & UPPER_MASK;
+    uint64_t word2 = ((uint64_t *)(sequence1 + i))[1] & UPPER_MASK;
+    if (start1 == word1 || start2 == word2) {
+        if (hamming_distance16(sequence1 + i, start_seq) <= 1) {
+            return i + 16;
+        }
+    }
+    if (end1 == word1 || end2 == word2) {
+        if (hamming_distance16(sequence1 + i, end_seq) <= 1) {
+            return i + sequence2_length;
+        }
+    }
+    return 0;
+}
+
 /**
  * @brief Determine insert size between sequences by calculating the overlap.
  *
  * @return Py_ssize_t 0, when no overlap could be determined.
  */
 static size_t
-calculate_insert_size(const uint8_t *restrict sequence1, size_t sequence1_length,
-                      const uint8_t *restrict sequence2, size_t sequence2_length)
+calculate_insert_size_default(const uint8_t *restrict sequence1,
+                              size_t sequence1_length,
+                              const uint8_t *restrict sequence2,
+                              size_t sequence2_length)
 {
     /* The needle size is 16. One error is allowed. By hardcoding is it can
        be optimized by looking for 2 64-bit integers instead. At least one of
@@ -4832,34 +9599,171 @@ calculate_insert_size(const uint8_t *restrict sequence1, size_t sequence1_length
     if (sequence2_length < 16 || sequence1_length < 16) {
         return 0;
     }
-    uint8_t seq_store[32];
-    uint8_t *start_seq = seq_store;
-    uint8_t *end_seq = ((uint8_t *)seq_store) + 16;
-    reverse_complement(start_seq, sequence2, 16);
-    reverse_complement(end_seq, sequence2 + sequence2_length - 16, 16);
-
-    uint64_t start1 = ((uint64_t *)start_seq)[0];
-    uint64_t start2 = ((uint64_t *)start_seq)[1];
-    uint64_t end1 = ((uint64_t *)end_seq)[0];
-    uint64_t end2 = ((uint64_t *)end_seq)[1];
+    uint64_t seq_store[4];
+    uint8_t *start_seq = (uint8_t *)seq_store;
+    uint8_t *end_seq = start_seq + 16;
+    reverse_complement(start_seq, sequence2, 16);
+    reverse_complement(end_seq, sequence2 + sequence2_length - 16, 16);
+
+    size_t run_length = sequence1_length - 15;
+    for (size_t i = 0; i < run_length; i++) {
+        size_t insert_size = insert_size_at_offset(sequence1, i, start_seq,
+                                                   end_seq, sequence2_length);
+        if (insert_size) {
+            return insert_size;
+        }
+    }
+    return 0;  // No matches found.
+}
+
+static size_t (*calculate_insert_size)(const uint8_t *restrict sequence1,
+                                       size_t sequence1_length,
+                                       const uint8_t *restrict sequence2,
+                                       size_t sequence2_length) =
+    calculate_insert_size_default;
+
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+/* Reverse complement 16 nucleotides with the same result as the
+   NUCLEOTIDE_COMPLEMENT table. The table has the same entries for uppercase
+   and lowercase letters, so the lower five bits of letters (0x40-0x7F) are
+   used to look up the complement in two 16-entry tables. */
+__attribute__((__target__("avx2"))) static inline void
+reverse_complement16_avx2(uint8_t *dest, const uint8_t *src)
+{
+    __m128i nucleotides = _mm_loadu_si128((const __m128i *)src);
+    __m128i reversed = _mm_shuffle_epi8(
+        nucleotides,
+        _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+    // pshufb only uses the lower four bits of the index.
+    __m128i complement_low = _mm_shuffle_epi8(
+        _mm_setr_epi8(0, 'T', 0, 'G', 0, 0, 0, 'C', 0, 0, 0, 0, 0, 0, 0, 0),
+        reversed);
+    __m128i complement_high = _mm_shuffle_epi8(
+        _mm_setr_epi8(0, 0, 0, 0, 'A', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0),
+        reversed);
+    __m128i is_high =
+        _mm_cmpeq_epi8(_mm_and_si128(reversed, _mm_set1_epi8(0x10)),
+                       _mm_set1_epi8(0x10));
+    __m128i is_letter =
+        _mm_cmpeq_epi8(_mm_and_si128(reversed, _mm_set1_epi8((char)0xC0)),
+                       _mm_set1_epi8(0x40));
+    __m128i complement =
+        _mm_blendv_epi8(complement_low, complement_high, is_high);
+    _mm_storeu_si128((__m128i *)dest, _mm_and_si128(complement, is_letter));
+}
+
+/* Return a byte mask of the offsets at which bytes 0, 2, 5 and 7 of an 8-byte
+   needle word match. bytes0 to bytes7 hold the sequence at 32 consecutive
+   offsets plus 0, 2, 5 and 7. */
+#define INSERT_SIZE_WORD_MATCH_AVX2(bytes0, bytes2, bytes5, bytes7, needle) \
+    _mm256_and_si256(                                                        \
+        _mm256_and_si256(                                                    \
+            _mm256_cmpeq_epi8(bytes0, _mm256_set1_epi8((needle)[0])),        \
+            _mm256_cmpeq_epi8(bytes2, _mm256_set1_epi8((needle)[2]))),       \
+        _mm256_and_si256(                                                    \
+            _mm256_cmpeq_epi8(bytes5, _mm256_set1_epi8((needle)[5])),        \
+            _mm256_cmpeq_epi8(bytes7, _mm256_set1_epi8((needle)[7]))))
+
+/* Candidate offsets are found for 32 offsets at once by comparing four bytes
+   of each 8-byte needle word. Only those candidates are verified with the
+   scalar check, in order, so the result is the same as the default
+   implementation. */
+__attribute__((__target__("avx2"))) static size_t
+calculate_insert_size_avx2(const uint8_t *restrict sequence1,
+                           size_t sequence1_length,
+                           const uint8_t *restrict sequence2,
+                           size_t sequence2_length)
+{
+    if (sequence2_length < 16 || sequence1_length < 16) {
+        return 0;
+    }
+    uint64_t seq_store[4];
+    uint8_t *start_seq = (uint8_t *)seq_store;
+    uint8_t *end_seq = start_seq + 16;
+    reverse_complement16_avx2(start_seq, sequence2);
+    reverse_complement16_avx2(end_seq, sequence2 + sequence2_length - 16);
 
+    __m256i upper_mask = _mm256_set1_epi8((char)0xDF);
     size_t run_length = sequence1_length - 15;
-    for (size_t i = 0; i < run_length; i++) {
-        uint64_t word1 = ((uint64_t *)(sequence1 + i))[0] & UPPER_MASK;
-        uint64_t word2 = ((uint64_t *)(sequence1 + i))[1] & UPPER_MASK;
-        if (start1 == word1 || start2 == word2) {
-            if (hamming_distance(sequence1 + i, start_seq, 16) <= 1) {
-                return i + 16;
+    if (run_length < 32) {
+        for (size_t i = 0; i < run_length; i++) {
+            size_t insert_size = insert_size_at_offset(
+                sequence1, i, start_seq, end_seq, sequence2_length);
+            if (insert_size) {
+                return insert_size;
             }
         }
-        if (end1 == word1 || end2 == word2) {
-            if (hamming_distance(sequence1 + i, end_seq, 16) <= 1) {
-                return i + sequence2_length;
+        return 0;
+    }
+    /* The last load of a block reads up to block_start + 46, which is within
+       sequence1 as block_start + 32 <= run_length. The last block overlaps
+       with the previous one, the offsets that were already checked are
+       masked. */
+    size_t block_start = 0;
+    uint32_t skip_mask = 0;
+    while (true) {
+        const uint8_t *cursor = sequence1 + block_start;
+#define LOAD_UPPER(offset)                                                   \
+    _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(cursor + offset)), \
+                     upper_mask)
+        __m256i bytes0 = LOAD_UPPER(0);
+        __m256i bytes2 = LOAD_UPPER(2);
+        __m256i bytes5 = LOAD_UPPER(5);
+        __m256i bytes7 = LOAD_UPPER(7);
+        __m256i bytes8 = LOAD_UPPER(8);
+        __m256i bytes10 = LOAD_UPPER(10);
+        __m256i bytes13 = LOAD_UPPER(13);
+        __m256i bytes15 = LOAD_UPPER(15);
+#undef LOAD_UPPER
+        __m256i start_candidates = _mm256_or_si256(
+            INSERT_SIZE_WORD_MATCH_AVX2(bytes0, bytes2, bytes5, bytes7,
+                                        start_seq),
+            INSERT_SIZE_WORD_MATCH_AVX2(bytes8, bytes10, bytes13, bytes15,
+                                        start_seq + 8));
+        __m256i end_candidates = _mm256_or_si256(
+            INSERT_SIZE_WORD_MATCH_AVX2(bytes0, bytes2, bytes5, bytes7,
+                                        end_seq),
+            INSERT_SIZE_WORD_MATCH_AVX2(bytes8, bytes10, bytes13, bytes15,
+                                        end_seq + 8));
+        __m256i candidates_vec =
+            _mm256_or_si256(start_candidates, end_candidates);
+        uint32_t candidates =
+            (uint32_t)_mm256_movemask_epi8(candidates_vec) & ~skip_mask;
+        while (candidates) {
+            size_t offset = block_start + __builtin_ctz(candidates);
+            size_t insert_size = insert_size_at_offset(
+                sequence1, offset, start_seq, end_seq, sequence2_length);
+            if (insert_size) {
+                return insert_size;
             }
+            candidates &= candidates - 1;
+        }
+        size_t next_block_start = block_start + 32;
+        if (next_block_start >= run_length) {
+            return 0;
+        }
+        if (next_block_start + 32 > run_length) {
+            size_t last_block_start = run_length - 32;
+            size_t overlap = next_block_start - last_block_start;
+            skip_mask = UINT32_MAX >> (32 - overlap);
+            next_block_start = last_block_start;
         }
+        block_start = next_block_start;
+    }
+}
+
+/* Constructor runs at dynamic load time */
+__attribute__((constructor)) static void
+calculate_insert_size_init_func_ptr(void)
+{
+    if (__builtin_cpu_supports("avx2")) {
+        calculate_insert_size = calculate_insert_size_avx2;
+    }
+    else {
+        calculate_insert_size = calculate_insert_size_default;
     }
-    return 0;  // No matches found.
 }
+#endif
 
 static int
 InsertSizeMetrics_add_sequence_pair_ptr(InsertSizeMetrics *self,
@@ -4886,14 +9790,14 @@ InsertSizeMetrics_add_sequence_pair_ptr(InsertSizeMetrics *self,
         self->number_of_adapters_read1 += 1;
         InsertSizeMetrics_add_adapter(
             self, sequence1 + insert_size,
-            Py_MIN(remainder1, INSERT_SIZE_MAX_ADAPTER_STORE_SIZE), false);
+            Py_MIN(remainder1, INSERT_SIZE_MAX_ADAPTER_STORE_SIZE), 1, false);
     }
     Py_ssize_t remainder2 = (Py_ssize_t)sequence2_length - (Py_ssize_t)insert_size;
     if (remainder2 > 0) {
         self->number_of_adapters_read2 += 1;
         InsertSizeMetrics_add_adapter(
             self, sequence2 + insert_size,
-            Py_MIN(remainder2, INSERT_SIZE_MAX_ADAPTER_STORE_SIZE), true);
+            Py_MIN(remainder2, INSERT_SIZE_MAX_ADAPTER_STORE_SIZE), 1, true);
     }
     return 0;
 }
@@ -4957,6 +9861,7 @@ InsertSizeMetrics_add_record_array_pair(InsertSizeMetrics *self,
                      "InsertSizeMetrics.add_record_array_pair() "
                      "takes exactly two arguments, got %zd",
                      nargs);
+        return NULL;
     }
     FastqRecordArrayView *record_array1 = (FastqRecordArrayView *)args[0];
     FastqRecordArrayView *record_array2 = (FastqRecordArrayView *)args[1];
@@ -4981,9 +9886,13 @@ InsertSizeMetrics_add_record_array_pair(InsertSizeMetrics *self,
             "record_array1 and record_array2 must be of the same size. "
             "Got %zd and %zd respectively.",
             number_of_records, Py_SIZE(record_array2));
+        return NULL;
     }
     struct FastqMeta *records1 = record_array1->records;
     struct FastqMeta *records2 = record_array2->records;
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start = ModuleProfile_start(self->profiling);
     for (Py_ssize_t i = 0; i < number_of_records; i++) {
         struct FastqMeta *meta1 = records1 + i;
         struct FastqMeta *meta2 = records2 + i;
@@ -4991,12 +9900,21 @@ InsertSizeMetrics_add_record_array_pair(InsertSizeMetrics *self,
         uint8_t *sequence2 = meta2->record_start + meta2->sequence_offset;
         size_t sequence_length1 = meta1->sequence_length;
         size_t sequence_length2 = meta2->sequence_length;
-        int ret = InsertSizeMetrics_add_sequence_pair_ptr(
+        ret = InsertSizeMetrics_add_sequence_pair_ptr(
             self, sequence1, sequence_length1, sequence2, sequence_length2);
         if (ret != 0) {
-            return NULL;
+            break;
         }
     }
+    if (self->profiling) {
+        ModuleProfile_stop(&self->profile, start, records1,
+                           number_of_records);
+        ModuleProfile_add_bases(&self->profile, records2, number_of_records);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -5074,6 +9992,226 @@ InsertSizeMetrics_adapters_read2(InsertSizeMetrics *self,
                                              self->hash_table_size);
 }
 
+PyDoc_STRVAR(InsertSizeMetrics_merge__doc__,
+             "merge($self, other, /)\n"
+             "--\n"
+             "\n"
+             "Add the insert sizes and adapters of another InsertSizeMetrics \n"
+             "object to this one. Adapters that are not yet stored in this \n"
+             "object are only added when max_adapters is not yet reached.\n"
+             "\n"
+             "  other\n"
+             "    An InsertSizeMetrics object.\n");
+
+#define InsertSizeMetrics_merge_method METH_O
+
+static PyObject *
+InsertSizeMetrics_merge(InsertSizeMetrics *self, InsertSizeMetrics *other)
+{
+    if (check_merge_compatibility((PyObject *)self, (PyObject *)other) != 0) {
+        return NULL;
+    }
+    if (InsertSizeMetrics_resize(self, other->max_insert_size) != 0) {
+        return NULL;
+    }
+    for (size_t i = 0; i < other->max_insert_size + 1; i++) {
+        self->insert_sizes[i] += other->insert_sizes[i];
+    }
+    for (size_t i = 0; i < other->hash_table_size; i++) {
+        struct AdapterTableEntry *entry = other->hash_table_read1 + i;
+        if (entry->adapter_count != 0) {
+            InsertSizeMetrics_add_adapter(self, entry->adapter,
+                                          entry->adapter_length,
+                                          entry->adapter_count, false);
+        }
+        entry = other->hash_table_read2 + i;
+        if (entry->adapter_count != 0) {
+            InsertSizeMetrics_add_adapter(self, entry->adapter,
+                                          entry->adapter_length,
+                                          entry->adapter_count, true);
+        }
+    }
+    self->total_reads += other->total_reads;
+    self->number_of_adapters_read1 += other->number_of_adapters_read1;
+    self->number_of_adapters_read2 += other->number_of_adapters_read2;
+    ModuleProfile_merge(&self->profile, &other->profile);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(InsertSizeMetrics_dump__doc__,
+             "dump($self, /)\n"
+             "--\n"
+             "\n"
+             "Return the state of the object as a bytes object that can be \n"
+             "restored with InsertSizeMetrics.load.\n");
+
+#define InsertSizeMetrics_dump_method METH_NOARGS
+
+static int
+StateWriter_write_adapter_table(struct StateWriter *writer,
+                                struct AdapterTableEntry *hash_table,
+                                size_t hash_table_size, size_t entries)
+{
+    if (StateWriter_write_u64(writer, entries) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < hash_table_size; i++) {
+        struct AdapterTableEntry *entry = hash_table + i;
+        if (entry->adapter_count == 0) {
+            continue;
+        }
+        if (StateWriter_write_bytes(writer, entry->adapter,
+                                    entry->adapter_length) != 0 ||
+            StateWriter_write_u64(writer, entry->adapter_count) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static PyObject *
+InsertSizeMetrics_dump(InsertSizeMetrics *self, PyObject *Py_UNUSED(ignore))
+{
+    struct StateWriter writer;
+    if (StateWriter_init(&writer, (PyObject *)self) != 0) {
+        return NULL;
+    }
+    int failed =
+        StateWriter_write_u64(&writer, self->max_adapters) ||
+        StateWriter_write_u64(&writer, self->total_reads) ||
+        StateWriter_write_u64(&writer, self->number_of_adapters_read1) ||
+        StateWriter_write_u64(&writer, self->number_of_adapters_read2) ||
+        StateWriter_write_u64(&writer, self->max_insert_size) ||
+        StateWriter_write_u64_array(&writer, self->insert_sizes,
+                                    self->max_insert_size + 1) ||
+        StateWriter_write_adapter_table(&writer, self->hash_table_read1,
+                                        self->hash_table_size,
+                                        self->hash_table_read1_entries) ||
+        StateWriter_write_adapter_table(&writer, self->hash_table_read2,
+                                        self->hash_table_size,
+                                        self->hash_table_read2_entries);
+    return StateWriter_finish(&writer, failed);
+}
+
+PyDoc_STRVAR(InsertSizeMetrics_load__doc__,
+             "load($type, data, /)\n"
+             "--\n"
+             "\n"
+             "Create an InsertSizeMetrics object from the output of dump(). \n"
+             "\n"
+             "  data\n"
+             "    A bytes-like object.\n");
+
+#define InsertSizeMetrics_load_method (METH_O | METH_CLASS)
+
+static int
+StateReader_read_adapter_table(struct StateReader *reader,
+                               InsertSizeMetrics *self, bool read2)
+{
+    size_t entries;
+    if (StateReader_read_size(reader, &entries) != 0) {
+        return -1;
+    }
+    if (entries > self->max_adapters) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid number of adapters in state data");
+        return -1;
+    }
+    for (size_t i = 0; i < entries; i++) {
+        uint8_t *adapter;
+        size_t adapter_length;
+        uint64_t count;
+        if (StateReader_read_bytes(reader, &adapter, &adapter_length) != 0) {
+            return -1;
+        }
+        if (adapter_length > INSERT_SIZE_MAX_ADAPTER_STORE_SIZE ||
+            StateReader_read_u64(reader, &count) != 0 || count == 0) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_ValueError,
+                                "Invalid adapter entry in state data");
+            }
+            PyMem_Free(adapter);
+            return -1;
+        }
+        InsertSizeMetrics_add_adapter(self, adapter, adapter_length, count,
+                                      read2);
+        PyMem_Free(adapter);
+    }
+    return 0;
+}
+
+static PyObject *
+InsertSizeMetrics_load(PyTypeObject *type, PyObject *data)
+{
+    struct StateReader reader;
+    if (StateReader_init(&reader, data, type) != 0) {
+        return NULL;
+    }
+    InsertSizeMetrics *self = NULL;
+    size_t max_adapters;
+    uint64_t total_reads;
+    uint64_t number_of_adapters_read1;
+    uint64_t number_of_adapters_read2;
+    size_t max_insert_size;
+    if (StateReader_read_size(&reader, &max_adapters) != 0 ||
+        StateReader_read_u64(&reader, &total_reads) != 0 ||
+        StateReader_read_u64(&reader, &number_of_adapters_read1) != 0 ||
+        StateReader_read_u64(&reader, &number_of_adapters_read2) != 0 ||
+        StateReader_read_size(&reader, &max_insert_size) != 0 ||
+        StateReader_check_remaining(&reader, max_insert_size) != 0) {
+        goto error;
+    }
+    self = (InsertSizeMetrics *)PyObject_CallFunction(
+        (PyObject *)type, "n", (Py_ssize_t)max_adapters);
+    if (self == NULL || InsertSizeMetrics_resize(self, max_insert_size) != 0 ||
+        StateReader_read_u64_array(&reader, self->insert_sizes,
+                                   max_insert_size + 1) != 0 ||
+        StateReader_read_adapter_table(&reader, self, false) != 0 ||
+        StateReader_read_adapter_table(&reader, self, true) != 0 ||
+        StateReader_finish(&reader) != 0) {
+        goto error;
+    }
+    self->total_reads = total_reads;
+    self->number_of_adapters_read1 = number_of_adapters_read1;
+    self->number_of_adapters_read2 = number_of_adapters_read2;
+    StateReader_release(&reader);
+    return (PyObject *)self;
+error:
+    Py_XDECREF(self);
+    StateReader_release(&reader);
+    return NULL;
+}
+
+PyDoc_STRVAR(InsertSizeMetrics_profile__doc__,
+             "profile($self, /)\n"
+             "--\n"
+             "\n"
+             "Return a dictionary with the performance counters of the "
+             "module.\n"
+             "The time is only measured when profiling is set.\n");
+
+#define InsertSizeMetrics_profile_method METH_NOARGS
+
+static PyObject *
+InsertSizeMetrics_profile(InsertSizeMetrics *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *profile = ModuleProfile_to_dict(&self->profile);
+    if (profile == NULL ||
+        dict_set_u64(profile, "hash_table_entries",
+                     self->hash_table_read1_entries +
+                         self->hash_table_read2_entries) != 0 ||
+        dict_set_u64(profile, "hash_table_slots",
+                     self->hash_table_size * 2) != 0 ||
+        dict_set_u64(profile, "hash_table_lookups",
+                     self->profile.hash_table_lookups) != 0 ||
+        dict_set_u64(profile, "hash_table_probes",
+                     self->profile.hash_table_probes) != 0) {
+        Py_XDECREF(profile);
+        return NULL;
+    }
+    return profile;
+}
+
 static PyMethodDef InsertSizeMetrics_methods[] = {
     {"add_sequence_pair", (PyCFunction)InsertSizeMetrics_add_sequence_pair,
      InsertSizeMetrics_add_sequence_pair_method,
@@ -5092,7 +10230,15 @@ static PyMethodDef InsertSizeMetrics_methods[] = {
     {"adapters_read2", (PyCFunction)InsertSizeMetrics_adapters_read2,
      InsertSizeMetrics_adapters_read2_method,
      InsertSizeMetrics_adapters_read2__doc__},
-
+    {"merge", (PyCFunction)InsertSizeMetrics_merge,
+     InsertSizeMetrics_merge_method, InsertSizeMetrics_merge__doc__},
+
+    {"dump", (PyCFunction)InsertSizeMetrics_dump,
+     InsertSizeMetrics_dump_method, InsertSizeMetrics_dump__doc__},
+    {"load", (PyCFunction)InsertSizeMetrics_load,
+     InsertSizeMetrics_load_method, InsertSizeMetrics_load__doc__},
+    {"profile", (PyCFunction)InsertSizeMetrics_profile,
+     InsertSizeMetrics_profile_method, InsertSizeMetrics_profile__doc__},
     {NULL},
 };
 
@@ -5106,6 +10252,316 @@ static PyTypeObject InsertSizeMetrics_Type = {
     .tp_members = InsertSizeMetrics_members,
 };
 
+/***************
+ * QC PIPELINE *
+ ***************/
+
+/* Calling add_record_array on each module separately means every module
+   walks the entire record array, so the record buffer is pulled through the
+   cache once per module. QCPipeline calls all the per-record functions of
+   the modules back to back, so each record is only read from memory once.
+
+   QCMetrics is always run first as it stores the accumulated error rate in
+   the FastqMeta struct, which is subsequently used by NanoStats.
+
+   When profiling is set on any of the modules, the modules are run one
+   after another over the entire record array instead, so the time spent can
+   be attributed to each module. */
+
+typedef struct _QCPipelineStruct {
+    PyObject_HEAD
+    QCMetrics *metrics;
+    PerTileQuality *per_tile_quality;
+    SequenceDuplication *sequence_duplication;
+    NanoStats *nanostats;
+    AdapterCounter *adapter_counter;
+    DedupEstimator *dedup_estimator;
+} QCPipeline;
+
+static void
+QCPipeline_dealloc(QCPipeline *self)
+{
+    Py_XDECREF(self->metrics);
+    Py_XDECREF(self->per_tile_quality);
+    Py_XDECREF(self->sequence_duplication);
+    Py_XDECREF(self->nanostats);
+    Py_XDECREF(self->adapter_counter);
+    Py_XDECREF(self->dedup_estimator);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+QCPipeline__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    PyObject *modules[6] = {Py_None, Py_None, Py_None,
+                            Py_None, Py_None, Py_None};
+    PyTypeObject *module_types[6] = {
+        &QCMetrics_Type, &PerTileQuality_Type, &SequenceDuplication_Type,
+        &NanoStats_Type, &AdapterCounter_type, &DedupEstimator_Type,
+    };
+    static char *kwargnames[] = {
+        "metrics",   "per_tile_quality", "sequence_duplication",
+        "nanostats", "adapter_counter",  "dedup_estimator",
+        NULL};
+    static char *format = "|$OOOOOO:QCPipeline";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwargnames,
+                                     modules, modules + 1, modules + 2,
+                                     modules + 3, modules + 4, modules + 5)) {
+        return NULL;
+    }
+    for (size_t i = 0; i < 6; i++) {
+        if (modules[i] == Py_None) {
+            modules[i] = NULL;
+        }
+        else if (Py_TYPE(modules[i]) != module_types[i]) {
+            PyErr_Format(PyExc_TypeError, "%s should be a %s object, got %s",
+                         kwargnames[i], module_types[i]->tp_name,
+                         Py_TYPE(modules[i])->tp_name);
+            return NULL;
+        }
+    }
+    if (modules[3] != NULL && modules[0] == NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "nanostats requires metrics to be set as well, as "
+                        "it uses the error rates calculated by metrics.");
+        return NULL;
+    }
+    QCPipeline *self = PyObject_New(QCPipeline, type);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
+    for (size_t i = 0; i < 6; i++) {
+        Py_XINCREF(modules[i]);
+    }
+    self->metrics = (QCMetrics *)modules[0];
+    self->per_tile_quality = (PerTileQuality *)modules[1];
+    self->sequence_duplication = (SequenceDuplication *)modules[2];
+    self->nanostats = (NanoStats *)modules[3];
+    self->adapter_counter = (AdapterCounter *)modules[4];
+    self->dedup_estimator = (DedupEstimator *)modules[5];
+    return (PyObject *)self;
+}
+
+static int
+QCPipeline_add_meta(QCPipeline *self, struct FastqMeta *meta)
+{
+    if (self->metrics != NULL &&
+        QCMetrics_add_meta(self->metrics, meta) != 0) {
+        return -1;
+    }
+    if (self->per_tile_quality != NULL &&
+        PerTileQuality_add_meta(self->per_tile_quality, meta) != 0) {
+        return -1;
+    }
+    if (self->sequence_duplication != NULL &&
+        SequenceDuplication_add_meta(self->sequence_duplication, meta) != 0) {
+        return -1;
+    }
+    if (self->nanostats != NULL &&
+        NanoStats_add_meta(self->nanostats, meta) != 0) {
+        return -1;
+    }
+    if (self->adapter_counter != NULL &&
+        AdapterCounter_add_meta(self->adapter_counter, meta) != 0) {
+        return -1;
+    }
+    if (self->dedup_estimator != NULL &&
+        DedupEstimator_add_sequence_ptr(
+            self->dedup_estimator, meta->record_start + meta->sequence_offset,
+            meta->sequence_length) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline int
+QCPipeline_profiling(QCPipeline *self)
+{
+    return (self->metrics != NULL && self->metrics->profiling) ||
+           (self->per_tile_quality != NULL &&
+            self->per_tile_quality->profiling) ||
+           (self->sequence_duplication != NULL &&
+            self->sequence_duplication->profiling) ||
+           (self->nanostats != NULL && self->nanostats->profiling) ||
+           (self->adapter_counter != NULL &&
+            self->adapter_counter->profiling) ||
+           (self->dedup_estimator != NULL && self->dedup_estimator->profiling);
+}
+
+static int
+QCPipeline_add_records_profiled(QCPipeline *self, struct FastqMeta *records,
+                                Py_ssize_t number_of_records)
+{
+    uint64_t start;
+    QCMetrics *metrics = self->metrics;
+    if (metrics != NULL) {
+        start = ModuleProfile_start(metrics->profiling);
+        for (Py_ssize_t i = 0; i < number_of_records; i++) {
+            if (QCMetrics_add_meta(metrics, records + i) != 0) {
+                return -1;
+            }
+        }
+        if (metrics->profiling) {
+            ModuleProfile_stop(&metrics->profile, start, records,
+                               number_of_records);
+        }
+    }
+    PerTileQuality *per_tile_quality = self->per_tile_quality;
+    if (per_tile_quality != NULL) {
+        start = ModuleProfile_start(per_tile_quality->profiling);
+        for (Py_ssize_t i = 0; i < number_of_records; i++) {
+            if (PerTileQuality_add_meta(per_tile_quality, records + i) != 0) {
+                return -1;
+            }
+        }
+        if (per_tile_quality->profiling) {
+            ModuleProfile_stop(&per_tile_quality->profile, start, records,
+                               number_of_records);
+        }
+    }
+    SequenceDuplication *sequence_duplication = self->sequence_duplication;
+    if (sequence_duplication != NULL) {
+        start = ModuleProfile_start(sequence_duplication->profiling);
+        for (Py_ssize_t i = 0; i < number_of_records; i++) {
+            if (SequenceDuplication_add_meta(sequence_duplication,
+                                             records + i) != 0) {
+                return -1;
+            }
+        }
+        SequenceDuplication_flush_batch(sequence_duplication);
+        if (sequence_duplication->profiling) {
+            ModuleProfile_stop(&sequence_duplication->profile, start, records,
+                               number_of_records);
+        }
+    }
+    NanoStats *nanostats = self->nanostats;
+    if (nanostats != NULL) {
+        start = ModuleProfile_start(nanostats->profiling);
+        for (Py_ssize_t i = 0; i < number_of_records; i++) {
+            if (NanoStats_add_meta(nanostats, records + i) != 0) {
+                return -1;
+            }
+        }
+        if (nanostats->profiling) {
+            ModuleProfile_stop(&nanostats->profile, start, records,
+                               number_of_records);
+        }
+    }
+    AdapterCounter *adapter_counter = self->adapter_counter;
+    if (adapter_counter != NULL) {
+        start = ModuleProfile_start(adapter_counter->profiling);
+        for (Py_ssize_t i = 0; i < number_of_records; i++) {
+            if (AdapterCounter_add_meta(adapter_counter, records + i) != 0) {
+                return -1;
+            }
+        }
+        if (adapter_counter->profiling) {
+            ModuleProfile_stop(&adapter_counter->profile, start, records,
+                               number_of_records);
+        }
+    }
+    DedupEstimator *dedup_estimator = self->dedup_estimator;
+    if (dedup_estimator != NULL) {
+        start = ModuleProfile_start(dedup_estimator->profiling);
+        for (Py_ssize_t i = 0; i < number_of_records; i++) {
+            struct FastqMeta *meta = records + i;
+            if (DedupEstimator_add_sequence_ptr(
+                    dedup_estimator,
+                    meta->record_start + meta->sequence_offset,
+                    meta->sequence_length) != 0) {
+                return -1;
+            }
+        }
+        if (dedup_estimator->profiling) {
+            ModuleProfile_stop(&dedup_estimator->profile, start, records,
+                               number_of_records);
+        }
+    }
+    return 0;
+}
+
+PyDoc_STRVAR(QCPipeline_add_record_array__doc__,
+             "add_record_array($self, record_array, /)\n"
+             "--\n"
+             "\n"
+             "Add a record_array to all modules of the pipeline. \n"
+             "\n"
+             "  record_array\n"
+             "    A FastqRecordArrayView object.\n");
+
+#define QCPipeline_add_record_array_method METH_O
+
+static PyObject *
+QCPipeline_add_record_array(QCPipeline *self,
+                            FastqRecordArrayView *record_array)
+{
+    if (!FastqRecordArrayView_CheckExact(record_array)) {
+        PyErr_Format(
+            PyExc_TypeError,
+            "record_array should be a FastqRecordArrayView object, got %s",
+            Py_TYPE(record_array)->tp_name);
+        return NULL;
+    }
+    Py_ssize_t number_of_records = Py_SIZE(record_array);
+    struct FastqMeta *records = record_array->records;
+    int ret = 0;
+    int profiling = QCPipeline_profiling(self);
+    Py_BEGIN_ALLOW_THREADS
+    if (profiling) {
+        ret = QCPipeline_add_records_profiled(self, records,
+                                              number_of_records);
+    }
+    else {
+        for (Py_ssize_t i = 0; i < number_of_records; i++) {
+            ret = QCPipeline_add_meta(self, records + i);
+            if (ret != 0) {
+                break;
+            }
+        }
+        if (self->sequence_duplication != NULL) {
+            SequenceDuplication_flush_batch(self->sequence_duplication);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if (ret != 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef QCPipeline_methods[] = {
+    {"add_record_array", (PyCFunction)QCPipeline_add_record_array,
+     QCPipeline_add_record_array_method, QCPipeline_add_record_array__doc__},
+    {NULL},
+};
+
+static PyMemberDef QCPipeline_members[] = {
+    {"metrics", T_OBJECT, offsetof(QCPipeline, metrics), READONLY,
+     "The QCMetrics module or None"},
+    {"per_tile_quality", T_OBJECT, offsetof(QCPipeline, per_tile_quality),
+     READONLY, "The PerTileQuality module or None"},
+    {"sequence_duplication", T_OBJECT,
+     offsetof(QCPipeline, sequence_duplication), READONLY,
+     "The SequenceDuplication module or None"},
+    {"nanostats", T_OBJECT, offsetof(QCPipeline, nanostats), READONLY,
+     "The NanoStats module or None"},
+    {"adapter_counter", T_OBJECT, offsetof(QCPipeline, adapter_counter),
+     READONLY, "The AdapterCounter module or None"},
+    {"dedup_estimator", T_OBJECT, offsetof(QCPipeline, dedup_estimator),
+     READONLY, "The DedupEstimator module or None"},
+    {NULL},
+};
+
+static PyTypeObject QCPipeline_Type = {
+    .tp_name = "_qc.QCPipeline",
+    .tp_basicsize = sizeof(QCPipeline),
+    .tp_dealloc = (destructor)QCPipeline_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = QCPipeline__new__,
+    .tp_methods = QCPipeline_methods,
+    .tp_members = QCPipeline_members,
+};
+
 /*************************
  * MODULE INITIALIZATION *
  *************************/
@@ -5199,19 +10655,16 @@ PyInit__qc(void)
     if (python_module_add_type(m, &DedupEstimator_Type) != 0) {
         return NULL;
     }
-    if (python_module_add_type(m, &NanoporeReadInfo_Type) != 0) {
-        return NULL;
-    }
     if (python_module_add_type(m, &NanoStats_Type) != 0) {
         return NULL;
     }
-    if (python_module_add_type(m, &NanoStatsIterator_Type) != 0) {
-        return NULL;
-    }
 
     if (python_module_add_type(m, &InsertSizeMetrics_Type) != 0) {
         return NULL;
     }
+    if (python_module_add_type(m, &QCPipeline_Type) != 0) {
+        return NULL;
+    }
     PyModule_AddIntConstant(m, "NUMBER_OF_NUCS", NUC_TABLE_SIZE);
     PyModule_AddIntConstant(m, "NUMBER_OF_PHREDS", PHRED_TABLE_SIZE);
     PyModule_AddIntConstant(m, "TABLE_SIZE", PHRED_TABLE_SIZE * NUC_TABLE_SIZE);
@@ -5222,10 +10675,17 @@ PyInit__qc(void)
     PyModule_AddIntMacro(m, N);
     PyModule_AddIntMacro(m, PHRED_MAX);
     PyModule_AddIntMacro(m, MAX_SEQUENCE_SIZE);
+    PyModule_AddIntMacro(m, DEFAULT_EXACT_POSITIONS);
     PyModule_AddIntMacro(m, DEFAULT_MAX_UNIQUE_FRAGMENTS);
     PyModule_AddIntMacro(m, DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS);
+    PyModule_AddIntMacro(m, DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS);
     PyModule_AddIntMacro(m, DEFAULT_FRAGMENT_LENGTH);
     PyModule_AddIntMacro(m, DEFAULT_UNIQUE_SAMPLE_EVERY);
+    PyModule_AddIntMacro(m, FRAGMENT_BUCKET_SLOTS);
+    PyModule_AddIntConstant(m, "FRAGMENT_BUCKET_SIZE",
+                            sizeof(struct FragmentBucket));
+    PyModule_AddIntConstant(m, "DEDUP_ESTIMATOR_ENTRY_SIZE",
+                            sizeof(struct EstimatorEntry));
     PyModule_AddIntMacro(m, DEFAULT_FINGERPRINT_FRONT_SEQUENCE_LENGTH);
     PyModule_AddIntMacro(m, DEFAULT_FINGERPRINT_BACK_SEQUENCE_LENGTH);
     PyModule_AddIntMacro(m, DEFAULT_FINGERPRINT_FRONT_SEQUENCE_OFFSET);
@@ -1,3 +1,19 @@
+from typing import Dict, Sequence, Tuple
+
+KMER_INDEX_VERSION: int
+
 def sequence_identity(target: str, query: str,
                       match_score=1, mismatch_penalty=-1, deletion_penalty=-1,
-                      insertion_penalty=-1) -> float: ...
\ No newline at end of file
+                      insertion_penalty=-1) -> float: ...
+
+def best_sequence_identity(__targets: Sequence[str], __query: str,
+                           match_reverse_complement: bool = True,
+                           ) -> Tuple[int, float]: ...
+
+def create_kmer_index(sequences: Sequence[str], k: int) -> bytes: ...
+
+class KmerIndex:
+    k: int
+    number_of_entries: int
+    def __init__(self, data) -> None: ...
+    def count_matches(self, __sequence: str) -> Dict[int, int]: ...
@@ -17,6 +17,7 @@ along with Sequali.  If not, see <https://www.gnu.org/licenses/
 */
 
 #include "Python.h"
+#include "structmember.h"
 
 #include "compiler_defs.h"
 
@@ -136,7 +137,7 @@ get_smith_waterman_matches_avx2(const uint8_t *restrict target,
     /* Since the algorithm goes over reversed diagonals, it needs to be padded
        with  the vector length - 1 on both sides. So vectors can be loaded
        immediately rather than have a complex initialization. */
-    uint8_t *padded_target = PyMem_Calloc(target_length + 62, 1);
+    uint8_t *padded_target = PyMem_RawCalloc(target_length + 62, 1);
     if (padded_target == NULL) {
         return -1;
     }
@@ -258,7 +259,7 @@ get_smith_waterman_matches_avx2(const uint8_t *restrict target,
             best_matches = matches;
         }
     }
-    PyMem_Free(padded_target);
+    PyMem_RawFree(padded_target);
     return best_matches;
 }
 
@@ -335,9 +336,565 @@ sequence_identity(PyObject *module, PyObject *args, PyObject *kwargs)
     return PyFloat_FromDouble(identity);
 }
 
+/**************
+ * KMER INDEX *
+ **************/
+
+/* The k-mer index is a sorted array of 2-bit packed canonical k-mers with a
+   parallel array of the sequence ids they occur in. A k-mer that occurs in
+   multiple sequences is stored once for each sequence. The serialized form
+   is the header followed by both arrays, so it can be used directly from a
+   memory mapped file. */
+#define KMER_INDEX_MAGIC "SQKI"
+#define KMER_INDEX_VERSION 1
+#define KMER_INDEX_MAX_K 31
+
+struct KmerIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t k;
+    uint32_t reserved;
+    uint64_t number_of_entries;
+};
+
+struct KmerIndexEntry {
+    uint64_t kmer;
+    uint32_t sequence_id;
+};
+
+static const uint8_t NUCLEOTIDE_TO_TWOBIT[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+    ['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4,
+};
+
+/**
+ * @brief Store the canonical k-mers of the sequence in kmers. k-mers that
+ *        contain other characters than ACGT are skipped.
+ *
+ * @param kmers Array with room for at least sequence_length k-mers.
+ * @return The number of stored k-mers.
+ */
+static size_t
+sequence_to_canonical_kmers(const uint8_t *sequence, size_t sequence_length,
+                            size_t k, uint64_t *kmers)
+{
+    uint64_t kmer_mask = (1ULL << (2 * k)) - 1;
+    size_t reverse_shift = 2 * (k - 1);
+    uint64_t forward = 0;
+    uint64_t reverse = 0;
+    size_t valid_bases = 0;
+    size_t number_of_kmers = 0;
+    for (size_t i = 0; i < sequence_length; i++) {
+        uint8_t code = NUCLEOTIDE_TO_TWOBIT[sequence[i]];
+        if (code == 0) {
+            valid_bases = 0;
+            continue;
+        }
+        code -= 1;
+        forward = ((forward << 2) | code) & kmer_mask;
+        reverse = (reverse >> 2) | ((uint64_t)(3 - code) << reverse_shift);
+        valid_bases += 1;
+        if (valid_bases >= k) {
+            kmers[number_of_kmers] = Py_MIN(forward, reverse);
+            number_of_kmers += 1;
+        }
+    }
+    return number_of_kmers;
+}
+
+static int
+compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int
+compare_kmer_index_entry(const void *a, const void *b)
+{
+    const struct KmerIndexEntry *x = a;
+    const struct KmerIndexEntry *y = b;
+    if (x->kmer != y->kmer) {
+        return (x->kmer > y->kmer) - (x->kmer < y->kmer);
+    }
+    return (x->sequence_id > y->sequence_id) -
+           (x->sequence_id < y->sequence_id);
+}
+
+/**
+ * @brief Sort the k-mers and remove duplicates.
+ * @return The number of unique k-mers.
+ */
+static size_t
+sort_unique_kmers(uint64_t *kmers, size_t number_of_kmers)
+{
+    if (number_of_kmers == 0) {
+        return 0;
+    }
+    qsort(kmers, number_of_kmers, sizeof(uint64_t), compare_uint64);
+    size_t unique = 1;
+    for (size_t i = 1; i < number_of_kmers; i++) {
+        if (kmers[i] != kmers[unique - 1]) {
+            kmers[unique] = kmers[i];
+            unique += 1;
+        }
+    }
+    return unique;
+}
+
+static int
+check_k(Py_ssize_t k)
+{
+    if (k < 1 || k > KMER_INDEX_MAX_K || (k % 2) == 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "k must be an uneven number between 1 and %d, got %zd",
+                     KMER_INDEX_MAX_K, k);
+        return -1;
+    }
+    return 0;
+}
+
+PyDoc_STRVAR(create_kmer_index__doc__,
+             "create_kmer_index($module, sequences, k)\n"
+             "--\n"
+             "\n"
+             "Create a serialized k-mer index that can be used by KmerIndex.\n"
+             "\n"
+             "  sequences\n"
+             "    A sequence of ASCII strings. The position of each string is "
+             "its\n"
+             "    sequence id.\n"
+             "  k\n"
+             "    The uneven k-mer size.\n");
+
+#define create_kmer_index_method METH_VARARGS | METH_KEYWORDS
+
+static PyObject *
+create_kmer_index(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *format = "On:create_kmer_index";
+    static char *kwnames[] = {"sequences", "k", NULL};
+    PyObject *sequences_obj = NULL;
+    Py_ssize_t k = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwnames,
+                                     &sequences_obj, &k)) {
+        return NULL;
+    }
+    if (check_k(k) != 0) {
+        return NULL;
+    }
+    PyObject *sequences = PySequence_Tuple(sequences_obj);
+    if (sequences == NULL) {
+        return NULL;
+    }
+    Py_ssize_t number_of_sequences = PyTuple_GET_SIZE(sequences);
+    if ((size_t)number_of_sequences > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "Too many sequences");
+        Py_DECREF(sequences);
+        return NULL;
+    }
+    size_t total_length = 0;
+    size_t max_length = 0;
+    for (Py_ssize_t i = 0; i < number_of_sequences; i++) {
+        PyObject *sequence = PyTuple_GET_ITEM(sequences, i);
+        if (!PyUnicode_CheckExact(sequence) ||
+            !PyUnicode_IS_COMPACT_ASCII(sequence)) {
+            PyErr_Format(PyExc_ValueError,
+                         "Only ascii strings are allowed. Got %R", sequence);
+            Py_DECREF(sequences);
+            return NULL;
+        }
+        size_t length = PyUnicode_GET_LENGTH(sequence);
+        total_length += length;
+        max_length = Py_MAX(max_length, length);
+    }
+    PyObject *result = NULL;
+    uint64_t *kmers = PyMem_Malloc(Py_MAX(max_length, 1) * sizeof(uint64_t));
+    struct KmerIndexEntry *entries =
+        PyMem_Malloc(Py_MAX(total_length, 1) * sizeof(struct KmerIndexEntry));
+    if (kmers == NULL || entries == NULL) {
+        PyErr_NoMemory();
+        goto finish;
+    }
+    size_t number_of_entries = 0;
+    for (Py_ssize_t i = 0; i < number_of_sequences; i++) {
+        PyObject *sequence = PyTuple_GET_ITEM(sequences, i);
+        size_t number_of_kmers = sequence_to_canonical_kmers(
+            PyUnicode_DATA(sequence), PyUnicode_GET_LENGTH(sequence), k,
+            kmers);
+        number_of_kmers = sort_unique_kmers(kmers, number_of_kmers);
+        for (size_t j = 0; j < number_of_kmers; j++) {
+            entries[number_of_entries].kmer = kmers[j];
+            entries[number_of_entries].sequence_id = i;
+            number_of_entries += 1;
+        }
+    }
+    qsort(entries, number_of_entries, sizeof(struct KmerIndexEntry),
+          compare_kmer_index_entry);
+    size_t kmers_size = number_of_entries * sizeof(uint64_t);
+    size_t ids_size = number_of_entries * sizeof(uint32_t);
+    result = PyBytes_FromStringAndSize(
+        NULL, sizeof(struct KmerIndexHeader) + kmers_size + ids_size);
+    if (result == NULL) {
+        goto finish;
+    }
+    uint8_t *data = (uint8_t *)PyBytes_AS_STRING(result);
+    struct KmerIndexHeader header = {
+        .version = KMER_INDEX_VERSION,
+        .k = k,
+        .reserved = 0,
+        .number_of_entries = number_of_entries,
+    };
+    memcpy(header.magic, KMER_INDEX_MAGIC, 4);
+    memcpy(data, &header, sizeof(header));
+    uint8_t *kmer_data = data + sizeof(header);
+    uint8_t *id_data = kmer_data + kmers_size;
+    for (size_t i = 0; i < number_of_entries; i++) {
+        memcpy(kmer_data + i * sizeof(uint64_t), &entries[i].kmer,
+               sizeof(uint64_t));
+        memcpy(id_data + i * sizeof(uint32_t), &entries[i].sequence_id,
+               sizeof(uint32_t));
+    }
+finish:
+    PyMem_Free(kmers);
+    PyMem_Free(entries);
+    Py_DECREF(sequences);
+    return result;
+}
+
+typedef struct _KmerIndexStruct {
+    PyObject_HEAD
+    Py_buffer view;
+    size_t k;
+    size_t number_of_entries;
+    const uint8_t *kmers;
+    const uint8_t *sequence_ids;
+} KmerIndex;
+
+static void
+KmerIndex_dealloc(KmerIndex *self)
+{
+    if (self->view.obj != NULL) {
+        PyBuffer_Release(&self->view);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+KmerIndex__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *format = "O:KmerIndex";
+    static char *kwnames[] = {"data", NULL};
+    PyObject *data = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwnames, &data)) {
+        return NULL;
+    }
+    KmerIndex *self = PyObject_New(KmerIndex, type);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
+    self->view.obj = NULL;
+    if (PyObject_GetBuffer(data, &self->view, PyBUF_SIMPLE) != 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    size_t size = self->view.len;
+    const uint8_t *buffer = self->view.buf;
+    struct KmerIndexHeader header;
+    if (size < sizeof(header)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid k-mer index: too short");
+        Py_DECREF(self);
+        return NULL;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if (memcmp(header.magic, KMER_INDEX_MAGIC, 4) != 0 ||
+        header.version != KMER_INDEX_VERSION) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid k-mer index: unknown format");
+        Py_DECREF(self);
+        return NULL;
+    }
+    if (check_k(header.k) != 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    size_t entry_size = sizeof(uint64_t) + sizeof(uint32_t);
+    if ((size - sizeof(header)) / entry_size != header.number_of_entries ||
+        (size - sizeof(header)) % entry_size != 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid k-mer index: size does not match number of "
+                        "entries");
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->k = header.k;
+    self->number_of_entries = header.number_of_entries;
+    self->kmers = buffer + sizeof(header);
+    self->sequence_ids =
+        self->kmers + header.number_of_entries * sizeof(uint64_t);
+    return (PyObject *)self;
+}
+
+static inline uint64_t
+KmerIndex_kmer_at(KmerIndex *self, size_t index)
+{
+    /* The buffer is not guaranteed to be aligned. */
+    uint64_t kmer;
+    memcpy(&kmer, self->kmers + index * sizeof(uint64_t), sizeof(uint64_t));
+    return kmer;
+}
+
+PyDoc_STRVAR(KmerIndex_count_matches__doc__,
+             "count_matches($self, sequence, /)\n"
+             "--\n"
+             "\n"
+             "Count the unique canonical k-mers of the sequence that occur in "
+             "each\n"
+             "indexed sequence.\n"
+             "\n"
+             "  sequence\n"
+             "    An ASCII string.\n"
+             "\n"
+             "Returns a dictionary with the sequence ids as keys and the "
+             "number of\n"
+             "matching k-mers as values.\n");
+
+#define KmerIndex_count_matches_method METH_O
+
+static PyObject *
+KmerIndex_count_matches(KmerIndex *self, PyObject *sequence)
+{
+    if (!PyUnicode_CheckExact(sequence) ||
+        !PyUnicode_IS_COMPACT_ASCII(sequence)) {
+        PyErr_Format(PyExc_ValueError,
+                     "Only ascii strings are allowed. Got %R", sequence);
+        return NULL;
+    }
+    size_t sequence_length = PyUnicode_GET_LENGTH(sequence);
+    uint64_t *kmers =
+        PyMem_Malloc(Py_MAX(sequence_length, 1) * sizeof(uint64_t));
+    if (kmers == NULL) {
+        return PyErr_NoMemory();
+    }
+    size_t number_of_kmers = sequence_to_canonical_kmers(
+        PyUnicode_DATA(sequence), sequence_length, self->k, kmers);
+    number_of_kmers = sort_unique_kmers(kmers, number_of_kmers);
+    PyObject *counts = PyDict_New();
+    if (counts == NULL) {
+        PyMem_Free(kmers);
+        return NULL;
+    }
+    size_t number_of_entries = self->number_of_entries;
+    for (size_t i = 0; i < number_of_kmers; i++) {
+        uint64_t kmer = kmers[i];
+        /* Binary search for the first entry of the k-mer. */
+        size_t low = 0;
+        size_t high = number_of_entries;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (KmerIndex_kmer_at(self, middle) < kmer) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        for (size_t j = low; j < number_of_entries; j++) {
+            if (KmerIndex_kmer_at(self, j) != kmer) {
+                break;
+            }
+            uint32_t sequence_id;
+            memcpy(&sequence_id, self->sequence_ids + j * sizeof(uint32_t),
+                   sizeof(uint32_t));
+            PyObject *key = PyLong_FromUnsignedLong(sequence_id);
+            if (key == NULL) {
+                goto error;
+            }
+            PyObject *count = PyDict_GetItemWithError(counts, key);
+            Py_ssize_t new_count = 1;
+            if (count != NULL) {
+                new_count = PyLong_AsSsize_t(count) + 1;
+            }
+            else if (PyErr_Occurred()) {
+                Py_DECREF(key);
+                goto error;
+            }
+            PyObject *new_count_obj = PyLong_FromSsize_t(new_count);
+            if (new_count_obj == NULL ||
+                PyDict_SetItem(counts, key, new_count_obj) != 0) {
+                Py_XDECREF(new_count_obj);
+                Py_DECREF(key);
+                goto error;
+            }
+            Py_DECREF(new_count_obj);
+            Py_DECREF(key);
+        }
+    }
+    PyMem_Free(kmers);
+    return counts;
+error:
+    PyMem_Free(kmers);
+    Py_DECREF(counts);
+    return NULL;
+}
+
+static PyMethodDef KmerIndex_methods[] = {
+    {"count_matches", (PyCFunction)KmerIndex_count_matches,
+     KmerIndex_count_matches_method, KmerIndex_count_matches__doc__},
+    {NULL},
+};
+
+static PyMemberDef KmerIndex_members[] = {
+    {"k", T_ULONGLONG, offsetof(KmerIndex, k), READONLY,
+     "The k-mer size"},
+    {"number_of_entries", T_ULONGLONG, offsetof(KmerIndex, number_of_entries),
+     READONLY, "The number of stored k-mer and sequence id combinations"},
+    {NULL},
+};
+
+PyDoc_STRVAR(KmerIndex__doc__,
+             "KmerIndex(data)\n"
+             "\n"
+             "A k-mer index on the data created by create_kmer_index. The data "
+             "is\n"
+             "used in place, so a memory mapped file can be used.\n");
+
+static PyTypeObject KmerIndex_Type = {
+    .tp_name = "_seqident.KmerIndex",
+    .tp_basicsize = sizeof(KmerIndex),
+    .tp_dealloc = (destructor)KmerIndex_dealloc,
+    .tp_new = (newfunc)KmerIndex__new__,
+    .tp_doc = KmerIndex__doc__,
+    .tp_members = KmerIndex_members,
+    .tp_methods = KmerIndex_methods,
+};
+
+static const uint8_t COMPLEMENT_TABLE[256] = {
+    ['A'] = 'T', ['C'] = 'G', ['G'] = 'C', ['T'] = 'A',
+    ['a'] = 'T', ['c'] = 'G', ['g'] = 'C', ['t'] = 'A',
+};
+
+PyDoc_STRVAR(
+    best_sequence_identity__doc__,
+    "best_sequence_identity($module, targets, query, /, "
+    "match_reverse_complement=True)\n"
+    "--\n"
+    "\n"
+    "Find the target with the highest sequence identity to the query. The\n"
+    "targets are aligned in order without holding the GIL, so multiple\n"
+    "queries can be aligned concurrently from different threads. The search\n"
+    "stops at the first target with an identity of 1.0.\n"
+    "\n"
+    "  targets\n"
+    "    A sequence of ASCII strings.\n"
+    "  query\n"
+    "    An ASCII string of at most 31 characters.\n"
+    "  match_reverse_complement\n"
+    "    Also align the reverse complement of the query and use the best of\n"
+    "    both strands.\n"
+    "\n"
+    "Returns a tuple of the index of the first target with the highest\n"
+    "identity and the identity. The index is -1 when no target has an\n"
+    "identity above 0.\n");
+
+#define best_sequence_identity_method METH_VARARGS | METH_KEYWORDS
+
+static PyObject *
+best_sequence_identity(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *format = "OU|p:best_sequence_identity";
+    static char *kwnames[] = {"", "", "match_reverse_complement", NULL};
+    PyObject *targets_obj = NULL;
+    PyObject *query_obj = NULL;
+    int match_reverse_complement = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwnames,
+                                     &targets_obj, &query_obj,
+                                     &match_reverse_complement)) {
+        return NULL;
+    }
+    if (!PyUnicode_IS_COMPACT_ASCII(query_obj)) {
+        PyErr_Format(PyExc_ValueError,
+                     "Only ascii strings are allowed. Got %R", query_obj);
+        return NULL;
+    }
+    Py_ssize_t query_length = PyUnicode_GET_LENGTH(query_obj);
+    if (query_length > 31) {
+        PyErr_Format(
+            PyExc_ValueError,
+            "Only query with lengths less than 32 are supported. Got %zd",
+            query_length);
+        return NULL;
+    }
+    PyObject *targets = PySequence_Tuple(targets_obj);
+    if (targets == NULL) {
+        return NULL;
+    }
+    Py_ssize_t number_of_targets = PyTuple_GET_SIZE(targets);
+    for (Py_ssize_t i = 0; i < number_of_targets; i++) {
+        PyObject *target = PyTuple_GET_ITEM(targets, i);
+        if (!PyUnicode_CheckExact(target) ||
+            !PyUnicode_IS_COMPACT_ASCII(target)) {
+            PyErr_Format(PyExc_ValueError,
+                         "Only ascii strings are allowed. Got %R", target);
+            Py_DECREF(targets);
+            return NULL;
+        }
+    }
+    const uint8_t *query = PyUnicode_DATA(query_obj);
+    uint8_t reverse_complement[31];
+    for (Py_ssize_t i = 0; i < query_length; i++) {
+        uint8_t complement = COMPLEMENT_TABLE[query[query_length - 1 - i]];
+        reverse_complement[i] = complement ? complement : 'N';
+    }
+    Py_ssize_t best_index = -1;
+    double best_identity = 0.0;
+    int memory_error = 0;
+    /* The targets are kept alive by the tuple, so their data can be used
+       without the GIL. */
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < number_of_targets; i++) {
+        PyObject *target_obj = PyTuple_GET_ITEM(targets, i);
+        const uint8_t *target = PyUnicode_DATA(target_obj);
+        Py_ssize_t target_length = PyUnicode_GET_LENGTH(target_obj);
+        Py_ssize_t most_matches = get_smith_waterman_matches(
+            target, target_length, query, query_length, 1, -1, -1, -1);
+        if (match_reverse_complement && most_matches >= 0) {
+            Py_ssize_t reverse_matches = get_smith_waterman_matches(
+                target, target_length, reverse_complement, query_length, 1,
+                -1, -1, -1);
+            most_matches = reverse_matches < 0
+                               ? reverse_matches
+                               : Py_MAX(most_matches, reverse_matches);
+        }
+        if (most_matches < 0) {
+            memory_error = 1;
+            break;
+        }
+        double identity = (double)most_matches / (double)query_length;
+        if (identity > best_identity) {
+            best_identity = identity;
+            best_index = i;
+            if (identity == 1.0) {
+                break;
+            }
+        }
+    }
+    Py_END_ALLOW_THREADS
+    Py_DECREF(targets);
+    if (memory_error) {
+        return PyErr_NoMemory();
+    }
+    return Py_BuildValue("(nd)", best_index, best_identity);
+}
+
 static PyMethodDef _seqident_methods[] = {
     {"sequence_identity", (PyCFunction)sequence_identity,
      sequence_identity_method, sequence_identity__doc__},
+    {"best_sequence_identity", (PyCFunction)best_sequence_identity,
+     best_sequence_identity_method, best_sequence_identity__doc__},
+    {"create_kmer_index", (PyCFunction)create_kmer_index,
+     create_kmer_index_method, create_kmer_index__doc__},
     {NULL},
 };
 
@@ -357,5 +914,19 @@ PyInit__seqident(void)
     if (m == NULL) {
         return NULL;
     }
+    if (PyType_Ready(&KmerIndex_Type) != 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(&KmerIndex_Type);
+    if (PyModule_AddObject(m, "KmerIndex", (PyObject *)&KmerIndex_Type) != 0) {
+        Py_DECREF(&KmerIndex_Type);
+        Py_DECREF(m);
+        return NULL;
+    }
+    if (PyModule_AddIntMacro(m, KMER_INDEX_VERSION) != 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
     return m;
 }
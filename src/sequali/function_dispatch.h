@@ -22,6 +22,10 @@ along with Sequali.  If not, see <https://www.gnu.org/licenses/
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__SSE2__) && !BUILD_IS_X86_64
+#include "emmintrin.h"
+#endif
+
 static void
 decode_bam_sequence_default(uint8_t *dest, const uint8_t *encoded_sequence,
                             size_t length)
@@ -143,7 +147,7 @@ static const uint8_t NUCLEOTIDE_TO_TWOBIT[128] = {
 #define TWOBIT_N_CHAR -2
 #define TWOBIT_SUCCESS 0
 
-static uint64_t
+static inline uint64_t
 reverse_complement_kmer(uint64_t kmer, uint64_t k)
 {
     // Invert all the bits, with 0,1,2,3 == A,C,G,T this automatically is the
@@ -337,3 +341,74 @@ sequence_to_canonical_kmer_init_func_ptr(void)
     }
 }
 #endif
+
+/* Return 1 if the sequence consists of A, C, G and T only, in either case.
+   The fragments of such a sequence can be converted to twobit without
+   checking each nucleotide. */
+static int
+sequence_is_acgt(const uint8_t *sequence, size_t length)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i not_acgt = _mm_setzero_si128();
+    for (; i + sizeof(__m128i) <= length; i += sizeof(__m128i)) {
+        __m128i chunk = _mm_andnot_si128(
+            _mm_set1_epi8(32), _mm_loadu_si128((__m128i *)(sequence + i)));
+        __m128i acgt = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('A')),
+                         _mm_cmpeq_epi8(chunk, _mm_set1_epi8('C'))),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('G')),
+                         _mm_cmpeq_epi8(chunk, _mm_set1_epi8('T'))));
+        not_acgt = _mm_or_si128(not_acgt,
+                                _mm_andnot_si128(acgt, _mm_set1_epi8(-1)));
+    }
+    if (_mm_movemask_epi8(not_acgt)) {
+        return 0;
+    }
+#endif
+    size_t all_nucs = 0;
+    for (; i < length; i++) {
+        uint8_t c = sequence[i];
+        all_nucs |= c > 127 ? 4 : NUCLEOTIDE_TO_TWOBIT[c];
+    }
+    return all_nucs < 4;
+}
+
+/* Load 8 bytes with the first byte in the most significant position.
+   Compilers recognize this as a (byte swapping) load on any endianness. */
+static inline uint64_t
+load_big_endian_uint64(const uint8_t *bytes)
+{
+    return ((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) |
+           ((uint64_t)bytes[2] << 40) | ((uint64_t)bytes[3] << 32) |
+           ((uint64_t)bytes[4] << 24) | ((uint64_t)bytes[5] << 16) |
+           ((uint64_t)bytes[6] << 8) | ((uint64_t)bytes[7]);
+}
+
+/* Bits 1 and 2 of the ASCII codes of A, C, G and T, in either case, are
+   00, 01, 11 and 10. Gather these bits of 8 nucleotides loaded with
+   load_big_endian_uint64 into 16 bits, first nucleotide highest. */
+static inline uint64_t
+gather_nucleotide_bits_default(uint64_t nucleotides)
+{
+    uint64_t bits = (nucleotides >> 1) & 0x0303030303030303ULL;
+    bits = (bits | (bits >> 6)) & 0x000F000F000F000FULL;
+    bits = (bits | (bits >> 12)) & 0x000000FF000000FFULL;
+    return (bits | (bits >> 24)) & 0xFFFF;
+}
+
+#if COMPILER_HAS_TARGETED_DISPATCH && BUILD_IS_X86_64
+__attribute__((__target__("bmi2"))) static inline uint64_t
+gather_nucleotide_bits_bmi2(uint64_t nucleotides)
+{
+    return _pext_u64(nucleotides, 0x0606060606060606ULL);
+}
+#endif
+
+/* Swap the codes of G and T in gathered nucleotide bits to get the A, C,
+   G, T == 0, 1, 2, 3 twobit representation. */
+static inline uint64_t
+nucleotide_bits_to_twobit(uint64_t bits)
+{
+    return bits ^ ((bits >> 1) & 0x5555555555555555ULL);
+}
@@ -0,0 +1,545 @@
+# Copyright (C) 2023 Leiden University Medical Center
+# This file is part of Sequali
+#
+# Sequali is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# Sequali is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Sequali.  If not, see <https://www.gnu.org/licenses/
+
+import json
+import math
+import queue
+import threading
+from typing import (Any, Callable, Dict, List, NamedTuple, Optional, Sequence,
+                    Tuple, Union)
+
+from ._qc import (
+    AdapterCounter,
+    DEDUP_ESTIMATOR_ENTRY_SIZE,
+    DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS,
+    DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS,
+    DEFAULT_FINGERPRINT_BACK_SEQUENCE_LENGTH,
+    DEFAULT_FINGERPRINT_BACK_SEQUENCE_OFFSET,
+    DEFAULT_FINGERPRINT_FRONT_SEQUENCE_LENGTH,
+    DEFAULT_FINGERPRINT_FRONT_SEQUENCE_OFFSET,
+    DEFAULT_FRAGMENT_LENGTH,
+    DEFAULT_MAX_UNIQUE_FRAGMENTS,
+    DEFAULT_UNIQUE_SAMPLE_EVERY,
+    DedupEstimator,
+    FRAGMENT_BUCKET_SIZE,
+    FRAGMENT_BUCKET_SLOTS,
+    FastqRecordArrayView,
+    InsertSizeMetrics,
+    NanoStats,
+    PerTileQuality,
+    QCMetrics,
+    QCPipeline,
+    SequenceDuplication
+)
+
+
+# Identifies a state file written by Collectors.dump
+STATE_FILE_MAGIC = b"SQLCOLLS"
+
+_MODULE_TYPES = {
+    "metrics": QCMetrics,
+    "per_tile_quality": PerTileQuality,
+    "sequence_duplication": SequenceDuplication,
+    "nanostats": NanoStats,
+    "dedup_estimator": DedupEstimator,
+    "adapter_counter": AdapterCounter,
+    "insert_size_metrics": InsertSizeMetrics,
+    "metrics_reverse": QCMetrics,
+    "per_tile_quality_reverse": PerTileQuality,
+    "sequence_duplication_reverse": SequenceDuplication,
+}
+
+
+def _int_to_bytes(value: int) -> bytes:
+    return value.to_bytes(8, "little")
+
+
+class Collectors:
+    """
+    The set of QC modules that gather the data for one report.
+
+    In paired mode the read 2 specific modules and the InsertSizeMetrics
+    module are present. In single end mode the AdapterCounter is present.
+    """
+    metrics: QCMetrics
+    per_tile_quality: PerTileQuality
+    sequence_duplication: SequenceDuplication
+    nanostats: NanoStats
+    dedup_estimator: DedupEstimator
+    adapter_counter: Optional[AdapterCounter]
+    insert_size_metrics: Optional[InsertSizeMetrics]
+    metrics_reverse: Optional[QCMetrics]
+    per_tile_quality_reverse: Optional[PerTileQuality]
+    sequence_duplication_reverse: Optional[SequenceDuplication]
+    _pipeline: QCPipeline
+    _pipeline_reverse: Optional[QCPipeline]
+
+    def __init__(
+            self,
+            adapter_sequences: Sequence[str],
+            paired: bool = False,
+            *,
+            max_unique_fragments: int = DEFAULT_MAX_UNIQUE_FRAGMENTS,
+            fragment_length: int = DEFAULT_FRAGMENT_LENGTH,
+            sample_every: int = DEFAULT_UNIQUE_SAMPLE_EVERY,
+            max_stored_fingerprints: int = DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS,
+            duplication_sketch: bool = False,
+            front_sequence_length: int = DEFAULT_FINGERPRINT_FRONT_SEQUENCE_LENGTH,
+            back_sequence_length: int = DEFAULT_FINGERPRINT_BACK_SEQUENCE_LENGTH,
+            front_sequence_offset: int = DEFAULT_FINGERPRINT_FRONT_SEQUENCE_OFFSET,
+            back_sequence_offset: int = DEFAULT_FINGERPRINT_BACK_SEQUENCE_OFFSET,
+            profiling: bool = False,
+    ):
+        self.paired = paired
+        self.metrics = QCMetrics()
+        self.per_tile_quality = PerTileQuality()
+        self.nanostats = NanoStats()
+        self.sequence_duplication = SequenceDuplication(
+            max_unique_fragments=max_unique_fragments,
+            fragment_length=fragment_length,
+            sample_every=sample_every,
+        )
+        self.dedup_estimator = DedupEstimator(
+            max_stored_fingerprints=max_stored_fingerprints,
+            front_sequence_length=front_sequence_length,
+            front_sequence_offset=front_sequence_offset,
+            back_sequence_length=back_sequence_length,
+            back_sequence_offset=back_sequence_offset,
+            sketch=duplication_sketch,
+        )
+        if paired:
+            self.adapter_counter = None
+            self.insert_size_metrics = InsertSizeMetrics()
+            self.metrics_reverse = QCMetrics()
+            self.per_tile_quality_reverse = PerTileQuality()
+            self.sequence_duplication_reverse = SequenceDuplication(
+                max_unique_fragments=max_unique_fragments,
+                fragment_length=fragment_length,
+                sample_every=sample_every,
+            )
+        else:
+            self.adapter_counter = AdapterCounter(adapter_sequences)
+            self.insert_size_metrics = None
+            self.metrics_reverse = None
+            self.per_tile_quality_reverse = None
+            self.sequence_duplication_reverse = None
+        self._init_pipelines()
+        self.set_profiling(profiling)
+
+    def _init_pipelines(self):
+        # The QCPipeline objects run all modules that process a single read
+        # on each record in one pass.
+        if self.paired:
+            self._pipeline = QCPipeline(
+                metrics=self.metrics,
+                per_tile_quality=self.per_tile_quality,
+                sequence_duplication=self.sequence_duplication,
+                nanostats=self.nanostats,
+            )
+            self._pipeline_reverse = QCPipeline(
+                metrics=self.metrics_reverse,
+                per_tile_quality=self.per_tile_quality_reverse,
+                sequence_duplication=self.sequence_duplication_reverse,
+            )
+        else:
+            self._pipeline = QCPipeline(
+                metrics=self.metrics,
+                per_tile_quality=self.per_tile_quality,
+                sequence_duplication=self.sequence_duplication,
+                nanostats=self.nanostats,
+                adapter_counter=self.adapter_counter,
+                dedup_estimator=self.dedup_estimator,
+            )
+            self._pipeline_reverse = None
+
+    def set_profiling(self, profiling: bool):
+        """Set whether the modules measure the time they spend."""
+        for name in _MODULE_TYPES:
+            module = getattr(self, name)
+            if module is not None:
+                module.profiling = profiling
+
+    def profile(self) -> Dict[str, Dict[str, Union[int, float]]]:
+        """Return the performance counters of each module."""
+        return {name: getattr(self, name).profile() for name in _MODULE_TYPES
+                if getattr(self, name) is not None}
+
+    def _set_read_index(self, read_index: Optional[int]):
+        # Reads are sampled by their position in the input, so reads that
+        # are divided over multiple Collectors are sampled the same way as
+        # with a single one.
+        if read_index is None:
+            return
+        self.sequence_duplication.read_index = read_index
+        if self.sequence_duplication_reverse is not None:
+            self.sequence_duplication_reverse.read_index = read_index
+
+    def add_record_array(self, record_array: FastqRecordArrayView,
+                         read_index: Optional[int] = None):
+        self._set_read_index(read_index)
+        self._pipeline.add_record_array(record_array)
+
+    def add_record_array_pair(self,
+                              record_array1: FastqRecordArrayView,
+                              record_array2: FastqRecordArrayView,
+                              read_index: Optional[int] = None):
+        self._set_read_index(read_index)
+        self._pipeline.add_record_array(record_array1)
+        self.dedup_estimator.add_record_array_pair(record_array1, record_array2)
+        self.insert_size_metrics.add_record_array_pair(  # type: ignore
+            record_array1, record_array2)
+        self._pipeline_reverse.add_record_array(record_array2)  # type: ignore
+
+    def merge(self, other: "Collectors"):
+        """Add the gathered data of other to this object's modules."""
+        self.metrics.merge(other.metrics)
+        self.per_tile_quality.merge(other.per_tile_quality)
+        self.sequence_duplication.merge(other.sequence_duplication)
+        self.nanostats.merge(other.nanostats)
+        self.dedup_estimator.merge(other.dedup_estimator)
+        if self.paired:
+            self.insert_size_metrics.merge(  # type: ignore
+                other.insert_size_metrics)
+            self.metrics_reverse.merge(other.metrics_reverse)  # type: ignore
+            self.per_tile_quality_reverse.merge(  # type: ignore
+                other.per_tile_quality_reverse)
+            self.sequence_duplication_reverse.merge(  # type: ignore
+                other.sequence_duplication_reverse)
+        else:
+            self.adapter_counter.merge(other.adapter_counter)  # type: ignore
+
+    def finish(self) -> "Collectors":
+        return self
+
+    def dump(self, metadata: Dict[str, Any]) -> bytes:
+        """
+        Return the state of all modules as a bytes object. metadata should
+        be JSON serializable and is stored alongside the state.
+        """
+        modules = [name for name in _MODULE_TYPES
+                   if getattr(self, name) is not None]
+        header = json.dumps(dict(paired=self.paired, modules=modules,
+                                 metadata=metadata)).encode("utf-8")
+        parts = [STATE_FILE_MAGIC, _int_to_bytes(len(header)), header]
+        for name in modules:
+            module_state = getattr(self, name).dump()
+            parts.append(_int_to_bytes(len(module_state)))
+            parts.append(module_state)
+        return b"".join(parts)
+
+    @classmethod
+    def load(cls, data: bytes) -> Tuple["Collectors", Dict[str, Any]]:
+        """
+        Restore a Collectors object from the output of dump. Returns the
+        Collectors object and the stored metadata.
+        """
+        view = memoryview(data)
+        if bytes(view[:8]) != STATE_FILE_MAGIC:
+            raise ValueError("Data is not a sequali state file")
+
+        position = 8
+
+        def read_part() -> memoryview:
+            nonlocal position
+            length = int.from_bytes(view[position:position + 8], "little")
+            position += 8
+            part = view[position:position + length]
+            if len(part) != length:
+                raise ValueError("Truncated sequali state file")
+            position += length
+            return part
+
+        header = json.loads(bytes(read_part()).decode("utf-8"))
+        collectors = cls.__new__(cls)
+        collectors.paired = header["paired"]
+        for name in _MODULE_TYPES:
+            setattr(collectors, name, None)
+        for name in header["modules"]:
+            setattr(collectors, name, _MODULE_TYPES[name].load(read_part()))
+        collectors._init_pipelines()
+        if position != len(view):
+            raise ValueError("Trailing data after sequali state")
+        return collectors, header["metadata"]
+
+
+class ThreadedPipeline:
+    """
+    Distribute record arrays over worker threads.
+
+    Each worker thread has its own Collectors object, so no state is shared
+    between the threads. The add_record_array methods of the modules release
+    the GIL, so the workers run in parallel with each other and with the
+    thread that parses the input. At the end the results of all workers are
+    merged into one Collectors object. Each record array is submitted with
+    the position of its first read in the input, so the sampled modules
+    give the same results regardless of which worker gets which array.
+
+    The same interface as Collectors is offered, so either can be used to
+    process the input.
+    """
+    _queue: "queue.Queue[Optional[Tuple[int, Tuple[FastqRecordArrayView, ...]]]]"
+    _workers: List[threading.Thread]
+    _collectors: List[Collectors]
+    _exception: Optional[BaseException]
+
+    def __init__(self, collectors_factory: Callable[[], Collectors],
+                 threads: int):
+        if threads < 1:
+            raise ValueError(f"threads must be at least 1, got {threads}")
+        # Allow some record arrays to be queued so workers do not starve
+        # when the parser is momentarily slower, while bounding the memory.
+        self._queue = queue.Queue(maxsize=threads * 2)
+        self._number_of_reads = 0
+        self._exception = None
+        self._collectors = [collectors_factory() for _ in range(threads)]
+        self._workers = [
+            threading.Thread(target=self._work, args=(collectors,),
+                             daemon=True)
+            for collectors in self._collectors
+        ]
+        for worker in self._workers:
+            worker.start()
+
+    def _work(self, collectors: Collectors):
+        while True:
+            item = self._queue.get()
+            if item is None:
+                return
+            if self._exception is not None:
+                # Keep consuming so the producer never blocks on a full queue.
+                continue
+            read_index, record_arrays = item
+            try:
+                if len(record_arrays) == 1:
+                    collectors.add_record_array(record_arrays[0], read_index)
+                else:
+                    collectors.add_record_array_pair(
+                        record_arrays[0], record_arrays[1], read_index)
+            except BaseException as e:
+                self._exception = e
+
+    def _submit(self, item: Tuple[FastqRecordArrayView, ...]):
+        if self._exception is not None:
+            self.close()
+            raise self._exception
+        read_index = self._number_of_reads
+        self._number_of_reads += len(item[0])
+        self._queue.put((read_index, item))
+
+    def add_record_array(self, record_array: FastqRecordArrayView):
+        self._submit((record_array,))
+
+    def add_record_array_pair(self,
+                              record_array1: FastqRecordArrayView,
+                              record_array2: FastqRecordArrayView):
+        self._submit((record_array1, record_array2))
+
+    def close(self):
+        """Stop all worker threads after the queued work is done."""
+        for worker in self._workers:
+            if worker.is_alive():
+                self._queue.put(None)
+        for worker in self._workers:
+            worker.join()
+
+    def finish(self) -> Collectors:
+        """Wait for all work to be done and return the merged results."""
+        self.close()
+        if self._exception is not None:
+            raise self._exception
+        result = self._collectors[0]
+        for collectors in self._collectors[1:]:
+            result.merge(collectors)
+        return result
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+
+def write_state_file(filename: str, collectors: Collectors,
+                     metadata: Dict[str, Any]):
+    with open(filename, "wb") as state_file:
+        state_file.write(collectors.dump(metadata))
+
+
+def read_state_file(filename: str) -> Tuple[Collectors, Dict[str, Any]]:
+    with open(filename, "rb") as state_file:
+        return Collectors.load(state_file.read())
+
+
+class ConvergenceMonitor:
+    """
+    Decide when the metrics of a sample of the reads are precise enough.
+
+    The monitored distributions are the per sequence GC content and average
+    quality of each read of a pair and the fraction of reads with each
+    adapter. They have converged when the 95% confidence interval of every
+    proportion is at most tolerance wide on each side and no proportion
+    changed more than tolerance over the last stable_checks checks. The
+    checks are done each time the number of reads has grown by a quarter.
+    """
+    def __init__(self, tolerance: float, min_reads: int = 10_000,
+                 stable_checks: int = 3):
+        if not 0.0 < tolerance < 1.0:
+            raise ValueError(f"tolerance must be between 0 and 1, "
+                             f"got {tolerance}")
+        self.tolerance = tolerance
+        self.min_reads = min_reads
+        self.stable_checks = stable_checks
+        self._next_check = min_reads
+        self._previous: Optional[List[float]] = None
+        self._stable = 0
+
+    @staticmethod
+    def _proportions(collectors: Collectors) -> List[float]:
+        proportions = []
+        all_metrics = [collectors.metrics]
+        if collectors.metrics_reverse is not None:
+            all_metrics.append(collectors.metrics_reverse)
+        for metrics in all_metrics:
+            for histogram in (metrics.gc_content(), metrics.phred_scores()):
+                total = sum(histogram)
+                proportions.extend(
+                    count / max(total, 1) for count in histogram)
+        adapter_counter = collectors.adapter_counter
+        if adapter_counter is not None:
+            number_of_sequences = max(adapter_counter.number_of_sequences, 1)
+            for _, counts in adapter_counter.get_counts():
+                proportions.append(sum(counts) / number_of_sequences)
+        insert_size_metrics = collectors.insert_size_metrics
+        if insert_size_metrics is not None:
+            # Paired data has no adapter counter, the insert size module
+            # counts the adapters for each read of the pair.
+            total_reads = max(insert_size_metrics.total_reads, 1)
+            proportions.append(
+                insert_size_metrics.number_of_adapters_read1 / total_reads)
+            proportions.append(
+                insert_size_metrics.number_of_adapters_read2 / total_reads)
+        return proportions
+
+    def converged(self, collectors: Collectors) -> bool:
+        number_of_reads = collectors.metrics.number_of_reads
+        if number_of_reads < self._next_check:
+            return False
+        self._next_check = number_of_reads + number_of_reads // 4
+        proportions = self._proportions(collectors)
+        half_width = max(1.96 * math.sqrt(p * (1 - p) / number_of_reads)
+                         for p in proportions)
+        if self._previous is not None and half_width <= self.tolerance and \
+                max(abs(p - q) for p, q in zip(proportions, self._previous)
+                    ) <= self.tolerance:
+            self._stable += 1
+        else:
+            self._stable = 0
+        self._previous = proportions
+        return self._stable >= self.stable_checks
+
+
+# Kept free of the memory budget for the parsers, the other modules, whose
+# tables grow with the read length and the number of tiles and reads, and
+# Python itself.
+MEMORY_BUDGET_RESERVED_FRACTION = 0.25
+MEMORY_BUDGET_MINIMUM_RESERVED = 128 * 1024 * 1024
+# The share of the hash table budget for the overrepresented sequences
+# tables. This is the ratio of the default table sizes.
+MEMORY_BUDGET_SEQUENCE_DUPLICATION_FRACTION = 0.8
+
+
+class MemoryPlan(NamedTuple):
+    max_unique_fragments: int
+    sample_every: int
+    max_stored_fingerprints: int
+
+
+def sequence_duplication_memory(max_unique_fragments: int) -> int:
+    """Size in bytes of the fragment table of a SequenceDuplication."""
+    # Same sizing as SequenceDuplication.__new__
+    number_of_buckets = 1
+    while (number_of_buckets * FRAGMENT_BUCKET_SLOTS <
+           max_unique_fragments + max_unique_fragments // 2):
+        number_of_buckets <<= 1
+    return number_of_buckets * FRAGMENT_BUCKET_SIZE
+
+
+def dedup_estimator_memory(max_stored_fingerprints: int,
+                           sketch: bool = False) -> int:
+    """Size in bytes of the hash table and sketch of a DedupEstimator."""
+    # Same sizing as DedupEstimator.__new__
+    hash_table_size_bits = int(math.log2(max_stored_fingerprints * 1.5) + 1)
+    memory = (1 << hash_table_size_bits) * DEDUP_ESTIMATOR_ENTRY_SIZE
+    if sketch:
+        memory += max_stored_fingerprints * 8
+    return memory
+
+
+def plan_memory(max_memory: int,
+                workers: int = 1,
+                paired: bool = False,
+                duplication_sketch: bool = False) -> MemoryPlan:
+    """
+    Divide a memory limit over the hash tables of the collectors.
+
+    Every worker has its own collectors and in paired mode there is an
+    overrepresented sequences table for each read. The tables are never
+    made larger than the defaults. When the overrepresented sequences table
+    is made smaller, reads are sampled less often, so the table still
+    represents a similar part of the file. The duplication estimate already
+    subsamples the fingerprints when its table is full.
+    """
+    reserved = max(int(max_memory * MEMORY_BUDGET_RESERVED_FRACTION),
+                   MEMORY_BUDGET_MINIMUM_RESERVED)
+    tables_memory = (max_memory - reserved) // max(workers, 1)
+    sequence_duplication_tables = 2 if paired else 1
+    sequence_duplication_share = int(
+        tables_memory * MEMORY_BUDGET_SEQUENCE_DUPLICATION_FRACTION
+    ) // sequence_duplication_tables
+    dedup_estimator_share = (
+        tables_memory -
+        sequence_duplication_share * sequence_duplication_tables)
+
+    max_unique_fragments = DEFAULT_MAX_UNIQUE_FRAGMENTS
+    if sequence_duplication_memory(max_unique_fragments) > \
+            sequence_duplication_share:
+        number_of_buckets = 1
+        while (number_of_buckets * 2 * FRAGMENT_BUCKET_SIZE <=
+               sequence_duplication_share):
+            number_of_buckets <<= 1
+        # The largest amount that still fits in number_of_buckets.
+        max_unique_fragments = (
+            number_of_buckets * FRAGMENT_BUCKET_SLOTS * 2 // 3)
+    sample_every = DEFAULT_UNIQUE_SAMPLE_EVERY * math.ceil(
+        DEFAULT_MAX_UNIQUE_FRAGMENTS / max_unique_fragments)
+
+    max_stored_fingerprints = (
+        DEFAULT_DEDUP_SKETCH_STORED_FINGERPRINTS if duplication_sketch
+        else DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS)
+    while (dedup_estimator_memory(max_stored_fingerprints,
+                                  duplication_sketch) >
+           dedup_estimator_share):
+        max_stored_fingerprints //= 2
+        if max_stored_fingerprints < 100:
+            minimum = MEMORY_BUDGET_MINIMUM_RESERVED + max(workers, 1) * (
+                dedup_estimator_memory(100, duplication_sketch) /
+                (1 - MEMORY_BUDGET_SEQUENCE_DUPLICATION_FRACTION))
+            raise ValueError(
+                f"A memory limit of {max_memory:,} bytes is too small for "
+                f"{workers} worker thread(s). At least "
+                f"{math.ceil(minimum / (1024 * 1024))} MiB is needed.")
+    return MemoryPlan(max_unique_fragments, sample_every,
+                      max_stored_fingerprints)
@@ -15,21 +15,26 @@
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
 import array
+import bisect
 import collections
+import concurrent.futures
 import dataclasses
+import hashlib
 import html
 import io
+import json
 import math
 import os
+import re
 import sys
 import time
 import typing
+import urllib.parse
 import xml.etree.ElementTree
 from abc import ABC, abstractmethod
-from collections import defaultdict
 from pathlib import Path
 from typing import (Any, Dict, Iterable, Iterator, List, Optional, Sequence,
-                    Set, Tuple, Type)
+                    Tuple, Type)
 
 import pygal  # type: ignore
 import pygal.style  # type: ignore
@@ -42,6 +47,7 @@ from ._qc import NUMBER_OF_NUCS, NUMBER_OF_PHREDS, PHRED_MAX
 from ._version import __version__
 from .adapters import Adapter
 from .sequence_identification import (identify_sequence_builtin,
+                                      identify_sequences_builtin,
                                       reverse_complement)
 
 SEQUALI_REPORT_CSS = Path(__file__).parent / "static" / "sequali_report.css"
@@ -261,6 +267,31 @@ def logarithmic_ranges(length: int, min_distance: int = 5):
                 return
 
 
+def bin_data_ranges(
+        data_ranges: Sequence[Tuple[int, int]],
+        row_ranges: Sequence[Tuple[int, int]],
+) -> Tuple[List[Tuple[int, int]], List[Tuple[int, int]]]:
+    """
+    Snap the position ranges to the rows of a binned table. Returns the
+    snapped position ranges and the matching ranges of table rows.
+    """
+    row_starts = [start for start, stop in row_ranges]
+    position_ranges: List[Tuple[int, int]] = []
+    table_ranges: List[Tuple[int, int]] = []
+    previous_row_stop = 0
+    for start, stop in data_ranges:
+        row_start = max(bisect.bisect_right(row_starts, start) - 1,
+                        previous_row_stop)
+        row_stop = bisect.bisect_left(row_starts, stop)
+        if row_stop <= row_start:
+            continue
+        position_ranges.append(
+            (row_ranges[row_start][0], row_ranges[row_stop - 1][1]))
+        table_ranges.append((row_start, row_stop))
+        previous_row_stop = row_stop
+    return position_ranges, table_ranges
+
+
 def stringify_ranges(data_ranges: Iterable[Tuple[int, int]]):
     return [
         f"{start + 1}-{stop}" if start + 1 != stop else f"{start + 1}"
@@ -358,9 +389,13 @@ class Meta(ReportModule):
     filesize: int
     filename_read2: Optional[str]
     filesize_read2: Optional[int]
+    estimated: bool = False
+    sampled_fraction: Optional[float] = None
 
     @classmethod
-    def from_filepath(cls, filepath: str, filepath_read2: Optional[str] = None):
+    def from_filepath(cls, filepath: str, filepath_read2: Optional[str] = None,
+                      estimated: bool = False,
+                      sampled_fraction: Optional[float] = None):
         filename = os.path.basename(filepath)
         try:
             filesize = os.path.getsize(filepath)
@@ -379,7 +414,7 @@ class Meta(ReportModule):
         time_struct = time.localtime(timestamp)
         report_generated = time.strftime("%Y-%m-%d %H:%M:%S%z", time_struct)
         return cls(__version__, report_generated, filename, filesize,
-                   filename_read2, filesize_read2)
+                   filename_read2, filesize_read2, estimated, sampled_fraction)
 
     def to_html(self) -> str:
         content = io.StringIO()
@@ -400,6 +435,17 @@ class Meta(ReportModule):
                     <td>{self.filesize_read2 / (1024 ** 3):.2f} GiB</td>
                 </tr>
             """)
+        if self.estimated:
+            if self.sampled_fraction is not None:
+                sample = f"{self.sampled_fraction:.2%} of the file"
+            else:
+                sample = "the start of the file"
+            content.write(f"""
+                <tr>
+                    <td>Estimated</td>
+                    <td>From a sample of {sample}</td>
+                </tr>
+            """)
         content.write(f"""
             <tr><td>Sequali version</td><td>{self.sequali_version}</td></tr>
             <tr><td>Report generated on</td><td>{self.report_generated}</td></tr>
@@ -521,27 +567,24 @@ class SequenceLengthDistribution(ReportModule):
         """
 
     @classmethod
-    def from_base_count_tables(cls,
-                               base_count_tables: array.ArrayType,
-                               total_sequences: int,
-                               data_ranges: Sequence[Tuple[int, int]],
-                               read_pair_info: Optional[str] = None):
-        max_length = len(base_count_tables) // NUMBER_OF_NUCS
-        # use bytes constructor to initialize to 0
-        sequence_lengths = array.array("Q", bytes(8 * (max_length + 1)))
-        base_counts = array.array("Q", bytes(8 * (max_length + 1)))
-        base_counts[0] = total_sequences  # all reads have at least 0 bases
-        for i, table in enumerate(table_iterator(base_count_tables, NUMBER_OF_NUCS)):
-            base_counts[i + 1] = sum(table)
-        previous_count = 0
-        for i in range(max_length, 0, -1):
-            number_at_least = base_counts[i]
-            sequence_lengths[i] = number_at_least - previous_count
-            previous_count = number_at_least
-        seqlength_view = memoryview(sequence_lengths)[1:]
-        lengths = [sum(seqlength_view[start:stop]) for start, stop in
-                   data_ranges]
+    def from_length_counts(cls,
+                           length_counts: Sequence[int],
+                           row_ranges: Sequence[Tuple[int, int]],
+                           total_sequences: int,
+                           data_ranges: Sequence[Tuple[int, int]],
+                           table_ranges: Optional[
+                               Sequence[Tuple[int, int]]] = None,
+                           read_pair_info: Optional[str] = None):
+        if table_ranges is None:
+            table_ranges = data_ranges
+        zero_length_sequences = total_sequences - sum(length_counts)
+        lengths = [sum(length_counts[start:stop]) for start, stop in
+                   table_ranges]
         x_labels = stringify_ranges(data_ranges)
+        # Binned lengths are attributed to the end of their bin.
+        sequence_lengths = [(0, zero_length_sequences)] + [
+            (stop, count) for (start, stop), count in
+            zip(row_ranges, length_counts)]
         percentiles = [1, 5, 10, 25, 50, 75, 90, 95, 99]
         percentile_thresholds = [int(p * total_sequences / 100) for p in percentiles]
         thresh_iter = enumerate(percentile_thresholds)
@@ -549,7 +592,7 @@ class SequenceLengthDistribution(ReportModule):
         accumulated_count = 0
         percentile_lengths = [0 for _ in percentiles]
         done = False
-        for length, count in enumerate(sequence_lengths):
+        for length, count in sequence_lengths:
             while count > 0 and not done:
                 remaining_threshold = current_threshold - accumulated_count
                 if count > remaining_threshold:
@@ -567,7 +610,7 @@ class SequenceLengthDistribution(ReportModule):
             if done:
                 break
 
-        return cls(["0"] + x_labels, [sequence_lengths[0]] + lengths,
+        return cls(["0"] + x_labels, [zero_length_sequences] + lengths,
                    *percentile_lengths, read_pair_info=read_pair_info)  # type: ignore
 
 
@@ -1101,16 +1144,19 @@ class PerTileQualityReport(ReportModule):
     def from_per_tile_quality_and_ranges(
             cls, ptq: PerTileQuality, data_ranges: Sequence[Tuple[int, int]],
             read_pair_info: Optional[str] = None,
+            table_ranges: Optional[Sequence[Tuple[int, int]]] = None,
     ):
         if ptq.skipped_reason:
             return cls([], [], [], [], ptq.skipped_reason)
+        if table_ranges is None:
+            table_ranges = data_ranges
         average_phreds = []
         per_category_totals = [0.0 for i in range(len(data_ranges))]
-        tile_counts = ptq.get_tile_counts()
+        tile_counts = ptq.get_tile_counts(table_ranges)
         for tile, summed_errors, counts in tile_counts:
             range_averages = [
-                sum(summed_errors[start:stop]) / max(sum(counts[start:stop]), 1)
-                for start, stop in data_ranges]
+                errors / max(count, 1)
+                for errors, count in zip(summed_errors, counts)]
             range_phreds = []
             for i, average in enumerate(range_averages):
                 if average != 0:
@@ -1225,6 +1271,7 @@ class DuplicationCounts(ReportModule):
     fingerprint_back_sequence_length: int
     fingerprint_front_sequence_offset: int
     fingerprint_back_sequence_offset: int
+    estimated_distinct_fingerprints: Optional[int] = None
 
     def plot(self) -> pygal.Graph:
         plot = pygal.Bar(
@@ -1285,8 +1332,17 @@ class DuplicationCounts(ReportModule):
                 <td>Estimated remaining sequences if deduplicated</td>
                 <td style="text-align:right;">{self.remaining_fraction:.2%}</td>
             </tr>
-            </table>
         """
+        if self.estimated_distinct_fingerprints is not None:
+            first_part += f"""
+            <tr>
+                <td>Estimated distinct fingerprints</td>
+                <td style="text-align:right;">
+                    {self.estimated_distinct_fingerprints:,}
+                </td>
+            </tr>
+            """
+        first_part += "</table>"
         return f"""
             {html_header("Duplication percentages", 1)}
             {first_part}
@@ -1353,6 +1409,8 @@ class DuplicationCounts(ReportModule):
             fingerprint_back_sequence_length=dedup_est.back_sequence_length,
             fingerprint_front_sequence_offset=dedup_est.front_sequence_offset,
             fingerprint_back_sequence_offset=dedup_est.back_sequence_offset,
+            estimated_distinct_fingerprints=(
+                dedup_est.estimated_distinct_fingerprints()),
         )
 
 
@@ -1500,18 +1558,22 @@ class OverRepresentedSequences(ReportModule):
             min_threshold: int = DEFAULT_MIN_THRESHOLD,
             max_threshold: int = DEFAULT_MAX_THRESHOLD,
             read_pair_info: Optional[str] = None,
+            threads: int = 1,
     ):
         overrepresented_sequences = seqdup.overrepresented_sequences(
             fraction_threshold,
             min_threshold,
             max_threshold
         )
-
+        identifications = identify_sequences_builtin(
+            (sequence for _, _, sequence in overrepresented_sequences),
+            threads)
         overrepresented_with_identification = [
             OverRepresentedSequence(
                 count, fraction, sequence, reverse_complement(sequence),
-                *identify_sequence_builtin(sequence))
-            for count, fraction, sequence in overrepresented_sequences
+                *identification)
+            for (count, fraction, sequence), identification
+            in zip(overrepresented_sequences, identifications)
         ]
         return cls(overrepresented_with_identification,
                    seqdup.max_unique_fragments,
@@ -1557,76 +1619,44 @@ class NanoStatsReport(ReportModule):
                 [],
                 nanostats.skipped_reason
             )
-        run_start_time = nanostats.minimum_time
-        run_end_time = nanostats.maximum_time
-        duration = run_end_time - run_start_time
-        time_slots = 200
-        time_per_slot = duration / time_slots
-        time_interval_minutes = (math.ceil(time_per_slot) + 59) // 60
-        time_interval = max(time_interval_minutes * 60, 1)
-        # Use duration + 1 to avoid cases where time_interval x time_slots == duration
-        # which causes the last slot to be missing.
-        time_ranges = [(start, start + time_interval)
-                       for start in range(0, duration + 1, time_interval)]
-        time_slots = len(time_ranges)
-        time_active_slots_sets: List[Set[int]] = [set() for _ in
-                                                  range(time_slots)]
-        time_bases = [0 for _ in range(time_slots)]
-        time_reads = [0 for _ in range(time_slots)]
-        time_qualities = [[0 for _ in range(12)] for _ in
-                          range(time_slots)]
-        per_channel_bases: Dict[int, int] = defaultdict(lambda: 0)
-        per_channel_cumulative_error: Dict[int, float] = defaultdict(lambda: 0.0)
-        translocation_speeds = [0] * 81
-        for readinfo in nanostats.nano_info_iterator():
-            relative_start_time = readinfo.start_time - run_start_time
-            timeslot = relative_start_time // time_interval
-            length = readinfo.length
-            cumulative_error_rate = readinfo.cumulative_error_rate
-            channel_id = readinfo.channel_id
-            if length:
-                phred = round(
-                    -10 * math.log10(cumulative_error_rate / length))
-            else:
-                phred = 0
-            phred_index = min(phred, 47) >> 2
-            time_active_slots_sets[timeslot].add(channel_id)
-            time_bases[timeslot] += length
-            time_reads[timeslot] += 1
-            time_qualities[timeslot][phred_index] += 1
-            per_channel_bases[channel_id] += length
-            per_channel_cumulative_error[channel_id] += cumulative_error_rate
-            read_duration = readinfo.duration
-            if read_duration:
-                translocation_speed = min(round(length / read_duration), 800)
-                translocation_speed //= 10
-                translocation_speeds[translocation_speed] += 1
-        per_channel_quality: Dict[int, float] = {}
-        for channel, error_rate in per_channel_cumulative_error.items():
-            total_bases = per_channel_bases[channel]
-            if total_bases:
-                phred_score = -10 * math.log10(error_rate / total_bases)
-            else:
-                phred_score = 0
-            per_channel_quality[channel] = phred_score
+        time_buckets = nanostats.time_buckets()
+        time_interval = nanostats.time_bucket_width
+        run_start_time = time_buckets[0][0] if time_buckets else 0
+        x_labels = []
+        time_bases = []
+        time_reads = []
+        time_active_channels = []
         qual_percentages_over_time: List[List[float]] = [[] for _ in
                                                          range(12)]
-        for quals in time_qualities:
+        for start_time, reads, bases, active_channels, quals in time_buckets:
+            start = start_time - run_start_time
+            stop = start + time_interval
+            x_labels.append(f"{cls.seconds_to_hour_minute_notation(start)}-"
+                            f"{cls.seconds_to_hour_minute_notation(stop)}")
+            time_bases.append(bases)
+            time_reads.append(reads)
+            time_active_channels.append(active_channels)
             total = sum(quals)
             for i, q in enumerate(quals):
                 qual_percentages_over_time[i].append(q / max(total, 1))
-        time_active_slots = [len(s) for s in time_active_slots_sets]
+        per_channel_bases: Dict[int, int] = {}
+        per_channel_quality: Dict[int, float] = {}
+        for channel, reads, bases, error_rate in nanostats.channel_stats():
+            per_channel_bases[channel] = bases
+            if bases and error_rate:
+                phred_score = -10 * math.log10(error_rate / bases)
+            else:
+                phred_score = 0
+            per_channel_quality[channel] = phred_score
         return cls(
-            x_labels=[f"{cls.seconds_to_hour_minute_notation(start)}-"
-                      f"{cls.seconds_to_hour_minute_notation(stop)}"
-                      for start, stop in time_ranges],
+            x_labels=x_labels,
             qual_percentages_over_time=qual_percentages_over_time,
-            time_active_channels=time_active_slots,
+            time_active_channels=time_active_channels,
             time_bases=time_bases,
             time_reads=time_reads,
-            per_channel_bases=dict(sorted(per_channel_bases.items())),
-            per_channel_quality=dict(sorted(per_channel_quality.items())),
-            translocation_speed=translocation_speeds,
+            per_channel_bases=per_channel_bases,
+            per_channel_quality=per_channel_quality,
+            translocation_speed=list(nanostats.translocation_speeds()),
             skipped_reason=nanostats.skipped_reason
         )
 
@@ -2013,18 +2043,127 @@ def dict_to_report_modules(d: Dict[str, Dict[str, Any]]) -> List[ReportModule]:
             for name, class_dict in d.items()]
 
 
+# Figures larger than this are written to separate files for a report with
+# lazily loaded plots.
+LAZY_FIGURE_MIN_SIZE = 64 * 1024
+FIGURE_PATTERN = re.compile(
+    r'<figure>\s*(<svg\b[^>]*\bid="([^"]+)".*?</svg>)\s*'
+    r'<figcaption>.*?</figcaption>\s*</figure>', re.DOTALL)
+
+
+def module_cache_key(module: ReportModule) -> str:
+    """
+    Hash of the module's data and the Sequali version, which together
+    determine the rendered HTML.
+    """
+    data = json.dumps([__version__, CLASS_TO_NAME[type(module)],
+                       module.to_dict()], sort_keys=True)
+    return hashlib.sha256(data.encode("utf-8")).hexdigest()
+
+
+def render_module(module: ReportModule) -> str:
+    return module.to_html()
+
+
+def render_modules(report_modules: Sequence[ReportModule],
+                   threads: int = 1,
+                   cache_dir: Optional[str] = None) -> List[str]:
+    """
+    Render the HTML of each module. When cache_dir is given, modules whose
+    data did not change since a previous report are read from the cache.
+    The other modules are rendered on threads worker processes.
+    """
+    rendered: List[Optional[str]] = [None] * len(report_modules)
+    cache_paths: List[str] = []
+    if cache_dir is not None:
+        os.makedirs(cache_dir, exist_ok=True)
+        for i, module in enumerate(report_modules):
+            cache_path = os.path.join(cache_dir,
+                                      module_cache_key(module) + ".html")
+            cache_paths.append(cache_path)
+            if os.path.exists(cache_path):
+                with open(cache_path, "rt", encoding="utf-8") as cache_file:
+                    rendered[i] = cache_file.read()
+    to_render = [i for i, module_html in enumerate(rendered)
+                 if module_html is None]
+    if threads > 1 and len(to_render) > 1:
+        with concurrent.futures.ProcessPoolExecutor(
+                min(threads, len(to_render))) as executor:
+            results = executor.map(
+                render_module, [report_modules[i] for i in to_render])
+            for i, module_html in zip(to_render, results):
+                rendered[i] = module_html
+    else:
+        for i in to_render:
+            rendered[i] = report_modules[i].to_html()
+    if cache_dir is not None:
+        for i in to_render:
+            # Write and rename, so concurrent reports never read a partial
+            # file.
+            temporary_path = f"{cache_paths[i]}.{os.getpid()}.tmp"
+            with open(temporary_path, "wt", encoding="utf-8") as cache_file:
+                cache_file.write(rendered[i])  # type: ignore
+            os.replace(temporary_path, cache_paths[i])
+    return rendered  # type: ignore
+
+
+def externalize_large_figures(module_html: str, plots_dir: str,
+                              plots_url: str) -> str:
+    """
+    Write the SVGs of large figures to plots_dir and replace them with
+    images that the browser loads when they are scrolled into view.
+    """
+    def replace(match: re.Match) -> str:
+        svg, svg_id = match.groups()
+        if len(svg) < LAZY_FIGURE_MIN_SIZE:
+            return match.group(0)
+        os.makedirs(plots_dir, exist_ok=True)
+        svg_filename = svg_id + ".svg"
+        with open(os.path.join(plots_dir, svg_filename), "wt",
+                  encoding="utf-8") as svg_file:
+            svg_file.write(svg)
+        src = html.escape(
+            plots_url + "/" + urllib.parse.quote(svg_filename))
+        return f"""
+            <figure>
+                <img src="{src}" loading="lazy" alt="{html.escape(svg_id)}"/>
+                <figcaption>
+                    <a href="{src}" download="{html.escape(svg_filename)}"
+                    >Download image</a>
+                </figcaption>
+            </figure>
+        """
+    return FIGURE_PATTERN.sub(replace, module_html)
+
+
 def write_html_report(report_modules: Iterable[ReportModule],
-                      html: str):
+                      html: str,
+                      threads: int = 1,
+                      cache_dir: Optional[str] = None,
+                      lazy_plots: bool = False):
+    """
+    Write the HTML report. With lazy_plots, large plots are written as
+    SVG files to a directory next to the report, named after the report
+    with a _plots suffix, and only loaded when they are scrolled into view.
+    """
+    report_modules = list(report_modules)
     for mod in report_modules:
         if isinstance(mod, Meta):
             filename = mod.filename
             break
     else:
         raise RuntimeError("No filename found in metadata")
+    rendered = render_modules(report_modules, threads, cache_dir)
+    if lazy_plots:
+        plots_url = os.path.splitext(os.path.basename(html))[0] + "_plots"
+        plots_dir = os.path.join(os.path.dirname(html), plots_url)
+        rendered = [externalize_large_figures(module_html, plots_dir,
+                                              plots_url)
+                    for module_html in rendered]
     content_division = io.StringIO()
     content_division.write('<div class="content">')
-    for module in report_modules:
-        content_division.write(module.to_html())
+    for module_html in rendered:
+        content_division.write(module_html)
     content_division.write("</div>")
     content = content_division.getvalue()
     toc = create_toc(content)
@@ -2073,14 +2212,15 @@ def write_html_report(report_modules: Iterable[ReportModule],
 def qc_metrics_modules(metrics: QCMetrics,
                        data_ranges: Sequence[Tuple[int, int]],
                        read_pair_info: Optional[str] = None,
+                       table_ranges: Optional[Sequence[Tuple[int, int]]] = None,
                        ) -> List[ReportModule]:
-    base_count_tables = metrics.base_count_table()
-    phred_count_table = metrics.phred_count_table()
+    if table_ranges is None:
+        table_ranges = data_ranges
+    length_counts = metrics.length_count_table()
+    row_ranges = metrics.position_ranges()
     x_labels = stringify_ranges(data_ranges)
-    aggregrated_base_matrix = aggregate_count_matrix(
-        base_count_tables, data_ranges, NUMBER_OF_NUCS)
-    aggregated_phred_matrix = aggregate_count_matrix(
-        phred_count_table, data_ranges, NUMBER_OF_PHREDS)
+    aggregrated_base_matrix = metrics.base_count_table(table_ranges)
+    aggregated_phred_matrix = metrics.phred_count_table(table_ranges)
     summary_bases = aggregate_count_matrix(
         aggregrated_base_matrix,
         [(0, len(aggregrated_base_matrix) // NUMBER_OF_NUCS)], NUMBER_OF_NUCS)
@@ -2092,10 +2232,11 @@ def qc_metrics_modules(metrics: QCMetrics,
     minimum_length = 0
     total_reads = metrics.number_of_reads
     q20_reads = sum(metrics.phred_scores()[20:])
-    for table in table_iterator(base_count_tables, NUMBER_OF_NUCS):
-        if sum(table) < total_reads:
-            break
-        minimum_length += 1
+    if sum(length_counts) == total_reads:
+        for (start, stop), count in zip(row_ranges, length_counts):
+            if count:
+                minimum_length = start + 1
+                break
     total_gc_bases = summary_bases[C] + summary_bases[G]
     return [
         Summary(
@@ -2109,9 +2250,9 @@ def qc_metrics_modules(metrics: QCMetrics,
             total_gc_bases=total_gc_bases,
             total_n_bases=summary_bases[N],
             read_pair_info=read_pair_info),
-        SequenceLengthDistribution.from_base_count_tables(
-            base_count_tables, total_reads, data_ranges,
-            read_pair_info=read_pair_info),
+        SequenceLengthDistribution.from_length_counts(
+            length_counts, row_ranges, total_reads, data_ranges,
+            table_ranges=table_ranges, read_pair_info=read_pair_info),
         PerBaseQualityScoreDistribution.from_phred_count_table_and_labels(
             aggregated_phred_matrix, x_labels, read_pair_info=read_pair_info),
         PerPositionMeanQualityAndSpread.from_phred_table_and_labels(
@@ -2145,6 +2286,9 @@ def calculate_stats(
         fraction_threshold: float = DEFAULT_FRACTION_THRESHOLD,
         min_threshold: int = DEFAULT_MIN_THRESHOLD,
         max_threshold: int = DEFAULT_MAX_THRESHOLD,
+        threads: int = 1,
+        estimated: bool = False,
+        sampled_fraction: Optional[float] = None,
 ) -> List[ReportModule]:
     read_pair_info1 = READ1 if filename_reverse else None
     max_length = metrics.max_length
@@ -2152,17 +2296,23 @@ def calculate_stats(
         data_ranges = list(logarithmic_ranges(max_length))
     else:
         data_ranges = list(equidistant_ranges(max_length, graph_resolution))
+    data_ranges, table_ranges = bin_data_ranges(
+        data_ranges, metrics.position_ranges())
     modules = [
-        Meta.from_filepath(filename, filename_reverse),
-        *qc_metrics_modules(metrics, data_ranges, read_pair_info=read_pair_info1),
+        Meta.from_filepath(filename, filename_reverse, estimated,
+                           sampled_fraction),
+        *qc_metrics_modules(metrics, data_ranges, read_pair_info=read_pair_info1,
+                            table_ranges=table_ranges),
         PerTileQualityReport.from_per_tile_quality_and_ranges(
-            per_tile_quality, data_ranges, read_pair_info=read_pair_info1),
+            per_tile_quality, data_ranges, read_pair_info=read_pair_info1,
+            table_ranges=table_ranges),
         OverRepresentedSequences.from_sequence_duplication(
             sequence_duplication,
             fraction_threshold=fraction_threshold,
             min_threshold=min_threshold,
             max_threshold=max_threshold,
             read_pair_info=read_pair_info1,
+            threads=threads,
         ),
         DuplicationCounts.from_dedup_estimator(dedup_estimator),
         NanoStatsReport.from_nanostats(nanostats)
@@ -2188,18 +2338,22 @@ def calculate_stats(
         else:
             data_ranges_reverse = list(
                 equidistant_ranges(max_length_reverse, graph_resolution))
+        data_ranges_reverse, table_ranges_reverse = bin_data_ranges(
+            data_ranges_reverse, metrics_reverse.position_ranges())
 
         modules.extend(qc_metrics_modules(metrics_reverse, data_ranges_reverse,
-                                          read_pair_info=READ2))
+                                          read_pair_info=READ2,
+                                          table_ranges=table_ranges_reverse))
         modules.append(PerTileQualityReport.from_per_tile_quality_and_ranges(
             per_tile_quality_reverse, data_ranges_reverse,
-            read_pair_info=READ2))
+            read_pair_info=READ2, table_ranges=table_ranges_reverse))
         modules.append(OverRepresentedSequences.from_sequence_duplication(
             sequence_duplication_reverse,
             fraction_threshold=fraction_threshold,
             min_threshold=min_threshold,
             max_threshold=max_threshold,
             read_pair_info=READ2,
+            threads=threads,
         ))
     modules.sort(key=module_sort_key)
     return modules
@@ -13,20 +13,24 @@
 #
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
-import collections
+import concurrent.futures
 import functools
+import hashlib
+import mmap
 import os
-import typing
-from typing import Dict, Iterable, Iterator, List, Tuple, Union
+import tempfile
+from typing import Iterable, Iterator, List, Optional, Sequence, Tuple
 
-from ._seqident import sequence_identity
+from ._seqident import (KMER_INDEX_VERSION, KmerIndex, best_sequence_identity,
+                        create_kmer_index)
+from ._seqident import sequence_identity  # noqa: F401
 from .util import fasta_parser
 
 DEFAULT_K = 13
 
 CONTAMINANTS_DIR = os.path.join(os.path.dirname(__file__), "contaminants")
-DEFAULT_CONTAMINANTS_FILES = [f.path for f in os.scandir(CONTAMINANTS_DIR)
-                              if f.name != "README"]
+DEFAULT_CONTAMINANTS_FILES = sorted(
+    f.path for f in os.scandir(CONTAMINANTS_DIR) if f.name.endswith(".fasta"))
 
 
 def default_contaminant_iterator() -> Iterator[Tuple[str, str]]:
@@ -35,9 +39,95 @@ def default_contaminant_iterator() -> Iterator[Tuple[str, str]]:
 
 
 @functools.lru_cache
-def default_sequence_lookup() -> Dict[str, str]:
-    """Lazily evaluated and cached dictionary of all contaminants."""
-    return dict(default_contaminant_iterator())
+def default_contaminants() -> Tuple[Tuple[str, str], ...]:
+    """
+    Lazily evaluated and cached tuple of the names and sequences of all
+    contaminants. The position in the tuple is the sequence id in the k-mer
+    index.
+    """
+    return tuple(default_contaminant_iterator())
+
+
+def kmer_index_cache_dirs() -> List[str]:
+    """
+    Directories where k-mer indexes are cached in order of preference. The
+    index is stored next to the contaminant files when that directory is
+    writable, else in the user cache directory.
+    """
+    cache_home = os.environ.get("XDG_CACHE_HOME") or os.path.join(
+        os.path.expanduser("~"), ".cache")
+    return [CONTAMINANTS_DIR, os.path.join(cache_home, "sequali")]
+
+
+def kmer_index_file_name(fasta_files: Iterable[str], k: int) -> str:
+    """
+    The file name of the k-mer index contains a hash of the contents of
+    the FASTA files, so an index is never used for changed files.
+    """
+    hasher = hashlib.sha256(f"{KMER_INDEX_VERSION} {k}".encode("ascii"))
+    for fasta_file in fasta_files:
+        with open(fasta_file, "rb") as f:
+            hasher.update(f.read())
+    return f"kmer_index_k{k}_{hasher.hexdigest()[:32]}.bin"
+
+
+def load_kmer_index(path: str) -> Optional[KmerIndex]:
+    try:
+        with open(path, "rb") as f:
+            data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    except (OSError, ValueError):  # ValueError is raised on empty files.
+        return None
+    try:
+        return KmerIndex(data)
+    except ValueError:
+        data.close()
+        return None
+
+
+def save_kmer_index(path: str, data: bytes) -> bool:
+    directory = os.path.dirname(path)
+    try:
+        os.makedirs(directory, exist_ok=True)
+        # Write to a temporary file first, so concurrent runs never see a
+        # partially written index.
+        fd, temporary_path = tempfile.mkstemp(dir=directory,
+                                              prefix=".kmer_index")
+        try:
+            with os.fdopen(fd, "wb") as f:
+                f.write(data)
+            os.replace(temporary_path, path)
+        except BaseException:
+            os.remove(temporary_path)
+            raise
+    except OSError:
+        return False
+    return True
+
+
+def cached_kmer_index(
+        fasta_files: Sequence[str],
+        sequences: Sequence[str],
+        k: int = DEFAULT_K,
+        cache_dirs: Optional[Sequence[str]] = None,
+) -> KmerIndex:
+    """
+    Return the k-mer index for the sequences from the FASTA files. The
+    index is loaded from a cache directory when available. Otherwise it is
+    created and stored in the first writable cache directory.
+    """
+    if cache_dirs is None:
+        cache_dirs = kmer_index_cache_dirs()
+    file_name = kmer_index_file_name(fasta_files, k)
+    paths = [os.path.join(directory, file_name) for directory in cache_dirs]
+    for path in paths:
+        index = load_kmer_index(path)
+        if index is not None:
+            return index
+    data = create_kmer_index(sequences, k)
+    for path in paths:
+        if save_kmer_index(path, data):
+            break
+    return KmerIndex(data)
 
 
 def create_upper_table():
@@ -85,78 +175,64 @@ def canonical_kmers(sequence: str, k: int):
     return canonical_set
 
 
-def create_sequence_index(
-        names_and_sequences: Iterable[Tuple[str, str]],
-        k: int = DEFAULT_K,
-        ) -> Dict[str, Union[List[str], str]]:
-    sequence_index: Dict[str, Union[List[str], str]] = {}
-    for name, sequence in names_and_sequences:
-        kmers = canonical_kmers(sequence, k)
-        # Store one sequence name (most common) or alternatively a list
-        # of multiple names. This is a bit convoluted, but it
-        # saves a lot of time as memory does not need to be allocated for a
-        # lot of one-item lists.
-        for kmer in kmers:
-            if kmer in sequence_index:
-                prev_entry = sequence_index[kmer]
-                if isinstance(prev_entry, list):
-                    sequence_index[kmer].append(name)  # type: ignore
-                else:
-                    sequence_index[kmer] = [name, prev_entry]
-            else:
-                sequence_index[kmer] = name
-    return sequence_index
-
-
 @functools.lru_cache
-def create_default_sequence_index(k: int = DEFAULT_K
-                                  ) -> Dict[str, Union[List[str], str]]:
-    return create_sequence_index(default_sequence_lookup().items(), k)
+def create_default_sequence_index(k: int = DEFAULT_K) -> KmerIndex:
+    return cached_kmer_index(
+        DEFAULT_CONTAMINANTS_FILES,
+        [sequence for _, sequence in default_contaminants()],
+        k)
 
 
 def identify_sequence(
         sequence: str,
-        sequence_index: Dict[str, Union[List[str], str]],
-        sequence_lookup: Dict[str, str],
-        k: int = DEFAULT_K,
+        sequence_index: KmerIndex,
+        contaminants: Sequence[Tuple[str, str]],
         match_reverse_complement: bool = True,
 ) -> Tuple[int, int, str]:
-    kmers = canonical_kmers(sequence, k)
-    counted_seqs: typing.Counter[str] = collections.Counter()
-    sequence_reverse_complement = reverse_complement(sequence)
-    for kmer in kmers:
-        matched = sequence_index.get(kmer, [])
-        if isinstance(matched, list):
-            counted_seqs.update(matched)
-        else:
-            counted_seqs.update([matched])
-    best_identity = 0.0
-    best_match = "No match"
+    """
+    Identify a sequence using a k-mer index of contaminants.
+    :param contaminants: The names and sequences of the contaminants in the
+                         order of their sequence ids in the index.
+    """
+    counted_seqs = sequence_index.count_matches(sequence)
 
     def sort_func(x):
-        count = x[1]
-        name = x[0]
-        length = len(sequence_lookup[name])
+        sequence_id, count = x
+        name, target_sequence = contaminants[sequence_id]
         # Sort descending. The highest counted sequences with the lowest length
         # will come first. We want the sequences to be as small as possible.
-        return count, -length, name
+        return count, -len(target_sequence), name
 
     matches = sorted(counted_seqs.items(), key=sort_func, reverse=True)
-    for match, _ in matches:
-        target_sequence = sequence_lookup[match]
-        identity = sequence_identity(target_sequence, sequence)
-        if match_reverse_complement:
-            reverse_identity = sequence_identity(target_sequence,
-                                                 sequence_reverse_complement)
-            identity = max(identity, reverse_identity)
-        if identity > best_identity:
-            best_identity = identity
-            best_match = match
-            if identity == 1.0:
-                break
+    candidates = [contaminants[sequence_id] for sequence_id, _ in matches]
+    # All candidates are aligned in one call that does not hold the GIL.
+    best_index, best_identity = best_sequence_identity(
+        [target_sequence for _, target_sequence in candidates],
+        sequence, match_reverse_complement)
+    if best_index == -1:
+        best_match = "No match"
+    else:
+        best_match = candidates[best_index][0]
     return round(best_identity * len(sequence)), len(sequence), best_match
 
 
+def identify_sequences_builtin(sequences: Iterable[str],
+                               threads: int = 1) -> List[Tuple[int, int, str]]:
+    """
+    Identify multiple sequences using the builtin sequence libraries. The
+    alignments release the GIL, so multiple threads are used effectively.
+    :return: A list of identify_sequence_builtin results for the sequences.
+    """
+    sequences = list(sequences)
+    if threads <= 1 or len(sequences) <= 1:
+        return [identify_sequence_builtin(sequence) for sequence in sequences]
+    # Create the index before starting the threads, so it is not created by
+    # multiple threads at once.
+    create_default_sequence_index(DEFAULT_K)
+    with concurrent.futures.ThreadPoolExecutor(threads) as executor:
+        return list(executor.map(identify_sequence_builtin, sequences))
+
+
 def identify_sequence_builtin(sequence: str, k: int = DEFAULT_K,
                               match_reverse_complement: bool = True):
     """
@@ -167,7 +243,7 @@ def identify_sequence_builtin(sequence: str, k: int = DEFAULT_K,
     while True:
         sequence_index = create_default_sequence_index(k)
         matches, max_matches, best_match = identify_sequence(
-            sequence, sequence_index, default_sequence_lookup(), k,
+            sequence, sequence_index, default_contaminants(),
             match_reverse_complement
         )
         # Check if the sequence has been adequately identified, if not retry
@@ -14,12 +14,20 @@
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
+import collections
+import concurrent.futures
 import io
+import mmap
 import os
+import queue
 import string
+import struct
+import threading
+import zlib
 from typing import (
     BinaryIO,
     Callable,
+    Deque,
     Iterator,
     List,
     Optional,
@@ -40,6 +48,17 @@ try:
 except ImportError:
     _ThreadedGzipReader = None  # type: ignore
 
+try:
+    from isal import isal_zlib as _deflate
+except ImportError:
+    _deflate = zlib  # type: ignore
+
+# The fixed part of a BGZF block header: gzip magic, CM, FLG with FEXTRA
+# set, MTIME, XFL, OS and XLEN.
+BGZF_HEADER = struct.Struct("<4sIBBH")
+BGZF_MAGIC = b"\x1f\x8b\x08\x04"
+BGZF_TRAILER = struct.Struct("<II")
+
 
 class ProgressUpdater:
     """
@@ -55,25 +74,33 @@ class ProgressUpdater:
     current_processed_bytes = 0
     progress_update_every: int
     next_update_at: int
+    total: Optional[int]
     tqdm: tqdm.tqdm
 
-    def __init__(self, filereader: io.BufferedReader):
+    def __init__(self, filereader: io.BufferedReader,
+                 count_processed_bytes: bool = False, disable: bool = False):
         self.previous_file_pos = 0
         self.current_processed_bytes = 0
         self.progress_update_every = 1024 * 1024 * 10
         self.next_update_at = self.progress_update_every
         filename = filereader.name
         total: Optional[int] = os.stat(filename).st_size
-        if filereader.seekable():
+        if count_processed_bytes:
+            # The file position does not move when the data is read through
+            # a memory map. The processed bytes are the file bytes then.
+            self._get_position = lambda: self.current_processed_bytes
+        elif filereader.seekable():
             self._get_position = filereader.tell
         else:
             self._get_position = lambda: self.current_processed_bytes
             total = None
+        self.total = total
         self.tqdm = tqdm.tqdm(
             desc=f"Processing {os.path.basename(filename)}",
             unit="iB", unit_scale=True, unit_divisor=1024,
             total=total,
             smoothing=0.05,  # Much less erratic than default 0.3
+            disable=disable,
         )
 
     def __enter__(self):
@@ -87,6 +114,12 @@ class ProgressUpdater:
     def __exit__(self, exc_type, exc_val, exc_tb):
         self.close()
 
+    def fraction_read(self) -> Optional[float]:
+        """The fraction of the file that was read, if the size is known."""
+        if not self.total:
+            return None
+        return min(self._get_position() / self.total, 1.0)
+
     def update(self, record_array: FastqRecordArrayView):
         self.current_processed_bytes += len(record_array.obj)
         if self.current_processed_bytes > self.next_update_at:
@@ -96,30 +129,323 @@ class ProgressUpdater:
             self.previous_file_pos = current_position
 
 
+class ReadAheadReader:
+    """
+    Read a binary file in a background thread, so reading the next block
+    of data overlaps with processing of the current one.
+
+    A fixed set of buffers is passed between the reader thread and the
+    consumer. The reader thread takes an empty buffer, fills it using the
+    readinto method of the file object and hands it over. The consumer
+    copies the data out using readinto or read and returns the buffer when
+    it has been used up. The file object is not closed by this class.
+    """
+    fileobj: BinaryIO
+
+    def __init__(self, fileobj: BinaryIO, buffer_size: int = 128 * 1024,
+                 number_of_buffers: int = 2):
+        if buffer_size < 1:
+            raise ValueError(f"buffer_size must be at least 1, "
+                             f"got {buffer_size}")
+        if number_of_buffers < 1:
+            raise ValueError(f"number_of_buffers must be at least 1, "
+                             f"got {number_of_buffers}")
+        self.fileobj = fileobj
+        self._empty: queue.Queue = queue.Queue()
+        self._filled: queue.Queue = queue.Queue()
+        for _ in range(number_of_buffers):
+            self._empty.put(bytearray(buffer_size))
+        self._current: Optional[bytearray] = None
+        self._current_pos = 0
+        self._current_size = 0
+        self._eof = False
+        self._stopped = False
+        self._thread = threading.Thread(target=self._fill_buffers,
+                                        daemon=True)
+        self._thread.start()
+
+    def _fill_buffers(self):
+        try:
+            while True:
+                buffer = self._empty.get()
+                if buffer is None:
+                    return
+                read_bytes = self.fileobj.readinto(buffer)
+                self._filled.put((buffer, read_bytes))
+                if not read_bytes:
+                    return
+        except Exception as error:
+            self._filled.put(error)
+
+    def _next_buffer(self) -> bool:
+        """Get the next filled buffer. Return False at end of file."""
+        if self._current is not None:
+            self._empty.put(self._current)
+            self._current = None
+        if self._eof:
+            return False
+        item = self._filled.get()
+        if isinstance(item, Exception):
+            self._eof = True
+            raise item
+        buffer, read_bytes = item
+        if not read_bytes:
+            self._eof = True
+            return False
+        self._current = buffer
+        self._current_pos = 0
+        self._current_size = read_bytes
+        return True
+
+    def readinto(self, b) -> int:
+        if self._stopped:
+            raise ValueError("I/O operation on closed file.")
+        view = memoryview(b).cast("B")
+        written = 0
+        while written < len(view):
+            if self._current_pos == self._current_size:
+                if not self._next_buffer():
+                    break
+            size = min(len(view) - written,
+                       self._current_size - self._current_pos)
+            start = self._current_pos
+            with memoryview(self._current) as current:  # type: ignore
+                view[written:written + size] = current[start:start + size]
+            self._current_pos += size
+            written += size
+        return written
+
+    def read(self, size: int = -1) -> bytes:
+        if size is None or size < 0:
+            chunks = []
+            while True:
+                chunk = self.read(io.DEFAULT_BUFFER_SIZE)
+                if not chunk:
+                    return b"".join(chunks)
+                chunks.append(chunk)
+        buffer = bytearray(size)
+        read_bytes = self.readinto(buffer)
+        del buffer[read_bytes:]
+        return bytes(buffer)
+
+    def readable(self) -> bool:
+        return True
+
+    def close(self):
+        if self._stopped:
+            return
+        self._stopped = True
+        # Wake up the reader thread if it is waiting for an empty buffer.
+        self._empty.put(None)
+        self._thread.join()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+
+def is_bgzf(fp: io.BufferedReader) -> bool:
+    """Check if the file starts with a BGZF block header."""
+    try:
+        data = fp.peek(BGZF_HEADER.size + 4)
+    except IOError:
+        return False
+    return (len(data) >= BGZF_HEADER.size + 4 and
+            data[:4] == BGZF_MAGIC and
+            data[BGZF_HEADER.size:BGZF_HEADER.size + 2] == b"BC")
+
+
+def _read_bgzf_block(fileobj: BinaryIO) -> Optional[Tuple[bytes, int, int]]:
+    """Read one block. Return its deflate data, CRC32 and size."""
+    header = fileobj.read(BGZF_HEADER.size)
+    if not header:
+        return None
+    if len(header) < BGZF_HEADER.size:
+        raise EOFError("Truncated BGZF block header.")
+    magic, _, _, _, xlen = BGZF_HEADER.unpack(header)
+    if magic != BGZF_MAGIC:
+        raise ValueError("Not a BGZF block.")
+    extra = fileobj.read(xlen)
+    if len(extra) < xlen:
+        raise EOFError("Truncated BGZF block header.")
+    block_size = None
+    pos = 0
+    while pos + 4 <= xlen:
+        subfield_id = extra[pos:pos + 2]
+        subfield_length, = struct.unpack_from("<H", extra, pos + 2)
+        if subfield_id == b"BC" and subfield_length == 2:
+            block_size, = struct.unpack_from("<H", extra, pos + 4)
+            block_size += 1
+        pos += 4 + subfield_length
+    if block_size is None:
+        raise ValueError("BGZF block without BC extra field.")
+    remaining = block_size - BGZF_HEADER.size - xlen
+    if remaining < BGZF_TRAILER.size:
+        raise ValueError(f"Invalid BGZF block size: {block_size}")
+    data = fileobj.read(remaining)
+    if len(data) < remaining:
+        raise EOFError("Truncated BGZF block.")
+    crc, isize = BGZF_TRAILER.unpack_from(data, remaining -
+                                          BGZF_TRAILER.size)
+    return data[:-BGZF_TRAILER.size], crc, isize
+
+
+def _inflate_bgzf_blocks(blocks: List[Tuple[bytes, int, int]]) -> bytes:
+    decompressed_blocks = []
+    for deflate_data, crc, isize in blocks:
+        decompressed = _deflate.decompress(deflate_data, wbits=-15)
+        if len(decompressed) != isize or _deflate.crc32(decompressed) != crc:
+            raise ValueError("BGZF block CRC32 or size check failed.")
+        decompressed_blocks.append(decompressed)
+    return b"".join(decompressed_blocks)
+
+
+class BGZFReader(io.RawIOBase):
+    """
+    Decompress a BGZF file, for instance a BAM file, on multiple threads.
+
+    BGZF files consist of independent gzip blocks of at most 64 KiB, with
+    the size of each block stored in the BC extra field. The blocks are read
+    in the calling thread and inflated in groups on a thread pool. The
+    results are delivered in order. Wrap in an io.BufferedReader for peek
+    and efficient small reads. The file object is not closed by this class.
+    """
+    fileobj: BinaryIO
+
+    def __init__(self, fileobj: BinaryIO, threads: int = 1,
+                 blocks_per_task: int = 16):
+        if threads < 1:
+            raise ValueError(f"threads must be at least 1, got {threads}")
+        self.fileobj = fileobj
+        self._blocks_per_task = blocks_per_task
+        # Keep all threads busy, while limiting the amount of decompressed
+        # data in memory.
+        self._max_pending = threads * 2
+        self._executor = concurrent.futures.ThreadPoolExecutor(threads)
+        self._pending: Deque[concurrent.futures.Future] = collections.deque()
+        self._current = memoryview(b"")
+        self._current_pos = 0
+        self._fileobj_eof = False
+
+    def readable(self) -> bool:
+        return True
+
+    def _submit_tasks(self):
+        while len(self._pending) < self._max_pending and not self._fileobj_eof:
+            blocks = []
+            for _ in range(self._blocks_per_task):
+                block = _read_bgzf_block(self.fileobj)
+                if block is None:
+                    self._fileobj_eof = True
+                    break
+                blocks.append(block)
+            if blocks:
+                self._pending.append(
+                    self._executor.submit(_inflate_bgzf_blocks, blocks))
+
+    def readinto(self, b) -> int:
+        view = memoryview(b).cast("B")
+        while self._current_pos == len(self._current):
+            self._submit_tasks()
+            if not self._pending:
+                return 0
+            self._current = memoryview(self._pending.popleft().result())
+            self._current_pos = 0
+        size = min(len(view), len(self._current) - self._current_pos)
+        start = self._current_pos
+        view[:size] = self._current[start:start + size]
+        self._current_pos += size
+        return size
+
+    def close(self):
+        if not self.closed:
+            for future in self._pending:
+                future.cancel()
+            self._executor.shutdown(wait=True)
+        super().close()
+
+
+def map_uncompressed_fastq(fp: io.BufferedReader) -> Optional[mmap.mmap]:
+    """
+    Memory map the file when it is an uncompressed FASTQ file on a regular
+    filesystem. Returns None otherwise.
+    """
+    try:
+        if fp.peek(1)[:1] != b"@":
+            return None
+        fileno = fp.fileno()
+        if os.fstat(fileno).st_size == 0:
+            return None
+        mapped = mmap.mmap(fileno, 0, access=mmap.ACCESS_READ)
+    except (OSError, ValueError):
+        return None
+    # The access hints are best effort. Not all platforms support them.
+    for advice in ("MADV_SEQUENTIAL", "MADV_HUGEPAGE"):
+        if hasattr(mmap, advice) and hasattr(mapped, "madvise"):
+            try:
+                mapped.madvise(getattr(mmap, advice))
+            except OSError:
+                pass
+    return mapped
+
+
 class NGSFile:
     filepath: str
     raw: io.BufferedReader
     file: BinaryIO
     progress: ProgressUpdater
     reader: Union[BamParser, FastqParser]
+    read_ahead: Optional[ReadAheadReader]
+    mapped: Optional[mmap.mmap]
     sequencing_technology: Optional[str]
     format: str
 
-    def __init__(self, filepath: str, threads: int = 0):
+    def __init__(self, filepath: str, threads: int = 0,
+                 read_ahead: bool = False, use_mmap: bool = True,
+                 progress: bool = True):
         self.filepath = filepath
         self.raw = open(filepath, "rb")  # type: ignore
-        self.progress = ProgressUpdater(self.raw)
-        self.file = xopen.xopen(self.raw, "rb", threads=threads)
-        if filepath.endswith(".bam") or (
-                hasattr(self.file, "peek") and self.file.peek(4)[:4] == b"BAM\1"):
-            self.reader = BamParser(self.file)
+        self.read_ahead = None
+        self.mapped = None
+        if use_mmap:
+            self.mapped = map_uncompressed_fastq(self.raw)
+        self.progress = ProgressUpdater(
+            self.raw, count_processed_bytes=self.mapped is not None,
+            disable=not progress)
+        if self.mapped is not None:
+            # The parser reads the records straight from the page cache.
+            self.file = self.raw
             self.sequencing_technology = \
-                guess_sequencing_technology_from_bam_header(self.reader.header)
-            self.format = "BAM"
+                guess_sequencing_technology_from_file(self.raw)
+            self.reader = FastqParser(self.mapped)
+            self.format = "FASTQ"
+            return
+        if threads > 0 and is_bgzf(self.raw):
+            # Blocks can be inflated independently. This scales better than
+            # the single decompression thread from xopen.
+            self.file = io.BufferedReader(BGZFReader(self.raw, threads))
         else:
-            self.reader = FastqParser(self.file)
+            self.file = xopen.xopen(self.raw, "rb", threads=threads)
+        is_bam = filepath.endswith(".bam") or (
+            hasattr(self.file, "peek") and self.file.peek(4)[:4] == b"BAM\1")
+        if not is_bam:
+            # Must be done before the read ahead thread starts consuming the
+            # file.
             self.sequencing_technology = \
                 guess_sequencing_technology_from_file(self.file)  # type: ignore
+        parser_input: BinaryIO = self.file
+        if read_ahead:
+            self.read_ahead = ReadAheadReader(self.file)
+            parser_input = self.read_ahead  # type: ignore
+        if is_bam:
+            self.reader = BamParser(parser_input)
+            self.sequencing_technology = \
+                guess_sequencing_technology_from_bam_header(self.reader.header)
+            self.format = "BAM"
+        else:
+            self.reader = FastqParser(parser_input)
             self.format = "FASTQ"
 
     def __iter__(self):
@@ -134,6 +460,15 @@ class NGSFile:
 
     def close(self):
         self.progress.close()
+        if self.read_ahead is not None:
+            self.read_ahead.close()
+        if self.mapped is not None:
+            # Record arrays that are still alive keep views on the map.
+            del self.reader
+            try:
+                self.mapped.close()
+            except BufferError:
+                pass
         self.file.close()
         self.raw.close()
 
@@ -144,6 +479,386 @@ class NGSFile:
         self.close()
 
 
+class PairedReader:
+    """
+    Iterate over two paired FASTQ files as aligned pairs of record arrays.
+
+    When threaded, the second file is parsed in a background thread while
+    the main thread parses the next record array of the first file. Each
+    NGSFile can use its own decompression threads, so the files are
+    decompressed and parsed concurrently. The parsers release the GIL while
+    indexing the data.
+
+    A RuntimeError is raised when the files are out of sync or when the
+    record names do not match.
+    """
+    reader1: NGSFile
+    reader2: NGSFile
+
+    def __init__(self, reader1: NGSFile, reader2: NGSFile,
+                 threaded: bool = True):
+        self.reader1 = reader1
+        self.reader2 = reader2
+        self._requests: queue.Queue = queue.Queue()
+        self._results: queue.Queue = queue.Queue()
+        self._thread: Optional[threading.Thread] = None
+        if threaded:
+            self._thread = threading.Thread(target=self._read_reverse,
+                                            daemon=True)
+            self._thread.start()
+
+    def _read_reverse(self):
+        while True:
+            number_of_records = self._requests.get()
+            if number_of_records is None:
+                return
+            try:
+                self._results.put(self.reader2.read(number_of_records))
+            except Exception as error:
+                self._results.put(error)
+                return
+
+    def _read_reverse_result(self) -> FastqRecordArrayView:
+        result = self._results.get()
+        if isinstance(result, Exception):
+            raise result
+        return result
+
+    def _check_mates(self, record_array1: FastqRecordArrayView,
+                     record_array2: FastqRecordArrayView):
+        if len(record_array1) != len(record_array2):
+            raise RuntimeError(
+                f"FASTQ Files out of sync {self.reader1.filepath} has more "
+                f"FASTQ records than {self.reader2.filepath}.")
+        if not record_array1.is_mate(record_array2):
+            for r1, r2 in zip(iter(record_array1), iter(record_array2)):
+                if not sequence_names_match(r1.name(), r2.name()):
+                    raise RuntimeError(
+                        f"Mismatching names found! {r1.name()} {r2.name()}")
+            raise RuntimeError("Mismatching names found!")
+
+    def _check_reverse_exhausted(self, record_array2: FastqRecordArrayView):
+        if len(record_array2) > 0:
+            raise RuntimeError(
+                f"FASTQ Files out of sync {self.reader2.filepath} has "
+                f"more FASTQ records than {self.reader1.filepath}.")
+
+    def __iter__(self) -> Iterator[Tuple[FastqRecordArrayView,
+                                         FastqRecordArrayView]]:
+        if self._thread is None:
+            for record_array1 in self.reader1:
+                record_array2 = self.reader2.read(len(record_array1))
+                self._check_mates(record_array1, record_array2)
+                yield record_array1, record_array2
+            self._check_reverse_exhausted(self.reader2.read(1))
+            return
+        # The mate of a record array is requested as soon as it is parsed
+        # and collected after the next record array has been parsed.
+        pending: Deque[FastqRecordArrayView] = collections.deque()
+        for record_array1 in self.reader1:
+            self._requests.put(len(record_array1))
+            pending.append(record_array1)
+            if len(pending) > 1:
+                record_array1 = pending.popleft()
+                record_array2 = self._read_reverse_result()
+                self._check_mates(record_array1, record_array2)
+                yield record_array1, record_array2
+        while pending:
+            record_array1 = pending.popleft()
+            record_array2 = self._read_reverse_result()
+            self._check_mates(record_array1, record_array2)
+            yield record_array1, record_array2
+        self._requests.put(1)
+        self._check_reverse_exhausted(self._read_reverse_result())
+
+    def close(self):
+        if self._thread is None:
+            return
+        self._requests.put(None)
+        self._thread.join()
+        self._thread = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+
+def fastq_record_complete(data, start: int) -> int:
+    """
+    Check if a complete FASTQ record starts at start. The record must have
+    four lines, the third starting with '+' and a sequence and qualities
+    of equal length. Return the end of the record or -1.
+    """
+    if data[start:start + 1] != b"@":
+        return -1
+    header_end = data.find(b"\n", start)
+    sequence_end = data.find(b"\n", header_end + 1) if header_end != -1 else -1
+    plus_end = data.find(b"\n", sequence_end + 1) if sequence_end != -1 else -1
+    qualities_end = data.find(b"\n", plus_end + 1) if plus_end != -1 else -1
+    if qualities_end == -1 or data[sequence_end + 1:sequence_end + 2] != b"+":
+        return -1
+    if sequence_end - header_end != qualities_end - plus_end:
+        return -1
+    return qualities_end + 1
+
+
+def fastq_complete_records(data, start: Optional[int] = None
+                           ) -> Tuple[int, int]:
+    """
+    Find the complete FASTQ records in a block of data that ends at an
+    arbitrary position. When start is not given, the data may also start at
+    an arbitrary position and the first record is searched for. Returns the
+    start of the first and the end of the last complete record. Start and
+    end are equal if there are none.
+    """
+    if start is None:
+        # A quality line can start with '@' as well. In that case the line
+        # two lines further is a sequence, not a line starting with '+'.
+        candidate = data.find(b"\n@")
+        while candidate != -1:
+            if fastq_record_complete(data, candidate + 1) != -1:
+                start = candidate + 1
+                break
+            candidate = data.find(b"\n@", candidate + 1)
+        else:
+            return 0, 0
+    if fastq_record_complete(data, start) == -1:
+        return start, start
+    # The last record that is complete ends the block. Records in between
+    # need not be checked, they are checked by the parser.
+    candidate = data.rfind(b"\n@", start)
+    while candidate != -1:
+        end = fastq_record_complete(data, candidate + 1)
+        if end != -1:
+            return start, end
+        candidate = data.rfind(b"\n@", start, candidate)
+    return start, fastq_record_complete(data, start)
+
+
+BAM_RECORD_HEADER = struct.Struct("<IiiBBHHHIiii")
+
+
+def bam_record_size(data, start: int, number_of_references: int) -> int:
+    """
+    Check if a plausible BAM record starts at start. Return the size of the
+    record including the block_size field, or -1.
+    """
+    if start + BAM_RECORD_HEADER.size > len(data):
+        return -1
+    (block_size, reference_id, _, read_name_length, _, _, cigar_operations,
+     _, sequence_length, next_reference_id, _, _) = \
+        BAM_RECORD_HEADER.unpack_from(data, start)
+    if not (-1 <= reference_id < number_of_references and
+            -1 <= next_reference_id < number_of_references):
+        return -1
+    minimum_size = (BAM_RECORD_HEADER.size - 4 + read_name_length +
+                    4 * cigar_operations + (sequence_length + 1) // 2 +
+                    sequence_length)
+    if read_name_length < 1 or block_size < minimum_size:
+        return -1
+    name_end = start + BAM_RECORD_HEADER.size + read_name_length - 1
+    if name_end >= len(data) or data[name_end] != 0:
+        return -1
+    return block_size + 4
+
+
+def bam_complete_records(data, number_of_references: int,
+                         start: Optional[int] = None) -> Tuple[int, int]:
+    """
+    Find the complete BAM records in a block of data. When start is not
+    given, the first record is found by requiring two consecutive
+    plausible records. Returns the start of the first and the end of the
+    last complete record.
+    """
+    if start is None:
+        for candidate in range(len(data) - BAM_RECORD_HEADER.size):
+            size = bam_record_size(data, candidate, number_of_references)
+            if size == -1:
+                continue
+            if candidate + size == len(data) or bam_record_size(
+                    data, candidate + size, number_of_references) != -1:
+                start = candidate
+                break
+        else:
+            return 0, 0
+    end = start
+    while end < len(data):
+        size = bam_record_size(data, end, number_of_references)
+        if size == -1 or end + size > len(data):
+            break
+        end += size
+    return start, end
+
+
+def bam_header_size(data) -> Tuple[int, int]:
+    """
+    Return the size of the BAM header at the start of data and the number
+    of references, or -1 and 0 if data does not contain a complete header.
+    """
+    if data[:4] != b"BAM\1" or len(data) < 12:
+        return -1, 0
+    text_length, = struct.unpack_from("<I", data, 4)
+    pos = 8 + text_length
+    if pos + 4 > len(data):
+        return -1, 0
+    number_of_references, = struct.unpack_from("<I", data, pos)
+    pos += 4
+    for _ in range(number_of_references):
+        if pos + 4 > len(data):
+            return -1, 0
+        name_length, = struct.unpack_from("<I", data, pos)
+        pos += 4 + name_length + 4
+    if pos > len(data):
+        return -1, 0
+    return pos, number_of_references
+
+
+class StrideSampler:
+    """
+    Read record arrays from chunks at offsets spread over a file, without
+    reading the entire file.
+
+    Uncompressed FASTQ files are memory mapped. In BGZF files, FASTQ or
+    BAM, the first block after an offset is found by its header and
+    checksum. The chunks are then cut at record boundaries. The offsets are
+    visited in bit-reversed order, so at any moment the chunks that have
+    been read are spread evenly over the file. A ValueError is raised for
+    other files, such as regular gzip files, that can not be read from an
+    arbitrary offset.
+    """
+    filepath: str
+    file_size: int
+    sampled_bytes: int
+    format: str
+
+    def __init__(self, filepath: str, chunk_size: int = 1024 * 1024):
+        self.filepath = filepath
+        self.chunk_size = chunk_size
+        self.raw = open(filepath, "rb")  # type: ignore
+        self.file_size = os.fstat(self.raw.fileno()).st_size
+        self.sampled_bytes = 0
+        self.mapped: Optional[mmap.mmap] = None
+        self.is_bgzf = is_bgzf(self.raw)
+        if self.is_bgzf:
+            first_chunk = self._read_bgzf_chunk(0)
+        else:
+            self.mapped = map_uncompressed_fastq(self.raw)
+            if self.mapped is None:
+                self.raw.close()
+                raise ValueError(f"{filepath} can not be sampled. Only "
+                                 f"uncompressed FASTQ and BGZF compressed "
+                                 f"files are supported.")
+            first_chunk = self.mapped[:chunk_size]
+        self.bam_header = b""
+        self.number_of_references = 0
+        if first_chunk[:4] == b"BAM\1":
+            header_size, self.number_of_references = \
+                bam_header_size(first_chunk)
+            if header_size == -1:
+                self.close()
+                raise ValueError(f"{filepath} has a BAM header larger than "
+                                 f"{chunk_size} bytes.")
+            self.format = "BAM"
+            self.bam_header = bytes(first_chunk[:header_size])
+        elif first_chunk[:1] == b"@":
+            self.format = "FASTQ"
+        else:
+            self.close()
+            raise ValueError(f"{filepath} is not a FASTQ or BAM file.")
+
+    def _read_bgzf_chunk(self, offset: int) -> bytes:
+        """
+        Decompress chunk_size bytes from the first BGZF block at or after
+        offset.
+        """
+        search_size = 128 * 1024
+        while offset < self.file_size:
+            self.raw.seek(offset)
+            window = self.raw.read(search_size)
+            candidate = window.find(BGZF_MAGIC)
+            while candidate != -1:
+                block_start = offset + candidate
+                self.raw.seek(block_start)
+                blocks = []
+                size = 0
+                try:
+                    # The sizes are in the trailers, so only the blocks
+                    # that are needed are inflated.
+                    while size < self.chunk_size:
+                        block = _read_bgzf_block(self.raw)
+                        if block is None:
+                            break
+                        blocks.append(block)
+                        size += block[2]
+                    chunk = _inflate_bgzf_blocks(blocks)
+                except (ValueError, EOFError, zlib.error, _deflate.error):
+                    # Not an actual block header.
+                    candidate = window.find(BGZF_MAGIC, candidate + 1)
+                    continue
+                self.sampled_bytes += self.raw.tell() - block_start
+                return chunk
+            offset += search_size - len(BGZF_MAGIC)
+        return b""
+
+    def _read_chunk(self, offset: int) -> bytes:
+        if self.is_bgzf:
+            return self._read_bgzf_chunk(offset)
+        assert self.mapped is not None
+        chunk = self.mapped[offset:offset + self.chunk_size]
+        self.sampled_bytes += len(chunk)
+        return chunk
+
+    def _record_arrays(self, chunk: bytes, at_file_start: bool
+                       ) -> Iterator[FastqRecordArrayView]:
+        parser: Union[FastqParser, BamParser]
+        if self.format == "FASTQ":
+            start, end = fastq_complete_records(
+                chunk, 0 if at_file_start else None)
+            if start == end:
+                return
+            parser = FastqParser(memoryview(chunk)[start:end])
+        else:
+            start, end = bam_complete_records(
+                chunk, self.number_of_references,
+                len(self.bam_header) if at_file_start else None)
+            if start == end:
+                return
+            parser = BamParser(io.BytesIO(self.bam_header + chunk[start:end]))
+        yield from parser
+
+    def _stride_order(self) -> Iterator[int]:
+        # The last stride may be shorter than chunk_size.
+        number_of_strides = max(1, -(-self.file_size // self.chunk_size))
+        bits = max(1, (number_of_strides - 1).bit_length())
+        for i in range(1 << bits):
+            stride = int(format(i, f"0{bits}b")[::-1], 2)
+            if stride < number_of_strides:
+                yield stride
+
+    def __iter__(self) -> Iterator[FastqRecordArrayView]:
+        for stride in self._stride_order():
+            offset = stride * self.chunk_size
+            chunk = self._read_chunk(offset)
+            yield from self._record_arrays(chunk, offset == 0)
+
+    def close(self):
+        if self.mapped is not None:
+            try:
+                self.mapped.close()
+            except BufferError:
+                # Record arrays that are still alive keep views on the map.
+                pass
+        self.raw.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+
 def fasta_parser(fasta_file: str) -> Iterator[Tuple[str, str]]:
     current_seq: List[str] = []
     name = ""
@@ -14,6 +14,8 @@
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
+import random
+
 import pytest
 
 from sequali import AdapterCounter
@@ -130,7 +132,53 @@ def test_adapter_counter_matcher_multiple_machine_words(adapters):
         assert sum(countview) == 1
 
 
-def test_adapter_counter_mixed_lengths():
+@pytest.mark.parametrize("prefilter", [False, True])
+@pytest.mark.parametrize("number_of_words", list(range(1, 12)))
+def test_adapter_counter_many_machine_words(number_of_words, prefilter):
+    # Five adapters of 12 fit in one word. Depending on the CPU, groups of
+    # words are packed in AVX2, SSE2 or scalar matchers. All
+    # combinations should give the same results, with or without prefilter.
+    rng = random.Random(number_of_words)
+    adapters = ["".join(rng.choices("ACGT", k=12))
+                for _ in range(number_of_words * 5)]
+    counter = AdapterCounter(adapters, prefilter=prefilter)
+    assert counter.prefilter is prefilter
+    sequences = []
+    for _ in range(20):
+        parts = [adapter for adapter in adapters if rng.random() < 0.3]
+        parts.append("".join(rng.choices("ACGT", k=50)))
+        parts.append("".join(rng.choices("ACGTN", k=20)))
+        rng.shuffle(parts)
+        sequence = "".join(parts)
+        sequences.append(sequence)
+        counter.add_read(
+            FastqRecordView("name", sequence, "H" * len(sequence)))
+    for adapter, countview in counter.get_counts():
+        expected = [0] * counter.max_length
+        for sequence in sequences:
+            index = sequence.find(adapter)
+            if index != -1:
+                expected[index] += 1
+        assert countview.tolist() == expected
+
+
+def test_adapter_counter_prefilter_automatic():
+    assert not AdapterCounter(["GATTACAGATTACA"] * 4).prefilter
+    assert AdapterCounter(["GATTACAGATTACA"] * 40).prefilter
+    # Adapters that are too short for the prefilter k-mer are searched
+    # without prefilter.
+    assert not AdapterCounter(["GATTACA"] * 80).prefilter
+
+
+@pytest.mark.parametrize("adapter", ["GATTACA", "GATNACAGATTACA"])
+def test_adapter_counter_prefilter_unsuitable_adapter(adapter):
+    with pytest.raises(ValueError) as error:
+        AdapterCounter(["GATTACAGATTACA", adapter], prefilter=True)
+    error.match("prefilter")
+
+
+@pytest.mark.parametrize("prefilter", [False, True])
+def test_adapter_counter_mixed_lengths(prefilter):
     adapters = [
         "TATAAATATAAATATAAA",
         "GATTACAGATTACAGATTACA",
@@ -146,7 +194,7 @@ def test_adapter_counter_mixed_lengths():
         "NNNNNNN".join(adapters[i] for i in (1, 2, 4, 5, 6, 7)),
         "NNN".join(adapters[i] for i in (7, 2, 6, 3, 4, 7)),
     ]
-    counter = AdapterCounter(adapters)
+    counter = AdapterCounter(adapters, prefilter=prefilter)
     for sequence in sequences:
         read = FastqRecordView("name", sequence, "H" * len(sequence))
         counter.add_read(read)
@@ -156,3 +204,39 @@ def test_adapter_counter_mixed_lengths():
             index = sequence.find(adapter)
             if index != -1:
                 assert counts[index] > 0
+
+
+def test_adapter_counter_merge():
+    adapters = ["GATTACA", "GGGCCC"]
+    sequences = ["AAAAGATTACAAAA", "TTTTGGGCCC", "GATTACAGGGCCCAAAAAAAAA"]
+    expected = AdapterCounter(adapters)
+    for sequence in sequences:
+        expected.add_read(FastqRecordView("name", sequence, "A" * len(sequence)))
+    counter1 = AdapterCounter(adapters)
+    counter1.add_read(FastqRecordView("name", sequences[0],
+                                      "A" * len(sequences[0])))
+    counter2 = AdapterCounter(adapters)
+    for sequence in sequences[1:]:
+        counter2.add_read(FastqRecordView("name", sequence, "A" * len(sequence)))
+    counter1.merge(counter2)
+    assert counter1.number_of_sequences == expected.number_of_sequences
+    assert counter1.max_length == expected.max_length
+    assert counter1.get_counts() == expected.get_counts()
+
+
+def test_adapter_counter_merge_different_adapters():
+    counter = AdapterCounter(["GATTACA"])
+    with pytest.raises(ValueError) as error:
+        counter.merge(AdapterCounter(["GGGCCC"]))
+    error.match("Adapters should be the same")
+
+
+def test_adapter_counter_dump_load():
+    counter = AdapterCounter(["GATTACA", "GGGCCC"])
+    for sequence in ["AAAAGATTACAAAA", "TTTTGGGCCC"]:
+        counter.add_read(FastqRecordView("name", sequence, "A" * len(sequence)))
+    loaded = AdapterCounter.load(counter.dump())
+    assert loaded.adapters == counter.adapters
+    assert loaded.number_of_sequences == counter.number_of_sequences
+    assert loaded.max_length == counter.max_length
+    assert loaded.get_counts() == counter.get_counts()
@@ -187,3 +187,87 @@ def test_dedup_estimator_offsets_and_lengths_paired(
     for sequence1, sequence2 in input_sequence_pairs:
         dedup_est.add_sequence_pair(sequence1, sequence2)
     assert set(dedup_est.duplication_counts()) == result
+
+
+def test_dedup_estimator_merge():
+    # Use enough sequences so the modulo changes in the estimators.
+    sequences = ["".join(letters) for letters in
+                 itertools.product(string.ascii_letters, repeat=2)]
+    expected = DedupEstimator(100)
+    for sequence in sequences + sequences[:100]:
+        expected.add_sequence(sequence)
+    dedup_est1 = DedupEstimator(100)
+    for sequence in sequences[:100]:
+        dedup_est1.add_sequence(sequence)
+    dedup_est2 = DedupEstimator(100)
+    for sequence in sequences:
+        dedup_est2.add_sequence(sequence)
+    dedup_est1.merge(dedup_est2)
+    assert dedup_est1._modulo_bits == expected._modulo_bits
+    assert dedup_est1.tracked_sequences == expected.tracked_sequences
+    assert (sorted(dedup_est1.duplication_counts()) ==
+            sorted(expected.duplication_counts()))
+
+
+def test_dedup_estimator_merge_incompatible():
+    with pytest.raises(ValueError):
+        DedupEstimator(100).merge(DedupEstimator(200))
+
+
+def test_dedup_estimator_dump_load():
+    dedup_est = DedupEstimator(100, front_sequence_length=4,
+                               back_sequence_length=4)
+    for letters in itertools.product(string.ascii_letters, repeat=2):
+        dedup_est.add_sequence("".join(letters))
+    loaded = DedupEstimator.load(dedup_est.dump())
+    assert loaded._modulo_bits == dedup_est._modulo_bits
+    assert loaded.tracked_sequences == dedup_est.tracked_sequences
+    assert (sorted(loaded.duplication_counts()) ==
+            sorted(dedup_est.duplication_counts()))
+
+
+def test_dedup_estimator_sketch():
+    sequences = ["".join(letters) for letters in
+                 itertools.product(string.ascii_letters, repeat=3)]
+    sketch = DedupEstimator(1000, sketch=True)
+    exact = DedupEstimator(1_000_000)
+    assert sketch.sketch
+    assert not exact.sketch
+    for sequence in itertools.chain(sequences, sequences[::4]):
+        sketch.add_sequence(sequence)
+        exact.add_sequence(sequence)
+    assert sketch._modulo_bits == 0
+    assert sketch.tracked_sequences == 1000
+    assert exact.estimated_distinct_fingerprints() == len(sequences)
+    assert sketch.estimated_distinct_fingerprints() == pytest.approx(
+        len(sequences), rel=0.05)
+    # All retained fingerprints are counted exactly, so one in four has
+    # a duplicate.
+    counts = sorted(sketch.duplication_counts())
+    assert set(counts) == {1, 2}
+    assert counts.count(2) / len(counts) == pytest.approx(0.25, abs=0.05)
+
+
+def test_dedup_estimator_sketch_merge_dump_load():
+    sequences = ["".join(letters) for letters in
+                 itertools.product(string.ascii_letters, repeat=3)]
+    expected = DedupEstimator(500, sketch=True)
+    dedup_est1 = DedupEstimator(500, sketch=True)
+    dedup_est2 = DedupEstimator(500, sketch=True)
+    for i, sequence in enumerate(sequences + sequences[:5000]):
+        expected.add_sequence(sequence)
+        if i % 3:
+            dedup_est1.add_sequence(sequence)
+        else:
+            dedup_est2.add_sequence(sequence)
+    dedup_est1.merge(DedupEstimator.load(dedup_est2.dump()))
+    assert dedup_est1.tracked_sequences == expected.tracked_sequences
+    assert (sorted(dedup_est1.duplication_counts()) ==
+            sorted(expected.duplication_counts()))
+    assert (dedup_est1.estimated_distinct_fingerprints() ==
+            expected.estimated_distinct_fingerprints())
+
+
+def test_dedup_estimator_merge_sketch_incompatible():
+    with pytest.raises(ValueError):
+        DedupEstimator(100, sketch=True).merge(DedupEstimator(100))
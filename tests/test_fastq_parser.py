@@ -15,6 +15,7 @@
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
 import io
+import mmap
 import re
 from pathlib import Path
 
@@ -105,6 +106,19 @@ def test_small_initial_buffer(initial_buffersize):
     assert len(list(parser)) == 1
 
 
+def test_fastq_parser_profile():
+    parser = FastqParser(io.BytesIO(COMPLETE_RECORD * 10), initial_buffersize=8)
+    parser.profiling = True
+    record_arrays = list(parser)
+    profile = parser.profile()
+    assert profile["seconds"] > 0.0
+    # The last call returns an empty record array to signal the end.
+    assert profile["record_arrays"] == len(record_arrays) + 1
+    assert profile["records"] == 10
+    assert profile["buffer_resizes"] > 0
+    assert profile["buffer_allocations"] > 0
+
+
 @pytest.mark.parametrize("number_of_records", [i for i in range(1, 101)])
 def test_fastq_record_array_read(number_of_records):
     with open(DATA / "100_illumina_adapters.fastq", "rb") as fileobj:
@@ -132,3 +146,136 @@ def test_fastq_record_array_read_buffersizes(buffer_size):
     assert record_array.obj.count(b"\n") >= 20 * 4
     assert second_record_array.obj.count(b"\n") >= 70 * 4
     assert third_record_array.obj.count(b"\n") == 10 * 4
+
+
+@pytest.mark.parametrize("buffer_size", [1, 63, 64, 65, 127, 128, 1000])
+def test_fastq_parser_record_lengths_around_64_bytes(buffer_size):
+    # Newlines are indexed in blocks of 64 bytes. Make sure records of all
+    # lengths around that size are split correctly for any buffer size.
+    records = []
+    for length in range(1, 140):
+        name = f"r{length}"
+        sequence = "ACGT" * (length // 4) + "A" * (length % 4)
+        qualities = "I" * length
+        records.append((name, sequence, qualities))
+    data = "".join(f"@{n}\n{s}\n+\n{q}\n" for n, s, q in records).encode()
+    parser = FastqParser(io.BytesIO(data), buffer_size)
+    parsed = [
+        (record.name(), record.sequence(), record.qualities())
+        for record_array in parser for record in record_array
+    ]
+    assert parsed == records
+
+
+@pytest.mark.parametrize("buffer_size", [1, 100, 1024, 128 * 1024])
+def test_fastq_parser_buffer_reuse(buffer_size):
+    # Buffers of released record arrays are reused. Record arrays that are
+    # still referenced should keep their contents.
+    records = []
+    for i in range(200):
+        length = (i * 37) % 3000
+        sequence = "ACGT" * (length // 4) + "A" * (length % 4)
+        records.append((f"r{i}", sequence, "I" * length))
+    data = "".join(f"@{n}\n{s}\n+\n{q}\n" for n, s, q in records).encode()
+    parser = FastqParser(io.BytesIO(data), buffer_size)
+    released = []
+    kept_arrays = []
+    for i, record_array in enumerate(parser):
+        for record in record_array:
+            released.append(
+                (record.name(), record.sequence(), record.qualities()))
+        if i % 3 == 0:
+            kept_arrays.append((record_array, bytes(record_array.obj)))
+    assert released == records
+    for record_array, contents in kept_arrays:
+        assert bytes(record_array.obj) == contents
+
+
+@pytest.mark.parametrize("buffer_size", [1, 10, 50, 200])
+@pytest.mark.parametrize("read_sizes", [(1, 2, 7), (1, 1, 1, 1, 1, 1),
+                                        (3, 3), (2, 1, 1, 7)])
+def test_fastq_record_array_read_mixed_lengths(buffer_size, read_sizes):
+    # The buffer is enlarged and shrunk to fit during a read, which may move
+    # it. The records parsed before that must still be correct.
+    records = []
+    for i, length in enumerate([150, 1, 150, 10, 1]):
+        sequence = "ACGT" * (length // 4) + "A" * (length % 4)
+        records.append((f"r{i}", sequence, chr(33 + i) * length))
+    data = "".join(f"@{n}\n{s}\n+\n{q}\n" for n, s, q in records).encode()
+    parser = FastqParser(io.BytesIO(data), initial_buffersize=buffer_size)
+    record_arrays = [parser.read(n) for n in read_sizes]
+    # Overwrite memory that was freed when a resize moved the buffer.
+    overwrites = [bytearray(b"x" * size) for size in range(1, 2000)
+                  for _ in range(3)]
+    del overwrites
+    parsed = [(record.name(), record.sequence(), record.qualities())
+              for record_array in record_arrays for record in record_array]
+    assert parsed == records
+
+
+@pytest.mark.parametrize("buffer_size", [1, 100, 1024, 128 * 1024])
+def test_fastq_parser_buffer_input(buffer_size):
+    data = (DATA / "100_illumina_adapters.fastq").read_bytes()
+    expected = [
+        (record.name(), record.sequence(), record.qualities())
+        for array in FastqParser(io.BytesIO(data)) for record in array
+    ]
+    parser = FastqParser(data, buffer_size)
+    arrays = list(parser)
+    result = [(record.name(), record.sequence(), record.qualities())
+              for array in arrays for record in array]
+    assert result == expected
+    # The arrays hold views on consecutive parts of the input.
+    assert b"".join(bytes(array.obj) for array in arrays) == data
+
+
+def test_fastq_parser_buffer_input_read():
+    data = (DATA / "100_illumina_adapters.fastq").read_bytes()
+    parser = FastqParser(bytearray(data), 128)
+    assert len(parser.read(20)) == 20
+    assert len(parser.read(70)) == 70
+    assert len(parser.read(50)) == 10
+    assert len(parser.read(50)) == 0
+
+
+def test_fastq_parser_buffer_input_long_record():
+    # Records much larger than the buffer size grow the indexed window
+    # geometrically rather than in steps of the buffer size.
+    sequence = "ACGT" * 500_000
+    data = f"@long\n{sequence}\n+\n{'I' * len(sequence)}\n@short\nA\n+\nI\n"
+    parser = FastqParser(data.encode(), 16)
+    parsed = [(record.name(), record.sequence())
+              for array in parser for record in array]
+    assert parsed == [("long", sequence), ("short", "A")]
+
+
+def test_fastq_parser_mmap_input():
+    path = DATA / "100_illumina_adapters.fastq"
+    with open(path, "rb") as fileobj:
+        expected = [record.sequence() for array in FastqParser(fileobj)
+                    for record in array]
+    with open(path, "rb") as fileobj:
+        mapped = mmap.mmap(fileobj.fileno(), 0, access=mmap.ACCESS_READ)
+        parser = FastqParser(mapped)
+        result = [record.sequence() for array in parser for record in array]
+        del parser
+        mapped.close()
+    assert result == expected
+
+
+@pytest.mark.parametrize("end", range(1, len(COMPLETE_RECORD)))
+def test_truncated_record_buffer_input(end: int):
+    truncated_record = COMPLETE_RECORD[:end]
+    parser = FastqParser(truncated_record)
+    with pytest.raises(EOFError) as error:
+        list(parser)
+    error.match(re.escape(truncated_record.decode("ascii")))
+    error.match("ncomplete record")
+
+
+def test_fastq_parser_non_ascii_buffer_input():
+    parser = FastqParser("@nÄmé \nAGC\n+\nHHH\n".encode("latin-1"))
+    with pytest.raises(ValueError) as error:
+        list(parser)
+    error.match("ASCII")
+    error.match("Ä")
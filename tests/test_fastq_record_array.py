@@ -31,6 +31,18 @@ NAME_MATCH_TESTS = [
     ("same1", "same3", False),
     ("same2", "same1", True),
     ("same2", "same5", False),
+    ("same", "same1", False),
+    ("same1", "same", False),
+    ("same1", "same1", True),
+    ("same\twith tab", "same with space", True),
+    ("D00360:76:C672MANXX:3:1101:5469:2124 1:N:0:1",
+     "D00360:76:C672MANXX:3:1101:5469:2124 2:N:0:1", True),
+    ("D00360:76:C672MANXX:3:1101:5469:2124/1",
+     "D00360:76:C672MANXX:3:1101:5469:2124/2", True),
+    ("D00360:76:C672MANXX:3:1101:5469:2124X 1:N:0:1",
+     "D00360:76:C672MANXX:3:1101:5469:2124 2:N:0:1", False),
+    ("D00360:76:C672MANXX:3:1101:5469:2125 1:N:0:1",
+     "D00360:76:C672MANXX:3:1101:5469:2124 1:N:0:1", False),
 ]
 
 
@@ -14,6 +14,8 @@
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
+import random
+
 import pytest
 
 from sequali._qc import INSERT_SIZE_MAX_ADAPTER_STORE_SIZE, InsertSizeMetrics
@@ -78,3 +80,65 @@ def test_insert_size_metrics(sequence1, sequence2, insert_size):
         assert insert_size_metrics.number_of_adapters_read2 == 1
     else:
         assert insert_size_metrics.number_of_adapters_read2 == 0
+
+
+@pytest.mark.parametrize("insert_size",
+                         [16, 20, 47, 100, 130, 140, 150, 151, 200, 284, 285])
+@pytest.mark.parametrize("with_error", [False, True])
+def test_insert_size_metrics_long_reads(insert_size, with_error):
+    random.seed(insert_size)
+    fragment = "".join(random.choices("ACGT", k=insert_size))
+    reverse_complement = fragment[::-1].translate(str.maketrans("ACGT", "TGCA"))
+    padding = "".join(random.choices("ACGT", k=150))
+    sequence1 = (fragment + ILLUMINA_ADAPTER_R1 + padding)[:150]
+    sequence2 = (reverse_complement + ILLUMINA_ADAPTER_R2 + padding)[:150]
+    if with_error:
+        # One error at either end of read 2 is still detected.
+        sequence2 = ("N" + sequence2[1:-1] + "N")
+    insert_size_metrics = InsertSizeMetrics()
+    insert_size_metrics.add_sequence_pair(sequence1, sequence2)
+    expected = insert_size if insert_size <= 300 - 16 else 0
+    assert insert_size_metrics.insert_sizes()[expected] == 1
+
+
+def test_insert_size_metrics_merge():
+    pairs = [
+        ("ACGTTGCAGCTATCGA" + ILLUMINA_ADAPTER_R1,
+         "TCGATAGCTGCAACGT" + ILLUMINA_ADAPTER_R2),
+        ("GTACACGTTGCAGCTATCGA" + ILLUMINA_ADAPTER_R1,
+         "TCGATAGCTGCAACGTGTAC" + ILLUMINA_ADAPTER_R2),
+        ("ATATATATATATATAT", "ATATATATATATATAT"),
+    ]
+    expected = InsertSizeMetrics()
+    for sequence1, sequence2 in pairs:
+        expected.add_sequence_pair(sequence1, sequence2)
+    metrics1 = InsertSizeMetrics()
+    metrics1.add_sequence_pair(*pairs[0])
+    metrics2 = InsertSizeMetrics()
+    metrics2.add_sequence_pair(*pairs[1])
+    metrics2.add_sequence_pair(*pairs[2])
+    metrics1.merge(metrics2)
+    assert metrics1.total_reads == expected.total_reads
+    assert metrics1.insert_sizes() == expected.insert_sizes()
+    assert (metrics1.number_of_adapters_read1 ==
+            expected.number_of_adapters_read1)
+    assert (metrics1.number_of_adapters_read2 ==
+            expected.number_of_adapters_read2)
+    assert (sorted(metrics1.adapters_read1()) ==
+            sorted(expected.adapters_read1()))
+    assert (sorted(metrics1.adapters_read2()) ==
+            sorted(expected.adapters_read2()))
+
+
+def test_insert_size_metrics_dump_load():
+    metrics = InsertSizeMetrics()
+    metrics.add_sequence_pair("ACGTTGCAGCTATCGA" + ILLUMINA_ADAPTER_R1,
+                              "TCGATAGCTGCAACGT" + ILLUMINA_ADAPTER_R2)
+    metrics.add_sequence_pair("ATATATATATATATAT", "ATATATATATATATAT")
+    loaded = InsertSizeMetrics.load(metrics.dump())
+    assert loaded.total_reads == metrics.total_reads
+    assert loaded.insert_sizes() == metrics.insert_sizes()
+    assert loaded.number_of_adapters_read1 == metrics.number_of_adapters_read1
+    assert loaded.number_of_adapters_read2 == metrics.number_of_adapters_read2
+    assert loaded.adapters_read1() == metrics.adapters_read1()
+    assert loaded.adapters_read2() == metrics.adapters_read2()
@@ -14,13 +14,16 @@
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
+import gzip
 import json
+import random
 import sys
 from pathlib import Path
 
 import pytest
 
-from sequali.__main__ import main
+from sequali.__main__ import (main, sequali_batch, sequali_merge,
+                              sequali_report)
 
 TEST_DATA = Path(__file__).parent / "data"
 
@@ -38,6 +41,25 @@ def test_simple_fastq(tmp_path):
     assert result["summary"]["total_bases"] == 22
 
 
+@pytest.mark.parametrize("threads", [1, 2])
+def test_profile(tmp_path, threads):
+    simple_fastq = TEST_DATA / "simple.fastq"
+    sys.argv = ["", "--dir", str(tmp_path), "--profile", "--threads",
+                str(threads), str(simple_fastq)]
+    main()
+    profile = json.loads((tmp_path / "simple.fastq.profile.json").read_text())
+    assert profile["threads"] == threads
+    assert profile["processing_seconds"] > 0.0
+    assert profile["report_seconds"] > 0.0
+    assert profile["parsers"]["input"]["records"] == 3
+    assert profile["parsers"]["input"]["bases"] == 22
+    for name in ("metrics", "per_tile_quality", "sequence_duplication",
+                 "nanostats", "dedup_estimator", "adapter_counter"):
+        assert profile["modules"][name]["records"] == 3
+        assert profile["modules"][name]["bases"] == 22
+    assert "insert_size_metrics" not in profile["modules"]
+
+
 def test_empty_file(tmp_path):
     empty_fastq = TEST_DATA / "empty.fastq"
     sys.argv = ["", "--dir", str(tmp_path), str(empty_fastq)]
@@ -277,3 +299,204 @@ def test_version_command(capsys):
     result = capsys.readouterr()
     import sequali
     assert result.out.replace("\n", "") == sequali.__version__
+
+
+@pytest.mark.parametrize("paired", [False, True])
+def test_threads_same_result(tmp_path, paired):
+    fastqs = [str(TEST_DATA / "LTB-A-BC001_S1_L003_R1_001.fastq.gz")]
+    if paired:
+        fastqs.append(str(TEST_DATA / "LTB-A-BC001_S1_L003_R2_001.fastq.gz"))
+    results = []
+    for threads in (1, 4):
+        outdir = tmp_path / str(threads)
+        sys.argv = ["", "--threads", str(threads), "--dir", str(outdir),
+                    *fastqs]
+        main()
+        fastq_json = outdir / "LTB-A-BC001_S1_L003_R1_001.fastq.gz.json"
+        results.append(json.loads(fastq_json.read_text()))
+    single_threaded, multi_threaded = results
+    for key in ("summary", "summary_read2",
+                "per_position_quality_distribution",
+                "per_position_base_content", "per_sequence_gc_content",
+                "adapter_content", "adapter_content_from_overlap",
+                "insert_size_metrics", "per_tile_quality",
+                "overrepresented_sequences", "duplication_fractions"):
+        assert single_threaded.get(key) == multi_threaded.get(key)
+
+
+@pytest.mark.parametrize("paired", [False, True])
+def test_merge_state_files(tmp_path, paired):
+    fastqs = [TEST_DATA / "LTB-A-BC001_S1_L003_R1_001.fastq.gz"]
+    if paired:
+        fastqs.append(TEST_DATA / "LTB-A-BC001_S1_L003_R2_001.fastq.gz")
+    # Split the input in two shards of complete FASTQ records.
+    shards = [[], []]
+    for read_number, fastq in enumerate(fastqs, start=1):
+        with gzip.open(fastq, "rb") as fastq_file:
+            lines = fastq_file.readlines()
+        half = (len(lines) // 8) * 4
+        for i, shard_lines in enumerate((lines[:half], lines[half:])):
+            shard_path = tmp_path / f"shard{i}_R{read_number}.fastq"
+            shard_path.write_bytes(b"".join(shard_lines))
+            shards[i].append(str(shard_path))
+    states = []
+    for i, shard in enumerate(shards):
+        state = tmp_path / f"shard{i}.state"
+        sys.argv = ["", "--dir", str(tmp_path / f"shard{i}"),
+                    "--state", str(state), *shard]
+        main()
+        states.append(str(state))
+    sys.argv = ["", "--dir", str(tmp_path / "merged"), "--name", "merged",
+                *states]
+    sequali_merge()
+    merged = json.loads((tmp_path / "merged" / "merged.json").read_text())
+    sys.argv = ["", "--dir", str(tmp_path / "full"), *map(str, fastqs)]
+    main()
+    full = json.loads(
+        (tmp_path / "full" / (fastqs[0].name + ".json")).read_text())
+    for key in ("summary", "summary_read2",
+                "per_position_quality_distribution",
+                "per_position_base_content", "per_sequence_gc_content",
+                "adapter_content", "adapter_content_from_overlap",
+                "insert_size_metrics", "per_tile_quality"):
+        assert merged.get(key) == full.get(key)
+
+
+def test_max_memory(tmp_path):
+    fastq = TEST_DATA / "LTB-A-BC001_S1_L003_R1_001.fastq.gz"
+    sys.argv = ["", "--dir", str(tmp_path), "--max-memory", "150M",
+                str(fastq)]
+    main()
+    result = json.loads((tmp_path / (fastq.name + ".json")).read_text())
+    overrepresented = result["overrepresented_sequences"]
+    # The tables are smaller, so reads are sampled less often.
+    assert overrepresented["sample_every"] > 8
+    assert overrepresented["max_unique_fragments"] < 5_000_000
+
+
+@pytest.mark.parametrize("filename", ["100_illumina_adapters.fastq",
+                                      "dorado_nanopore_100reads.bam",
+                                      "100_nanopore_reads.fastq.gz"])
+def test_estimate(tmp_path, filename):
+    fastq = TEST_DATA / filename
+    sys.argv = ["", "--dir", str(tmp_path), "--estimate", "0.05", str(fastq)]
+    main()
+    result = json.loads((tmp_path / (fastq.name + ".json")).read_text())
+    meta = result["meta"]
+    # Too few reads to converge, sequentially read files are read entirely.
+    if filename.endswith(".gz"):
+        assert meta["estimated"] is False
+        assert meta["sampled_fraction"] is None
+    else:
+        assert meta["estimated"] is True
+        assert 0 < meta["sampled_fraction"] <= 1
+    assert result["summary"]["total_reads"] == 100
+    html = (tmp_path / (fastq.name + ".html")).read_text()
+    assert ("From a sample of" in html) == meta["estimated"]
+
+
+def test_estimate_paired(tmp_path):
+    # Enough reads for the convergence checks, which start at 10,000 reads.
+    rng = random.Random(27)
+    fastq1 = tmp_path / "estimate_R1.fastq"
+    fastq2 = tmp_path / "estimate_R2.fastq"
+    number_of_pairs = 40_000
+    with open(fastq1, "wt") as file1, open(fastq2, "wt") as file2:
+        for i in range(number_of_pairs):
+            for file in (file1, file2):
+                sequence = "".join(rng.choices("ACGT", k=100))
+                file.write(f"@read{i}\n{sequence}\n+\n{'I' * 100}\n")
+    sys.argv = ["", "--dir", str(tmp_path), "--estimate", "0.05",
+                str(fastq1), str(fastq2)]
+    main()
+    result = json.loads((tmp_path / (fastq1.name + ".json")).read_text())
+    meta = result["meta"]
+    assert meta["estimated"] is True
+    assert 0 < meta["sampled_fraction"] < 1
+    assert 0 < result["summary"]["total_reads"] < number_of_pairs
+    assert (result["summary_read2"]["total_reads"] ==
+            result["summary"]["total_reads"])
+
+
+def test_estimate_invalid_tolerance(tmp_path):
+    sys.argv = ["", "--dir", str(tmp_path), "--estimate", "2",
+                str(TEST_DATA / "simple.fastq")]
+    with pytest.raises(SystemExit) as error:
+        main()
+    error.match("tolerance")
+
+
+def test_duplication_sketch(tmp_path):
+    simple_fastq = TEST_DATA / "simple.fastq"
+    sys.argv = ["", "--dir", str(tmp_path), "--duplication-sketch",
+                str(simple_fastq)]
+    main()
+    result = json.loads((tmp_path / "simple.fastq.json").read_text())
+    duplication = result["duplication_fractions"]
+    assert duplication["tracked_unique_sequences"] == 3
+    assert duplication["estimated_distinct_fingerprints"] == 3
+
+
+def test_batch(tmp_path):
+    samples = [
+        [TEST_DATA / "simple.fastq"],
+        [TEST_DATA / "100_nanopore_reads.fastq.gz"],
+        [TEST_DATA / "LTB-A-BC001_S1_L003_R1_001.fastq.gz",
+         TEST_DATA / "LTB-A-BC001_S1_L003_R2_001.fastq.gz"],
+    ]
+    sample_sheet = tmp_path / "samples.tsv"
+    sample_sheet.write_text("# input\tinput_reverse\n\n" + "".join(
+        "\t".join(map(str, sample)) + "\n" for sample in samples))
+    sys.argv = ["", "--jobs", "2", str(sample_sheet),
+                "--dir", str(tmp_path / "batch")]
+    sequali_batch()
+    for sample in samples:
+        sys.argv = ["", "--threads", "1", "--dir", str(tmp_path / "single"),
+                    *map(str, sample)]
+        main()
+        name = sample[0].name + ".json"
+        single = json.loads((tmp_path / "single" / name).read_text())
+        batch = json.loads((tmp_path / "batch" / name).read_text())
+        assert single.keys() == batch.keys()
+        for key in single:
+            if key != "meta":
+                assert batch[key] == single[key]
+
+
+def test_batch_failed_sample(tmp_path):
+    sample_sheet = tmp_path / "samples.tsv"
+    sample_sheet.write_text(f"{TEST_DATA / 'simple.fastq'}\n"
+                            f"{tmp_path / 'missing.fastq'}\n")
+    sys.argv = ["", str(sample_sheet), "--dir", str(tmp_path)]
+    with pytest.raises(SystemExit) as error:
+        sequali_batch()
+    error.match("1 of 2 samples failed")
+    assert (tmp_path / "simple.fastq.json").exists()
+
+
+def test_batch_rejects_output_names(tmp_path):
+    sample_sheet = tmp_path / "samples.tsv"
+    sample_sheet.write_text(f"{TEST_DATA / 'simple.fastq'}\n")
+    sys.argv = ["", str(sample_sheet), "--json", "report.json"]
+    with pytest.raises(SystemExit):
+        sequali_batch()
+    assert not (tmp_path / "report.json").exists()
+
+
+def test_sequali_report(tmp_path):
+    fastq = TEST_DATA / "100_illumina_adapters.fastq"
+    sys.argv = ["", "--dir", str(tmp_path), str(fastq)]
+    main()
+    json_path = tmp_path / (fastq.name + ".json")
+    expected = (tmp_path / (fastq.name + ".html")).read_text()
+    cache_dir = tmp_path / "cache"
+    html_path = tmp_path / "report.html"
+    for _ in range(2):
+        sys.argv = ["", "--threads", "2", "--cache-dir", str(cache_dir),
+                    "-o", str(html_path), str(json_path)]
+        sequali_report()
+        assert html_path.read_text() == expected
+        assert len(list(cache_dir.iterdir())) > 0
+    sys.argv = ["", "--lazy-plots", "-o", str(html_path), str(json_path)]
+    sequali_report()
+    assert 'id="metadata"' in html_path.read_text()
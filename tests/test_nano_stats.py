@@ -40,10 +40,96 @@ def test_nano_stats():
     nanostats.add_read(view)
     assert nanostats.minimum_time == timestamp
     assert nanostats.maximum_time == timestamp
-    nano_info_list = list(nanostats.nano_info_iterator())
-    assert len(nano_info_list) == 1
-    info = nano_info_list[0]
-    assert info.start_time == timestamp
-    assert info.channel_id == 444
-    assert info.length == 4
-    assert info.cumulative_error_rate == cumulative_error_rate
+    assert nanostats.time_bucket_width == 60
+    assert nanostats.time_buckets() == [
+        (timestamp // 60 * 60, 1, 4, 1, [0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0])]
+    assert nanostats.channel_stats() == [(444, 1, 4, cumulative_error_rate)]
+    assert list(nanostats.translocation_speeds()) == [0] * 81
+
+
+def test_nano_stats_rebucket():
+    nanostats = NanoStats()
+    # Reads spanning 10 days do not fit in 256 one minute buckets.
+    for day in range(10, 0, -1):
+        nanostats.add_read(FastqRecordView(
+            f"read{day} start_time=2021-09-{day:02}T11:34:08Z ch={day}",
+            "ACGT", "AAAA"))
+    width = nanostats.time_bucket_width
+    assert width > 60
+    assert width // 60 & (width // 60 - 1) == 0
+    assert 9 * 24 * 3600 // width < 256
+    buckets = nanostats.time_buckets()
+    assert len(buckets) <= 256
+    assert buckets[0][0] <= nanostats.minimum_time < buckets[0][0] + width
+    assert buckets[-1][0] <= nanostats.maximum_time < buckets[-1][0] + width
+    assert sum(bucket[1] for bucket in buckets) == 10
+    assert sum(bucket[2] for bucket in buckets) == 40
+    assert sum(bucket[3] for bucket in buckets) == 10
+    assert [channel[0] for channel in nanostats.channel_stats()] == list(
+        range(1, 11))
+
+
+def test_nano_stats_merge():
+    view1 = FastqRecordView(
+        "read1 start_time=2021-09-30T11:34:08Z ch=444", "ACGT", "AAAA")
+    view2 = FastqRecordView(
+        "read2 start_time=2021-09-30T12:34:08Z ch=3", "ACGTAA", "BBBBBB")
+    nanostats1 = NanoStats()
+    nanostats1.add_read(view1)
+    nanostats2 = NanoStats()
+    nanostats2.add_read(view2)
+    nanostats1.merge(nanostats2)
+    assert [channel[0] for channel in nanostats1.channel_stats()] == [3, 444]
+    assert nanostats1.maximum_time - nanostats1.minimum_time == 3600
+    assert nanostats1.number_of_reads == 2
+    buckets = nanostats1.time_buckets()
+    assert len(buckets) == 61
+    assert [bucket[1] for bucket in buckets] == [1] + [0] * 59 + [1]
+
+
+def test_nano_stats_merge_skipped():
+    nanostats1 = NanoStats()
+    nanostats1.add_read(FastqRecordView(
+        "read1 start_time=2021-09-30T11:34:08Z ch=444", "ACGT", "AAAA"))
+    nanostats2 = NanoStats()
+    nanostats2.add_read(FastqRecordView("not_nanopore", "ACGT", "AAAA"))
+    assert nanostats2.skipped_reason is not None
+    nanostats1.merge(nanostats2)
+    assert nanostats1.skipped_reason == nanostats2.skipped_reason
+
+
+def test_nano_stats_dump_load():
+    nanostats = NanoStats()
+    nanostats.add_read(FastqRecordView(
+        "read1 start_time=2021-09-30T11:34:08Z ch=444", "ACGT", "AAAA"))
+    nanostats.add_read(FastqRecordView(
+        "read2 start_time=2021-09-30T12:34:08Z ch=3", "ACGTAA", "BBBBBB"))
+    loaded = NanoStats.load(nanostats.dump())
+    assert loaded.number_of_reads == nanostats.number_of_reads
+    assert loaded.minimum_time == nanostats.minimum_time
+    assert loaded.maximum_time == nanostats.maximum_time
+    assert loaded.time_bucket_width == nanostats.time_bucket_width
+    assert loaded.time_buckets() == nanostats.time_buckets()
+    assert loaded.channel_stats() == nanostats.channel_stats()
+    assert loaded.translocation_speeds() == nanostats.translocation_speeds()
+
+
+def test_nano_stats_merge_different_bucket_width():
+    views = [FastqRecordView(
+        f"read{day} start_time=2021-09-{day:02}T11:34:08Z ch={day}",
+        "ACGT", "AAAA") for day in range(1, 11)]
+    views.append(FastqRecordView(
+        "read11 start_time=2021-09-05T11:34:50Z ch=200", "ACGTAA", "BBBBBB"))
+    wide = NanoStats()
+    for view in views[:10]:
+        wide.add_read(view)
+    narrow = NanoStats()
+    narrow.add_read(views[10])
+    expected = NanoStats()
+    for view in views:
+        expected.add_read(view)
+    narrow.merge(wide)
+    assert narrow.time_bucket_width == expected.time_bucket_width
+    assert narrow.time_buckets() == expected.time_buckets()
+    assert narrow.channel_stats() == expected.channel_stats()
+    assert narrow.number_of_reads == 11
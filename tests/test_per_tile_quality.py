@@ -14,6 +14,8 @@
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
+import random
+
 import pytest
 
 from sequali import FastqRecordView, PerTileQuality
@@ -42,6 +44,24 @@ def test_per_tile_quality():
     assert count_list == [1, 1, 1, 1]
 
 
+def test_per_tile_quality_ranges():
+    ptq = PerTileQuality()
+    for header, sequence, qualities in (
+            ("SIM:1:FCX:1:15:6329:1045 1:N:0:ATCCGA", "AAAAAA", "ABCDEF"),
+            ("SIM:1:FCX:1:15:6329:1046 1:N:0:ATCCGA", "AAA", "III"),
+            ("SIM:1:FCX:1:16:6329:1045 1:N:0:ATCCGA", "AAAAA", "#####")):
+        ptq.add_read(FastqRecordView(header, sequence, qualities))
+    ranges = [(0, 2), (2, 2), (2, 6)]
+    for (tile, sums, counts), (range_tile, range_sums, range_counts) in zip(
+            ptq.get_tile_counts(), ptq.get_tile_counts(ranges)):
+        assert tile == range_tile
+        assert range_sums == [sum(sums[start:stop]) for start, stop in ranges]
+        assert range_counts == [
+            sum(counts[start:stop]) for start, stop in ranges]
+    with pytest.raises(ValueError):
+        ptq.get_tile_counts([(0, 7)])
+
+
 @pytest.mark.parametrize("tile_id", list(range(100)) + [1234, 99239])
 def test_tile_parse_correct(tile_id):
     read = FastqRecordView(
@@ -57,6 +77,25 @@ def test_tile_parse_correct(tile_id):
     assert tile == tile_id
 
 
+def test_tile_parse_consecutive_headers():
+    # Tile 15 is a prefix of tile 150, and the last read only shares the
+    # part before the tile ID with the previous read.
+    headers = [
+        "SIM:1:FCX:1:15:6329:1045 1:N:0:ATCCGA",
+        "SIM:1:FCX:1:15:6330:1046 1:N:0:ATCCGA",
+        "SIM:1:FCX:1:150:6329:1045 1:N:0:ATCCGA",
+        "SIM:1:FCX:1:15:6329:1045 1:N:0:ATCCGA",
+        "SIM:1:FCX:1:1",
+    ]
+    ptq = PerTileQuality()
+    for header in headers[:-1]:
+        ptq.add_read(FastqRecordView(header, "AAAA", "ABCD"))
+    assert [(tile, counts) for tile, _, counts in ptq.get_tile_counts()] == [
+        (15, [3, 3, 3, 3]), (150, [1, 1, 1, 1])]
+    ptq.add_read(FastqRecordView(headers[-1], "AAAA", "ABCD"))
+    assert ptq.skipped_reason is not None
+
+
 def test_per_tile_quality_not_view():
     ptq = PerTileQuality()
     with pytest.raises(TypeError) as error:
@@ -83,3 +122,111 @@ def test_per_tile_quality_skip(header):
     assert ptq.number_of_reads == 0
     assert ptq.max_length == 0
     assert header in ptq.skipped_reason
+
+
+def test_per_tile_quality_merge():
+    read1 = FastqRecordView(
+        "SIM:1:FCX:1:15:6329:1045:GATTACT+GTCTTAAC 1:N:0:ATCCGA",
+        "AAAA", "ABCD")
+    read2 = FastqRecordView(
+        "SIM:1:FCX:1:3:6329:1045:GATTACT+GTCTTAAC 1:N:0:ATCCGA",
+        "AAAAAA", "ABCDEF")
+    expected = PerTileQuality()
+    expected.add_read(read1)
+    expected.add_read(read2)
+    expected.add_read(read1)
+    ptq1 = PerTileQuality()
+    ptq1.add_read(read1)
+    ptq2 = PerTileQuality()
+    ptq2.add_read(read2)
+    ptq2.add_read(read1)
+    ptq1.merge(ptq2)
+    assert ptq1.number_of_reads == expected.number_of_reads
+    assert ptq1.max_length == expected.max_length
+    assert ptq1.get_tile_counts() == expected.get_tile_counts()
+
+
+def test_per_tile_quality_merge_skipped():
+    ptq1 = PerTileQuality()
+    ptq2 = PerTileQuality()
+    ptq2.add_read(FastqRecordView("SIMULATED_NAME", "AAAA", "ABCD"))
+    ptq1.merge(ptq2)
+    assert ptq1.skipped_reason == ptq2.skipped_reason
+
+
+def test_per_tile_quality_dump_load():
+    ptq = PerTileQuality()
+    ptq.add_read(FastqRecordView(
+        "SIM:1:FCX:1:15:6329:1045:GATTACT+GTCTTAAC 1:N:0:ATCCGA",
+        "AAAA", "ABCD"))
+    ptq.add_read(FastqRecordView(
+        "SIM:1:FCX:1:3:6329:1045:GATTACT+GTCTTAAC 1:N:0:ATCCGA",
+        "AAAAAA", "ABCDEF"))
+    loaded = PerTileQuality.load(ptq.dump())
+    assert loaded.number_of_reads == ptq.number_of_reads
+    assert loaded.max_length == ptq.max_length
+    assert loaded.skipped_reason is None
+    assert loaded.get_tile_counts() == ptq.get_tile_counts()
+
+
+def test_per_tile_quality_dump_load_skipped():
+    ptq = PerTileQuality()
+    ptq.add_read(FastqRecordView("SIMULATED_NAME", "AAAA", "ABCD"))
+    loaded = PerTileQuality.load(ptq.dump())
+    assert loaded.skipped_reason == ptq.skipped_reason
+
+
+def test_per_tile_quality_binned_same_as_exact():
+    header = "SIM:1:FCX:1:15:6329:1045:GATTACT+GTCTTAAC 1:N:0:ATCCGA"
+    exact = PerTileQuality()
+    binned = PerTileQuality(exact_positions=64)
+    for length in [1, 64, 65, 130, 1000]:
+        read = FastqRecordView(header, length * "A", length * "I")
+        exact.add_read(read)
+        binned.add_read(read)
+    ranges = binned.position_ranges()
+    assert binned.exact_positions == 64
+    assert ranges[-1][1] == 1000
+    [(_, exact_errors, exact_counts)] = exact.get_tile_counts()
+    [(tile, binned_errors, binned_counts)] = binned.get_tile_counts()
+    assert tile == 15
+    assert binned_counts == [sum(exact_counts[start:stop])
+                             for start, stop in ranges]
+    for (start, stop), errors in zip(ranges, binned_errors):
+        assert errors == pytest.approx(sum(exact_errors[start:stop]))
+    loaded = PerTileQuality.load(binned.dump())
+    assert loaded.exact_positions == 64
+    assert loaded.get_tile_counts() == binned.get_tile_counts()
+
+
+def test_per_tile_quality_merge_exact_positions_mismatch():
+    ptq = PerTileQuality(exact_positions=128)
+    with pytest.raises(ValueError) as error:
+        ptq.merge(PerTileQuality())
+    error.match("exact_positions")
+
+
+@pytest.mark.parametrize("unexpected_position", [None, 5, 100, 127])
+def test_per_tile_quality_quality_bins(unexpected_position):
+    rng = random.Random(15)
+    ptq = PerTileQuality()
+    expected = {}
+    for i in range(1200):
+        tile = rng.choice([1101, 1102])
+        header = f"SIM:1:FCX:1:{tile}:6329:{i}:GATTACT+GTCTTAAC 1:N:0:ATCCGA"
+        phreds = rng.choices([2, 12, 23, 37], k=150)
+        if i == 1100 and unexpected_position is not None:
+            phreds[unexpected_position] = 30
+        ptq.add_read(FastqRecordView(
+            header, 150 * "A", "".join(chr(q + 33) for q in phreds)))
+        errors = expected.setdefault(tile, [0.0] * 150)
+        for j, q in enumerate(phreds):
+            errors[j] += 10 ** (-q / 10)
+    bins = ptq.profile()["quality_bins"]
+    if unexpected_position is None:
+        # None when the CPU has no vectorized quality bin kernel.
+        assert bins in ([2, 12, 23, 37], None)
+    else:
+        assert bins is None
+    for tile, errors, _ in ptq.get_tile_counts():
+        assert errors == expected[tile]
@@ -0,0 +1,124 @@
+# Copyright (C) 2023 Leiden University Medical Center
+# This file is part of Sequali
+#
+# Sequali is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# Sequali is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Sequali.  If not, see <https://www.gnu.org/licenses/
+
+
+import pytest
+
+from sequali import FastqRecordArrayView, FastqRecordView
+from sequali._qc import (DEDUP_ESTIMATOR_ENTRY_SIZE,
+                         DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS,
+                         DEFAULT_MAX_UNIQUE_FRAGMENTS,
+                         DEFAULT_UNIQUE_SAMPLE_EVERY, FRAGMENT_BUCKET_SLOTS,
+                         FRAGMENT_BUCKET_SIZE, DedupEstimator,
+                         SequenceDuplication)
+from sequali.pipeline import (MEMORY_BUDGET_MINIMUM_RESERVED, Collectors,
+                              ConvergenceMonitor, dedup_estimator_memory,
+                              plan_memory, sequence_duplication_memory)
+
+MiB = 1024 * 1024
+
+
+@pytest.mark.parametrize("max_unique_fragments", [1, 7, 1000, 123456])
+def test_sequence_duplication_memory(max_unique_fragments):
+    seqdup = SequenceDuplication(max_unique_fragments)
+    slots = seqdup.profile()["hash_table_slots"]
+    assert (slots // FRAGMENT_BUCKET_SLOTS * FRAGMENT_BUCKET_SIZE ==
+            sequence_duplication_memory(max_unique_fragments))
+
+
+@pytest.mark.parametrize("max_stored_fingerprints", [100, 179, 65536, 99999])
+def test_dedup_estimator_memory(max_stored_fingerprints):
+    dedup_est = DedupEstimator(max_stored_fingerprints)
+    assert (dedup_est._hash_table_size * DEDUP_ESTIMATOR_ENTRY_SIZE ==
+            dedup_estimator_memory(max_stored_fingerprints))
+
+
+def test_plan_memory_large_budget_uses_defaults():
+    plan = plan_memory(64 * 1024 * MiB)
+    assert plan.max_unique_fragments == DEFAULT_MAX_UNIQUE_FRAGMENTS
+    assert plan.sample_every == DEFAULT_UNIQUE_SAMPLE_EVERY
+    assert plan.max_stored_fingerprints == DEFAULT_DEDUP_MAX_STORED_FINGERPRINTS
+
+
+@pytest.mark.parametrize("max_memory", [130 * MiB, 200 * MiB, 300 * MiB,
+                                        1024 * MiB])
+@pytest.mark.parametrize("workers", [1, 3])
+@pytest.mark.parametrize("paired", [False, True])
+@pytest.mark.parametrize("sketch", [False, True])
+def test_plan_memory_fits(max_memory, workers, paired, sketch):
+    plan = plan_memory(max_memory, workers, paired, sketch)
+    tables_memory = workers * (
+        sequence_duplication_memory(plan.max_unique_fragments) *
+        (2 if paired else 1) +
+        dedup_estimator_memory(plan.max_stored_fingerprints, sketch))
+    assert tables_memory <= max_memory - MEMORY_BUDGET_MINIMUM_RESERVED
+    # Sample less often when fewer fragments can be stored.
+    assert (plan.sample_every * plan.max_unique_fragments >=
+            DEFAULT_UNIQUE_SAMPLE_EVERY * DEFAULT_MAX_UNIQUE_FRAGMENTS)
+
+
+def test_plan_memory_too_small():
+    with pytest.raises(ValueError) as error:
+        plan_memory(MEMORY_BUDGET_MINIMUM_RESERVED)
+    error.match("too small")
+
+
+def monitored_reads(monitor, collectors, number_of_arrays):
+    array = FastqRecordArrayView(
+        [FastqRecordView(f"read{i}", "GATTACA" * 10, "I" * 70)
+         for i in range(1000)])
+    for i in range(number_of_arrays):
+        collectors.add_record_array(array)
+        if monitor.converged(collectors):
+            return i + 1
+    return None
+
+
+def test_convergence_monitor_converges():
+    collectors = Collectors(["AGATCGGAAGAGC"])
+    monitor = ConvergenceMonitor(0.01, min_reads=1000)
+    arrays = monitored_reads(monitor, collectors, 100)
+    assert arrays is not None
+    # Identical reads do not change, so the three checks after the first
+    # one at min_reads are stable.
+    assert arrays == 4
+
+
+def test_convergence_monitor_min_reads():
+    collectors = Collectors(["AGATCGGAAGAGC"])
+    monitor = ConvergenceMonitor(0.01, min_reads=50_000)
+    assert monitored_reads(monitor, collectors, 49) is None
+
+
+def test_convergence_monitor_paired():
+    # Paired collectors have no adapter counter.
+    collectors = Collectors(["AGATCGGAAGAGC"], paired=True)
+    monitor = ConvergenceMonitor(0.01, min_reads=1000)
+    array = FastqRecordArrayView(
+        [FastqRecordView(f"read{i}", "GATTACA" * 10, "I" * 70)
+         for i in range(1000)])
+    for i in range(100):
+        collectors.add_record_array_pair(array, array)
+        if monitor.converged(collectors):
+            break
+    assert i + 1 == 4
+
+
+@pytest.mark.parametrize("tolerance", [0.0, 1.0, -0.5, 2])
+def test_convergence_monitor_invalid_tolerance(tolerance):
+    with pytest.raises(ValueError) as error:
+        ConvergenceMonitor(tolerance)
+    error.match("tolerance")
@@ -15,10 +15,14 @@
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
 import math
+import random
+
+import pytest
 
 from sequali import A, C, G, N, T
-from sequali import FastqRecordView, QCMetrics
+from sequali import FastqRecordView, PerTileQuality, QCMetrics
 from sequali import NUMBER_OF_NUCS, NUMBER_OF_PHREDS
+from sequali import report_modules
 
 
 def view_from_sequence(sequence: str) -> FastqRecordView:
@@ -105,3 +109,259 @@ def test_average_long_quality():
     phred = -10 * math.log10(error_rate)
     metrics.add_read(FastqRecordView("name", sequence, qualities))
     assert metrics.phred_scores()[math.floor(phred)] == 1
+
+
+@pytest.mark.parametrize("length", [1, 4, 5, 31, 32, 33, 36, 37, 64, 65, 151])
+def test_qc_metrics_vector_boundaries(length):
+    # The counting kernels process 32 bytes at a time when the CPU supports
+    # it. Check per position results just around the chunk boundaries.
+    rng = random.Random(length)
+    sequence = "".join(rng.choices("ACGTNacgtnRY", k=length))
+    qualities = "".join(chr(rng.randint(0, 93) + 33) for _ in range(length))
+    metrics = QCMetrics()
+    metrics.add_read(FastqRecordView("name", sequence, qualities))
+    base_array = metrics.base_count_table()
+    phred_array = metrics.phred_count_table()
+    nuc_index = {"A": A, "C": C, "G": G, "T": T}
+    for i, (nuc, qual) in enumerate(zip(sequence, qualities)):
+        index = nuc_index.get(nuc.upper(), N)
+        assert base_array[i * NUMBER_OF_NUCS + index] == 1
+        phred_index = min(ord(qual) - 33, 47) // 4
+        assert phred_array[i * NUMBER_OF_PHREDS + phred_index] == 1
+    assert sum(base_array) == length
+    assert sum(phred_array) == length
+    at = sum(1 for nuc in sequence if nuc.upper() in "AT")
+    gc = sum(1 for nuc in sequence if nuc.upper() in "GC")
+    if at + gc:
+        gc_index = round(gc * 100 / (at + gc))
+        assert metrics.gc_content()[gc_index] == 1
+    # Replicate the summation order of the four accumulators.
+    accumulators = [0.0, 0.0, 0.0, 0.0]
+    i = 0
+    while i + 4 < length:
+        for j in range(4):
+            accumulators[j] += 10 ** (-(ord(qualities[i + j]) - 33) / 10)
+        i += 4
+    error_rate = ((accumulators[0] + accumulators[1]) + accumulators[2]
+                  ) + accumulators[3]
+    for qual in qualities[i:]:
+        error_rate += 10 ** (-(ord(qual) - 33) / 10)
+    phred = math.floor(-10 * math.log10(error_rate / length))
+    assert metrics.phred_scores()[phred] == 1
+
+
+def test_qc_metrics_merge():
+    reads = [
+        FastqRecordView("name", "ACGTN", "IIII#"),
+        FastqRecordView("name", "GGCCAATT", "ABCDEFGH"),
+        FastqRecordView("name", "A", "!"),
+    ]
+    expected = QCMetrics()
+    for read in reads:
+        expected.add_read(read)
+    metrics1 = QCMetrics()
+    metrics1.add_read(reads[0])
+    metrics2 = QCMetrics()
+    metrics2.add_read(reads[1])
+    metrics2.add_read(reads[2])
+    metrics1.merge(metrics2)
+    assert metrics1.number_of_reads == expected.number_of_reads
+    assert metrics1.max_length == expected.max_length
+    assert metrics1.base_count_table() == expected.base_count_table()
+    assert metrics1.phred_count_table() == expected.phred_count_table()
+    assert metrics1.gc_content() == expected.gc_content()
+    assert metrics1.phred_scores() == expected.phred_scores()
+
+
+def test_qc_metrics_merge_wrong_type():
+    metrics = QCMetrics()
+    with pytest.raises(TypeError) as error:
+        metrics.merge("metrics")  # type: ignore
+    error.match("QCMetrics")
+    with pytest.raises(ValueError) as error:
+        metrics.merge(metrics)
+    error.match("itself")
+
+
+def test_qc_metrics_dump_load():
+    metrics = QCMetrics()
+    metrics.add_read(FastqRecordView("name", "ACGTN", "IIII#"))
+    metrics.add_read(FastqRecordView("name", "GGCCAATT", "ABCDEFGH"))
+    loaded = QCMetrics.load(metrics.dump())
+    assert loaded.number_of_reads == metrics.number_of_reads
+    assert loaded.max_length == metrics.max_length
+    assert loaded.base_count_table() == metrics.base_count_table()
+    assert loaded.phred_count_table() == metrics.phred_count_table()
+    assert loaded.gc_content() == metrics.gc_content()
+    assert loaded.phred_scores() == metrics.phred_scores()
+
+
+@pytest.mark.parametrize("data", [
+    b"",
+    b"not a state",
+    QCMetrics().dump()[:-1],
+    QCMetrics().dump() + b"\0",
+    PerTileQuality().dump(),
+])
+def test_qc_metrics_load_invalid(data):
+    with pytest.raises(ValueError):
+        QCMetrics.load(data)
+
+
+def random_read(length: int) -> FastqRecordView:
+    sequence = "".join(random.choices("ACGTN", k=length))
+    qualities = "".join(chr(33 + random.randrange(45)) for _ in range(length))
+    return FastqRecordView("name", sequence, qualities)
+
+
+def test_qc_metrics_position_ranges():
+    metrics = QCMetrics(exact_positions=64)
+    assert metrics.exact_positions == 64
+    assert metrics.position_ranges() == []
+    metrics.add_read(view_from_sequence(300 * "A"))
+    ranges = metrics.position_ranges()
+    assert ranges[:64] == [(i, i + 1) for i in range(64)]
+    assert ranges[64:128] == [(i, i + 1) for i in range(64, 128)]
+    assert ranges[128:192] == [(i, i + 2) for i in range(128, 256, 2)]
+    assert ranges[192:] == [(256, 260), (260, 264), (264, 268), (268, 272),
+                            (272, 276), (276, 280), (280, 284), (284, 288),
+                            (288, 292), (292, 296), (296, 300)]
+    assert len(metrics.base_count_table()) == len(ranges) * NUMBER_OF_NUCS
+    assert len(metrics.phred_count_table()) == len(ranges) * NUMBER_OF_PHREDS
+    assert len(metrics.length_count_table()) == len(ranges)
+    assert metrics.length_count_table()[-1] == 1
+
+
+@pytest.mark.parametrize("exact_positions", [0, 1, 63, 100, -64])
+def test_qc_metrics_exact_positions_invalid(exact_positions):
+    with pytest.raises(ValueError) as error:
+        QCMetrics(exact_positions=exact_positions)
+    error.match("exact_positions")
+
+
+def test_qc_metrics_count_tables_ranges():
+    random.seed(12)
+    metrics = QCMetrics()
+    for length in (0, 5, 17, 40, 41):
+        metrics.add_read(random_read(length))
+    ranges = [(0, 3), (3, 10), (10, 10), (10, 41)]
+    assert metrics.base_count_table(ranges) == \
+        report_modules.aggregate_count_matrix(
+            metrics.base_count_table(), ranges, NUMBER_OF_NUCS)
+    assert metrics.phred_count_table(ranges=ranges) == \
+        report_modules.aggregate_count_matrix(
+            metrics.phred_count_table(), ranges, NUMBER_OF_PHREDS)
+    assert len(metrics.base_count_table([])) == 0
+    with pytest.raises(ValueError):
+        metrics.base_count_table([(0, 42)])
+    with pytest.raises(ValueError):
+        metrics.phred_count_table([(3, 2)])
+    with pytest.raises(TypeError):
+        metrics.base_count_table([[0, 1]])
+
+
+def test_qc_metrics_binned_same_as_exact():
+    random.seed(11)
+    reads = [random_read(length) for length in
+             [0, 1, 63, 64, 65, 127, 128, 129, 300, 1000, 4096]]
+    exact = QCMetrics()
+    binned = QCMetrics(exact_positions=64)
+    for read in reads:
+        exact.add_read(read)
+        binned.add_read(read)
+    ranges = binned.position_ranges()
+    assert ranges[-1][1] == exact.max_length == binned.max_length
+    assert binned.base_count_table() == report_modules.aggregate_count_matrix(
+        exact.base_count_table(), ranges, NUMBER_OF_NUCS)
+    assert binned.phred_count_table() == report_modules.aggregate_count_matrix(
+        exact.phred_count_table(), ranges, NUMBER_OF_PHREDS)
+    exact_lengths = exact.length_count_table()
+    assert binned.length_count_table().tolist() == [
+        sum(exact_lengths[start:stop]) for start, stop in ranges]
+    assert binned.gc_content() == exact.gc_content()
+    assert binned.phred_scores() == exact.phred_scores()
+
+
+def test_qc_metrics_binned_merge_dump_load():
+    random.seed(12)
+    expected = QCMetrics(exact_positions=64)
+    metrics1 = QCMetrics(exact_positions=64)
+    metrics2 = QCMetrics(exact_positions=64)
+    for i, length in enumerate([10, 200, 70, 1500, 3]):
+        read = random_read(length)
+        expected.add_read(read)
+        (metrics1 if i % 2 else metrics2).add_read(read)
+    metrics1.merge(QCMetrics.load(metrics2.dump()))
+    assert metrics1.exact_positions == 64
+    assert metrics1.max_length == expected.max_length
+    assert metrics1.base_count_table() == expected.base_count_table()
+    assert metrics1.phred_count_table() == expected.phred_count_table()
+    assert metrics1.length_count_table() == expected.length_count_table()
+
+
+def test_qc_metrics_merge_exact_positions_mismatch():
+    metrics = QCMetrics(exact_positions=64)
+    with pytest.raises(ValueError) as error:
+        metrics.merge(QCMetrics())
+    error.match("exact_positions")
+
+
+def novaseq_reads(number_of_reads, length, seed):
+    rng = random.Random(seed)
+    return [
+        FastqRecordView(
+            "name",
+            "".join(rng.choices("ACGT", k=length)),
+            "".join(chr(q + 33) for q in rng.choices([2, 12, 23, 37], k=length)))
+        for _ in range(number_of_reads)
+    ]
+
+
+def check_qc_metrics_tables(metrics, reads):
+    length = metrics.max_length
+    phred_array = metrics.phred_count_table()
+    expected_array = [0] * (length * NUMBER_OF_PHREDS)
+    expected_scores = [0] * len(metrics.phred_scores())
+    for read in reads:
+        qualities = read.qualities()
+        for i, qual in enumerate(qualities):
+            phred_index = min(ord(qual) - 33, 47) // 4
+            expected_array[i * NUMBER_OF_PHREDS + phred_index] += 1
+        accumulators = [0.0, 0.0, 0.0, 0.0]
+        i = 0
+        while i + 4 < len(qualities):
+            for j in range(4):
+                accumulators[j] += 10 ** (-(ord(qualities[i + j]) - 33) / 10)
+            i += 4
+        error_rate = ((accumulators[0] + accumulators[1]) + accumulators[2]
+                      ) + accumulators[3]
+        for qual in qualities[i:]:
+            error_rate += 10 ** (-(ord(qual) - 33) / 10)
+        phred = -10 * math.log10(error_rate / len(qualities))
+        expected_scores[math.floor(phred)] += 1
+    assert phred_array.tolist() == expected_array
+    assert metrics.phred_scores().tolist() == expected_scores
+
+
+def test_qc_metrics_quality_bins():
+    reads = novaseq_reads(1500, 151, seed=13)
+    metrics = QCMetrics()
+    for read in reads:
+        metrics.add_read(read)
+    # None when the CPU has no vectorized quality bin kernel.
+    assert metrics.profile()["quality_bins"] in ([2, 12, 23, 37], None)
+    check_qc_metrics_tables(metrics, reads)
+
+
+def test_qc_metrics_quality_bins_fallback():
+    reads = novaseq_reads(1100, 151, seed=14)
+    metrics = QCMetrics()
+    for read in reads[:1050]:
+        metrics.add_read(read)
+    qualities = reads[1050].qualities()
+    reads[1050] = FastqRecordView(
+        "name", reads[1050].sequence(), qualities[:40] + "?" + qualities[41:])
+    for read in reads[1050:]:
+        metrics.add_read(read)
+    assert metrics.profile()["quality_bins"] is None
+    check_qc_metrics_tables(metrics, reads)
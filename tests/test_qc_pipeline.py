@@ -0,0 +1,144 @@
+# Copyright (C) 2023 Leiden University Medical Center
+# This file is part of Sequali
+#
+# Sequali is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# Sequali is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Sequali.  If not, see <https://www.gnu.org/licenses/
+
+import gzip
+from pathlib import Path
+
+import pytest
+
+from sequali import FastqParser, FastqRecordView
+from sequali._qc import (AdapterCounter, DedupEstimator, NanoStats,
+                         PerTileQuality, QCMetrics, QCPipeline,
+                         SequenceDuplication)
+
+TEST_DATA = Path(__file__).parent / "data"
+
+ADAPTERS = ["AGATCGGAAGAG", "CTGTCTCTTATA"]
+
+
+def create_modules():
+    return dict(
+        metrics=QCMetrics(),
+        per_tile_quality=PerTileQuality(),
+        sequence_duplication=SequenceDuplication(sample_every=1),
+        nanostats=NanoStats(),
+        adapter_counter=AdapterCounter(ADAPTERS),
+        dedup_estimator=DedupEstimator(),
+    )
+
+
+@pytest.mark.parametrize("profiling", [False, True])
+@pytest.mark.parametrize("filename", [
+    "LTB-A-BC001_S1_L003_R1_001.fastq.gz",
+    "100_nanopore_reads.fastq.gz",
+])
+def test_qc_pipeline_same_as_separate_modules(filename, profiling):
+    with gzip.open(TEST_DATA / filename, "rb") as fastq_file:
+        record_arrays = list(FastqParser(fastq_file))
+    separate = create_modules()
+    for record_array in record_arrays:
+        for module in separate.values():
+            module.add_record_array(record_array)
+    fused = create_modules()
+    # With profiling the modules are run one after another.
+    fused["metrics"].profiling = profiling
+    pipeline = QCPipeline(**fused)
+    for record_array in record_arrays:
+        pipeline.add_record_array(record_array)
+    assert (fused["metrics"].base_count_table() ==
+            separate["metrics"].base_count_table())
+    assert (fused["metrics"].phred_count_table() ==
+            separate["metrics"].phred_count_table())
+    assert (fused["metrics"].phred_scores() ==
+            separate["metrics"].phred_scores())
+    assert (fused["per_tile_quality"].get_tile_counts() ==
+            separate["per_tile_quality"].get_tile_counts())
+    assert (fused["per_tile_quality"].skipped_reason ==
+            separate["per_tile_quality"].skipped_reason)
+    assert (fused["sequence_duplication"].sequence_counts() ==
+            separate["sequence_duplication"].sequence_counts())
+    assert (fused["nanostats"].time_buckets() ==
+            separate["nanostats"].time_buckets())
+    assert (fused["nanostats"].channel_stats() ==
+            separate["nanostats"].channel_stats())
+    assert (fused["adapter_counter"].get_counts() ==
+            separate["adapter_counter"].get_counts())
+    assert (sorted(fused["dedup_estimator"].duplication_counts()) ==
+            sorted(separate["dedup_estimator"].duplication_counts()))
+
+
+def test_qc_pipeline_profile():
+    with gzip.open(TEST_DATA / "LTB-A-BC001_S1_L003_R1_001.fastq.gz",
+                   "rb") as fastq_file:
+        record_arrays = list(FastqParser(fastq_file))
+    number_of_records = sum(len(record_array)
+                            for record_array in record_arrays)
+    number_of_bases = sum(len(record.sequence()) for record_array in
+                          record_arrays for record in record_array)
+    modules = create_modules()
+    for module in modules.values():
+        module.profiling = True
+    pipeline = QCPipeline(**modules)
+    for record_array in record_arrays:
+        pipeline.add_record_array(record_array)
+    for module in modules.values():
+        profile = module.profile()
+        assert profile["seconds"] > 0.0
+        assert profile["record_arrays"] == len(record_arrays)
+        assert profile["records"] == number_of_records
+        assert profile["bases"] == number_of_bases
+    assert modules["metrics"].profile()["staging_flushes"] == 0
+    modules["metrics"].base_count_table()
+    assert modules["metrics"].profile()["staging_flushes"] == 1
+    duplication_profile = modules["sequence_duplication"].profile()
+    assert 0 < duplication_profile["hash_table_entries"] <= \
+        duplication_profile["hash_table_slots"]
+    assert 0 < duplication_profile["hash_table_lookups"] <= \
+        modules["sequence_duplication"].total_fragments
+    # Without profiling only the counters that cost no time are kept.
+    unprofiled = QCMetrics()
+    QCPipeline(metrics=unprofiled).add_record_array(record_arrays[0])
+    assert unprofiled.profile()["seconds"] == 0.0
+    assert unprofiled.profile()["records"] == 0
+
+
+def test_qc_pipeline_members():
+    modules = create_modules()
+    pipeline = QCPipeline(**modules)
+    for name, module in modules.items():
+        assert getattr(pipeline, name) is module
+    empty_pipeline = QCPipeline()
+    for name in modules:
+        assert getattr(empty_pipeline, name) is None
+
+
+def test_qc_pipeline_wrong_type():
+    with pytest.raises(TypeError) as error:
+        QCPipeline(metrics=PerTileQuality())
+    error.match("QCMetrics")
+
+
+def test_qc_pipeline_nanostats_without_metrics():
+    with pytest.raises(ValueError) as error:
+        QCPipeline(nanostats=NanoStats())
+    error.match("metrics")
+
+
+def test_qc_pipeline_add_record_array_no_record_array():
+    pipeline = QCPipeline(metrics=QCMetrics())
+    with pytest.raises(TypeError) as error:
+        pipeline.add_record_array(FastqRecordView("name", "A", "A"))
+    error.match("FastqRecordArrayView")
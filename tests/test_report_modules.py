@@ -16,6 +16,8 @@
 
 import array
 
+import pytest
+
 from sequali import report_modules
 
 
@@ -27,3 +29,64 @@ def test_per_position_mean_quality_one_nuc():
         ['1']
     )
     assert module
+
+
+def test_bin_data_ranges():
+    row_ranges = [(0, 1), (1, 2), (2, 3), (3, 4), (4, 6), (6, 8), (8, 12)]
+    data_ranges = [(0, 2), (2, 5), (5, 7), (7, 9), (9, 10), (10, 12)]
+    position_ranges, table_ranges = report_modules.bin_data_ranges(
+        data_ranges, row_ranges)
+    assert position_ranges == [(0, 2), (2, 6), (6, 8), (8, 12)]
+    assert table_ranges == [(0, 2), (2, 5), (5, 6), (6, 7)]
+
+
+def example_modules():
+    return [
+        report_modules.Meta("0.0.0", "2024-01-01 00:00:00+0000", "x.fastq",
+                            100, None, None),
+        report_modules.Summary(mean_length=10.0, minimum_length=10,
+                               maximum_length=10, total_reads=10,
+                               q20_reads=10, total_bases=100, q20_bases=100,
+                               total_gc_bases=50, total_n_bases=0),
+    ]
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_render_modules(threads):
+    modules = example_modules()
+    assert report_modules.render_modules(modules, threads) == [
+        module.to_html() for module in modules]
+
+
+def test_render_modules_cache(tmp_path):
+    modules = example_modules()
+    rendered = report_modules.render_modules(modules, cache_dir=str(tmp_path))
+    cache_files = sorted(tmp_path.iterdir())
+    assert len(cache_files) == 2
+    assert sorted(path.read_text() for path in cache_files) == sorted(rendered)
+    summary_cache = tmp_path / (
+        report_modules.module_cache_key(modules[1]) + ".html")
+    summary_cache.write_text("<p>cached</p>")
+    assert report_modules.render_modules(
+        modules, cache_dir=str(tmp_path))[1] == "<p>cached</p>"
+    # Different data is rendered again.
+    modules[1].total_reads = 11
+    assert "11" in report_modules.render_modules(
+        modules, cache_dir=str(tmp_path))[1]
+    assert len(list(tmp_path.iterdir())) == 3
+
+
+def test_externalize_large_figures(tmp_path):
+    small = '<svg xmlns="http://www.w3.org/2000/svg" id="small"></svg>'
+    large = ('<svg xmlns="http://www.w3.org/2000/svg" id="large">' +
+             "<g/>" * report_modules.LAZY_FIGURE_MIN_SIZE + "</svg>")
+    content = "".join(
+        f"<figure>{svg}<figcaption><script></script></figcaption></figure>"
+        for svg in (small, large))
+    result = report_modules.externalize_large_figures(
+        content, str(tmp_path / "plots"), "plots")
+    assert small in result
+    assert large not in result
+    assert '<img src="plots/large.svg" loading="lazy"' in result
+    assert (tmp_path / "plots" / "large.svg").read_text() == large
+    assert not (tmp_path / "plots" / "small.svg").exists()
@@ -15,11 +15,12 @@
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 import itertools
 import math
+import random
 import warnings
 
 import pytest
 
-from sequali import FastqRecordView, SequenceDuplication
+from sequali import FastqRecordArrayView, FastqRecordView, SequenceDuplication
 
 
 def view_from_sequence(sequence: str) -> FastqRecordView:
@@ -156,6 +157,47 @@ def test_sequence_duplication_all_fragments(sequence, result):
     assert seq_counts == result
 
 
+def expected_fragments(sequence, fragment_length):
+    total_fragments = -(-len(sequence) // fragment_length)
+    mid_point = len(sequence) - (total_fragments // 2) * fragment_length
+    starts = [*range(0, mid_point, fragment_length),
+              *range(mid_point, len(sequence), fragment_length)]
+    complement = str.maketrans("ACGT", "TGCA")
+    fragments = set()
+    for start in starts:
+        fragment = sequence[start:start + fragment_length].upper()
+        if "N" in fragment:
+            continue
+        revcomp = fragment.translate(complement)[::-1]
+        fragments.add(min(fragment, revcomp))
+    return {fragment: 1 for fragment in fragments}
+
+
+@pytest.mark.parametrize("fragment_length", range(3, 32, 2))
+@pytest.mark.parametrize("n_position", [None, 0, -1])
+def test_sequence_duplication_fragment_kernels(fragment_length, n_position):
+    rng = random.Random(fragment_length)
+    for length in (fragment_length, fragment_length + 1, 100, 151):
+        sequence = "".join(rng.choices("ACGTacgt", k=length))
+        if n_position is not None:
+            # Sequences with an N are not handled by the fragment kernels.
+            position = n_position % length
+            sequence = sequence[:position] + "N" + sequence[position + 1:]
+        seqdup = SequenceDuplication(fragment_length=fragment_length,
+                                     sample_every=1)
+        seqdup.add_read(view_from_sequence(sequence))
+        assert seqdup.sequence_counts() == expected_fragments(
+            sequence, fragment_length)
+
+
+@pytest.mark.parametrize(["fragment_length", "kernel"], [
+    (15, "15"), (21, "21"), (31, "31"), (3, "generic"), (17, "generic")])
+def test_sequence_duplication_fragment_kernel_selection(fragment_length,
+                                                        kernel):
+    seqdup = SequenceDuplication(fragment_length=fragment_length)
+    assert seqdup.profile()["fragment_kernel"].split("_")[0] == kernel
+
+
 def test_very_short_sequence():
     # With 32 byte load this will overflow the used memory.
     seqdup = SequenceDuplication(fragment_length=3, sample_every=1)
@@ -176,3 +218,90 @@ def test_valid_does_not_warn_for_n():
         seqdup.add_read(view_from_sequence("ACGTN"))
     # N does lead to a sample not being loaded.
     assert seqdup.sampled_sequences == 1
+
+
+@pytest.mark.parametrize("max_unique_fragments", [1, 7, 100, 5000])
+def test_sequence_duplication_record_array_same_as_reads(max_unique_fragments):
+    # Small tables force full buckets and probing into the next bucket. More
+    # than 4096 fragments in one record array span multiple batches.
+    rng = random.Random(max_unique_fragments)
+    sequences = ["".join(rng.choices("ACGT", k=31)) for _ in range(3000)]
+    sequences.extend(rng.choices(sequences, k=3000))
+    views = [view_from_sequence(sequence) for sequence in sequences]
+    per_read = SequenceDuplication(max_unique_fragments=max_unique_fragments,
+                                   fragment_length=11, sample_every=1)
+    for view in views:
+        per_read.add_read(view)
+    per_array = SequenceDuplication(max_unique_fragments=max_unique_fragments,
+                                    fragment_length=11, sample_every=1)
+    per_array.add_record_array(FastqRecordArrayView(views))
+    counts = per_array.sequence_counts()
+    assert counts == per_read.sequence_counts()
+    assert len(counts) == max_unique_fragments
+    assert per_array.collected_unique_fragments == len(counts)
+
+
+def test_sequence_duplication_merge():
+    sequences = ["ACGTACGTACGTACGTACGTACGTACGTACGTA",
+                 "GGGGCCCCAAAATTTTGGGGCCCCAAAATTTTG",
+                 "ACGTACGTACGTACGTACGTACGTACGTACGTA"]
+    expected = SequenceDuplication(sample_every=1)
+    for sequence in sequences:
+        expected.add_read(view_from_sequence(sequence))
+    seqdup1 = SequenceDuplication(sample_every=1)
+    seqdup1.add_read(view_from_sequence(sequences[0]))
+    seqdup2 = SequenceDuplication(sample_every=1)
+    seqdup2.add_read(view_from_sequence(sequences[1]))
+    seqdup2.add_read(view_from_sequence(sequences[2]))
+    seqdup1.merge(seqdup2)
+    assert seqdup1.number_of_sequences == expected.number_of_sequences
+    assert seqdup1.sampled_sequences == expected.sampled_sequences
+    assert seqdup1.total_fragments == expected.total_fragments
+    assert seqdup1.sequence_counts() == expected.sequence_counts()
+
+
+def test_sequence_duplication_read_index():
+    # Arrays divided over multiple objects sample the same reads as a single
+    # object when read_index is set to the position of their first read.
+    rng = random.Random(21)
+    reads = [view_from_sequence("".join(rng.choices("ACGT", k=50)))
+             for _ in range(100)]
+    arrays = [FastqRecordArrayView(reads[i:i + 7]) for i in range(0, 100, 7)]
+    expected = SequenceDuplication(sample_every=8)
+    for array in arrays:
+        expected.add_record_array(array)
+    assert expected.read_index == 100
+    divided = [SequenceDuplication(sample_every=8) for _ in range(3)]
+    for i, array in reversed(list(enumerate(arrays))):
+        seqdup = divided[(i * 5) % 3]
+        seqdup.read_index = i * 7
+        seqdup.add_record_array(array)
+    result = divided[0]
+    result.merge(divided[1])
+    result.merge(divided[2])
+    assert result.number_of_sequences == expected.number_of_sequences
+    assert result.sampled_sequences == expected.sampled_sequences == 13
+    assert result.sequence_counts() == expected.sequence_counts()
+
+
+def test_sequence_duplication_merge_different_fragment_length():
+    seqdup = SequenceDuplication(fragment_length=21)
+    with pytest.raises(ValueError):
+        seqdup.merge(SequenceDuplication(fragment_length=31))
+
+
+def test_sequence_duplication_dump_load():
+    seqdup = SequenceDuplication(max_unique_fragments=1000,
+                                 fragment_length=11, sample_every=1)
+    for sequence in ("ACGTACGTACGTACGTACGTACGTACGTACGTA",
+                     "GGGGCCCCAAAATTTTGGGGCCCCAAAATTTTG",
+                     "ACGTACGTACGTACGTACGTACGTACGTACGTA"):
+        seqdup.add_read(view_from_sequence(sequence))
+    loaded = SequenceDuplication.load(seqdup.dump())
+    assert loaded.max_unique_fragments == seqdup.max_unique_fragments
+    assert loaded.fragment_length == seqdup.fragment_length
+    assert loaded.sample_every == seqdup.sample_every
+    assert loaded.number_of_sequences == seqdup.number_of_sequences
+    assert loaded.sampled_sequences == seqdup.sampled_sequences
+    assert loaded.total_fragments == seqdup.total_fragments
+    assert loaded.sequence_counts() == seqdup.sequence_counts()
@@ -14,10 +14,19 @@
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
+import os
+import random
+
 import pytest
 
+from sequali._seqident import (KmerIndex, best_sequence_identity,
+                               create_kmer_index)
 from sequali.sequence_identification import (
+    cached_kmer_index,
     canonical_kmers,
+    identify_sequence_builtin,
+    identify_sequences_builtin,
+    kmer_index_file_name,
     reverse_complement,
     sequence_identity
 )
@@ -38,6 +47,119 @@ def test_canonical_kmers():
            canonical_kmers(reverse_complement("GATTACA"), 3)
 
 
+@pytest.mark.parametrize("k", [3, 9, 13, 31])
+def test_kmer_index_count_matches(k):
+    rng = random.Random(k)
+    sequences = ["".join(rng.choices("ACGT", k=rng.randrange(200)))
+                 for _ in range(50)]
+    # Lowercase and other characters are handled the same as in
+    # canonical_kmers, k-mers with other characters than ACGT are skipped.
+    sequences.append("gattacaGATTACANNNTTACGGGGGCCCATTTAGAGACCCATATTTAGG")
+    index = KmerIndex(create_kmer_index(sequences, k))
+    assert index.k == k
+    kmer_sets = [canonical_kmers(sequence, k) for sequence in sequences]
+    assert index.number_of_entries == sum(
+        len([kmer for kmer in kmers if "N" not in kmer])
+        for kmers in kmer_sets)
+    for query in sequences[:10] + [reverse_complement(sequences[-1])]:
+        query_kmers = {kmer for kmer in canonical_kmers(query, k)
+                       if "N" not in kmer}
+        expected = {}
+        for sequence_id, kmers in enumerate(kmer_sets):
+            count = len(query_kmers & kmers)
+            if count:
+                expected[sequence_id] = count
+        assert index.count_matches(query) == expected
+
+
+@pytest.mark.parametrize("k", [0, 2, 33])
+def test_create_kmer_index_invalid_k(k):
+    with pytest.raises(ValueError) as error:
+        create_kmer_index(["GATTACA"], k)
+    error.match("k must be an uneven number")
+
+
+@pytest.mark.parametrize("data", [
+    b"",
+    b"SQKI",
+    b"XXXX" + bytes(20),
+    create_kmer_index(["GATTACA"], 3)[:-1],
+])
+def test_kmer_index_invalid_data(data):
+    with pytest.raises(ValueError) as error:
+        KmerIndex(data)
+    error.match("Invalid k-mer index")
+
+
+def test_cached_kmer_index(tmp_path):
+    fasta = tmp_path / "contaminants.fasta"
+    fasta.write_text(">first\nGATTACAGATTACA\n>second\nTTTAGAGACCCATA\n")
+    sequences = ["GATTACAGATTACA", "TTTAGAGACCCATA"]
+    cache_dir = tmp_path / "cache"
+    index = cached_kmer_index([str(fasta)], sequences, 5, [str(cache_dir)])
+    cache_file = cache_dir / kmer_index_file_name([str(fasta)], 5)
+    assert cache_file.exists()
+    assert cache_file.read_bytes() == create_kmer_index(sequences, 5)
+    assert index.count_matches("GATTACA") == {0: 3}
+    # An invalid cache file is replaced.
+    cache_file.write_bytes(b"invalid")
+    index = cached_kmer_index([str(fasta)], sequences, 5, [str(cache_dir)])
+    assert index.count_matches("TTTAGAGA") == {1: 4}
+    assert cache_file.read_bytes() == create_kmer_index(sequences, 5)
+    # A changed file gets a new cache file.
+    fasta.write_text(">first\nGATTACAGATTACA\n")
+    assert kmer_index_file_name([str(fasta)], 5) != cache_file.name
+    assert len(os.listdir(cache_dir)) == 1
+
+
+def test_cached_kmer_index_unwritable_cache(tmp_path):
+    fasta = tmp_path / "contaminants.fasta"
+    fasta.write_text(">first\nGATTACAGATTACA\n")
+    not_a_dir = tmp_path / "file"
+    not_a_dir.write_bytes(b"")
+    index = cached_kmer_index([str(fasta)], ["GATTACAGATTACA"], 5,
+                              [str(not_a_dir / "cache")])
+    assert index.count_matches("GATTACA") == {0: 3}
+
+
+def test_identify_sequence_builtin():
+    # The Illumina universal adapter.
+    sequence = "AGATCGGAAGAGCACACGTCTGAACTCCAGT"
+    matches, max_matches, best_match = identify_sequence_builtin(sequence)
+    assert matches == max_matches == len(sequence)
+    assert best_match != "No match"
+
+
+def test_best_sequence_identity():
+    query = "GATTACAGATTACA"
+    targets = [
+        "CCCCCCCCCCCCCCCCCCCC",
+        "GATTACAGTTACA",
+        reverse_complement("AAAGATTACAGATTACAAAA"),
+        "GATTACAGATTACA",
+    ]
+    # The first target with the highest identity is returned. Both strands
+    # are aligned.
+    assert best_sequence_identity(targets, query) == (2, 1.0)
+    assert best_sequence_identity(targets, query,
+                                  match_reverse_complement=False) == (3, 1.0)
+    assert best_sequence_identity(targets[:2], query) == (
+        1, sequence_identity(targets[1], query))
+    assert best_sequence_identity(targets[:1], "ATAT") == (-1, 0.0)
+    assert best_sequence_identity([], query) == (-1, 0.0)
+
+
+def test_identify_sequences_builtin_threads():
+    sequences = [
+        "AGATCGGAAGAGCACACGTCTGAACTCCAGT",
+        "GATTACAGATTACAGATTACA",
+        "AGATCGGAAGAGCGTCGTGTAGGGAAAGAGT",
+    ]
+    expected = [identify_sequence_builtin(sequence) for sequence in sequences]
+    assert identify_sequences_builtin(sequences, threads=1) == expected
+    assert identify_sequences_builtin(sequences, threads=3) == expected
+
+
 @pytest.mark.parametrize(["target", "query", "result"], [
     ("XXXACGTXXX", "ACGT", 1.0),
     ("ACGT", "ACGT", 1.0),
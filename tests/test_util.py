@@ -14,12 +14,21 @@
 # You should have received a copy of the GNU Affero General Public License
 # along with Sequali.  If not, see <https://www.gnu.org/licenses/
 
+import gzip
+import io
+import os
+import struct
+import zlib
 from pathlib import Path
 
 import pytest
 
-from sequali.util import (fasta_parser,
-                          fastq_header_is_illumina, fastq_header_is_nanopore,
+from sequali import BamParser, FastqParser
+from sequali.util import (BGZFReader, NGSFile, PairedReader, ReadAheadReader,
+                          StrideSampler, bam_complete_records,
+                          bam_header_size, fasta_parser,
+                          fastq_complete_records, fastq_header_is_illumina,
+                          fastq_header_is_nanopore,
                           guess_sequencing_technology_from_bam_header,
                           sequence_names_match)
 
@@ -70,3 +79,254 @@ def test_fasta_parser():
 @pytest.mark.parametrize(["name1", "name2", "expected"], NAME_MATCH_TESTS)
 def test_sequence_names_match(name1, name2, expected):
     assert sequence_names_match(name1, name2) is expected
+
+
+@pytest.mark.parametrize("buffer_size", [1, 7, 64, 128 * 1024])
+@pytest.mark.parametrize("number_of_buffers", [1, 2, 3])
+def test_read_ahead_reader(buffer_size, number_of_buffers):
+    data = bytes(range(256)) * 40
+    with ReadAheadReader(io.BytesIO(data), buffer_size,
+                         number_of_buffers) as reader:
+        assert reader.read(3) == data[:3]
+        buffer = bytearray(1000)
+        assert reader.readinto(buffer) == 1000
+        assert buffer == data[3:1003]
+        assert reader.read() == data[1003:]
+        assert reader.read(10) == b""
+        assert reader.readinto(buffer) == 0
+
+
+def test_read_ahead_reader_error():
+    class BrokenFile(io.BytesIO):
+        def readinto(self, b):
+            raise OSError("broken")
+
+    with ReadAheadReader(BrokenFile(b"data")) as reader:  # type: ignore
+        with pytest.raises(OSError) as error:
+            reader.read(4)
+        error.match("broken")
+
+
+def test_read_ahead_reader_close_early():
+    reader = ReadAheadReader(io.BytesIO(b"A" * 100_000), 1000)
+    assert reader.read(10) == b"A" * 10
+    reader.close()
+    with pytest.raises(ValueError):
+        reader.read(10)
+
+
+@pytest.mark.parametrize("filename", [
+    "100_illumina_adapters.fastq",
+    "100_nanopore_reads.fastq.gz",
+    "dorado_nanopore_100reads.bam",
+])
+def test_ngs_file_read_ahead(filename):
+    path = str(DATA / filename)
+    with NGSFile(path) as normal:
+        expected = [(r.name(), r.sequence(), r.qualities())
+                    for array in normal for r in array]
+        technology = normal.sequencing_technology
+    with NGSFile(path, read_ahead=True) as read_ahead:
+        assert isinstance(read_ahead.reader, (BamParser, FastqParser))
+        assert read_ahead.sequencing_technology == technology
+        result = [(r.name(), r.sequence(), r.qualities())
+                  for array in read_ahead for r in array]
+    assert result == expected
+
+
+def test_ngs_file_mmap():
+    path = str(DATA / "100_illumina_adapters.fastq")
+    with NGSFile(path, use_mmap=False) as normal:
+        assert normal.mapped is None
+        expected = [(r.name(), r.sequence(), r.qualities())
+                    for array in normal for r in array]
+        technology = normal.sequencing_technology
+    with NGSFile(path) as mapped:
+        assert mapped.mapped is not None
+        assert mapped.sequencing_technology == technology
+        arrays = list(mapped)
+        result = [(r.name(), r.sequence(), r.qualities())
+                  for array in arrays for r in array]
+        assert mapped.progress.current_processed_bytes == os.stat(path).st_size
+    assert result == expected
+    # Record arrays that outlive the file remain valid.
+    assert arrays[0][0].sequence() == expected[0][1]
+
+
+def test_ngs_file_no_mmap_for_compressed_input():
+    with NGSFile(str(DATA / "100_nanopore_reads.fastq.gz")) as ngs_file:
+        assert ngs_file.mapped is None
+
+
+@pytest.mark.parametrize("threaded", [False, True])
+def test_paired_reader(threaded):
+    path1 = str(DATA / "LTB-A-BC001_S1_L003_R1_001.fastq.gz")
+    path2 = str(DATA / "LTB-A-BC001_S1_L003_R2_001.fastq.gz")
+    with NGSFile(path1) as reader1, NGSFile(path2) as reader2:
+        with PairedReader(reader1, reader2, threaded=threaded) as paired:
+            pairs = list(paired)
+    assert len(pairs) > 1
+    with NGSFile(path2) as reader2:
+        expected = [r.name() for array in reader2 for r in array]
+    assert [r.name() for _, array in pairs for r in array] == expected
+    for record_array1, record_array2 in pairs:
+        assert len(record_array1) == len(record_array2)
+        assert record_array1.is_mate(record_array2)
+
+
+@pytest.mark.parametrize("threaded", [False, True])
+@pytest.mark.parametrize(["file1", "file2", "message"], [
+    ("LTB-A-BC001_S1_L003_R1_001_shortened.fastq.gz",
+     "LTB-A-BC001_S1_L003_R2_001.fastq.gz",
+     "R2_001.fastq.gz has more FASTQ records"),
+    ("LTB-A-BC001_S1_L003_R1_001.fastq.gz",
+     "LTB-A-BC001_S1_L003_R2_001_shortened.fastq.gz",
+     "R1_001.fastq.gz has more FASTQ records"),
+    ("LTB-A-BC001_S1_L003_R1_001_names_changed.fastq.gz",
+     "LTB-A-BC001_S1_L003_R2_001.fastq.gz",
+     "Mismatching names"),
+])
+def test_paired_reader_error(threaded, file1, file2, message):
+    with NGSFile(str(DATA / file1)) as reader1, \
+            NGSFile(str(DATA / file2)) as reader2:
+        with PairedReader(reader1, reader2, threaded=threaded) as paired:
+            with pytest.raises(RuntimeError) as error:
+                for _ in paired:
+                    pass
+    error.match(message)
+
+
+def bgzf_compress(data: bytes, block_size: int = 65280) -> bytes:
+    blocks = []
+    for start in range(0, len(data) + 1, block_size):
+        chunk = data[start:start + block_size]
+        compressor = zlib.compressobj(wbits=-15)
+        deflated = compressor.compress(chunk) + compressor.flush()
+        total_size = 18 + len(deflated) + 8
+        blocks.append(
+            b"\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00BC\x02\x00" +
+            struct.pack("<H", total_size - 1) + deflated +
+            struct.pack("<II", zlib.crc32(chunk), len(chunk)))
+    return b"".join(blocks)
+
+
+@pytest.mark.parametrize("threads", [1, 2, 4])
+@pytest.mark.parametrize("block_size", [1, 1000, 65280])
+def test_bgzf_reader(threads, block_size):
+    data = bytes(range(256)) * 1000
+    compressed = bgzf_compress(data, block_size)
+    assert zlib.decompress(compressed, wbits=31) == data[:block_size]
+    with io.BufferedReader(BGZFReader(io.BytesIO(compressed),
+                                      threads)) as reader:
+        assert reader.read() == data
+
+
+@pytest.mark.parametrize("modify", [
+    lambda data: data[:-5],
+    lambda data: data[:-30] + b"\x00" + data[-29:],
+    lambda data: b"\x1f\x8b\x08\x00" + data[4:],
+])
+def test_bgzf_reader_corrupt(modify):
+    compressed = modify(bgzf_compress(b"GATTACA" * 100))
+    with BGZFReader(io.BytesIO(compressed)) as reader:
+        with pytest.raises((EOFError, ValueError, zlib.error)):
+            reader.read()
+
+
+def test_ngs_file_bgzf():
+    path = str(DATA / "dorado_nanopore_100reads.bam")
+    with NGSFile(path) as single:
+        expected = [(r.name(), r.sequence(), r.qualities())
+                    for array in single for r in array]
+    with NGSFile(path, threads=2) as threaded:
+        assert isinstance(threaded.file.raw, BGZFReader)  # type: ignore
+        result = [(r.name(), r.sequence(), r.qualities())
+                  for array in threaded for r in array]
+    assert result == expected
+
+
+def record_names(arrays):
+    return [record.name() for array in arrays for record in array]
+
+
+@pytest.mark.parametrize("offset", [0, 1, 57, 1000, 5000])
+@pytest.mark.parametrize("size", [300, 2000, 11543])
+def test_fastq_complete_records(offset, size):
+    data = (DATA / "100_illumina_adapters.fastq").read_bytes()
+    all_names = record_names(FastqParser(io.BytesIO(data)))
+    block = data[offset:offset + size]
+    start, end = fastq_complete_records(block, 0 if offset == 0 else None)
+    assert start <= end
+    if start == end:
+        return
+    names = record_names(FastqParser(io.BytesIO(block[start:end])))
+    assert names
+    # A contiguous run of records.
+    first = all_names.index(names[0])
+    assert names == all_names[first:first + len(names)]
+    if offset + size >= len(data):
+        assert names[-1] == all_names[-1]
+
+
+def test_bam_complete_records():
+    data = gzip.decompress(
+        (DATA / "dorado_nanopore_100reads.bam").read_bytes())
+    header_size, number_of_references = bam_header_size(data)
+    assert header_size > 0
+    start, end = bam_complete_records(data, number_of_references,
+                                      header_size)
+    assert (start, end) == (header_size, len(data))
+    # Searching from an arbitrary offset finds the next record.
+    block = data[header_size + 1000:]
+    start, end = bam_complete_records(block, number_of_references)
+    assert 0 < start and end == len(block)
+    half = data[header_size:len(data) // 2]
+    start, end = bam_complete_records(half, number_of_references, 0)
+    assert start == 0 and 0 < end < len(half)
+    assert bam_header_size(data[:header_size - 1]) == (-1, 0)
+
+
+@pytest.mark.parametrize("chunk_size", [512, 4096, 1024 * 1024])
+def test_stride_sampler_fastq(chunk_size):
+    path = str(DATA / "100_illumina_adapters.fastq")
+    with NGSFile(path) as reader:
+        all_names = record_names(reader)
+    with StrideSampler(path, chunk_size=chunk_size) as sampler:
+        assert sampler.format == "FASTQ"
+        names = record_names(sampler)
+    assert names
+    assert set(names) <= set(all_names)
+    assert len(names) == len(set(names))
+    if chunk_size > os.path.getsize(path):
+        assert names == all_names
+
+
+def test_stride_sampler_bgzf_fastq(tmp_path):
+    data = (DATA / "100_illumina_adapters.fastq").read_bytes() * 20
+    path = tmp_path / "reads.fastq.gz"
+    path.write_bytes(bgzf_compress(data, 1000))
+    with NGSFile(str(path)) as reader:
+        all_names = set(record_names(reader))
+    with StrideSampler(str(path), chunk_size=4096) as sampler:
+        assert sampler.is_bgzf
+        names = record_names(sampler)
+        assert 0 < sampler.sampled_bytes < sampler.file_size
+    assert names
+    assert set(names) <= all_names
+
+
+def test_stride_sampler_bam():
+    path = str(DATA / "dorado_nanopore_100reads.bam")
+    with NGSFile(path) as reader:
+        all_names = record_names(reader)
+    with StrideSampler(path, chunk_size=256 * 1024) as sampler:
+        assert sampler.format == "BAM"
+        names = record_names(sampler)
+    assert names
+    assert set(names) <= set(all_names)
+
+
+def test_stride_sampler_gzip_unsupported():
+    with pytest.raises(ValueError) as error:
+        StrideSampler(str(DATA / "100_nanopore_reads.fastq.gz"))
+    error.match("can not be sampled")